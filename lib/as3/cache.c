@@ -0,0 +1,1191 @@
+/* cache.c
+
+   Persistent compilation cache for the ActionScript 3 compiler
+
+   Every source file is parsed twice: Pass 1 registers the declarations
+   (classes, methods, variables and their types) in the registry, pass 2
+   generates the code. With a cache directory set, the results of both passes
+   are stored per source file, and reused as long as the file and the files
+   it depends on stay the same.
+
+   A cache entry stores
+     - the (unresolved) declarations of the file, as registered in pass 1
+     - the classes and packages the file scheduled for compilation
+     - the flags and values pass 2 assigned to the declarations
+     - the generated code, as a small abc file
+     - the files the code looked up declarations from, with their content hash
+     - the names the file tried to look up, but which didn't exist
+
+   Since declarations are stored unresolved, pass 1 only depends on the
+   file itself. Cached declarations are registered right away, and once
+   pass 1 is done (and all files are known) the entries are checked against
+   their dependencies. Files with outdated entries are removed from the
+   registry again, and parsed.
+
+   Extension module for the rfxswf library.
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../os.h"
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "../q.h"
+#include "../bitio.h"
+#include "../rfxswf.h"
+#include "common.h"
+#include "abc.h"
+#include "registry.h"
+#include "initcode.h"
+#include "parser_help.h"
+#include "compiler.h"
+#include "cache.h"
+
+extern char*as3_globalclass;
+
+//#define DEBUG
+#define DEBUG if(0)
+
+static const char*cache_magic = "as3code\1";
+
+/* file states */
+#define FILE_FRESH 0     // parsed
+#define FILE_DECLARED 1  // pass 1 was restored from the cache
+#define FILE_REPLAYED 2  // pass 2 was restored from the cache
+
+/* why a file needs to be parsed */
+#define REASON_CHANGED 1 // no cache entry, or the file itself changed
+#define REASON_RESOLVE 2 // names the file uses resolve differently now
+#define REASON_DEPS 3    // a file it depends on changed
+
+/* references to other slots */
+#define REF_NONE 0
+#define REF_SLOT 1
+#define REF_VOID 2
+#define REF_NULL 3
+#define REF_PACKAGE 4
+#define REF_NSSET 5
+
+/* schedule calls */
+#define SCHEDULE_NOERROR 0
+#define SCHEDULE_CLASS 1
+#define SCHEDULE_PACKAGE 2
+
+typedef struct _slotarray {
+    slotinfo_t**slots;
+    int num;
+    int size;
+} slotarray_t;
+
+typedef struct _block {
+    unsigned char*data;
+    int len;
+} block_t;
+
+struct _cachefile {
+    char*name;
+    char*filename;
+    uint64_t hash;
+    char state;
+    char reason;
+    char valued; // pass 2 assigns constants which other files might use
+    char checked;
+
+    /* the cache entry */
+    unsigned char*entry;
+    int num_dependencies;
+    char**dependencies;
+    uint64_t*dependency_hashes;
+    block_t misses;
+    block_t schedule;
+    block_t declarations;
+    block_t code;
+
+    /* the top-level declarations of this file */
+    slotarray_t decls;
+    /* all declarations, including members, in the order they're stored */
+    slotarray_t infos;
+
+    /* what happened while this file was parsed */
+    char cacheable;
+    dict_t*dependency_dict;
+    dict_t*visited;
+    dict_t*miss_dict;
+    dict_t*schedule_dict;
+    dict_t*use_dict;
+    slotarray_t uses;
+    writer_t scheduled;
+    int num_scheduled;
+    writer_t declared;
+    int methods0, method_bodies0, scripts0, classes0;
+
+    struct _cachefile*next;
+};
+
+static char*cachedir = 0;
+static uint64_t options_hash = 0;
+
+static cachefile_t*files = 0;
+static cachefile_t**files_tail = &files;
+static dict_t*filenames = 0;
+static dict_t*owners = 0;
+
+/* stands in for code which can't be cached (as3_parse_bytearray) */
+static cachefile_t uncached;
+
+static cachefile_t*current = 0;
+static char resolving = 0;
+static char replaying = 0;
+
+// ------------------------------ helpers -------------------------------------
+
+static void slotarray_append(slotarray_t*a, slotinfo_t*s)
+{
+    if(a->num == a->size) {
+        a->size = a->size?a->size*2:16;
+        a->slots = (slotinfo_t**)realloc(a->slots, sizeof(slotinfo_t*)*a->size);
+    }
+    a->slots[a->num++] = s;
+}
+
+static void writer_writeU64(writer_t*w, uint64_t v)
+{
+    writer_writeU32(w, (U32)v);
+    writer_writeU32(w, (U32)(v>>32));
+}
+static uint64_t reader_readU64(reader_t*r)
+{
+    uint64_t lo = reader_readU32(r);
+    uint64_t hi = reader_readU32(r);
+    return hi<<32|lo;
+}
+static void writer_writeBlock(writer_t*w, writer_t*from)
+{
+    int len = 0;
+    void*data = writer_growmemwrite_memptr(from, &len);
+    writer_writeU32(w, len);
+    if(len)
+        w->write(w, data, len);
+}
+static block_t reader_readBlock(reader_t*r, unsigned char*base)
+{
+    block_t b;
+    b.len = reader_readU32(r);
+    b.data = base + r->pos;
+    r->seek(r, r->pos + b.len);
+    return b;
+}
+
+/* registry lookups of the cache itself are not dependencies */
+static slotinfo_t* find(const char*package, const char*name)
+{
+    char old = replaying;
+    replaying = 1;
+    slotinfo_t*s = registry_find(package, name);
+    replaying = old;
+    return s;
+}
+
+static char is_method(U8 kind, U8 subtype)
+{
+    /* getters and setters are methods with kind VAR */
+    return kind == INFOTYPE_METHOD || (kind == INFOTYPE_VAR && subtype);
+}
+
+static cachefile_t* owner(slotinfo_t*s)
+{
+    if(!s || s->kind == INFOTYPE_UNRESOLVED)
+        return 0;
+    if(s->kind != INFOTYPE_CLASS && ((memberinfo_t*)s)->parent)
+        s = (slotinfo_t*)((memberinfo_t*)s)->parent;
+    return (cachefile_t*)dict_lookup(owners, s);
+}
+
+static void add_declaration(cachefile_t*f, slotinfo_t*s)
+{
+    dict_put(owners, s, f);
+    slotarray_append(&f->decls, s);
+}
+
+static void undeclare(cachefile_t*f)
+{
+    int t;
+    for(t=0;t<f->decls.num;t++) {
+        registry_unregister(f->decls.slots[t]);
+        dict_del(owners, f->decls.slots[t]);
+    }
+    f->decls.num = 0;
+    f->infos.num = 0;
+}
+
+// ------------------------------ dependencies --------------------------------
+
+static void depend_on(cachefile_t*f, slotinfo_t*s)
+{
+    if(!s || s->kind == INFOTYPE_UNRESOLVED || dict_contains(f->visited, s))
+        return;
+    dict_put(f->visited, s, 0);
+
+    cachefile_t*o = owner(s);
+    if(o == &uncached) {
+        f->cacheable = 0;
+    } else if(o && o != f && !dict_contains(f->dependency_dict, o)) {
+        dict_put(f->dependency_dict, o, 0);
+    }
+
+    /* the type hierarchy of a class, and the types of a member are
+       used for generating code, too */
+    if(s->kind == INFOTYPE_CLASS) {
+        classinfo_t*c = (classinfo_t*)s;
+        depend_on(f, (slotinfo_t*)c->superclass);
+        int t;
+        for(t=0;c->interfaces[t];t++) {
+            depend_on(f, (slotinfo_t*)c->interfaces[t]);
+        }
+    } else if(is_method(s->kind, s->subtype)) {
+        methodinfo_t*m = (methodinfo_t*)s;
+        depend_on(f, (slotinfo_t*)m->return_type);
+        classinfo_list_t*l;
+        for(l=m->params;l;l=l->next) {
+            depend_on(f, (slotinfo_t*)l->classinfo);
+        }
+    } else {
+        depend_on(f, (slotinfo_t*)((varinfo_t*)s)->type);
+    }
+}
+
+static void observe(int event, const char*package, const char*name, slotinfo_t*s)
+{
+    if(replaying)
+        return;
+    if(event == REGISTRY_DEFINE) {
+        if(!current) {
+            return;
+        } else if(as3_pass == 1) {
+            add_declaration(current, s);
+        } else {
+            /* namespaces are registered again in pass 2 */
+            dict_put(owners, s, current);
+        }
+    } else if(event == REGISTRY_RESOLVE) {
+        /* the declarations of all files are resolved at once, between
+           the passes */
+        cachefile_t*o = owner(s);
+        current = (o && o != &uncached && o->state == FILE_FRESH)?o:0;
+        resolving = s!=0;
+    } else if(event == REGISTRY_LOOKUP) {
+        if(!current || current == &uncached || (as3_pass!=2 && !resolving))
+            return;
+        if(s) {
+            depend_on(current, s);
+        } else {
+            slotinfo_t tmp;
+            tmp.package = package?package:"";
+            tmp.name = name?name:"";
+            if(!dict_contains(current->miss_dict, &tmp)) {
+                NEW(slotinfo_t,miss);
+                miss->package = strdup(tmp.package);
+                miss->name = strdup(tmp.name);
+                dict_put(current->miss_dict, miss, 0);
+            }
+        }
+    } else if(event == REGISTRY_USE) {
+        if(!current || current == &uncached || as3_pass!=2)
+            return;
+        if(!dict_contains(current->use_dict, s)) {
+            dict_put(current->use_dict, s, 0);
+            slotarray_append(&current->uses, s);
+        }
+    }
+}
+
+// ------------------------------ options -------------------------------------
+
+void as3cache_setdir(const char*dir)
+{
+    if(cachedir)
+        free(cachedir);
+    cachedir = strdup(dir);
+    if(!filenames) {
+        filenames = dict_new();
+        owners = dict_new2(&ptr_type);
+    }
+    registry_set_observer(observe);
+}
+
+char as3cache_enabled()
+{
+    return cachedir!=0;
+}
+
+void as3cache_addoption(const char*option, const void*data, int len)
+{
+    options_hash = memory_hash64(option, strlen(option)+1, options_hash);
+    options_hash = memory_hash64(data, len, options_hash);
+}
+
+// ------------------------------ serialization -------------------------------
+
+static void write_constant(writer_t*w, constant_t*c)
+{
+    writer_writeU8(w, c->type);
+    if(NS_TYPE(c->type)) {
+        writer_writeU8(w, c->ns->access);
+        writer_writeString(w, c->ns->name?c->ns->name:"");
+    } else if(c->type == CONSTANT_STRING) {
+        writer_writeU32(w, c->s->len);
+        w->write(w, (void*)c->s->str, c->s->len);
+    } else if(c->type == CONSTANT_INT) {
+        writer_writeU32(w, c->i);
+    } else if(c->type == CONSTANT_UINT) {
+        writer_writeU32(w, c->u);
+    } else if(c->type == CONSTANT_FLOAT) {
+        writer_writeDouble(w, c->f);
+    }
+}
+static constant_t* read_constant(reader_t*r)
+{
+    U8 type = reader_readU8(r);
+    if(NS_TYPE(type)) {
+        namespace_t ns;
+        ns.access = reader_readU8(r);
+        ns.name = reader_readString(r);
+        constant_t*c = constant_new_namespace(&ns);
+        free((char*)ns.name);
+        c->type = type;
+        return c;
+    } else if(type == CONSTANT_STRING) {
+        int len = reader_readU32(r);
+        char*s = (char*)malloc(len+1);
+        r->read(r, s, len);
+        constant_t*c = constant_new_string2(s, len);
+        free(s);
+        return c;
+    } else if(type == CONSTANT_INT) {
+        return constant_new_int(reader_readU32(r));
+    } else if(type == CONSTANT_UINT) {
+        return constant_new_uint(reader_readU32(r));
+    } else if(type == CONSTANT_FLOAT) {
+        return constant_new_float(reader_readDouble(r));
+    }
+    NEW(constant_t,c);
+    c->type = type;
+    return c;
+}
+
+/* references to other slots are stored by name. Returns 0 if the slot
+   can't be found by its name */
+static char write_ref(writer_t*w, slotinfo_t*s)
+{
+    if(!s) {
+        writer_writeU8(w, REF_NONE);
+    } else if(s == (slotinfo_t*)registry_getvoidclass()) {
+        writer_writeU8(w, REF_VOID);
+    } else if(s == (slotinfo_t*)registry_getnullclass()) {
+        writer_writeU8(w, REF_NULL);
+    } else if(s->kind == INFOTYPE_UNRESOLVED) {
+        unresolvedinfo_t*u = (unresolvedinfo_t*)s;
+        if(u->package) {
+            writer_writeU8(w, REF_PACKAGE);
+            writer_writeString(w, u->package);
+            writer_writeString(w, u->name);
+        } else {
+            writer_writeU8(w, REF_NSSET);
+            writer_writeString(w, u->name);
+            writer_writeU32(w, list_length(u->nsset));
+            namespace_list_t*l;
+            for(l=u->nsset;l;l=l->next) {
+                writer_writeU8(w, l->namespace->access);
+                writer_writeString(w, l->namespace->name?l->namespace->name:"");
+            }
+        }
+    } else {
+        if(find(s->package, s->name) != s)
+            return 0;
+        writer_writeU8(w, REF_SLOT);
+        writer_writeString(w, s->package);
+        writer_writeString(w, s->name);
+    }
+    return 1;
+}
+static char read_ref(reader_t*r, slotinfo_t**s)
+{
+    U8 type = reader_readU8(r);
+    *s = 0;
+    if(type == REF_VOID) {
+        *s = (slotinfo_t*)registry_getvoidclass();
+    } else if(type == REF_NULL) {
+        *s = (slotinfo_t*)registry_getnullclass();
+    } else if(type == REF_PACKAGE || type == REF_NSSET) {
+        NEW(unresolvedinfo_t,u);
+        u->kind = INFOTYPE_UNRESOLVED;
+        if(type == REF_PACKAGE) {
+            u->package = reader_readString(r);
+            u->name = reader_readString(r);
+        } else {
+            u->name = reader_readString(r);
+            int num = reader_readU32(r);
+            int t;
+            for(t=0;t<num;t++) {
+                U8 access = reader_readU8(r);
+                char*name = reader_readString(r);
+                list_append(u->nsset, namespace_new(access, name));
+                free(name);
+            }
+        }
+        *s = (slotinfo_t*)u;
+    } else if(type == REF_SLOT) {
+        char*package = reader_readString(r);
+        char*name = reader_readString(r);
+        *s = find(package, name);
+        free(package);
+        free(name);
+        return *s!=0;
+    }
+    return 1;
+}
+
+static char write_slot(cachefile_t*f, writer_t*w, slotinfo_t*s)
+{
+    char ok = 1;
+    slotarray_append(&f->infos, s);
+    writer_writeU8(w, s->kind);
+    writer_writeU8(w, s->subtype);
+    writer_writeU8(w, s->flags&~FLAG_USED);
+    writer_writeU8(w, s->access);
+    writer_writeString(w, s->package?s->package:"");
+    writer_writeString(w, s->name);
+    if(s->kind == INFOTYPE_CLASS) {
+        classinfo_t*c = (classinfo_t*)s;
+        int num_interfaces = 0;
+        while(c->interfaces[num_interfaces])
+            num_interfaces++;
+        writer_writeU32(w, num_interfaces);
+        ok &= write_ref(w, (slotinfo_t*)c->superclass);
+        int t;
+        for(t=0;t<num_interfaces;t++) {
+            ok &= write_ref(w, (slotinfo_t*)c->interfaces[t]);
+        }
+        writer_writeU32(w, dict_count(&c->members) + dict_count(&c->static_members));
+        DICT_ITERATE_DATA(&c->members, slotinfo_t*, m) {
+            writer_writeU8(w, 0);
+            ok &= write_slot(f, w, m);
+        }
+        DICT_ITERATE_DATA(&c->static_members, slotinfo_t*, m2) {
+            writer_writeU8(w, 1);
+            ok &= write_slot(f, w, m2);
+        }
+    } else if(is_method(s->kind, s->subtype)) {
+        methodinfo_t*m = (methodinfo_t*)s;
+        ok &= write_ref(w, (slotinfo_t*)m->return_type);
+        writer_writeU32(w, list_length(m->params));
+        classinfo_list_t*l;
+        for(l=m->params;l;l=l->next) {
+            ok &= write_ref(w, (slotinfo_t*)l->classinfo);
+        }
+    } else {
+        varinfo_t*v = (varinfo_t*)s;
+        ok &= write_ref(w, (slotinfo_t*)v->type);
+        writer_writeU8(w, v->value!=0);
+        if(v->value)
+            write_constant(w, v->value);
+    }
+    return ok;
+}
+
+/* reads the types (and the initial value) of a method or variable */
+static char read_member(reader_t*r, slotinfo_t*s)
+{
+    char ok = 1;
+    if(is_method(s->kind, s->subtype)) {
+        methodinfo_t*m = (methodinfo_t*)s;
+        ok &= read_ref(r, (slotinfo_t**)&m->return_type);
+        int num = reader_readU32(r);
+        int t;
+        for(t=0;t<num;t++) {
+            slotinfo_t*p = 0;
+            ok &= read_ref(r, &p);
+            list_append(m->params, (classinfo_t*)p);
+        }
+    } else {
+        varinfo_t*v = (varinfo_t*)s;
+        ok &= read_ref(r, (slotinfo_t**)&v->type);
+        if(reader_readU8(r))
+            v->value = read_constant(r);
+    }
+    return ok;
+}
+
+/* registers one top-level declaration. Returns 0 if it conflicts with an
+   existing declaration, or references a type which doesn't exist anymore */
+static char read_slot(cachefile_t*f, reader_t*r)
+{
+    U8 kind = reader_readU8(r);
+    U8 subtype = reader_readU8(r);
+    U8 flags = reader_readU8(r);
+    U8 access = reader_readU8(r);
+    char*package = reader_readString(r);
+    char*name = reader_readString(r);
+    if(find(package, name)) {
+        /* defined twice- let the parser report this */
+        free(package);
+        free(name);
+        return 0;
+    }
+
+    char ok = 1;
+    slotinfo_t*s = 0;
+    if(kind == INFOTYPE_CLASS) {
+        int num_interfaces = reader_readU32(r);
+        classinfo_t*c = classinfo_register(access, package, name, num_interfaces);
+        s = (slotinfo_t*)c;
+        add_declaration(f, s);
+        slotarray_append(&f->infos, s);
+        ok &= read_ref(r, (slotinfo_t**)&c->superclass);
+        int t;
+        for(t=0;t<num_interfaces;t++) {
+            ok &= read_ref(r, (slotinfo_t**)&c->interfaces[t]);
+        }
+        int num_members = reader_readU32(r);
+        for(t=0;t<num_members;t++) {
+            char is_static = reader_readU8(r);
+            U8 mkind = reader_readU8(r);
+            U8 msubtype = reader_readU8(r);
+            U8 mflags = reader_readU8(r);
+            U8 maccess = reader_readU8(r);
+            char*ns = reader_readString(r);
+            char*mname = reader_readString(r);
+            slotinfo_t*m = 0;
+            if(is_method(mkind, msubtype)) {
+                m = (slotinfo_t*)methodinfo_register_onclass(c, maccess, ns, mname, is_static);
+            } else {
+                m = (slotinfo_t*)varinfo_register_onclass(c, maccess, ns, mname, is_static);
+            }
+            m->kind = mkind;
+            m->subtype = msubtype;
+            m->flags = mflags;
+            slotarray_append(&f->infos, m);
+            ok &= read_member(r, m);
+        }
+    } else {
+        if(kind == INFOTYPE_METHOD) {
+            s = (slotinfo_t*)methodinfo_register_global(access, package, name);
+        } else {
+            s = (slotinfo_t*)varinfo_register_global(access, package, name);
+        }
+        add_declaration(f, s);
+        slotarray_append(&f->infos, s);
+        s->subtype = subtype;
+        ok &= read_member(r, s);
+    }
+    s->flags = flags;
+    return ok;
+}
+
+// ------------------------------ cache entries -------------------------------
+
+static char* entry_key(cachefile_t*f, int*len)
+{
+    char*key = (char*)malloc(strlen(VERSION)+strlen(f->name)+strlen(f->filename)+32);
+    sprintf(key, "%s %08x%08x %s %s", VERSION,
+            (unsigned int)(options_hash>>32), (unsigned int)options_hash,
+            f->name, f->filename);
+    *len = strlen(key);
+    return key;
+}
+
+static char* entry_filename(const char*key, int keylen)
+{
+    uint64_t h = memory_hash64(key, keylen, 0);
+    char*filename = (char*)malloc(strlen(cachedir)+32);
+    sprintf(filename, "%s/%08x%08x.as3c", cachedir, (unsigned int)(h>>32), (unsigned int)h);
+    return filename;
+}
+
+static U32 get_u32(unsigned char*p)
+{
+    return p[0]|p[1]<<8|p[2]<<16|(U32)p[3]<<24;
+}
+
+static void read_entry(cachefile_t*f)
+{
+    int keylen = 0;
+    char*key = entry_key(f, &keylen);
+    char*filename = entry_filename(key, keylen);
+    int headersize = 8+4+keylen+4+4;
+    unsigned char*data = 0;
+    long size = 0;
+    FILE*fi = fopen(filename, "rb");
+    if(fi) {
+        fseek(fi, 0, SEEK_END);
+        size = ftell(fi);
+        fseek(fi, 0, SEEK_SET);
+        if(size >= headersize) {
+            data = (unsigned char*)malloc(size);
+            if(fread(data, size, 1, fi)!=1) {
+                free(data);data = 0;
+            }
+        }
+        fclose(fi);
+    }
+    char ok = data &&
+              !memcmp(data, cache_magic, 8) &&
+              get_u32(data+8) == keylen &&
+              !memcmp(data+12, key, keylen) &&
+              get_u32(data+12+keylen) == size - headersize &&
+              get_u32(data+16+keylen) == crc32_add_bytes(0, data+headersize, size-headersize);
+    free(filename);
+    free(key);
+    if(!ok) {
+        if(data) free(data);
+        return;
+    }
+
+    unsigned char*base = data+headersize;
+    reader_t r;
+    reader_init_memreader(&r, base, size-headersize);
+    if(reader_readU64(&r) != f->hash) {
+        /* the file changed */
+        r.dealloc(&r);
+        free(data);
+        return;
+    }
+    f->entry = data;
+    f->valued = reader_readU8(&r);
+    f->num_dependencies = reader_readU32(&r);
+    f->dependencies = (char**)rfx_calloc(sizeof(char*)*(f->num_dependencies+1));
+    f->dependency_hashes = (uint64_t*)rfx_calloc(sizeof(uint64_t)*(f->num_dependencies+1));
+    int t;
+    for(t=0;t<f->num_dependencies;t++) {
+        f->dependencies[t] = reader_readString(&r);
+        f->dependency_hashes[t] = reader_readU64(&r);
+    }
+    f->misses = reader_readBlock(&r, base);
+    f->schedule = reader_readBlock(&r, base);
+    f->declarations = reader_readBlock(&r, base);
+    f->code = reader_readBlock(&r, base);
+    r.dealloc(&r);
+}
+
+static void write_entry(cachefile_t*f, writer_t*code)
+{
+    writer_t w;
+    writer_init_growingmemwriter(&w, 4096);
+    writer_writeU64(&w, f->hash);
+    writer_writeU8(&w, f->valued);
+
+    writer_writeU32(&w, dict_count(f->dependency_dict));
+    DICT_ITERATE_KEY(f->dependency_dict, cachefile_t*, d) {
+        writer_writeString(&w, d->filename);
+        writer_writeU64(&w, d->hash);
+    }
+
+    /* names which exist by now were looked up before they were declared,
+       and don't need to be checked */
+    writer_t misses;
+    writer_init_growingmemwriter(&misses, 256);
+    int num_misses = 0;
+    DICT_ITERATE_KEY(f->miss_dict, slotinfo_t*, miss) {
+        if(!find(miss->package, miss->name))
+            num_misses++;
+    }
+    writer_writeU32(&misses, num_misses);
+    DICT_ITERATE_KEY(f->miss_dict, slotinfo_t*, miss2) {
+        if(!find(miss2->package, miss2->name)) {
+            writer_writeString(&misses, miss2->package);
+            writer_writeString(&misses, miss2->name);
+        }
+    }
+    writer_writeBlock(&w, &misses);
+    misses.finish(&misses);
+
+    writer_writeBlock(&w, &f->scheduled);
+    writer_writeBlock(&w, &f->declared);
+    writer_writeBlock(&w, code);
+
+    int len = 0;
+    unsigned char*data = (unsigned char*)writer_growmemwrite_memptr(&w, &len);
+
+    int keylen = 0;
+    char*key = entry_key(f, &keylen);
+    char*filename = entry_filename(key, keylen);
+    char*tmpname = (char*)malloc(strlen(filename)+32);
+    sprintf(tmpname, "%s.%d.tmp", filename, (int)getpid());
+    FILE*fi = fopen(tmpname, "wb");
+    if(!fi) {
+        static char warned = 0;
+        if(!warned) {
+            as3_warning("Couldn't write to cache directory %s", cachedir);
+            warned = 1;
+        }
+    } else {
+        writer_t header;
+        writer_init_growingmemwriter(&header, 64);
+        header.write(&header, (void*)cache_magic, 8);
+        writer_writeU32(&header, keylen);
+        header.write(&header, key, keylen);
+        writer_writeU32(&header, len);
+        writer_writeU32(&header, crc32_add_bytes(0, data, len));
+        int headerlen = 0;
+        void*headerdata = writer_growmemwrite_memptr(&header, &headerlen);
+        int ok = fwrite(headerdata, headerlen, 1, fi)==1;
+        ok &= fwrite(data, len, 1, fi)==1;
+        ok &= fclose(fi)==0;
+        header.finish(&header);
+        /* rename() is atomic, so a concurrent compiler run sees either
+           the old entry or the new one */
+        if(!ok || rename(tmpname, filename)<0) {
+            unlink(tmpname);
+        }
+    }
+    free(tmpname);
+    free(filename);
+    free(key);
+    w.finish(&w);
+}
+
+// ------------------------------ pass 1 --------------------------------------
+
+cachefile_t* as3cache_open(const char*name, const char*filename, const void*data, int len)
+{
+    if(!cachedir)
+        return 0;
+    NEW(cachefile_t,f);
+    f->name = strdup(name);
+    f->filename = strdup(filename);
+    f->hash = memory_hash64(data, len, 0);
+    f->state = FILE_FRESH;
+    f->reason = REASON_CHANGED;
+    f->valued = 1;
+    *files_tail = f;
+    files_tail = &f->next;
+    dict_put(filenames, f->filename, f);
+
+    read_entry(f);
+    return f;
+}
+
+char as3cache_declare(cachefile_t*f)
+{
+    if(!f || !f->entry)
+        return 0;
+    reader_t r;
+    int t;
+    char ok = 1;
+    replaying = 1;
+    reader_init_memreader(&r, f->declarations.data, f->declarations.len);
+    int num = reader_readU32(&r);
+    for(t=0;t<num && ok;t++) {
+        ok &= read_slot(f, &r);
+    }
+    r.dealloc(&r);
+    replaying = 0;
+    if(!ok) {
+        DEBUG printf("[cache] couldn't declare %s\n", f->filename);
+        undeclare(f);
+        f->reason = REASON_RESOLVE;
+        return 0;
+    }
+
+    reader_init_memreader(&r, f->schedule.data, f->schedule.len);
+    num = reader_readU32(&r);
+    for(t=0;t<num;t++) {
+        U8 type = reader_readU8(&r);
+        char*package = reader_readString(&r);
+        char*cls = reader_readString(&r);
+        if(type == SCHEDULE_NOERROR) {
+            as3_schedule_class_noerror(package, cls);
+        } else if(type == SCHEDULE_CLASS) {
+            as3_schedule_class(package, cls);
+        } else {
+            as3_schedule_package(package);
+        }
+        free(package);
+        free(cls);
+    }
+    r.dealloc(&r);
+
+    DEBUG printf("[cache] declared %s\n", f->filename);
+    f->state = FILE_DECLARED;
+    return 1;
+}
+
+void as3cache_schedule(char error, const char*package, const char*cls)
+{
+    if(!current || current == &uncached || as3_pass!=1)
+        return;
+    char type = !cls?SCHEDULE_PACKAGE:(error?SCHEDULE_CLASS:SCHEDULE_NOERROR);
+    char*key = (char*)malloc(strlen(package)+(cls?strlen(cls):0)+8);
+    sprintf(key, "%d %s %s", type, package, cls?cls:"");
+    if(!dict_contains(current->schedule_dict, key)) {
+        dict_put(current->schedule_dict, key, 0);
+        writer_writeU8(&current->scheduled, type);
+        writer_writeString(&current->scheduled, package);
+        writer_writeString(&current->scheduled, cls?cls:"");
+        current->num_scheduled++;
+    }
+    free(key);
+}
+
+/* returns why the cache entry of f is out of date, or 0 */
+static char check(cachefile_t*f)
+{
+    reader_t r;
+    int t;
+    if(!f->checked) {
+        /* once all files are declared, the names in the registry don't
+           change anymore, so this only needs to be done once */
+        f->checked = 1;
+
+        reader_init_memreader(&r, f->misses.data, f->misses.len);
+        int num = reader_readU32(&r);
+        char found = 0;
+        for(t=0;t<num && !found;t++) {
+            char*package = reader_readString(&r);
+            char*name = reader_readString(&r);
+            found = find(package, name)!=0;
+            free(package);
+            free(name);
+        }
+        r.dealloc(&r);
+        if(found)
+            return REASON_RESOLVE;
+
+        /* everything pass 2 references has to exist */
+        char ok = 1;
+        slotinfo_t*s = 0;
+        reader_init_memreader(&r, f->code.data, f->code.len);
+        num = reader_readU32(&r);
+        for(t=0;t<num;t++) {
+            ok &= read_ref(&r, &s);
+        }
+        num = reader_readU32(&r);
+        for(t=0;t<num;t++) {
+            ok &= read_ref(&r, &s);
+            int num_used = reader_readU32(&r);
+            int i;
+            for(i=0;i<num_used;i++) {
+                ok &= read_ref(&r, &s);
+            }
+        }
+        r.dealloc(&r);
+        if(!ok)
+            return REASON_RESOLVE;
+    }
+
+    for(t=0;t<f->num_dependencies;t++) {
+        cachefile_t*d = (cachefile_t*)dict_lookup(filenames, f->dependencies[t]);
+        if(!d)
+            return REASON_RESOLVE;
+        if(d->hash != f->dependency_hashes[t])
+            return REASON_DEPS;
+        /* a dependency which is parsed only because of its own dependencies
+           declares the same things as before. Only the constants it computes
+           in pass 2 might differ. */
+        if(d->state == FILE_FRESH && (d->reason != REASON_DEPS || d->valued))
+            return REASON_DEPS;
+    }
+    return 0;
+}
+
+cachefile_t* as3cache_stale()
+{
+    cachefile_t*f;
+    for(f=files;f;f=f->next) {
+        if(f->state != FILE_DECLARED)
+            continue;
+        char reason = check(f);
+        if(reason) {
+            DEBUG printf("[cache] %s is out of date (%d)\n", f->filename, reason);
+            undeclare(f);
+            f->state = FILE_FRESH;
+            f->reason = reason;
+            return f;
+        }
+    }
+    return 0;
+}
+
+// ------------------------------ pass 2 --------------------------------------
+
+static void set_globalclass(classinfo_t*c)
+{
+    /* see startclass() */
+    if(!as3_globalclass && c->access == ACCESS_PACKAGE &&
+       slotinfo_equals((slotinfo_t*)registry_getMovieClip(), (slotinfo_t*)c->superclass)) {
+        if(c->package && c->package[0]) {
+            as3_globalclass = concat3(c->package, ".", c->name);
+        } else {
+            as3_globalclass = strdup(c->name);
+        }
+    }
+}
+
+char as3cache_replay(cachefile_t*f)
+{
+    if(!f || f->state != FILE_DECLARED)
+        return 0;
+
+    reader_t r;
+    slotinfo_t*s = 0;
+    char ok = 1;
+    int t;
+    replaying = 1;
+    reader_init_memreader(&r, f->code.data, f->code.len);
+    int num = reader_readU32(&r);
+    for(t=0;t<num;t++) {
+        ok &= read_ref(&r, &s);
+        registry_use(s);
+    }
+    int num_classes = reader_readU32(&r);
+    parsedclass_t**classes = (parsedclass_t**)rfx_calloc(sizeof(parsedclass_t*)*(num_classes+1));
+    for(t=0;t<num_classes;t++) {
+        ok &= read_ref(&r, &s);
+        classes[t] = parsedclass_new((classinfo_t*)s, 0);
+        int num_used = reader_readU32(&r);
+        int i;
+        for(i=0;i<num_used;i++) {
+            ok &= read_ref(&r, &s);
+            parsedclass_add_dependency(classes[t], (classinfo_t*)s);
+        }
+    }
+    num = reader_readU32(&r);
+    if(!ok || num != f->infos.num) {
+        as3_error("internal error: bad cache entry for %s", f->filename);
+    }
+    for(t=0;t<num;t++) {
+        s = f->infos.slots[t];
+        s->flags = reader_readU8(&r) | (s->flags&FLAG_USED);
+        if(s->kind != INFOTYPE_CLASS && !is_method(s->kind, s->subtype) && reader_readU8(&r)) {
+            ((varinfo_t*)s)->value = read_constant(&r);
+        }
+    }
+
+    /* move the code into the output file */
+    int len = reader_readU32(&r);
+    TAG*tag = swf_InsertTag(0, ST_RAWABC);
+    swf_SetBlock(tag, f->code.data+r.pos, len);
+    r.dealloc(&r);
+    abc_file_t*abc = (abc_file_t*)swf_ReadABC(tag);
+    swf_DeleteTag(0, tag);
+    if(!abc || abc->classes->num != num_classes) {
+        as3_error("internal error: bad code in cache entry for %s", f->filename);
+    }
+    abc_file_t*file = global->file;
+    for(t=0;t<abc->methods->num;t++) {
+        abc_method_t*m = (abc_method_t*)array_getvalue(abc->methods, t);
+        if(m->name && !m->name[0]) {
+            /* swf_ReadABC() doesn't distinguish between no name and "" */
+            free((void*)m->name);m->name = 0;
+        }
+        array_append(file->methods, "", m);
+    }
+    for(t=0;t<abc->method_bodies->num;t++) {
+        abc_method_body_t*b = (abc_method_body_t*)array_getvalue(abc->method_bodies, t);
+        b->file = file;
+        array_append(file->method_bodies, "", b);
+    }
+    for(t=0;t<abc->scripts->num;t++) {
+        abc_script_t*script = (abc_script_t*)array_getvalue(abc->scripts, t);
+        script->file = file;
+        array_append(file->scripts, "", script);
+    }
+    for(t=0;t<num_classes;t++) {
+        abc_class_t*c = (abc_class_t*)array_getvalue(abc->classes, t);
+        c->file = file;
+        classes[t]->abc = c;
+        list_append(global->classes, classes[t]);
+        set_globalclass(classes[t]->cls);
+    }
+    free(classes);
+    array_free(abc->metadata);
+    array_free(abc->methods);
+    array_free(abc->method_bodies);
+    array_free(abc->scripts);
+    array_free(abc->classes);
+    if(abc->name)
+        free((void*)abc->name);
+    free(abc);
+
+    replaying = 0;
+    DEBUG printf("[cache] replayed %s\n", f->filename);
+    f->state = FILE_REPLAYED;
+    return 1;
+}
+
+/* stores what pass 2 did for f */
+static char write_code(cachefile_t*f, writer_t*w)
+{
+    char ok = 1;
+    int t;
+    writer_writeU32(w, f->uses.num);
+    for(t=0;t<f->uses.num;t++) {
+        ok &= write_ref(w, f->uses.slots[t]);
+    }
+
+    abc_file_t*file = global->file;
+    abc_file_t*abc = abc_file_new();
+    abc->flags = file->flags;
+
+    /* (list_length() only works on the start of a list) */
+    parsedclass_list_t*first = global->classes, *l;
+    for(t=0;t<f->classes0 && first;t++) {
+        first = first->next;
+    }
+    int num_classes = 0;
+    for(l=first;l;l=l->next) {
+        num_classes++;
+    }
+    writer_writeU32(w, num_classes);
+    for(l=first;l;l=l->next) {
+        parsedclass_t*p = l->parsedclass;
+        ok &= write_ref(w, (slotinfo_t*)p->cls);
+        writer_writeU32(w, dict_count(&p->usedclasses));
+        DICT_ITERATE_KEY(&p->usedclasses, slotinfo_t*, used) {
+            ok &= write_ref(w, used);
+        }
+        /* writing the abc file adds constructors to classes which don't
+           have any yet, so write a copy */
+        abc_class_t*c = (abc_class_t*)malloc(sizeof(abc_class_t));
+        memcpy(c, p->abc, sizeof(abc_class_t));
+        c->file = abc;
+        array_append(abc->classes, "", c);
+    }
+
+    f->valued = 0;
+    writer_writeU32(w, f->infos.num);
+    for(t=0;t<f->infos.num;t++) {
+        slotinfo_t*s = f->infos.slots[t];
+        writer_writeU8(w, s->flags&~FLAG_USED);
+        if(s->kind != INFOTYPE_CLASS && !is_method(s->kind, s->subtype)) {
+            constant_t*value = ((varinfo_t*)s)->value;
+            writer_writeU8(w, value!=0);
+            if(value) {
+                write_constant(w, value);
+                if(!NS_TYPE(value->type))
+                    f->valued = 1;
+            }
+        }
+    }
+
+    for(t=f->methods0;t<file->methods->num;t++) {
+        array_append(abc->methods, "", array_getvalue(file->methods, t));
+    }
+    for(t=f->method_bodies0;t<file->method_bodies->num;t++) {
+        array_append(abc->method_bodies, "", array_getvalue(file->method_bodies, t));
+    }
+    for(t=f->scripts0;t<file->scripts->num;t++) {
+        array_append(abc->scripts, "", array_getvalue(file->scripts, t));
+    }
+    int num_methods = abc->methods->num;
+
+    TAG*tag = swf_InsertTag(0, ST_RAWABC);
+    swf_WriteABC(tag, abc);
+    writer_writeU32(w, tag->len);
+    w->write(w, tag->data, tag->len);
+    swf_DeleteTag(0, tag);
+
+    /* free the constructors swf_WriteABC() added */
+    for(t=num_methods;t<abc->methods->num;t++) {
+        abc_method_t*m = (abc_method_t*)array_getvalue(abc->methods, t);
+        if(m->body) {
+            code_free(m->body->code);
+            free(m->body);
+        }
+        free(m);
+    }
+    for(t=0;t<abc->classes->num;t++) {
+        free(array_getvalue(abc->classes, t));
+    }
+    array_free(abc->metadata);
+    array_free(abc->methods);
+    array_free(abc->method_bodies);
+    array_free(abc->scripts);
+    array_free(abc->classes);
+    free(abc);
+    return ok;
+}
+
+void as3cache_begin(cachefile_t*f)
+{
+    current = f?f:&uncached;
+    if(!f)
+        return;
+    if(as3_pass == 1) {
+        f->cacheable = 1;
+        f->decls.num = 0;
+        f->infos.num = 0;
+        f->uses.num = 0;
+        f->num_scheduled = 0;
+        f->dependency_dict = dict_new2(&ptr_type);
+        f->visited = dict_new2(&ptr_type);
+        f->miss_dict = dict_new2(&slotinfo_type);
+        f->schedule_dict = dict_new();
+        f->use_dict = dict_new2(&ptr_type);
+        writer_init_growingmemwriter(&f->scheduled, 256);
+        writer_writeU32(&f->scheduled, 0);
+    } else {
+        abc_file_t*file = global->file;
+        f->methods0 = file->methods->num;
+        f->method_bodies0 = file->method_bodies->num;
+        f->scripts0 = file->scripts->num;
+        f->classes0 = list_length(global->classes);
+    }
+}
+
+void as3cache_end(cachefile_t*f)
+{
+    current = 0;
+    if(!f)
+        return;
+    if(as3_pass == 1) {
+        /* patch in the number of schedule calls */
+        unsigned char*data = (unsigned char*)writer_growmemwrite_memptr(&f->scheduled, 0);
+        data[0] = f->num_scheduled;data[1] = f->num_scheduled>>8;
+        data[2] = f->num_scheduled>>16;data[3] = f->num_scheduled>>24;
+
+        /* store the declarations before they are resolved */
+        writer_init_growingmemwriter(&f->declared, 1024);
+        writer_writeU32(&f->declared, f->decls.num);
+        int t;
+        for(t=0;t<f->decls.num;t++) {
+            f->cacheable &= write_slot(f, &f->declared, f->decls.slots[t]);
+        }
+    } else {
+        writer_t code;
+        writer_init_growingmemwriter(&code, 4096);
+        if(write_code(f, &code) && f->cacheable) {
+            write_entry(f, &code);
+            DEBUG printf("[cache] stored %s\n", f->filename);
+        }
+        code.finish(&code);
+        f->scheduled.finish(&f->scheduled);
+        f->declared.finish(&f->declared);
+        dict_destroy(f->dependency_dict);f->dependency_dict = 0;
+        dict_destroy(f->visited);f->visited = 0;
+        DICT_ITERATE_KEY(f->miss_dict, slotinfo_t*, miss) {
+            free((void*)miss->package);
+            free((void*)miss->name);
+            free(miss);
+        }
+        dict_destroy(f->miss_dict);f->miss_dict = 0;
+        dict_destroy(f->schedule_dict);f->schedule_dict = 0;
+        dict_destroy(f->use_dict);f->use_dict = 0;
+    }
+}
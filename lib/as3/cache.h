@@ -0,0 +1,61 @@
+/* cache.h
+
+   Persistent compilation cache for the ActionScript 3 compiler
+
+   Extension module for the rfxswf library.
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __as3_cache_h__
+#define __as3_cache_h__
+
+typedef struct _cachefile cachefile_t;
+
+/* The cache is disabled until a directory is set. Everything which changes
+   the output of the compiler for a given source file (defines, include
+   directories, libraries) has to be registered via as3cache_addoption()
+   before the first file is parsed. */
+void as3cache_setdir(const char*dir);
+char as3cache_enabled();
+void as3cache_addoption(const char*option, const void*data, int len);
+
+/* Called in pass 1 for every source file. Returns 0 if there's no
+   usable cache entry */
+cachefile_t* as3cache_open(const char*name, const char*filename, const void*data, int len);
+
+/* pass 1: register the declarations of this file from its cache entry, and
+   schedule the files it imports. Returns 0 if the file needs to be parsed. */
+char as3cache_declare(cachefile_t*f);
+
+/* after pass 1: returns a file whose cache entry turned out to be out of date
+   (because a file it depends on changed). Its declarations are removed from
+   the registry again, and it needs to be parsed (pass 1). */
+cachefile_t* as3cache_stale();
+
+/* pass 2: add the cached code of this file to the output. Returns 0 if the
+   file needs to be parsed. */
+char as3cache_replay(cachefile_t*f);
+
+/* called around the parsing of a file, in both passes. At the end of
+   pass 2, a new cache entry is written. */
+void as3cache_begin(cachefile_t*f);
+void as3cache_end(cachefile_t*f);
+
+/* pass 1: remember that the current file scheduled a class or package
+   (cls==0) for compilation */
+void as3cache_schedule(char error, const char*package, const char*cls);
+
+#endif //__as3_cache_h__
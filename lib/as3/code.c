@@ -1302,3 +1302,327 @@ code_t* cut_last_push(code_t*c)
 }
 
 
+
+/* ------------------------------ peephole optimizer ------------------------------ */
+
+static dict_t* code_jumptargets(code_t*c, abc_exception_list_t*exceptions)
+{
+    dict_t*targets = dict_new2(&ptr_type);
+    while(c) {
+        if(c->branch)
+            dict_put(targets, c->branch, c->branch);
+        if(c->opcode == OPCODE_LOOKUPSWITCH) {
+            lookupswitch_t*l = (lookupswitch_t*)c->data[0];
+            if(l->def)
+                dict_put(targets, l->def, l->def);
+            code_list_t*t = l->targets;
+            while(t) {
+                if(t->code)
+                    dict_put(targets, t->code, t->code);
+                t = t->next;
+            }
+        }
+        c = c->next;
+    }
+    /* exception ranges and handlers are pinned, too */
+    while(exceptions) {
+        abc_exception_t*e = exceptions->abc_exception;
+        if(e->from) dict_put(targets, e->from, e->from);
+        if(e->to) dict_put(targets, e->to, e->to);
+        if(e->target) dict_put(targets, e->target, e->target);
+        exceptions = exceptions->next;
+    }
+    return targets;
+}
+
+static code_t* code_remove(code_t*c)
+{
+    code_t*next = c->next;
+    if(c->prev) c->prev->next = c->next;
+    if(c->next) c->next->prev = c->prev;
+    c->prev = c->next = 0;
+    code_free(c);
+    return next;
+}
+
+static int getlocal_reg(code_t*c)
+{
+    if(c->opcode == OPCODE_GETLOCAL)
+        return (ptroff_t)c->data[0];
+    if(c->opcode >= OPCODE_GETLOCAL_0 && c->opcode <= OPCODE_GETLOCAL_3)
+        return c->opcode - OPCODE_GETLOCAL_0;
+    return -1;
+}
+static int setlocal_reg(code_t*c)
+{
+    if(c->opcode == OPCODE_SETLOCAL)
+        return (ptroff_t)c->data[0];
+    if(c->opcode >= OPCODE_SETLOCAL_0 && c->opcode <= OPCODE_SETLOCAL_3)
+        return c->opcode - OPCODE_SETLOCAL_0;
+    return -1;
+}
+
+/* pushes without side effects, which can be removed if their value is popped again */
+static char is_simple_push(code_t*c)
+{
+    switch(c->opcode) {
+        case OPCODE_PUSHBYTE: case OPCODE_PUSHSHORT: case OPCODE_PUSHINT:
+        case OPCODE_PUSHUINT: case OPCODE_PUSHDOUBLE: case OPCODE_PUSHSTRING:
+        case OPCODE_PUSHTRUE: case OPCODE_PUSHFALSE: case OPCODE_PUSHNULL:
+        case OPCODE_PUSHUNDEFINED: case OPCODE_PUSHNAN: case OPCODE_PUSHNAMESPACE:
+        case OPCODE_GETGLOBALSCOPE: case OPCODE_GETSCOPEOBJECT: case OPCODE_DUP:
+            return 1;
+    }
+    return getlocal_reg(c)>=0;
+}
+static char is_coerce(code_t*c)
+{
+    return c->opcode == OPCODE_COERCE || c->opcode == OPCODE_COERCE_A || c->opcode == OPCODE_COERCE_S;
+}
+/* pushes of primitive constants */
+static char is_constant_push(code_t*c)
+{
+    switch(c->opcode) {
+        case OPCODE_PUSHBYTE: case OPCODE_PUSHSHORT: case OPCODE_PUSHINT:
+        case OPCODE_PUSHUINT: case OPCODE_PUSHDOUBLE: case OPCODE_PUSHSTRING:
+        case OPCODE_PUSHTRUE: case OPCODE_PUSHFALSE: case OPCODE_PUSHNULL:
+        case OPCODE_PUSHUNDEFINED: case OPCODE_PUSHNAN:
+            return 1;
+    }
+    return 0;
+}
+static char is_toplevel_type(multiname_t*m, const char*name)
+{
+    return m && m->type == QNAME && m->ns && m->ns->access == ACCESS_PACKAGE &&
+           (!m->ns->name || !*m->ns->name) && m->name && !strcmp(m->name, name);
+}
+/* coerces can throw (coerce <class>) or call toString() (coerce_s), so
+   they may only be removed together with the value they convert if that
+   can't happen. */
+static char is_noop_coerce(code_t*value, code_t*c)
+{
+    if(c->opcode == OPCODE_COERCE_A)
+        return 1;
+    if(value->opcode == OPCODE_PUSHNULL || value->opcode == OPCODE_PUSHUNDEFINED)
+        return 1;
+    if(c->opcode == OPCODE_COERCE_S)
+        return is_constant_push(value);
+    multiname_t*m = (multiname_t*)c->data[0];
+    if(is_toplevel_type(m, "Object"))
+        return 1;
+    if(is_constant_push(value)) {
+        return is_toplevel_type(m, "String") || is_toplevel_type(m, "Number") ||
+               is_toplevel_type(m, "int") || is_toplevel_type(m, "uint") ||
+               is_toplevel_type(m, "Boolean");
+    }
+    return 0;
+}
+
+/* "compare;iftrue" and "compare;iffalse" → single conditional branch */
+static U8 fused_branch(U8 compare, U8 cond)
+{
+    char t = cond == OPCODE_IFTRUE;
+    switch(compare) {
+        case OPCODE_EQUALS:        return t?OPCODE_IFEQ:OPCODE_IFNE;
+        case OPCODE_STRICTEQUALS:  return t?OPCODE_IFSTRICTEQ:OPCODE_IFSTRICTNE;
+        case OPCODE_LESSTHAN:      return t?OPCODE_IFLT:OPCODE_IFNLT;
+        case OPCODE_LESSEQUALS:    return t?OPCODE_IFLE:OPCODE_IFNLE;
+        case OPCODE_GREATERTHAN:   return t?OPCODE_IFGT:OPCODE_IFNGT;
+        case OPCODE_GREATEREQUALS: return t?OPCODE_IFGE:OPCODE_IFNGE;
+    }
+    return 0;
+}
+static U8 negated_branch(U8 op)
+{
+    switch(op) {
+        case OPCODE_IFTRUE:     return OPCODE_IFFALSE;
+        case OPCODE_IFFALSE:    return OPCODE_IFTRUE;
+        case OPCODE_IFEQ:       return OPCODE_IFNE;
+        case OPCODE_IFNE:       return OPCODE_IFEQ;
+        case OPCODE_IFSTRICTEQ: return OPCODE_IFSTRICTNE;
+        case OPCODE_IFSTRICTNE: return OPCODE_IFSTRICTEQ;
+        case OPCODE_IFLT:       return OPCODE_IFNLT;
+        case OPCODE_IFNLT:      return OPCODE_IFLT;
+        case OPCODE_IFLE:       return OPCODE_IFNLE;
+        case OPCODE_IFNLE:      return OPCODE_IFLE;
+        case OPCODE_IFGT:       return OPCODE_IFNGT;
+        case OPCODE_IFNGT:      return OPCODE_IFGT;
+        case OPCODE_IFGE:       return OPCODE_IFNGE;
+        case OPCODE_IFNGE:      return OPCODE_IFGE;
+    }
+    return 0;
+}
+
+static code_t* skip_labels(code_t*c)
+{
+    while(c && (c->opcode == OPCODE_LABEL || c->opcode == OPCODE_NOP))
+        c = c->next;
+    return c;
+}
+
+#define PINNED(c) dict_contains(targets, (c))
+
+/* one pass over the code. Instructions which are jump targets (or exception
+   boundaries) are only ever modified in place, never removed, and must not
+   appear anywhere but at the start of a pattern. */
+static int optimize_pass(code_t**start, abc_exception_list_t*exceptions)
+{
+    dict_t*targets = code_jumptargets(*start, exceptions);
+    int changes = 0;
+    code_t*c = *start;
+
+#define REMOVE(x) {if((x)==*start) *start=(x)->next; code_remove(x);changes++;}
+
+    while(c) {
+        code_t*n = c->next;
+        opcode_t*op = opcode_get(c->opcode);
+
+        /* getlocal <i> → getlocal_i, setlocal <i> → setlocal_i */
+        if((c->opcode == OPCODE_GETLOCAL || c->opcode == OPCODE_SETLOCAL) && (ptroff_t)c->data[0] < 4) {
+            c->opcode = (c->opcode == OPCODE_GETLOCAL?OPCODE_GETLOCAL_0:OPCODE_SETLOCAL_0) + (ptroff_t)c->data[0];
+            c->data[0] = 0;
+            changes++;
+        }
+
+        /* unreferenced labels and nops */
+        if((c->opcode == OPCODE_LABEL || c->opcode == OPCODE_NOP) && !PINNED(c)) {
+            REMOVE(c);
+            c = n;
+            continue;
+        }
+
+        /* a jump to a jump can be redirected */
+        if((op->flags & (OP_JUMP|OP_BRANCH)) && c->branch) {
+            int hops = 0;
+            code_t*t = skip_labels(c->branch);
+            while(t && t != c && t->opcode == OPCODE_JUMP && t->branch && t->branch != c->branch && hops++ < 8) {
+                c->branch = t->branch;
+                changes++;
+                t = skip_labels(c->branch);
+            }
+        }
+
+        /* "jump next;next:" */
+        if(c->opcode == OPCODE_JUMP && c->branch == n && !PINNED(c)) {
+            REMOVE(c);
+            c = n;
+            continue;
+        }
+
+        if(!n) {
+            c = n;
+            continue;
+        }
+
+        /* "iffalse xx;jump yy;xx:" → "iftrue yy" */
+        if(negated_branch(c->opcode) && n->opcode == OPCODE_JUMP && !PINNED(n) &&
+           c->branch && c->branch == n->next && n->branch) {
+            c->opcode = negated_branch(c->opcode);
+            c->branch = n->branch;
+            REMOVE(n);
+            continue;
+        }
+
+        /* "greaterthan;iftrue" → "ifgt" etc. */
+        if((n->opcode == OPCODE_IFTRUE || n->opcode == OPCODE_IFFALSE) &&
+           fused_branch(c->opcode, n->opcode) && !PINNED(n)) {
+            c->opcode = fused_branch(c->opcode, n->opcode);
+            c->branch = n->branch;
+            REMOVE(n);
+            continue;
+        }
+
+        /* "push;(coerce;)pop", "callproperty;(coerce_a;)pop" */
+        if(c->opcode == OPCODE_CALLPROPERTY || c->opcode == OPCODE_CALLSUPER || 
+           (is_simple_push(c) && !PINNED(c))) {
+            code_t*p = n;
+            while(p && is_coerce(p) && !PINNED(p) && is_noop_coerce(c, p))
+                p = p->next;
+            if(p && p->opcode == OPCODE_POP && !PINNED(p)) {
+                while(c->next != p) {
+                    REMOVE(c->next);
+                }
+                REMOVE(p);
+                if(c->opcode == OPCODE_CALLPROPERTY) {
+                    c->opcode = OPCODE_CALLPROPVOID;
+                } else if(c->opcode == OPCODE_CALLSUPER) {
+                    c->opcode = OPCODE_CALLSUPERVOID;
+                } else {
+                    code_t*next = c->next;
+                    REMOVE(c);
+                    c = next;
+                }
+                continue;
+            }
+        }
+
+        /* "getlocal_i;setlocal_i" */
+        if(getlocal_reg(c)>=0 && getlocal_reg(c) == setlocal_reg(n) && !PINNED(c) && !PINNED(n)) {
+            code_t*next = n->next;
+            REMOVE(n);
+            REMOVE(c);
+            c = next;
+            continue;
+        }
+
+        /* "dup;setlocal_i;pop" → "setlocal_i" (same for setglobalslot, pushscope) */
+        if(c->opcode == OPCODE_DUP && !PINNED(c) && !PINNED(n) && 
+           (setlocal_reg(n)>=0 || n->opcode == OPCODE_SETGLOBALSLOT || n->opcode == OPCODE_PUSHSCOPE) &&
+           n->next && n->next->opcode == OPCODE_POP && !PINNED(n->next)) {
+            REMOVE(n->next);
+            REMOVE(c);
+            c = n;
+            continue;
+        }
+
+        /* "getlocal_i;increment;(coerce_a;)setlocal_i" → "inclocal_i" */
+        code_t*s = n->next;
+        if(s && s->opcode == OPCODE_COERCE_A && !PINNED(s))
+            s = s->next;
+        if(getlocal_reg(c)>=0 && !PINNED(n) && s && !PINNED(s) &&
+           getlocal_reg(c) == setlocal_reg(s)) {
+            U8 opcode = 0;
+            switch(n->opcode) {
+                case OPCODE_INCREMENT:   opcode = OPCODE_INCLOCAL;break;
+                case OPCODE_INCREMENT_I: opcode = OPCODE_INCLOCAL_I;break;
+                case OPCODE_DECREMENT:   opcode = OPCODE_DECLOCAL;break;
+                case OPCODE_DECREMENT_I: opcode = OPCODE_DECLOCAL_I;break;
+            }
+            if(opcode) {
+                c->data[0] = (void*)(ptroff_t)getlocal_reg(c);
+                c->opcode = opcode;
+                while(c->next != s) {
+                    REMOVE(c->next);
+                }
+                REMOVE(s);
+                continue;
+            }
+        }
+
+        /* a kill before a return can be eliminated */
+        if(c->opcode == OPCODE_KILL && !PINNED(c) &&
+           (n->opcode == OPCODE_RETURNVALUE || n->opcode == OPCODE_RETURNVOID)) {
+            REMOVE(c);
+            c = n;
+            continue;
+        }
+
+        c = n;
+    }
+#undef REMOVE
+    dict_destroy(targets);
+    return changes;
+}
+
+code_t* code_optimize(code_t*c, abc_exception_list_t*exceptions)
+{
+    if(!c)
+        return c;
+    code_t*start = code_start(c);
+    int t;
+    for(t=0;t<16;t++) {
+        if(!optimize_pass(&start, exceptions))
+            break;
+    }
+    return code_end(start);
+}
@@ -102,6 +102,8 @@ code_t* code_append(code_t*code, code_t*toappend);
 
 code_t* cut_last_push(code_t*_c);
 
+code_t* code_optimize(code_t*c, abc_exception_list_t*exceptions);
+
 char is_getlocal(code_t*c);
 
 #define code_new() (0)
@@ -29,6 +29,7 @@
 #include "compiler.h"
 #include "registry.h"
 #include "assets.h"
+#include "cache.h"
 #include "../os.h"
 #ifdef HAVE_SYS_STAT_H
 #include <sys/stat.h>
@@ -43,6 +44,7 @@ extern int as3_lex();
 extern int as3_lex_destroy();
 
 static char config_recurse = 0;
+static char config_optimize = 0;
 
 void as3_setverbosity(int level)
 {
@@ -51,11 +53,19 @@ void as3_setverbosity(int level)
 void as3_add_include_dir(char*dir)
 {
     add_include_dir(dir);
+    as3cache_addoption("include", dir, strlen(dir));
 }
 void as3_set_option(const char*key, const char*value)
 {
     if(!strcmp(key, "recurse")) {
         config_recurse=atoi(value);
+        as3cache_addoption(key, value, strlen(value));
+    }
+    if(!strcmp(key, "optimize")) {
+        config_optimize=atoi(value);
+    }
+    if(!strcmp(key, "cachedir")) {
+        as3cache_setdir(value);
     }
 }
 
@@ -76,11 +86,13 @@ int a3_lex()
 typedef struct _compile_list {
     const char*name;
     const char*filename;
+    memfile_t*file;
+    cachefile_t*cache;
     struct _compile_list*next;
 } compile_list_t;
 static compile_list_t*compile_list=0;
 
-static void as3_parse_file_or_array(const char*name, const char*filename, const void*mem, int length)
+static void as3_parse_file_or_array(const char*name, const char*filename, const void*mem, int length, cachefile_t*cache)
 {
     if(!registry_initialized) {
         registry_initialized = 1;
@@ -94,16 +106,33 @@ static void as3_parse_file_or_array(const char*name, const char*filename, const
     FILE*fi = 0;
     if(filename) {
         if(as3_pass==1 && !mem) {
-            // record the fact that we compiled this file
+            // record the fact that we compiled this file. Keep the contents
+            // around, so that pass 2 parses from memory, and is guaranteed
+            // to see the same data as pass 1.
             compile_list_t*c = rfx_calloc(sizeof(compile_list_t));
             c->next = compile_list;
             c->name = strdup(name);
             c->filename = strdup(filename);
+            c->file = memfile_open(filename);
+            if(c->file && c->file->len) {
+                mem = c->file->data;
+                length = c->file->len;
+            }
             compile_list = c;
+            if(as3cache_enabled()) {
+                c->cache = cache = as3cache_open(name, filename, mem, length);
+                if(as3cache_declare(cache))
+                    return;
+            }
         }
         DEBUG printf("[pass %d] parse file %s %s\n", as3_pass, name, filename);
-        fi = enter_file2(name, filename, 0);
-        as3_file_input(fi);
+        if(mem) {
+            enter_file(name, filename, 0);
+            as3_buffer_input((void*)mem, length);
+        } else {
+            fi = enter_file2(name, filename, 0);
+            as3_file_input(fi);
+        }
     } else {
         DEBUG printf("[pass %d] parse bytearray %s (%d bytes)\n", as3_pass, name, length);
         enter_file(name, name, 0);
@@ -111,10 +140,12 @@ static void as3_parse_file_or_array(const char*name, const char*filename, const
     }
 
     as3_tokencount=0;
+    as3cache_begin(cache);
     initialize_file(name, filename);
     a3_parse();
     as3_lex_destroy();
     finish_file();
+    as3cache_end(cache);
     if(fi) fclose(fi);
 }
 
@@ -131,19 +162,31 @@ void as3_parse_scheduled()
 {
     DEBUG printf("[pass %d] parse scheduled\n", as3_pass);
 
-    while(scheduled) {
-        scheduled_file_t*s = scheduled;
-        scheduled = 0;
-        while(s) {
-            scheduled_file_t*old = s;
-            as3_parse_file_or_array(s->name, s->filename, 0,0);
-            s = s->next;
-
-            free(old->filename);
-            free(old->name);
-            old->filename = old->name = 0;
-            free(old);
+    while(1) {
+        while(scheduled) {
+            scheduled_file_t*s = scheduled;
+            scheduled = 0;
+            while(s) {
+                scheduled_file_t*old = s;
+                as3_parse_file_or_array(s->name, s->filename, 0,0, 0);
+                s = s->next;
+
+                free(old->filename);
+                free(old->name);
+                old->filename = old->name = 0;
+                free(old);
+            }
         }
+        /* now that all files are known, check whether the declarations
+           which came from the compilation cache are still valid */
+        cachefile_t*stale = as3cache_stale();
+        if(!stale)
+            break;
+        compile_list_t*c = compile_list;
+        while(c && c->cache != stale)
+            c = c->next;
+        as3_assert(c && c->file && c->file->data);
+        as3_parse_file_or_array(c->name, c->filename, c->file->data, c->file->len, c->cache);
     }
     if(scheduled_dict) {
         dict_destroy(scheduled_dict);
@@ -176,7 +219,18 @@ void as3_schedule_file(const char*name, const char*filename)
 void as3_parse_list()
 {
     while(compile_list) {
-        as3_parse_file_or_array(compile_list->name, compile_list->filename, 0,0);
+        memfile_t*file = compile_list->file;
+        if(as3cache_replay(compile_list->cache)) {
+            DEBUG printf("[pass %d] %s from cache\n", as3_pass, compile_list->filename);
+        } else if(file && file->len) {
+            as3_parse_file_or_array(compile_list->name, compile_list->filename, file->data, file->len, compile_list->cache);
+        } else {
+            as3_parse_file_or_array(compile_list->name, compile_list->filename, 0,0, compile_list->cache);
+        }
+        if(file) {
+            memfile_close(file);
+            compile_list->file = 0;
+        }
         compile_list = compile_list->next;
     }
 }
@@ -184,13 +238,13 @@ void as3_parse_list()
 void as3_parse_bytearray(const char*name, const void*mem, int length)
 {
     as3_pass = 1;
-    as3_parse_file_or_array(name, 0, mem, length);
+    as3_parse_file_or_array(name, 0, mem, length, 0);
     as3_parse_scheduled();
     
     registry_resolve_all();
     
     as3_pass = 2;
-    as3_parse_file_or_array(name, 0, mem, length);
+    as3_parse_file_or_array(name, 0, mem, length, 0);
     as3_parse_list();
 }
 
@@ -269,6 +323,7 @@ char as3_schedule_directory(const char*dirname)
 void as3_schedule_package(const char*package)
 {
     DEBUG printf("[pass %d] schedule package %s\n", as3_pass, package);
+    as3cache_schedule(1, package, 0);
     char*dirname = strdup(package);
     int s=0;
     while(dirname[s]) {
@@ -324,12 +379,15 @@ static void schedule_class(const char*package, const char*cls, char error)
 
 void as3_schedule_class(const char*package, const char*cls)
 {
+    if(cls)
+        as3cache_schedule(1, package, cls);
     schedule_class(package, cls, 1);
 }
 
 void as3_schedule_class_noerror(const char*package, const char*cls)
 {
     if(config_recurse) {
+        as3cache_schedule(0, package, cls);
         schedule_class(package, cls, 0);
     }
 }
@@ -341,6 +399,14 @@ void* as3_getcode()
     if(parser_initialized) {
         parser_initialized = 0;
         as3code = finish_parser();
+        if(config_optimize) {
+            abc_file_t*file = (abc_file_t*)as3code;
+            int t;
+            for(t=0;t<file->method_bodies->num;t++) {
+                abc_method_body_t*m = (abc_method_body_t*)array_getvalue(file->method_bodies, t);
+                m->code = code_optimize(m->code, m->exceptions);
+            }
+        }
     }
     return as3code;
 }
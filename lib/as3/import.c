@@ -25,6 +25,7 @@
 #include "common.h"
 #include "tokenizer.h"
 #include "assets.h"
+#include "cache.h"
 #include "../os.h"
 #include "../xml.h"
 #ifdef HAVE_ZZIP
@@ -244,6 +245,12 @@ void as3_import_file(char*filename)
     l = fread(head, 3, 1, fi);
     fclose(fi);
     if (l != 1) return;
+    /* classes in libraries change what source files compile to */
+    memfile_t*file = memfile_open(filename);
+    if(file) {
+        as3cache_addoption("library", file->data, file->len);
+        memfile_close(file);
+    }
     if(!strncmp(head, "FWS", 3) ||
        !strncmp(head, "CWS", 3)) {
         as3_import_swf(filename);
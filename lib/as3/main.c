@@ -104,6 +104,9 @@ int main(int argn, char*argv[])
         if(!strcmp(argv[t], "-R")) {
             as3_set_option("recurse","1");
         }
+        if(!strcmp(argv[t], "-O")) {
+            as3_set_option("optimize","1");
+        }
         if(!strcmp(argv[t], "-I")) {
             as3_add_include_dir(argv[++t]);
         }
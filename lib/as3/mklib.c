@@ -145,36 +145,77 @@ void write_slotinfo_decl(FILE*fi, slotinfo_t*s, char*prefix)
 	DICT_ITERATE_DATA(d, slotinfo_t*, s1) {
             fprintf(fi, "static %s %s;\n", mktype(s1), mkid2(id, s1->name));
 	}
+        d = &c->static_members;
 	DICT_ITERATE_DATA(d, slotinfo_t*, s2) {
             fprintf(fi, "static %s %s;\n", mktype(s2), mkid2(id, s2->name));
 	}
     }
 }
-void write_initinfo(FILE*fi, slotinfo_t*s, char*prefix)
+/* the snapshot hash tables are sized so that dict_lookup() never
+   has to expand them (which would try to free the static slot array) */
+static int snapshot_hashsize(int num)
+{
+    return num?num*2+1:0;
+}
+
+/* write a dict as static data: an array of entries (with precomputed
+   hashes, chained like dict_put() would have chained them), and an array
+   of slots pointing into it. parent is the class id for member dicts,
+   or NULL for the toplevel class dict. */
+void write_dict_snapshot(FILE*fi, dict_t*d, const char*id, const char*parent)
+{
+    int num = dict_count(d);
+    if(!num)
+        return;
+    int size = snapshot_hashsize(num);
+    int*head = malloc(sizeof(int)*size);
+    int t;
+    for(t=0;t<size;t++)
+        head[t] = -1;
+
+    fprintf(fi, "static dictentry_t %s_entries[%d] = {\n", id, num);
+    int nr = 0;
+    DICT_ITERATE_DATA(d, slotinfo_t*, s) {
+        char*id2 = parent?mkid2(parent, s->name):mkid(s);
+        unsigned int hash = d->key_type->hash(s);
+        int slot = hash % size;
+        fprintf(fi, "    {&%s, 0x%08x, &%s, ", id2, hash, id2);
+        if(head[slot]>=0)
+            fprintf(fi, "&%s_entries[%d]},\n", id, head[slot]);
+        else
+            fprintf(fi, "0},\n");
+        head[slot] = nr++;
+    }
+    fprintf(fi, "};\n");
+
+    fprintf(fi, "static dictentry_t* %s_slots[%d] = {\n", id, size);
+    for(t=0;t<size;t++) {
+        if(head[t]>=0)
+            fprintf(fi, "    [%d] = &%s_entries[%d],\n", t, id, head[t]);
+    }
+    fprintf(fi, "};\n");
+    free(head);
+}
+
+void write_classinfo_dicts(FILE*fi, slotinfo_t*s)
 {
     if(s->kind == INFOTYPE_CLASS) {
         classinfo_t*c = (classinfo_t*)s;
         char*id = mkid(c);
-        dict_t*d1 = &c->members;
-        dict_t*d2 = &c->static_members;
-        fprintf(fi, "%s", prefix);
-        fprintf(fi, "dict_init2(&%s.members, &memberinfo_type, %d);\n", id, d1->hashsize);
-	fprintf(fi, "%s", prefix);
-        fprintf(fi, "dict_init2(&%s.static_members, &memberinfo_type, %d);\n", id, d2->hashsize);
-        int t;
-	DICT_ITERATE_DATA(d1,slotinfo_t*,s1) {
-	   fprintf(fi, "%s", prefix);
-	   char*id2 = mkid2(id, s1->name);
-	   fprintf(fi, "dict_put(&%s.members, &%s, &%s);\n", id, id2, id2);
-	}
-	DICT_ITERATE_DATA(d2,slotinfo_t*,s2) {
-	   fprintf(fi, "%s", prefix);
-	   char*id2 = mkid2(id, s2->name);
-	   fprintf(fi, "dict_put(&%s.static_members, &%s, &%s);\n", id, id2, id2);
-	}
+        write_dict_snapshot(fi, &c->members, mkid2(id, "members"), id);
+        write_dict_snapshot(fi, &c->static_members, mkid2(id, "static_members"), id);
     }
 }
 
+static void write_dict_init(FILE*fi, dict_t*d, char*id, char*field)
+{
+    int num = dict_count(d);
+    if(num)
+        fprintf(fi, "%s: {%s_%s_slots, &memberinfo_type, %d, %d}, ", field, id, field, snapshot_hashsize(num), num);
+    else
+        fprintf(fi, "%s: {0, &memberinfo_type, 0, 0}, ", field);
+}
+
 void write_constant(FILE*fi, constant_t*value, char*id, char*prefix)
 {
     if(NS_TYPE(value->type)) {
@@ -228,6 +269,8 @@ void write_slotinfo(FILE*fi, slotinfo_t*s, char*id, char*prefix)
     if(s->kind == INFOTYPE_CLASS) {
         classinfo_t*c = (classinfo_t*)s;
         fprintf(fi, "%s, ", mkptr(c->superclass));
+        write_dict_init(fi, &c->members, id, "members");
+        write_dict_init(fi, &c->static_members, id, "static_members");
         fprintf(fi, "interfaces: {");
         int t;
         for(t=0;c->interfaces[t];t++) {
@@ -283,31 +326,34 @@ int main()
             fprintf(fi, "#include \"builtin.h\"\n");
             fprintf(fi, "\n");
         }
-        if(pass==3) {
-            fprintf(fi, "dict_t* builtin_getclasses()\n");
-            fprintf(fi, "{\n");
-            fprintf(fi, "    dict_t*d = dict_new2(&slotinfo_type);\n");
-        }
         for(t=0;t<registry_classes->hashsize;t++) {
             dictentry_t*l = registry_classes->slots[t];
             while(l) {
                 slotinfo_t*s = (slotinfo_t*)l->key;
                 //printf("%08x %s %s\n", s, s->package, s->name);
-                char*id = mkid(s);
                 if(pass==1) {
                     write_slotinfo_decl(fi, s, "");
                 }
                 if(pass==2) {
-                    write_slotinfo(fi, s, mkid(s), "");
+                    write_classinfo_dicts(fi, s);
                 }
                 if(pass==3) {
-                    fprintf(fi, "    dict_put(d, &%s, &%s);\n", id, id);
-                    write_initinfo(fi, s, "    ");
+                    write_slotinfo(fi, s, mkid(s), "");
                 }
                 l = l->next;
             }
         }
     }
+    write_dict_snapshot(fi, registry_classes, "builtin", 0);
+
+    /* everything is static data now- we only need a writable copy of the
+       toplevel slots, as the compiler adds its own classes to that dict */
+    fprintf(fi, "dict_t* builtin_getclasses()\n");
+    fprintf(fi, "{\n");
+    fprintf(fi, "    dict_t*d = rfx_alloc(sizeof(dict_t));\n");
+    fprintf(fi, "    dict_init2(d, &slotinfo_type, %d);\n", snapshot_hashsize(dict_count(registry_classes)));
+    fprintf(fi, "    memcpy(d->slots, builtin_slots, sizeof(builtin_slots));\n");
+    fprintf(fi, "    d->num = %d;\n", dict_count(registry_classes));
     fprintf(fi, "    _NaN_constant.f =  __builtin_nan(\"\");\n");
     fprintf(fi, "    _Infinity_constant.f = __builtin_inf();\n");
     fprintf(fi, "    return d;\n");
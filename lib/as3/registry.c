@@ -28,6 +28,12 @@
 
 dict_t*registry_classes=0;
 asset_bundle_list_t*assets=0;
+static registry_observer_t observer=0;
+
+void registry_set_observer(registry_observer_t o)
+{
+    observer = o;
+}
 
 // ----------------------- class signature ------------------------------
 
@@ -87,6 +93,8 @@ static void use_asset(asset_bundle_t*a)
 void registry_use(slotinfo_t*s)
 {
     if(!s) return;
+    if(observer)
+        observer(REGISTRY_USE, s->package, s->name, s);
     if(!(s->flags&FLAG_USED)) {
 	s->flags |= FLAG_USED;
 	if(s->kind == INFOTYPE_CLASS) {
@@ -185,6 +193,8 @@ void registry_resolve_all()
 {
     while(unresolved) {
         slotinfo_t*_s = unresolved->slotinfo;
+        if(observer)
+            observer(REGISTRY_RESOLVE, _s->package, _s->name, _s);
         if(_s->kind == INFOTYPE_CLASS) {
             resolve_on_class(_s);
         } else if(_s->kind == INFOTYPE_METHOD || _s->kind == INFOTYPE_VAR) {
@@ -196,6 +206,20 @@ void registry_resolve_all()
         unresolved = unresolved->next;
         free(tofree);
     }
+    if(observer)
+        observer(REGISTRY_RESOLVE, 0, 0, 0);
+}
+void registry_unregister(slotinfo_t*s)
+{
+    dict_del(registry_classes, s);
+    /* (the start of a list also stores its length, so build a new one) */
+    slotinfo_list_t*l, *remaining = 0;
+    for(l=unresolved;l;l=l->next) {
+        if(l->slotinfo != s)
+            list_append(remaining, l->slotinfo);
+    }
+    list_free(unresolved);
+    unresolved = remaining;
 }
 // ------------------------- constructors --------------------------------
 
@@ -213,6 +237,8 @@ classinfo_t* classinfo_register(int access, const char*package, const char*name,
     dict_init2(&c->static_members, &memberinfo_type, AVERAGE_NUMBER_OF_MEMBERS);
 
     schedule_for_resolve((slotinfo_t*)c);
+    if(observer)
+        observer(REGISTRY_DEFINE, package, name, (slotinfo_t*)c);
     return c;
 }
 methodinfo_t* methodinfo_register_onclass(classinfo_t*cls, U8 access, const char*ns, const char*name, char is_static)
@@ -255,6 +281,8 @@ methodinfo_t* methodinfo_register_global(U8 access, const char*package, const ch
     dict_put(registry_classes, m, m);
     
     schedule_for_resolve((slotinfo_t*)m);
+    if(observer)
+        observer(REGISTRY_DEFINE, package, name, (slotinfo_t*)m);
     return m;
 }
 varinfo_t* varinfo_register_global(U8 access, const char*package, const char*name)
@@ -269,6 +297,8 @@ varinfo_t* varinfo_register_global(U8 access, const char*package, const char*nam
     dict_put(registry_classes, m, m);
     
     schedule_for_resolve((slotinfo_t*)m);
+    if(observer)
+        observer(REGISTRY_DEFINE, package, name, (slotinfo_t*)m);
     return m;
 }
 
@@ -286,6 +316,8 @@ slotinfo_t* registry_find(const char*package, const char*name)
     tmp.package = package;
     tmp.name = name;
     slotinfo_t* c = (slotinfo_t*)dict_lookup(registry_classes, &tmp);
+    if(observer)
+        observer(REGISTRY_LOOKUP, package, name, c);
     /*if(c)
         printf("%s.%s->%08x (%s.%s)\n", package, name, c, c->package, c->name);*/
     return c;
@@ -312,7 +344,7 @@ void registry_dump()
     }
 }
 
-memberinfo_t* registry_findmember(classinfo_t*cls, const char*ns, const char*name, char recursive, char is_static)
+static memberinfo_t* findmember(classinfo_t*cls, const char*ns, const char*name, char recursive, char is_static)
 {
     memberinfo_t tmp;
     tmp.name = name;
@@ -365,6 +397,17 @@ memberinfo_t* registry_findmember(classinfo_t*cls, const char*ns, const char*nam
     return 0;
 }
 
+memberinfo_t* registry_findmember(classinfo_t*cls, const char*ns, const char*name, char recursive, char is_static)
+{
+    memberinfo_t*m = findmember(cls, ns, name, recursive, is_static);
+    if(observer) {
+        observer(REGISTRY_LOOKUP, cls->package, cls->name, (slotinfo_t*)cls);
+        if(m)
+            observer(REGISTRY_LOOKUP, m->package, m->name, (slotinfo_t*)m);
+    }
+    return m;
+}
+
 memberinfo_t* registry_findmember_nsset(classinfo_t*cls, namespace_list_t*ns, const char*name, char superclasses, char is_static)
 {
     memberinfo_t*m = 0;
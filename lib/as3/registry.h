@@ -123,6 +123,17 @@ varinfo_t* varinfo_register_global(U8 access, const char*package, const char*nam
 
 slotinfo_t* registry_resolve(slotinfo_t*s);
 void registry_resolve_all();
+void registry_unregister(slotinfo_t*s);
+
+/* the registry observer is notified about every definition, lookup and use
+   of a (global) slot. This is used by the compilation cache (cache.c) to track
+   which files depend on which other files. */
+#define REGISTRY_DEFINE 1
+#define REGISTRY_LOOKUP 2
+#define REGISTRY_RESOLVE 3
+#define REGISTRY_USE 4
+typedef void (*registry_observer_t)(int event, const char*package, const char*name, slotinfo_t*s);
+void registry_set_observer(registry_observer_t observer);
 
 slotinfo_t* registry_find(const char*package, const char*name);
 void registry_dump();
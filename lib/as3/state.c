@@ -1,5 +1,6 @@
 #include "state.h"
 #include "common.h"
+#include "cache.h"
 
 state_t* state = 0;
 
@@ -89,7 +90,9 @@ void as3_set_define(const char*c)
 {
     if(!definitions) 
         definitions = dict_new();
-    if(!dict_contains(definitions,c))
+    if(!dict_contains(definitions,c)) {
         dict_put(definitions,c,0);
+        as3cache_addoption("define", c, strlen(c));
+    }
 }
 
@@ -646,6 +646,10 @@ static void writer_zlibdeflate_finish(writer_t*writer)
 #endif
 }
 void writer_init_zlibdeflate(writer_t*w, writer_t*output)
+{
+    writer_init_zlibdeflate2(w, output, 9);
+}
+void writer_init_zlibdeflate2(writer_t*w, writer_t*output, int level)
 {
 #ifdef HAVE_ZLIB
     zlibdeflate_t*z;
@@ -664,7 +668,7 @@ void writer_init_zlibdeflate(writer_t*w, writer_t*output)
     z->zs.zalloc = Z_NULL;
     z->zs.zfree  = Z_NULL;
     z->zs.opaque = Z_NULL;
-    ret = deflateInit(&z->zs, 9);
+    ret = deflateInit(&z->zs, level);
     if (ret != Z_OK) zlib_error(ret, "bitio:deflate_init", &z->zs);
     w->bitpos = 0;
     w->mybyte = 0;
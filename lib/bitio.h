@@ -30,6 +30,10 @@
 #ifndef __rfxswf_bitio_h__
 #define __rfxswf_bitio_h__
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define READER_TYPE_FILE 1
 #define READER_TYPE_MEM  2
 #define READER_TYPE_ZLIB_U 3
@@ -115,6 +119,7 @@ void reader_init_zzipreader(reader_t*r,ZZIP_FILE*z);
 void writer_init_filewriter(writer_t*w, int handle);
 void writer_init_filewriter2(writer_t*w, char*filename);
 void writer_init_zlibdeflate(writer_t*w, writer_t*output);
+void writer_init_zlibdeflate2(writer_t*w, writer_t*output, int level);
 void writer_init_memwriter(writer_t*r, void*data, int length);
 void writer_init_nullwriter(writer_t*w);
 
@@ -123,4 +128,8 @@ void* writer_growmemwrite_memptr(writer_t*w, int*len);
 void* writer_growmemwrite_getmem(writer_t*w);
 void writer_growmemwrite_reset(writer_t*w);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //__rfxswf_bitio_h__
@@ -114,6 +114,8 @@ void ops_fillbitmap(struct _gfxdevice*dev, gfxline_t*line, gfximage_t*img, gfxma
     gfximage_t img2;
     img2.width = img->width;
     img2.height = img->height;
+    img2.jpeg = 0;
+    img2.jpeg_size = 0;
     img2.data = (gfxcolor_t*)malloc(img->width*img->height*4);
     int x,y; 
     for(y=0;y<img->height;y++)  {
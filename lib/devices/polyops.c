@@ -33,6 +33,7 @@
 #include "../gfxtools.h"
 #include "../gfxpoly.h"
 #include "../log.h"
+#include "../stats.h"
 #include "polyops.h"
 
 typedef struct _clip {
@@ -91,6 +92,9 @@ void polyops_startclip(struct _gfxdevice*dev, gfxline_t*line)
     dbg("polyops_startclip");
     internal_t*i = (internal_t*)dev->internal;
 
+    stats_timer_t timer;
+    stats_timer_start(&timer, "polyops.clip");
+
     gfxpoly_t* oldclip = i->clip?i->clip->poly:0;
     gfxpoly_t* poly = gfxpoly_from_fill(line, DEFAULT_GRID);
     if(poly) 
@@ -145,6 +149,8 @@ void polyops_startclip(struct _gfxdevice*dev, gfxline_t*line)
     i->clip->next = n;
     i->clip->poly = currentclip;
     i->clip->openclips = type;
+
+    stats_timer_stop(&timer);
 }
 
 void polyops_endclip(struct _gfxdevice*dev)
@@ -183,6 +189,8 @@ static void addtounion(struct _gfxdevice*dev, gfxpoly_t*poly)
 static gfxline_t* handle_poly(gfxdevice_t*dev, gfxpoly_t*poly, char*ok)
 {
     internal_t*i = (internal_t*)dev->internal;
+    stats_timer_t timer;
+    stats_timer_start(&timer, "polyops.intersect");
     if(i->clip && i->clip->poly) {
 	gfxpoly_t*old = poly;
 	if(poly) {
@@ -203,6 +211,7 @@ static gfxline_t* handle_poly(gfxdevice_t*dev, gfxpoly_t*poly, char*ok)
 	gfxline_t*line = gfxline_from_gfxpoly(poly);
 	gfxpoly_destroy(poly);
         *ok = 1;
+	stats_timer_stop(&timer);
 	return line;
     } else {
 	if(i->clip && i->clip->poly) {
@@ -214,8 +223,10 @@ static gfxline_t* handle_poly(gfxdevice_t*dev, gfxpoly_t*poly, char*ok)
 	    gfxline_free(clipline);
 	    gfxpoly_destroy(i->clip->poly);i->clip->poly = 0;
 	    i->clip->openclips++;
+	    stats_timer_stop(&timer);
 	    return 0;
 	} else {
+	    stats_timer_stop(&timer);
 	    return 0;
 	}
     }
@@ -226,7 +237,10 @@ void polyops_stroke(struct _gfxdevice*dev, gfxline_t*line, gfxcoord_t width, gfx
     dbg("polyops_stroke");
     internal_t*i = (internal_t*)dev->internal;
 
+    stats_timer_t timer;
+    stats_timer_start(&timer, "polyops.convert");
     gfxpoly_t* poly = gfxpoly_from_stroke(line, width, cap_style, joint_style, miterLimit, DEFAULT_GRID);
+    stats_timer_stop(&timer);
     char ok = 0;
     gfxline_t*line2 = handle_poly(dev, poly, &ok);
 
@@ -244,7 +258,10 @@ void polyops_fill(struct _gfxdevice*dev, gfxline_t*line, gfxcolor_t*color)
     dbg("polyops_fill");
     internal_t*i = (internal_t*)dev->internal;
 
+    stats_timer_t timer;
+    stats_timer_start(&timer, "polyops.convert");
     gfxpoly_t*poly = gfxpoly_from_fill(line, DEFAULT_GRID);
+    stats_timer_stop(&timer);
     char ok = 0;
     gfxline_t*line2 = handle_poly(dev, poly, &ok);
 
@@ -261,7 +278,10 @@ void polyops_fillbitmap(struct _gfxdevice*dev, gfxline_t*line, gfximage_t*img, g
     dbg("polyops_fillbitmap");
     internal_t*i = (internal_t*)dev->internal;
     
+    stats_timer_t timer;
+    stats_timer_start(&timer, "polyops.convert");
     gfxpoly_t*poly = gfxpoly_from_fill(line, DEFAULT_GRID);
+    stats_timer_stop(&timer);
     char ok = 0;
     gfxline_t*line2 = handle_poly(dev, poly, &ok);
 
@@ -278,7 +298,10 @@ void polyops_fillgradient(struct _gfxdevice*dev, gfxline_t*line, gfxgradient_t*g
     dbg("polyops_fillgradient");
     internal_t*i = (internal_t*)dev->internal;
     
+    stats_timer_t timer;
+    stats_timer_start(&timer, "polyops.convert");
     gfxpoly_t*poly = gfxpoly_from_fill(line, DEFAULT_GRID);
+    stats_timer_stop(&timer);
     char ok = 0;
     gfxline_t*line2 = handle_poly(dev, poly, &ok);
 
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #endif
 #include <memory.h>
+#include <fcntl.h>
 #ifdef HAVE_IO_H
 #include <io.h>
 #endif
@@ -51,9 +52,21 @@
 //#define FILTER_IMAGES
 
 typedef struct _state {
-    char*last_string[16];
-    gfxcolor_t last_color[16];
-    gfxmatrix_t last_matrix[16];
+    /* fixed point units per pixel for coordinates, 0 = store doubles */
+    int precision;
+
+    /* coordinates are delta coded against the previous point of the
+       same line, and character positions against the previous character */
+    int lastx, lasty;
+    int charx, chary;
+
+    gfxcolor_t last_color;
+    gfxmatrix_t last_matrix;
+
+    /* font ids are stored only once per stream, and then referenced by number */
+    gfxfontlist_t*font_ids; // writing: font -> number+1
+    char**font_table; // reading: number -> id
+    int num_fonts;
 
 #ifdef STATS
     int size_matrices;
@@ -66,23 +79,182 @@ typedef struct _state {
 #endif
 } state_t;
 
+/* offsets of the pages, and of the operations outside of pages which a page
+   might depend on (fonts, parameters). Written to the end of uncompressed
+   recordings, and used for replaying single pages. */
+typedef struct _recordindex {
+    int*pages;
+    int num_pages;
+    int*globals;
+    int num_globals;
+} recordindex_t;
+
 typedef struct _internal {
     gfxfontlist_t* fontlist;
+    gfxfontlist_t* external_fonts;
     state_t state;
 
     writer_t w;
+    writer_t spillw; // the spill writer below i->w, if compressing
     int cliplevel;
     char use_tempfile;
-    char*filename;
+    char compress;
+    recordindex_t index;
 } internal_t;
 
 typedef struct _internal_result {
     char use_tempfile;
+    char compress;
+    char keep_file; // filename was passed to gfxresult_record_load(), and isn't ours to delete
     char*filename;
     void*data;
     int length;
+    recordindex_t index;
 } internal_result_t;
 
+/* ------------------------------ spill writer -------------------------------- */
+
+/* The spill writer keeps the recording in memory until it exceeds max_memory
+   bytes, and only then moves it to a tempfile. After that, the memory
+   block is used as write buffer for the file. */
+
+#define SPILL_BUFFER_SIZE 65536
+
+static int record_max_memory = 32*1048576;
+
+typedef struct _spillwrite {
+    unsigned char*data;
+    int length;
+    int size;
+    int max_memory;
+    int handle; // -1 as long as everything is in memory
+    char*filename;
+} spillwrite_t;
+
+static void spillwrite_flushbuffer(spillwrite_t*s)
+{
+    if(s->length && write(s->handle, s->data, s->length) != s->length) {
+	msg("<fatal> Couldn't write to tempfile %s", s->filename);
+	exit(1);
+    }
+    s->length = 0;
+}
+static void spillwrite_spill(spillwrite_t*s)
+{
+    char buffer[128];
+    s->filename = strdup(mktempname(buffer, "gfx"));
+    s->handle = open(s->filename,
+#ifdef O_BINARY
+	    O_BINARY|
+#endif
+	    O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if(s->handle<0) {
+	msg("<fatal> Couldn't create tempfile %s", s->filename);
+	exit(1);
+    }
+    msg("<verbose> record: spilling %d bytes to %s", s->length, s->filename);
+    spillwrite_flushbuffer(s);
+    if(s->size > SPILL_BUFFER_SIZE) {
+	s->size = SPILL_BUFFER_SIZE;
+	s->data = (unsigned char*)rfx_realloc(s->data, s->size);
+    }
+}
+static int spillwrite_write(writer_t*w, void*data, int len)
+{
+    spillwrite_t*s = (spillwrite_t*)w->internal;
+    if(s->handle<0 && s->length+len > s->max_memory) {
+	spillwrite_spill(s);
+    }
+    if(s->length+len > s->size) {
+	if(s->handle>=0) {
+	    spillwrite_flushbuffer(s);
+	    if(len > s->size) {
+		if(write(s->handle, data, len) != len) {
+		    msg("<fatal> Couldn't write to tempfile %s", s->filename);
+		    exit(1);
+		}
+		w->pos += len;
+		return len;
+	    }
+	} else {
+	    while(s->length+len > s->size)
+		s->size = s->size ? s->size*2 : 65536;
+	    s->data = (unsigned char*)rfx_realloc(s->data, s->size);
+	}
+    }
+    memcpy(s->data+s->length, data, len);
+    s->length += len;
+    w->pos += len;
+    return len;
+}
+static void spillwrite_flush(writer_t*w)
+{
+    spillwrite_t*s = (spillwrite_t*)w->internal;
+    if(s->handle>=0)
+	spillwrite_flushbuffer(s);
+}
+static void spillwrite_finish(writer_t*w)
+{
+    spillwrite_t*s = (spillwrite_t*)w->internal;
+    if(s->handle>=0) {
+	close(s->handle);
+    }
+    if(s->data)
+	free(s->data);
+    if(s->filename) {
+	unlink(s->filename);
+	free(s->filename);
+    }
+    free(s);
+    memset(w, 0, sizeof(writer_t));
+}
+static void writer_init_spillwriter(writer_t*w, int max_memory)
+{
+    spillwrite_t*s = (spillwrite_t*)rfx_calloc(sizeof(spillwrite_t));
+    s->max_memory = max_memory;
+    s->handle = -1;
+    memset(w, 0, sizeof(writer_t));
+    w->write = spillwrite_write;
+    w->flush = spillwrite_flush;
+    w->finish = spillwrite_finish;
+    w->internal = s;
+}
+/* returns a reader for everything written so far. If the data was spilled
+   to disk, the tempfile is mapped into memory (*file), which the caller
+   needs to memfile_close() after reading. Returns 0 if the tempfile
+   can't be mapped. */
+static char spillwrite_getreader(writer_t*w, reader_t*r, memfile_t**file)
+{
+    spillwrite_t*s = (spillwrite_t*)w->internal;
+    *file = 0;
+    if(s->handle<0) {
+	reader_init_memreader(r, s->data, s->length);
+    } else {
+	spillwrite_flushbuffer(s);
+	*file = memfile_open(s->filename);
+	if(!*file) {
+	    msg("<error> record: couldn't map %s, can't replay", s->filename);
+	    return 0;
+	}
+	reader_init_memreader(r, (*file)->data, (*file)->len);
+    }
+    return 1;
+}
+/* discard everything written so far, and go back to memory */
+static void spillwrite_reset(writer_t*w)
+{
+    spillwrite_t*s = (spillwrite_t*)w->internal;
+    if(s->handle>=0) {
+	close(s->handle);
+	s->handle = -1;
+	unlink(s->filename);
+	free(s->filename);
+	s->filename = 0;
+    }
+    s->length = 0;
+    w->pos = 0;
+}
+
 #define OP_END 0x00
 #define OP_SETPARAM 0x01
 #define OP_STROKE 0x02
@@ -98,8 +270,20 @@ typedef struct _internal_result {
 #define OP_ENDPAGE 0x0c
 #define OP_FINISH 0x0d
 
-#define FLAG_SAME_AS_LAST 0x10
+/* flags for OP_DRAWCHAR */
+#define FLAG_SAME_MATRIX 0x10
 #define FLAG_ZERO_FONT 0x20
+#define FLAG_FONT_REF 0x40
+#define FLAG_SAME_COLOR 0x80
+
+/* flags for OP_ADDFONT */
+#define FLAG_EXTERNAL_FONT 0x10
+
+/* uncompressed recordings end with an index of the pages:
+   U32 num_globals, U32 globals[num_globals],
+   U32 num_pages, U32 pages[num_pages],
+   U32 index_start, "GRIX" */
+#define INDEX_MAGIC "GRIX"
 
 #define LINE_MOVETO 0x0e
 #define LINE_LINETO 0x0f
@@ -107,43 +291,61 @@ typedef struct _internal_result {
 
 /* ----------------- reading/writing of low level primitives -------------- */
 
+static void dumpCoord(writer_t*w, state_t*state, double v, int*last)
+{
+    if(!state->precision) {
+	writer_writeDouble(w, v);
+	return;
+    }
+    /* clamp, so that deltas always fit into an int */
+    double f = v*state->precision;
+    if(f > 0x1fffffff) f = 0x1fffffff;
+    if(f < -0x1fffffff) f = -0x1fffffff;
+    int i = (int)floor(f+0.5);
+    write_compressed_int(w, i - *last);
+    *last = i;
+}
+static double readCoord(reader_t*r, state_t*state, int*last)
+{
+    if(!state->precision)
+	return reader_readDouble(r);
+    *last += read_compressed_int(r);
+    return *last / (double)state->precision;
+}
+
 static void dumpLine(writer_t*w, state_t*state, gfxline_t*line)
 {
+#ifdef STATS
+    int oldpos = w->pos;
+#endif
+    state->lastx = state->lasty = 0;
     while(line) {
 	if(line->type == gfx_moveTo) {
 	    writer_writeU8(w, LINE_MOVETO);
-	    writer_writeDouble(w, line->x);
-	    writer_writeDouble(w, line->y);
-#ifdef STATS
-	    state->size_lines += 1+8+8;
-#endif
+	    dumpCoord(w, state, line->x, &state->lastx);
+	    dumpCoord(w, state, line->y, &state->lasty);
 	} else if(line->type == gfx_lineTo) {
 	    writer_writeU8(w, LINE_LINETO);
-	    writer_writeDouble(w, line->x);
-	    writer_writeDouble(w, line->y);
-#ifdef STATS
-	    state->size_lines += 1+8+8;
-#endif
+	    dumpCoord(w, state, line->x, &state->lastx);
+	    dumpCoord(w, state, line->y, &state->lasty);
 	} else if(line->type == gfx_splineTo) {
 	    writer_writeU8(w, LINE_SPLINETO);
-	    writer_writeDouble(w, line->x);
-	    writer_writeDouble(w, line->y);
-	    writer_writeDouble(w, line->sx);
-	    writer_writeDouble(w, line->sy);
-#ifdef STATS
-	    state->size_lines += 1+8+8+8+8;
-#endif
+	    dumpCoord(w, state, line->x, &state->lastx);
+	    dumpCoord(w, state, line->y, &state->lasty);
+	    dumpCoord(w, state, line->sx, &state->lastx);
+	    dumpCoord(w, state, line->sy, &state->lasty);
 	}
 	line = line->next;
     }
     writer_writeU8(w, OP_END);
 #ifdef STATS
-    state->size_lines += 1;
+    state->size_lines += w->pos - oldpos;
 #endif
 }
 static gfxline_t* readLine(reader_t*r, state_t*s)
 {
     gfxline_t*start = 0, *pos = 0;
+    s->lastx = s->lasty = 0;
     while(1) {
 	unsigned char op = reader_readU8(r);
 	if(op == OP_END)
@@ -157,18 +359,18 @@ static gfxline_t* readLine(reader_t*r, state_t*s)
 	}
 	if(op == LINE_MOVETO) {
 	    line->type = gfx_moveTo;
-	    line->x = reader_readDouble(r);
-	    line->y = reader_readDouble(r);
+	    line->x = readCoord(r, s, &s->lastx);
+	    line->y = readCoord(r, s, &s->lasty);
 	} else if(op == LINE_LINETO) {
 	    line->type = gfx_lineTo;
-	    line->x = reader_readDouble(r);
-	    line->y = reader_readDouble(r);
+	    line->x = readCoord(r, s, &s->lastx);
+	    line->y = readCoord(r, s, &s->lasty);
 	} else if(op == LINE_SPLINETO) {
 	    line->type = gfx_splineTo;
-	    line->x = reader_readDouble(r);
-	    line->y = reader_readDouble(r);
-	    line->sx = reader_readDouble(r);
-	    line->sy = reader_readDouble(r);
+	    line->x = readCoord(r, s, &s->lastx);
+	    line->y = readCoord(r, s, &s->lasty);
+	    line->sx = readCoord(r, s, &s->lastx);
+	    line->sy = readCoord(r, s, &s->lasty);
 	}
     }
     return start;
@@ -224,6 +426,9 @@ static void dumpImage(writer_t*w, state_t*state, gfximage_t*img)
 #else
     w->write(w, img->data, img->width*img->height*sizeof(gfxcolor_t));
 #endif
+    writer_writeU32(w, img->jpeg?img->jpeg_size:0);
+    if(img->jpeg)
+	w->write(w, img->jpeg, img->jpeg_size);
 #ifdef STATS
     state->size_images += w->pos - oldpos;
 #endif
@@ -267,6 +472,12 @@ static gfximage_t readImage(reader_t*r, state_t*state)
 #else
     r->read(r, img.data, size);
 #endif
+    img.jpeg_size = reader_readU32(r);
+    img.jpeg = 0;
+    if(img.jpeg_size) {
+	img.jpeg = malloc(img.jpeg_size);
+	r->read(r, img.jpeg, img.jpeg_size);
+    }
     return img;
 }
 
@@ -295,16 +506,19 @@ static gfxmatrix_t readMatrix(reader_t*r, state_t*state)
 }
 static void dumpXY(writer_t*w, state_t*state, gfxmatrix_t*matrix)
 {
-    writer_writeDouble(w, matrix->tx);
-    writer_writeDouble(w, matrix->ty);
 #ifdef STATS
-    state->size_positions += 2*8;
+    int oldpos = w->pos;
+#endif
+    dumpCoord(w, state, matrix->tx, &state->charx);
+    dumpCoord(w, state, matrix->ty, &state->chary);
+#ifdef STATS
+    state->size_positions += w->pos - oldpos;
 #endif
 }
 static void readXY(reader_t*r, state_t*state, gfxmatrix_t*m)
 {
-    m->tx = reader_readDouble(r);
-    m->ty = reader_readDouble(r);
+    m->tx = readCoord(r, state, &state->charx);
+    m->ty = readCoord(r, state, &state->chary);
 }
 
 static void dumpColor(writer_t*w, state_t*state, gfxcolor_t*color)
@@ -441,51 +655,127 @@ static gfxfont_t*readFont(reader_t*r, state_t*state)
 
 /* ----------------- reading/writing of primitives with caching -------------- */
 
+static void state_init(state_t*state, int precision)
+{
+    memset(state, 0, sizeof(state_t));
+    state->precision = precision;
+}
+
 void state_clear(state_t*state)
 {
-    int t;
-    for(t=0;t<sizeof(state->last_string)/sizeof(state->last_string[0]);t++) {
-	if(state->last_string[t]) {
-	    free(state->last_string[t]);
-	    state->last_string[t] = 0;
+    if(state->font_ids) {
+	gfxfontlist_free(state->font_ids, 0);
+	state->font_ids = 0;
+    }
+    if(state->font_table) {
+	int t;
+	for(t=0;t<state->num_fonts;t++) {
+	    free(state->font_table[t]);
 	}
+	free(state->font_table);
+	state->font_table = 0;
     }
+    state->num_fonts = 0;
 }
 
-static char* read_string(reader_t*r, state_t*state, U8 id, U8 flags)
+static void writeHeader(writer_t*w, state_t*state)
 {
-    assert(id>=0 && id<16);
-    if(flags&FLAG_SAME_AS_LAST) {
-	assert(state->last_string[id]);
-	return strdup(state->last_string[id]);
+    writer_writeU8(w, 'G');
+    writer_writeU8(w, 'R');
+    writer_writeU8(w, RECORD_VERSION);
+    write_compressed_uint(w, state->precision);
+}
+static char readHeader(reader_t*r, state_t*state)
+{
+    U8 g = reader_readU8(r);
+    U8 rr = reader_readU8(r);
+    U8 version = reader_readU8(r);
+    if(g!='G' || rr!='R' || version!=RECORD_VERSION) {
+	msg("<error> Not a (version %d) gfx recording", RECORD_VERSION);
+	return 0;
     }
-    char*s = reader_readString(r);
-    if(state->last_string[id]) {
-	free(state->last_string[id]);
+    state_init(state, read_compressed_uint(r));
+    return 1;
+}
+
+/* returns the number of an already stored font id, or -1 (and registers
+   the id) if it needs to be written out */
+static int lookup_fontid(state_t*state, gfxfont_t*font)
+{
+    int nr = (int)(ptroff_t)gfxfontlist_getuserdata(state->font_ids, font->id);
+    if(nr) {
+	return nr-1;
     }
-    state->last_string[id] = strdup(s);
-    return s;
+    state->font_ids = gfxfontlist_addfont2(state->font_ids, font, (void*)(ptroff_t)(++state->num_fonts));
+    return -1;
 }
-static gfxcolor_t read_color(reader_t*r, state_t*state, U8 id, U8 flags)
+static char* read_fontid(reader_t*r, state_t*state, U8 flags)
 {
-    assert(id>=0 && id<16);
-    if(flags&FLAG_SAME_AS_LAST)
-	return state->last_color[id];
-    gfxcolor_t c = readColor(r, state);
-    state->last_color[id] = c;
-    return c;
+    if(flags&FLAG_FONT_REF) {
+	unsigned int nr = read_compressed_uint(r);
+	if(nr >= state->num_fonts) {
+	    msg("<error> Invalid font reference %d in recording", nr);
+	    return 0;
+	}
+	return state->font_table[nr];
+    }
+    char*id = reader_readString(r);
+    state->font_table = (char**)rfx_realloc(state->font_table, sizeof(char*)*(state->num_fonts+1));
+    state->font_table[state->num_fonts++] = id;
+    return id;
 }
-static gfxmatrix_t read_matrix(reader_t*r, state_t*state, U8 id, U8 flags)
+
+/* ---------------------------- page index ------------------------------------ */
+
+static void index_add(int**list, int*num, int pos)
 {
-    assert(id>=0 && id<16);
-    if(flags&FLAG_SAME_AS_LAST) {
-	gfxmatrix_t m = state->last_matrix[id];
-	readXY(r, state, &m);
-	return m;
+    if(!(*num&63)) {
+	*list = (int*)rfx_realloc(*list, sizeof(int)*(*num+64));
     }
-    gfxmatrix_t m = readMatrix(r, state);
-    state->last_matrix[id] = m;
-    return m;
+    (*list)[(*num)++] = pos;
+}
+static void index_clear(recordindex_t*index)
+{
+    if(index->pages)
+	free(index->pages);
+    if(index->globals)
+	free(index->globals);
+    memset(index, 0, sizeof(recordindex_t));
+}
+static void writeIndex(writer_t*w, recordindex_t*index)
+{
+    int start = w->pos;
+    int t;
+    writer_writeU32(w, index->num_globals);
+    for(t=0;t<index->num_globals;t++)
+	writer_writeU32(w, index->globals[t]);
+    writer_writeU32(w, index->num_pages);
+    for(t=0;t<index->num_pages;t++)
+	writer_writeU32(w, index->pages[t]);
+    writer_writeU32(w, start);
+    w->write(w, INDEX_MAGIC, 4);
+}
+static char readIndex(void*data, int len, recordindex_t*index)
+{
+    memset(index, 0, sizeof(recordindex_t));
+    if(len < 8 || memcmp((char*)data+len-4, INDEX_MAGIC, 4))
+	return 0;
+    reader_t r;
+    reader_init_memreader(&r, data, len-4);
+    r.seek(&r, len-8);
+    int start = reader_readU32(&r);
+    if(start<0 || start >= len-8 || r.seek(&r, start)<0) {
+	r.dealloc(&r);
+	return 0;
+    }
+    int num = reader_readU32(&r), t;
+    for(t=0;t<num && r.pos<len-8;t++)
+	index_add(&index->globals, &index->num_globals, reader_readU32(&r));
+    num = reader_readU32(&r);
+    for(t=0;t<num && r.pos<len-8;t++)
+	index_add(&index->pages, &index->num_pages, reader_readU32(&r));
+    r.dealloc(&r);
+    return 1;
 }
 
 /* --------------------------- record device operations ---------------------- */
@@ -494,6 +784,7 @@ static int record_setparameter(struct _gfxdevice*dev, const char*key, const char
 {
     internal_t*i = (internal_t*)dev->internal;
     msg("<trace> record: %08x SETPARAM %s %s\n", dev, key, value);
+    index_add(&i->index.globals, &i->index.num_globals, i->w.pos);
     writer_writeU8(&i->w, OP_SETPARAM);
     writer_writeString(&i->w, key);
     writer_writeString(&i->w, value);
@@ -569,8 +860,14 @@ static void record_addfont(struct _gfxdevice*dev, gfxfont_t*font)
     internal_t*i = (internal_t*)dev->internal;
     msg("<trace> record: %08x ADDFONT %s\n", dev, font->id);
     if(font && !gfxfontlist_hasfont(i->fontlist, font)) {
-	writer_writeU8(&i->w, OP_ADDFONT);
-	dumpFont(&i->w, &i->state, font);
+	index_add(&i->index.globals, &i->index.num_globals, i->w.pos);
+	if(gfxfontlist_hasfont(i->external_fonts, font)) {
+	    writer_writeU8(&i->w, OP_ADDFONT|FLAG_EXTERNAL_FONT);
+	    writer_writeString(&i->w, font->id);
+	} else {
+	    writer_writeU8(&i->w, OP_ADDFONT);
+	    dumpFont(&i->w, &i->state, font);
+	}
 	i->fontlist = gfxfontlist_addfont(i->fontlist, font);
     }
 }
@@ -583,53 +880,63 @@ static void record_drawchar(struct _gfxdevice*dev, gfxfont_t*font, int glyphnr,
     }
 
     msg("<trace> record: %08x DRAWCHAR %d\n", glyphnr, dev);
+#ifdef STATS
+    int oldpos = i->w.pos;
+#endif
     const char*font_id = (font&&font->id)?font->id:"*NULL*";
-    
-    gfxmatrix_t*l = &i->state.last_matrix[OP_DRAWCHAR];
+    state_t*state = &i->state;
+    gfxmatrix_t*l = &state->last_matrix;
 
     U8 flags = 0;
-    if(!font)
+    int fontnr = -1;
+    if(!font) {
 	flags |= FLAG_ZERO_FONT;
-
-    char same_font = i->state.last_string[OP_DRAWCHAR] && !strcmp(i->state.last_string[OP_DRAWCHAR], font_id);
-    char same_matrix = (l->m00 == matrix->m00) && (l->m01 == matrix->m01) && (l->m10 == matrix->m10) && (l->m11 == matrix->m11);
-    char same_color = !memcmp(color, &i->state.last_color[OP_DRAWCHAR], sizeof(gfxcolor_t));
-
-    /* FIXME
-    if(same_font && same_matrix && same_color)
-	flags |= FLAG_SAME_AS_LAST;
-    */
+    } else if((fontnr = lookup_fontid(state, font)) >= 0) {
+	flags |= FLAG_FONT_REF;
+    }
+    if(!memcmp(color, &state->last_color, sizeof(gfxcolor_t)))
+	flags |= FLAG_SAME_COLOR;
+    if((l->m00 == matrix->m00) && (l->m01 == matrix->m01) && (l->m10 == matrix->m10) && (l->m11 == matrix->m11))
+	flags |= FLAG_SAME_MATRIX;
 
     writer_writeU8(&i->w, OP_DRAWCHAR|flags);
-    writer_writeU32(&i->w, glyphnr);
+    write_compressed_uint(&i->w, glyphnr);
+
+    if(flags&FLAG_FONT_REF)
+	write_compressed_uint(&i->w, fontnr);
+    else if(!(flags&FLAG_ZERO_FONT))
+	writer_writeString(&i->w, font_id);
+    if(!(flags&FLAG_SAME_COLOR)) {
+	dumpColor(&i->w, state, color);
+	state->last_color = *color;
+    }
+    if(!(flags&FLAG_SAME_MATRIX)) {
+	writer_writeDouble(&i->w, matrix->m00);
+	writer_writeDouble(&i->w, matrix->m01);
+	writer_writeDouble(&i->w, matrix->m10);
+	writer_writeDouble(&i->w, matrix->m11);
+	*l = *matrix;
+    }
+    dumpXY(&i->w, state, matrix);
 #ifdef STATS
-    i->state.size_chars += 5;
+    state->size_chars += i->w.pos - oldpos;
 #endif
-
-    if(!(flags&FLAG_SAME_AS_LAST)) {
-	if(!(flags&FLAG_ZERO_FONT))
-	    writer_writeString(&i->w, font_id);
-	dumpColor(&i->w, &i->state, color);
-	dumpMatrix(&i->w, &i->state, matrix);
-
-	if(i->state.last_string[OP_DRAWCHAR])
-	    free(i->state.last_string[OP_DRAWCHAR]);
-	i->state.last_string[OP_DRAWCHAR] = strdup(font_id);
-
-	i->state.last_color[OP_DRAWCHAR] = *color;
-	i->state.last_matrix[OP_DRAWCHAR] = *matrix;
-    } else {
-	dumpXY(&i->w, &i->state, matrix);
-    }
 }
 
 static void record_startpage(struct _gfxdevice*dev, int width, int height)
 {
     internal_t*i = (internal_t*)dev->internal;
     msg("<trace> record: %08x STARTPAGE\n", dev);
+    index_add(&i->index.pages, &i->index.num_pages, i->w.pos);
     writer_writeU8(&i->w, OP_STARTPAGE);
     writer_writeU16(&i->w, width);
     writer_writeU16(&i->w, height);
+
+    /* pages don't depend on the font references, colors etc. of previous
+       pages, so that they can be replayed individually */
+    int precision = i->state.precision;
+    state_clear(&i->state);
+    state_init(&i->state, precision);
 }
 
 static void record_endpage(struct _gfxdevice*dev)
@@ -651,7 +958,187 @@ static void record_drawlink(struct _gfxdevice*dev, gfxline_t*line, const char*ac
 
 /* ------------------------------- replaying --------------------------------- */
 
-static void replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontlist_t**fontlist)
+/* replays a single operation, and returns its opcode (-1 at the end of the data) */
+static int replay_op(internal_t*i, gfxdevice_t*out, reader_t*r, state_t*state, gfxfontlist_t**fontlist)
+{
+    unsigned char op;
+    if(r->read(r, &op, 1)!=1)
+	return -1;
+    unsigned char flags = op&0xf0;
+    op&=0x0f;
+
+    switch(op) {
+	case OP_END:
+	    break;
+	case OP_SETPARAM: {
+	    msg("<trace> replay: SETPARAM");
+	    char*key;
+	    char*value;
+	    key = reader_readString(r);
+	    value = reader_readString(r);
+	    out->setparameter(out, key, value);
+	    free(key);
+	    free(value);
+	    break;
+	}
+	case OP_STARTPAGE: {
+	    msg("<trace> replay: STARTPAGE");
+	    U16 width = reader_readU16(r);
+	    U16 height = reader_readU16(r);
+	    out->startpage(out, width, height);
+	    int precision = state->precision;
+	    state_clear(state);
+	    state_init(state, precision);
+	    break;
+	}
+	case OP_ENDPAGE: {
+	    msg("<trace> replay: ENDPAGE");
+	    out->endpage(out);
+	    break;
+	}
+	case OP_FINISH: {
+	    msg("<trace> replay: FINISH");
+	    break;
+	}
+	case OP_STROKE: {
+	    msg("<trace> replay: STROKE");
+	    double width = reader_readDouble(r);
+	    double miterlimit = reader_readDouble(r);
+	    gfxcolor_t color = readColor(r, state);
+	    gfx_capType captype;
+	    int v = reader_readU8(r);
+	    switch (v) {
+		case 0: captype = gfx_capButt; break;
+		case 1: captype = gfx_capRound; break;
+		case 2: captype = gfx_capSquare; break;
+	    }
+	    gfx_joinType jointtype;
+	    v = reader_readU8(r);
+	    switch (v) {
+		case 0: jointtype = gfx_joinMiter; break;
+		case 1: jointtype = gfx_joinRound; break;
+		case 2: jointtype = gfx_joinBevel; break;
+	    }
+	    gfxline_t* line = readLine(r, state);
+	    out->stroke(out, line, width, &color, captype, jointtype,miterlimit);
+	    gfxline_free(line);
+	    break;
+	}
+	case OP_STARTCLIP: {
+	    msg("<trace> replay: STARTCLIP");
+	    gfxline_t* line = readLine(r, state);
+	    out->startclip(out, line);
+	    gfxline_free(line);
+	    break;
+	}
+	case OP_ENDCLIP: {
+	    msg("<trace> replay: ENDCLIP");
+	    out->endclip(out);
+	    break;
+	}
+	case OP_FILL: {
+	    msg("<trace> replay: FILL");
+	    gfxcolor_t color = readColor(r, state);
+	    gfxline_t* line = readLine(r, state);
+	    out->fill(out, line, &color);
+	    gfxline_free(line);
+	    break;
+	}
+	case OP_FILLBITMAP: {
+	    msg("<trace> replay: FILLBITMAP");
+	    gfximage_t img = readImage(r, state);
+	    gfxmatrix_t matrix = readMatrix(r, state);
+	    gfxline_t* line = readLine(r, state);
+	    gfxcxform_t* cxform = readCXForm(r, state);
+	    out->fillbitmap(out, line, &img, &matrix, cxform);
+	    gfxline_free(line);
+	    if(cxform)
+		free(cxform);
+	    free(img.data);img.data=0;
+	    if(img.jpeg)
+		free(img.jpeg);
+	    break;
+	}
+	case OP_FILLGRADIENT: {
+	    msg("<trace> replay: FILLGRADIENT");
+	    gfxgradienttype_t type;
+	    int v = reader_readU8(r);
+	    switch (v) {
+		case 0: 
+		  type = gfxgradient_radial; break;
+		case 1:
+		  type = gfxgradient_linear; break;
+	    }  
+	    gfxgradient_t*gradient = readGradient(r, state);
+	    gfxmatrix_t matrix = readMatrix(r, state);
+	    gfxline_t* line = readLine(r, state);
+	    out->fillgradient(out, line, gradient, type, &matrix);
+	    break;
+	}
+	case OP_DRAWLINK: {
+	    msg("<trace> replay: DRAWLINK");
+	    gfxline_t* line = readLine(r, state);
+	    char* s = reader_readString(r);
+	    char* t = reader_readString(r);
+	    out->drawlink(out,line,s, t);
+	    gfxline_free(line);
+	    free(s);
+	    break;
+	}
+	case OP_ADDFONT: {
+	    msg("<trace> replay: ADDFONT out=%08x(%s)", out, out->name);
+	    if(flags&FLAG_EXTERNAL_FONT) {
+		char*id = reader_readString(r);
+		gfxfont_t*font = gfxfontlist_findfont(*fontlist, id);
+		if(font) {
+		    out->addfont(out, font);
+		} else {
+		    msg("<error> record: font %s wasn't passed to the replay", id);
+		}
+		free(id);
+		break;
+	    }
+	    gfxfont_t*font = readFont(r, state);
+	    if(!gfxfontlist_hasfont(*fontlist, font)) {
+		*fontlist = gfxfontlist_addfont(*fontlist, font);
+		out->addfont(out, font);
+	    } else {
+		gfxfont_free(font);
+	    }
+	    break;
+	}
+	case OP_DRAWCHAR: {
+	    U32 glyph = read_compressed_uint(r);
+	    char* id = 0;
+	    if(!(flags&FLAG_ZERO_FONT))
+		id = read_fontid(r, state, flags);
+	    if(!(flags&FLAG_SAME_COLOR))
+		state->last_color = readColor(r, state);
+	    gfxmatrix_t*m = &state->last_matrix;
+	    if(!(flags&FLAG_SAME_MATRIX)) {
+		m->m00 = reader_readDouble(r);
+		m->m01 = reader_readDouble(r);
+		m->m10 = reader_readDouble(r);
+		m->m11 = reader_readDouble(r);
+	    }
+	    readXY(r, state, m);
+	    gfxmatrix_t matrix = *m;
+	    gfxcolor_t color = state->last_color;
+
+	    gfxfont_t*font = id?gfxfontlist_findfont(*fontlist, id):0;
+	    if(i && id && !font) {
+		font = gfxfontlist_findfont(i->fontlist, id);
+	    }
+	    msg("<trace> replay: DRAWCHAR font=%s glyph=%d (flags=%d)", id, glyph, flags);
+	    out->drawchar(out, font, glyph, &color, &matrix);
+	    break;
+	}
+    }
+    return op;
+}
+
+/* returns 0 if the recording is broken (or has the wrong version) */
+static char replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontlist_t**fontlist)
 {
     internal_t*i = 0;
     if(dev) {
@@ -664,177 +1151,138 @@ static void replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontli
 
     state_t state;
     memset(&state, 0, sizeof(state));
-
-    while(1) {
-	unsigned char op;
-	if(r->read(r, &op, 1)!=1)
-	    break;
-	unsigned char flags = op&0xf0;
-	op&=0x0f;
-
-	switch(op) {
-	    case OP_END:
-		goto finish;
-	    case OP_SETPARAM: {
-		msg("<trace> replay: SETPARAM");
-		char*key;
-		char*value;
-		key = reader_readString(r);
-		value = reader_readString(r);
-		out->setparameter(out, key, value);
-		free(key);
-		free(value);
-		break;
-	    }
-	    case OP_STARTPAGE: {
-		msg("<trace> replay: STARTPAGE");
-		U16 width = reader_readU16(r);
-		U16 height = reader_readU16(r);
-		out->startpage(out, width, height);
-		break;
-	    }
-	    case OP_ENDPAGE: {
-		msg("<trace> replay: ENDPAGE");
-		out->endpage(out);
-		break;
-	    }
-	    case OP_FINISH: {
-		msg("<trace> replay: FINISH");
-		break;
-	    }
-	    case OP_STROKE: {
-		msg("<trace> replay: STROKE");
-		double width = reader_readDouble(r);
-		double miterlimit = reader_readDouble(r);
-		gfxcolor_t color = readColor(r, &state);
-		gfx_capType captype;
-		int v = reader_readU8(r);
-		switch (v) {
-		    case 0: captype = gfx_capButt; break;
-		    case 1: captype = gfx_capRound; break;
-		    case 2: captype = gfx_capSquare; break;
-		}
-		gfx_joinType jointtype;
-		v = reader_readU8(r);
-		switch (v) {
-		    case 0: jointtype = gfx_joinMiter; break;
-		    case 1: jointtype = gfx_joinRound; break;
-		    case 2: jointtype = gfx_joinBevel; break;
-		}
-		gfxline_t* line = readLine(r, &state);
-		out->stroke(out, line, width, &color, captype, jointtype,miterlimit);
-		gfxline_free(line);
-		break;
-	    }
-	    case OP_STARTCLIP: {
-		msg("<trace> replay: STARTCLIP");
-		gfxline_t* line = readLine(r, &state);
-		out->startclip(out, line);
-		gfxline_free(line);
-		break;
-	    }
-	    case OP_ENDCLIP: {
-		msg("<trace> replay: ENDCLIP");
-		out->endclip(out);
-		break;
-	    }
-	    case OP_FILL: {
-		msg("<trace> replay: FILL");
-		gfxcolor_t color = readColor(r, &state);
-		gfxline_t* line = readLine(r, &state);
-		out->fill(out, line, &color);
-		gfxline_free(line);
-		break;
-	    }
-	    case OP_FILLBITMAP: {
-		msg("<trace> replay: FILLBITMAP");
-		gfximage_t img = readImage(r, &state);
-		gfxmatrix_t matrix = readMatrix(r, &state);
-		gfxline_t* line = readLine(r, &state);
-		gfxcxform_t* cxform = readCXForm(r, &state);
-		out->fillbitmap(out, line, &img, &matrix, cxform);
-		gfxline_free(line);
-		if(cxform)
-		    free(cxform);
-		free(img.data);img.data=0;
-		break;
-	    }
-	    case OP_FILLGRADIENT: {
-		msg("<trace> replay: FILLGRADIENT");
-		gfxgradienttype_t type;
-		int v = reader_readU8(r);
-		switch (v) {
-		    case 0: 
-		      type = gfxgradient_radial; break;
-		    case 1:
-		      type = gfxgradient_linear; break;
-		}  
-		gfxgradient_t*gradient = readGradient(r, &state);
-		gfxmatrix_t matrix = readMatrix(r, &state);
-		gfxline_t* line = readLine(r, &state);
-		out->fillgradient(out, line, gradient, type, &matrix);
-		break;
-	    }
-	    case OP_DRAWLINK: {
-		msg("<trace> replay: DRAWLINK");
-		gfxline_t* line = readLine(r, &state);
-		char* s = reader_readString(r);
-		char* t = reader_readString(r);
-		out->drawlink(out,line,s, t);
-		gfxline_free(line);
-		free(s);
-		break;
-	    }
-	    case OP_ADDFONT: {
-		msg("<trace> replay: ADDFONT out=%08x(%s)", out, out->name);
-		gfxfont_t*font = readFont(r, &state);
-		if(!gfxfontlist_hasfont(*fontlist, font)) {
-		    *fontlist = gfxfontlist_addfont(*fontlist, font);
-		    out->addfont(out, font);
-		} else {
-		    gfxfont_free(font);
-		}
-		break;
-	    }
-	    case OP_DRAWCHAR: {
-		U32 glyph = reader_readU32(r);
-		gfxmatrix_t m = {1,0,0, 0,1,0};
-		char* id = 0;
-		if(!(flags&FLAG_ZERO_FONT))
-		    id = read_string(r, &state, op, flags);
-		gfxcolor_t color = read_color(r, &state, op, flags);
-		gfxmatrix_t matrix = read_matrix(r, &state, op, flags);
-
-		gfxfont_t*font = id?gfxfontlist_findfont(*fontlist, id):0;
-		if(i && !font) {
-		    font = gfxfontlist_findfont(i->fontlist, id);
-		}
-		msg("<trace> replay: DRAWCHAR font=%s glyph=%d (flags=%d)", id, glyph, flags);
-		out->drawchar(out, font, glyph, &color, &matrix);
-		if(id)
-		    free(id);
-		break;
-	    }
-	}
+    char ok = 0;
+    if(readHeader(r, &state)) {
+	int op;
+	do {
+	    op = replay_op(i, out, r, &state, fontlist);
+	} while(op>=0 && op!=OP_END);
+	ok = op==OP_END;
     }
-finish:
+
     state_clear(&state);
     r->dealloc(r);
     if(_fontlist)
 	gfxfontlist_free(_fontlist, 0);
+    return ok;
 }
+
 void gfxresult_record_replay(gfxresult_t*result, gfxdevice_t*device, gfxfontlist_t**fontlist)
 {
     internal_result_t*i = (internal_result_t*)result->internal;
     
     reader_t r;
-    if(i->use_tempfile) {
-	reader_init_filereader2(&r, i->filename);
+    reader_t input;
+    memfile_t*file = 0;
+    if(i->use_tempfile && i->compress) {
+	reader_init_filereader2(&input, i->filename);
+    } else if(i->use_tempfile) {
+	/* map the file, reading it through a file reader would do a read()
+	   call for every single byte */
+	file = memfile_open(i->filename);
+	if(!file) {
+	    msg("<error> record: couldn't map %s, can't replay", i->filename);
+	    return;
+	}
+	reader_init_memreader(&input, file->data, file->len);
     } else {
-	reader_init_memreader(&r, i->data, i->length);
+	reader_init_memreader(&input, i->data, i->length);
+    }
+
+    if(i->compress) {
+	reader_init_zlibinflate(&r, &input);
+	replay(0, device, &r, fontlist);
+	input.dealloc(&input);
+    } else {
+	replay(0, device, &input, fontlist);
+    }
+    if(file) {
+	memfile_close(file);
+    }
+}
+
+char gfxresult_record_replay_memory(const void*data, int len, gfxdevice_t*device, gfxfontlist_t**fontlist)
+{
+    /* check the header and the index first, so that nothing is drawn
+       if the data is from another version, or truncated */
+    const unsigned char*d = (const unsigned char*)data;
+    recordindex_t index;
+    if(len<3 || d[0]!='G' || d[1]!='R' || d[2]!=RECORD_VERSION ||
+       !readIndex((void*)data, len, &index)) {
+	msg("<verbose> Not a complete (version %d) gfx recording", RECORD_VERSION);
+	return 0;
+    }
+    index_clear(&index);
+
+    reader_t r;
+    reader_init_memreader(&r, (void*)data, len);
+    return replay(0, device, &r, fontlist);
+}
+
+/* returns the (uncompressed) recording as one block of memory. If it's
+   in a file, the file is mapped, and needs to be memfile_close()d */
+static void* result_map(internal_result_t*i, int*len, memfile_t**file)
+{
+    *file = 0;
+    if(i->use_tempfile) {
+	*file = memfile_open(i->filename);
+	if(!*file)
+	    return 0;
+	*len = (*file)->len;
+	return (*file)->data;
     }
+    *len = i->length;
+    return i->data;
+}
 
-    replay(0, device, &r, fontlist);
+int gfxresult_record_num_pages(gfxresult_t*result)
+{
+    internal_result_t*i = (internal_result_t*)result->internal;
+    return i->index.num_pages;
+}
+
+void gfxresult_record_replay_page(gfxresult_t*result, int page, gfxdevice_t*device, gfxfontlist_t**fontlist)
+{
+    internal_result_t*i = (internal_result_t*)result->internal;
+    if(page<0 || page>=i->index.num_pages) {
+	msg("<error> record: no page %d in recording (%d pages)", page, i->index.num_pages);
+	return;
+    }
+    gfxfontlist_t*_fontlist=0;
+    if(!fontlist) {
+	fontlist = &_fontlist;
+    }
+    /* every replay maps the recording (and has its own state), so
+       several pages can be replayed at the same time */
+    int len = 0;
+    memfile_t*file = 0;
+    void*data = result_map(i, &len, &file);
+    if(!data)
+	return;
+    reader_t r;
+    reader_init_memreader(&r, data, len);
+    state_t state;
+    memset(&state, 0, sizeof(state));
+    if(readHeader(&r, &state)) {
+	/* fonts and parameters from before this page */
+	int start = i->index.pages[page];
+	int t;
+	for(t=0;t<i->index.num_globals && i->index.globals[t]<start;t++) {
+	    r.seek(&r, i->index.globals[t]);
+	    replay_op(0, device, &r, &state, fontlist);
+	}
+	r.seek(&r, start);
+	int op;
+	do {
+	    op = replay_op(0, device, &r, &state, fontlist);
+	} while(op>=0 && op!=OP_ENDPAGE && op!=OP_END);
+    }
+    state_clear(&state);
+    r.dealloc(&r);
+    if(file)
+	memfile_close(file);
+    if(_fontlist)
+	gfxfontlist_free(_fontlist, 0);
 }
 
 static void record_result_write(gfxresult_t*r, int filedesc)
@@ -847,8 +1295,21 @@ static void record_result_write(gfxresult_t*r, int filedesc)
 static int record_result_save(gfxresult_t*r, const char*filename)
 {
     internal_result_t*i = (internal_result_t*)r->internal;
-    if(i->use_tempfile) {
+    if(i->use_tempfile && !i->keep_file) {
 	move_file(i->filename, filename);
+    } else if(i->use_tempfile) {
+	int len = 0;
+	memfile_t*file = 0;
+	void*data = result_map(i, &len, &file);
+	FILE*fi = data ? fopen(filename, "wb") : 0;
+	if(!fi) {
+	    fprintf(stderr, "Couldn't open file %s for writing\n", filename);
+	    if(file) memfile_close(file);
+	    return -1;
+	}
+	fwrite(data, len, 1, fi);
+	fclose(fi);
+	memfile_close(file);
     } else {
 	FILE*fi = fopen(filename, "wb");
 	if(!fi) {
@@ -877,13 +1338,41 @@ static void record_result_destroy(gfxresult_t*r)
 	free(i->data);i->data = 0;
     }
     if(i->filename) {
-	unlink(i->filename);
+	if(!i->keep_file)
+	    unlink(i->filename);
 	free(i->filename);
     }
+    index_clear(&i->index);
     free(r->internal);r->internal = 0;
     free(r);
 }
 
+gfxresult_t* gfxresult_record_load(const char*filename)
+{
+    memfile_t*file = memfile_open(filename);
+    if(!file)
+	return 0;
+    internal_result_t*ir = (internal_result_t*)rfx_calloc(sizeof(internal_result_t));
+    if(file->len < 3 || memcmp(file->data, "GR", 2)) {
+	msg("<error> %s is not a recording (or a compressed one)", filename);
+	memfile_close(file);
+	free(ir);
+	return 0;
+    }
+    readIndex(file->data, file->len, &ir->index);
+    memfile_close(file);
+    ir->use_tempfile = 1;
+    ir->keep_file = 1;
+    ir->filename = strdup(filename);
+
+    gfxresult_t*result= (gfxresult_t*)rfx_calloc(sizeof(gfxresult_t));
+    result->save = record_result_save;
+    result->get = record_result_get;
+    result->destroy = record_result_destroy;
+    result->internal = ir;
+    return result;
+}
+
 static unsigned char printable(unsigned char a)
 {
     if(a<32 || a==127) return '.';
@@ -937,9 +1426,41 @@ void gfxdevice_record_flush(gfxdevice_t*dev, gfxdevice_t*out, gfxfontlist_t**fon
 	    replay(dev, out, &r, fontlist);
 	    writer_growmemwrite_reset(&i->w);
 	} else {
-	    msg("<fatal> Flushing not supported for file based record device");
-	    exit(1);
+	    writer_t*spillw = i->compress ? &i->spillw : &i->w;
+	    if(i->compress) {
+		/* terminate the zlib stream */
+		i->w.finish(&i->w);
+	    }
+	    reader_t input;
+	    memfile_t*file = 0;
+	    /* if the tempfile can't be read, the recording is discarded
+	       without replaying it */
+	    if(spillwrite_getreader(spillw, &input, &file)) {
+		if(i->compress) {
+		    reader_t r;
+		    reader_init_zlibinflate(&r, &input);
+		    replay(dev, out, &r, fontlist);
+		    input.dealloc(&input);
+		} else {
+		    replay(dev, out, &input, fontlist);
+		}
+	    }
+	    if(file) {
+		memfile_close(file);
+	    }
+	    spillwrite_reset(spillw);
+	    if(i->compress) {
+		writer_init_zlibdeflate2(&i->w, &i->spillw, 1);
+	    }
 	}
+
+	index_clear(&i->index);
+
+	/* the next replay starts with a fresh state, too */
+	int precision = i->state.precision;
+	state_clear(&i->state);
+	state_init(&i->state, precision);
+	writeHeader(&i->w, &i->state);
     }
 }
 
@@ -974,16 +1495,40 @@ static gfxresult_t* record_finish(struct _gfxdevice*dev)
     
     gfxfontlist_free(i->fontlist, 0);
    
-    internal_result_t*ir = (internal_result_t*)rfx_calloc(sizeof(gfxresult_t));
+    internal_result_t*ir = (internal_result_t*)rfx_calloc(sizeof(internal_result_t));
    
-    ir->use_tempfile = i->use_tempfile;
+    ir->compress = i->compress;
+    if(!i->compress) {
+	/* offsets into compressed data aren't seekable, so only uncompressed
+	   recordings get an index */
+	writeIndex(&i->w, &i->index);
+	ir->index = i->index;
+    } else {
+	index_clear(&i->index);
+    }
     if(i->use_tempfile) {
-	ir->filename = i->filename;
+	writer_t*spillw = i->compress ? &i->spillw : &i->w;
+	if(i->compress) {
+	    i->w.finish(&i->w);
+	}
+	/* take over the data (or tempfile) from the spill writer */
+	spillwrite_t*s = (spillwrite_t*)spillw->internal;
+	if(s->handle>=0) {
+	    spillwrite_flushbuffer(s);
+	    ir->use_tempfile = 1;
+	    ir->filename = s->filename;
+	    s->filename = 0;
+	} else {
+	    ir->data = s->data;
+	    ir->length = s->length;
+	    s->data = 0;
+	}
+	spillw->finish(spillw);
     } else {
 	ir->data = writer_growmemwrite_getmem(&i->w);
 	ir->length = i->w.pos;
+	i->w.finish(&i->w);
     }
-    i->w.finish(&i->w);
 
     gfxresult_t*result= (gfxresult_t*)rfx_calloc(sizeof(gfxresult_t));
     result->save = record_result_save;
@@ -996,7 +1541,23 @@ static gfxresult_t* record_finish(struct _gfxdevice*dev)
     return result;
 }
 
+void gfxdevice_record_setexternalfonts(gfxdevice_t*dev, gfxfontlist_t*fonts)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    i->external_fonts = fonts;
+}
+
+void gfxdevice_record_setmaxmemory(int bytes)
+{
+    record_max_memory = bytes;
+}
+
 void gfxdevice_record_init(gfxdevice_t*dev, char use_tempfile)
+{
+    gfxdevice_record_init2(dev, use_tempfile, 0, 0);
+}
+
+void gfxdevice_record_init2(gfxdevice_t*dev, char use_tempfile, int precision, char compress)
 {
     internal_t*i = (internal_t*)rfx_calloc(sizeof(internal_t));
     memset(dev, 0, sizeof(gfxdevice_t));
@@ -1008,11 +1569,15 @@ void gfxdevice_record_init(gfxdevice_t*dev, char use_tempfile)
     i->use_tempfile = use_tempfile;
     if(!use_tempfile) {
 	writer_init_growingmemwriter(&i->w, 1048576);
+    } else if(compress) {
+	i->compress = 1;
+	writer_init_spillwriter(&i->spillw, record_max_memory);
+	writer_init_zlibdeflate2(&i->w, &i->spillw, 1);
     } else {
-	char buffer[128];
-	i->filename = strdup(mktempname(buffer, "gfx"));
-	writer_init_filewriter2(&i->w, i->filename);
+	writer_init_spillwriter(&i->w, record_max_memory);
     }
+    state_init(&i->state, precision);
+    writeHeader(&i->w, &i->state);
     i->fontlist = gfxfontlist_create();
     i->cliplevel = 0;
 
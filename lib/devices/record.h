@@ -30,14 +30,46 @@
 extern "C" {
 #endif
 
+/* every recording (and every chunk after gfxdevice_record_flush) starts with
+   "GR", the format version and the coordinate precision */
+#define RECORD_VERSION 3
+
+/* use_tempfile: keep the recording in memory only up to a given size
+   (see gfxdevice_record_setmaxmemory), and spill it to a tempfile beyond that */
 void gfxdevice_record_init(gfxdevice_t*, char use_tempfile);
 
+/* precision: store coordinates as fixed point numbers with the given number
+   of units per pixel (0: store them as doubles, i.e., lossless)
+   compress: deflate the recording (only with use_tempfile) */
+void gfxdevice_record_init2(gfxdevice_t*, char use_tempfile, int precision, char compress);
+
+/* fonts in this list are only stored by their id. They need to be in the
+   fontlist passed to the replay functions. */
+void gfxdevice_record_setexternalfonts(gfxdevice_t*, gfxfontlist_t*fonts);
+
+/* memory budget of tempfile-backed recordings, default 32MB */
+void gfxdevice_record_setmaxmemory(int bytes);
+
 gfxdevice_t* gfxdevice_record_new(char*filename);
 
 void gfxdevice_record_flush(gfxdevice_t*, gfxdevice_t*, gfxfontlist_t**);
 
 void gfxresult_record_replay(gfxresult_t*, gfxdevice_t*, gfxfontlist_t**);
 
+/* uncompressed recordings carry an index of their pages, which allows
+   replaying single pages, in any order. Each call maps the recording
+   separately, so pages can also be replayed concurrently. */
+int gfxresult_record_num_pages(gfxresult_t*);
+void gfxresult_record_replay_page(gfxresult_t*, int page, gfxdevice_t*, gfxfontlist_t**);
+
+/* open a recording previously stored with result->save() */
+gfxresult_t* gfxresult_record_load(const char*filename);
+
+/* replay an (uncompressed) recording, as written by result->save(), from memory.
+   Returns 0 (without drawing anything, unless the data is corrupt) if the
+   recording is incomplete or from another version. */
+char gfxresult_record_replay_memory(const void*data, int len, gfxdevice_t*, gfxfontlist_t**);
+
 void gfxdevice_record_show(gfxdevice_t*dev);
 
 #ifdef __cplusplus
@@ -48,6 +48,7 @@ typedef struct _internal_result {
     gfximage_t img;
     struct _internal_result*next;
     char palette;
+    png_preset_t pngpreset;
 } internal_result_t;
 
 typedef struct _clipbuffer {
@@ -68,6 +69,7 @@ typedef struct _internal {
     int fillwhite;
 
     char palette;
+    png_preset_t pngpreset;
 
     RGBA* img;
 
@@ -523,6 +525,10 @@ int render_setparameter(struct _gfxdevice*dev, const char*key, const char*value)
     } else if(!strcmp(key, "palette")) {
 	i->palette = atoi(value);
 	return 1;
+    } else if(!strcmp(key, "pngpreset")) {
+	if(!png_parse_preset(value, &i->pngpreset))
+	    fprintf(stderr, "Unknown png preset: %s\n", value);
+	return 1;
     }
     return 0;
 }
@@ -797,7 +803,7 @@ int render_result_save(gfxresult_t*r, const char*filename)
 	while(i->next) {
 	    sprintf(filenamebuf, "%s.%d.png", origname, nr);
             if(!i->palette) {
-	        png_write(filename, (unsigned char*)i->img.data, i->img.width, i->img.height);
+	        png_write_preset(filename, (unsigned char*)i->img.data, i->img.width, i->img.height, i->pngpreset);
             } else {
 	        png_write_palette_based_2(filename, (unsigned char*)i->img.data, i->img.width, i->img.height);
             }
@@ -806,7 +812,7 @@ int render_result_save(gfxresult_t*r, const char*filename)
 	free(origname);
     } else {
         if(!i->palette) {
-	    png_write(filename, (unsigned char*)i->img.data, i->img.width, i->img.height);
+	    png_write_preset(filename, (unsigned char*)i->img.data, i->img.width, i->img.height, i->pngpreset);
 	} else {
 	    png_write_palette_based_2(filename, (unsigned char*)i->img.data, i->img.width, i->img.height);
 	}
@@ -1013,6 +1019,7 @@ void render_endpage(struct _gfxdevice*dev)
     
     internal_result_t*ir= (internal_result_t*)rfx_calloc(sizeof(internal_result_t));
     ir->palette = i->palette;
+    ir->pngpreset = i->pngpreset;
 
     int y,x;
 
@@ -1059,6 +1066,7 @@ void gfxdevice_render_init(gfxdevice_t*dev)
     i->antialize = 1;
     i->multiply = 1;
     i->zoom = 1;
+    i->pngpreset = png_best;
 
     dev->setparameter = render_setparameter;
     dev->startpage = render_startpage;
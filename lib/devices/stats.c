@@ -0,0 +1,232 @@
+/* stats.c
+   A device which measures the time spent in (and the data sent to)
+   another device.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../types.h"
+#include "../mem.h"
+#include "../gfxdevice.h"
+#include "../stats.h"
+#include "stats.h"
+
+enum {
+    CB_SETPARAMETER,
+    CB_STARTPAGE,
+    CB_STARTCLIP,
+    CB_ENDCLIP,
+    CB_STROKE,
+    CB_FILL,
+    CB_FILLBITMAP,
+    CB_FILLGRADIENT,
+    CB_ADDFONT,
+    CB_DRAWCHAR,
+    CB_DRAWLINK,
+    CB_ENDPAGE,
+    CB_FINISH,
+    NUM_CALLBACKS
+};
+
+static const char*callback_names[NUM_CALLBACKS] = {
+    "setparameter", "startpage", "startclip", "endclip", "stroke", "fill", "fillbitmap",
+    "fillgradient", "addfont", "drawchar", "drawlink", "endpage", "finish"
+};
+
+typedef struct _internal {
+    gfxdevice_t*out;
+    stats_entry_t*entries[NUM_CALLBACKS];
+    double wall, cpu;
+} internal_t;
+
+static inline void start(internal_t*i)
+{
+    stats_now(&i->wall, &i->cpu);
+}
+
+static inline stats_entry_t* stop(internal_t*i, int cb)
+{
+    double wall, cpu;
+    stats_now(&wall, &cpu);
+    stats_entry_t*e = i->entries[cb];
+    e->calls++;
+    e->wall += wall - i->wall;
+    e->cpu += cpu - i->cpu;
+    return e;
+}
+
+static int count_points(gfxline_t*line)
+{
+    int num = 0;
+    while(line) {
+	num++;
+	line = line->next;
+    }
+    return num;
+}
+
+static int stats_setparameter(gfxdevice_t*dev, const char*key, const char*value)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    int ret = i->out->setparameter(i->out, key, value);
+    stop(i, CB_SETPARAMETER);
+    return ret;
+}
+
+static void stats_startpage(gfxdevice_t*dev, int width, int height)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->startpage(i->out, width, height);
+    stop(i, CB_STARTPAGE);
+}
+
+static void stats_startclip(gfxdevice_t*dev, gfxline_t*line)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->startclip(i->out, line);
+    stop(i, CB_STARTCLIP)->points += count_points(line);
+}
+
+static void stats_endclip(gfxdevice_t*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->endclip(i->out);
+    stop(i, CB_ENDCLIP);
+}
+
+static void stats_stroke(gfxdevice_t*dev, gfxline_t*line, gfxcoord_t width, gfxcolor_t*color, gfx_capType cap_style, gfx_joinType joint_style, gfxcoord_t miterLimit)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->stroke(i->out, line, width, color, cap_style, joint_style, miterLimit);
+    stop(i, CB_STROKE)->points += count_points(line);
+}
+
+static void stats_fill(gfxdevice_t*dev, gfxline_t*line, gfxcolor_t*color)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->fill(i->out, line, color);
+    stop(i, CB_FILL)->points += count_points(line);
+}
+
+static void stats_fillbitmap(gfxdevice_t*dev, gfxline_t*line, gfximage_t*img, gfxmatrix_t*matrix, gfxcxform_t*cxform)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->fillbitmap(i->out, line, img, matrix, cxform);
+    stats_entry_t*e = stop(i, CB_FILLBITMAP);
+    double pixels = (double)img->width*img->height;
+    e->points += count_points(line);
+    e->pixels += pixels;
+    e->bytes += pixels*sizeof(gfxcolor_t);
+}
+
+static void stats_fillgradient(gfxdevice_t*dev, gfxline_t*line, gfxgradient_t*gradient, gfxgradienttype_t type, gfxmatrix_t*matrix)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->fillgradient(i->out, line, gradient, type, matrix);
+    stop(i, CB_FILLGRADIENT)->points += count_points(line);
+}
+
+static void stats_addfont(gfxdevice_t*dev, gfxfont_t*font)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->addfont(i->out, font);
+    stats_entry_t*e = stop(i, CB_ADDFONT);
+    if(font) {
+	int t;
+	for(t=0;t<font->num_glyphs;t++)
+	    e->points += count_points(font->glyphs[t].line);
+    }
+}
+
+static void stats_drawchar(gfxdevice_t*dev, gfxfont_t*font, int glyph, gfxcolor_t*color, gfxmatrix_t*matrix)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->drawchar(i->out, font, glyph, color, matrix);
+    stop(i, CB_DRAWCHAR);
+}
+
+static void stats_drawlink(gfxdevice_t*dev, gfxline_t*line, const char*action, const char*text)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->drawlink(i->out, line, action, text);
+    stop(i, CB_DRAWLINK)->points += count_points(line);
+}
+
+static void stats_endpage(gfxdevice_t*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    start(i);
+    i->out->endpage(i->out);
+    stop(i, CB_ENDPAGE);
+}
+
+static gfxresult_t* stats_finish(gfxdevice_t*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    gfxdevice_t*out = i->out;
+    start(i);
+    gfxresult_t*result = out->finish(out);
+    stop(i, CB_FINISH);
+    free(dev->internal);dev->internal = 0;
+    return result;
+}
+
+void gfxdevice_stats_init(gfxdevice_t*dev, gfxdevice_t*out, const char*name)
+{
+    internal_t*i = (internal_t*)rfx_calloc(sizeof(internal_t));
+    memset(dev, 0, sizeof(gfxdevice_t));
+
+    dev->name = "stats";
+
+    dev->internal = i;
+
+    dev->setparameter = stats_setparameter;
+    dev->startpage = stats_startpage;
+    dev->startclip = stats_startclip;
+    dev->endclip = stats_endclip;
+    dev->stroke = stats_stroke;
+    dev->fill = stats_fill;
+    dev->fillbitmap = stats_fillbitmap;
+    dev->fillgradient = stats_fillgradient;
+    dev->addfont = stats_addfont;
+    dev->drawchar = stats_drawchar;
+    dev->drawlink = stats_drawlink;
+    dev->endpage = stats_endpage;
+    dev->finish = stats_finish;
+
+    char buf[256];
+    int t;
+    for(t=0;t<NUM_CALLBACKS;t++) {
+	snprintf(buf, sizeof(buf), "%s.%s", name, callback_names[t]);
+	i->entries[t] = stats_get(buf);
+    }
+
+    i->out = out;
+}
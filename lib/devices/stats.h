@@ -0,0 +1,38 @@
+/* stats.h
+   Header file for stats.c
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __gfxdevice_stats_h__
+#define __gfxdevice_stats_h__
+
+#include "../gfxdevice.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* pass everything through to dest, counting calls and data, and measuring
+   the time spent in dest. The entries are named "<name>.<callback>"
+   (see ../stats.h) */
+void gfxdevice_stats_init(gfxdevice_t*self, gfxdevice_t*dest, const char*name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__gfxdevice_stats_h__
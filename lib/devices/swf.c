@@ -37,12 +37,15 @@
 #include <math.h>
 #include "../mem.h"
 #include "../log.h"
+#include "../q.h"
 #include "../rfxswf.h"
 #include "../gfxdevice.h"
 #include "../gfxtools.h"
 #include "swf.h"
 #include "../gfxpoly.h"
 #include "../gfximage.h"
+#include "../stats.h"
+#include "../palette.h"
 
 #define CHARDATAMAX 1024
 #define CHARMIDX 0
@@ -99,6 +102,8 @@ typedef struct _swfoutput_internal
     int config_frameresets;
     int config_linknameurl;
     int config_jpegquality;
+    int config_keepjpegs;
+    int config_quantize;
     int config_storeallcharacters;
     int config_enablezlib;
     int config_insertstoptag;
@@ -107,6 +112,8 @@ typedef struct _swfoutput_internal
     int config_noclips;
     int config_flashversion;
     int config_reordertags;
+    int config_optimize;
+    gfximage_scaler_t config_scaler;
     int config_showclipshapes;
     int config_splinemaxerror;
     int config_fontsplinemaxerror;
@@ -133,6 +140,8 @@ typedef struct _swfoutput_internal
     SWF* swf;
 
     fontlist_t* fontlist;
+    fontlist_t* fontlist_end;
+    dict_t* fontid2font;
 
     char storefont;
 
@@ -238,6 +247,7 @@ static swfoutput_internal* init_internal_struct()
     swfoutput_internal*i = (swfoutput_internal*)malloc(sizeof(swfoutput_internal));
     memset(i, 0, sizeof(swfoutput_internal));
 
+    i->fontid2font = dict_new();
     i->storefont = 0;
     i->currentswfid = 0;
     i->depth = 0;
@@ -275,6 +285,8 @@ static swfoutput_internal* init_internal_struct()
     i->config_ignoredraworder=0;
     i->config_drawonlyshapes=0;
     i->config_jpegquality=85;
+    i->config_keepjpegs=-1;
+    i->config_quantize=0;
     i->config_storeallcharacters=0;
     i->config_dots=1;
     i->config_enablezlib=0;
@@ -1538,8 +1550,8 @@ void swfoutput_finalize(gfxdevice_t*dev)
         swf_AddButtonLinks(i->swf, i->config_insertstoptag, 
                 i->config_internallinkfunction||i->config_externallinkfunction);
     }
-//    if(i->config_reordertags)
-//	swf_Optimize(i->swf);
+    if(i->config_optimize)
+	swf_Optimize(i->swf);
 }
 
 int swfresult_save(gfxresult_t*gfx, const char*filename)
@@ -1637,6 +1649,8 @@ static void swfoutput_destroy(gfxdevice_t* dev)
         iterator = iterator->next;
         free(tmp);
     }
+    i->fontlist = i->fontlist_end = 0;
+    dict_destroy(i->fontid2font);i->fontid2font = 0;
     if(i->swf) {swf_FreeTags(i->swf);free(i->swf);i->swf = 0;}
 
     free(i);i=0;
@@ -2100,6 +2114,13 @@ int swf_setparameter(gfxdevice_t*dev, const char*name, const char*value)
 	i->config_showclipshapes = atoi(value);
     } else if(!strcmp(name, "reordertags")) {
 	i->config_reordertags = atoi(value);
+    } else if(!strcmp(name, "optimize")) {
+	i->config_optimize = atoi(value);
+    } else if(!strcmp(name, "scaler")) {
+	if(!gfximage_parse_scaler(value, &i->config_scaler))
+	    fprintf(stderr, "Unknown image scaler: %s\n", value);
+    } else if(!strcmp(name, "scalethreads")) {
+	gfximage_set_rescale_threads(atoi(value));
     } else if(!strcmp(name, "internallinkfunction")) {
 	i->config_internallinkfunction = strdup(value);
     } else if(!strcmp(name, "externallinkfunction")) {
@@ -2164,6 +2185,16 @@ int swf_setparameter(gfxdevice_t*dev, const char*name, const char*value)
 	if(val<0) val=0;
 	if(val>101) val=101;
 	i->config_jpegquality = val;
+	/* an explicit quality means the user wants jpegs recompressed */
+	if(i->config_keepjpegs<0)
+	    i->config_keepjpegs = 0;
+    } else if(!strcmp(name, "keepjpegs")) {
+	i->config_keepjpegs = atoi(value);
+    } else if(!strcmp(name, "quantize")) {
+	int val = atoi(value);
+	if(val<0) val=0;
+	if(val>256) val=256;
+	i->config_quantize = val;
     } else if(!strcmp(name, "splinequality")) {
 	int v = atoi(value);
 	v = 500-(v*5); // 100% = 0.25 pixel, 0% = 25 pixel
@@ -2200,6 +2231,9 @@ int swf_setparameter(gfxdevice_t*dev, const char*name, const char*value)
         printf("bboxvars                    store the bounding box of the SWF file in actionscript variables\n");
         printf("dots                        Take care to handle dots correctly\n");
         printf("reordertags=0/1             (default: 1) perform some tag optimizations\n");
+        printf("optimize=0/1                (default: 0) merge identical shapes, fonts, images and sprites\n");
+        printf("scaler=<filter>             filter for downscaling images: auto (default), box, bilinear or lanczos\n");
+        printf("scalethreads=<num>          downscale large images on <num> threads\n");
         printf("internallinkfunction=<name> when the user clicks a internal link (to a different page) in the converted file, this actionscript function is called\n");
         printf("externallinkfunction=<name> when the user clicks an external link (e.g. http://www.foo.bar/) on the converted file, this actionscript function is called\n");
         printf("disable_polygon_conversion  never convert strokes to polygons (will remove capstyles and joint styles)\n");
@@ -2212,6 +2246,8 @@ int swf_setparameter(gfxdevice_t*dev, const char*name, const char*value)
         printf("simpleviewer                Add next/previous buttons to the SWF\n");
         printf("animate                     insert a showframe tag after each placeobject (animate draw order of PDF files)\n");
         printf("jpegquality=<quality>       set compression quality of jpeg images\n");
+        printf("quantize=<colors>           reduce lossless images with more than 256 colors to <colors> colors\n");
+        printf("keepjpegs=0/1               (default: 1, or 0 if jpegquality is set) store jpeg images from the input without recompressing them\n");
 	printf("splinequality=<value>       Set the quality of spline convertion to value (0-100, default: 100).\n");
 	printf("disablelinks                Disable links.\n");
     } else {
@@ -2254,7 +2290,7 @@ static void addImageToCache(gfxdevice_t*dev, void*data, int width, int height)
 {
 }
     
-static int add_image(swfoutput_internal*i, gfximage_t*img, int targetwidth, int targetheight, int* newwidth, int* newheight)
+static int encode_image(swfoutput_internal*i, gfximage_t*img, int targetwidth, int targetheight, int* newwidth, int* newheight)
 {
     gfxdevice_t*dev = i->dev;
     RGBA*newpic = 0;
@@ -2288,7 +2324,7 @@ static int add_image(swfoutput_internal*i, gfximage_t*img, int targetwidth, int
     
     if(newsizex<sizex || newsizey<sizey) {
 	msg("<verbose> Scaling %dx%d image to %dx%d", sizex, sizey, newsizex, newsizey);
-	gfximage_t*ni = gfximage_rescale(img, newsizex, newsizey);
+	gfximage_t*ni = gfximage_rescale2(img, newsizex, newsizey, i->config_scaler);
 	newpic = (RGBA*)ni->data;
 	free(ni);
 	*newwidth = sizex = newsizex;
@@ -2299,8 +2335,10 @@ static int add_image(swfoutput_internal*i, gfximage_t*img, int targetwidth, int
 	*newheight = newsizey  = sizey;
     }
 
-    int num_colors = swf_ImageGetNumberOfPaletteEntries(mem,sizex,sizey,0);
-    int has_alpha = swf_ImageHasAlpha(mem,sizex,sizey);
+    palette_t pal;
+    palette_analyze(mem, sizex, sizey, 256, &pal, 0, 0);
+    int num_colors = pal.num;
+    int has_alpha = pal.alpha;
     
     msg("<verbose> Drawing %dx%d %s%simage (id %d) at size %dx%d (%dx%d), %s%d colors",
 	    sizex, sizey, 
@@ -2322,13 +2360,25 @@ static int add_image(swfoutput_internal*i, gfximage_t*img, int targetwidth, int
     }
     printf("\n");*/
 
+    /* DEFINEBITSJPEG3 would need the colors premultiplied with alpha,
+       so only opaque images can keep their original encoding */
+    int keep_jpeg = img->jpeg && !newpic && !has_alpha &&
+		    i->config_keepjpegs && i->config_jpegquality<=100;
+
     int bitid = -1;
     int cacheid = imageInCache(dev, mem, sizex, sizey);
 
     if(cacheid<=0) {
 	bitid = getNewID(dev);
 
-	i->tag = swf_AddImage(i->tag, bitid, mem, sizex, sizey, i->config_jpegquality);
+	if(keep_jpeg) {
+	    msg("<verbose> Storing original jpeg data (%d bytes)", img->jpeg_size);
+	    i->tag = swf_InsertTag(i->tag, ST_DEFINEBITSJPEG2);
+	    swf_SetU16(i->tag, bitid);
+	    swf_SetBlock(i->tag, img->jpeg, img->jpeg_size);
+	} else {
+	    i->tag = swf_AddImageQuantized(i->tag, bitid, mem, sizex, sizey, i->config_jpegquality, is_jpeg?0:i->config_quantize);
+	}
 	addImageToCache(dev, mem, sizex, sizey);
     } else {
 	bitid = cacheid;
@@ -2339,6 +2389,16 @@ static int add_image(swfoutput_internal*i, gfximage_t*img, int targetwidth, int
     return bitid;
 }
 
+static int add_image(swfoutput_internal*i, gfximage_t*img, int targetwidth, int targetheight, int* newwidth, int* newheight)
+{
+    stats_timer_t timer;
+    stats_timer_start(&timer, "swf.image");
+    int id = encode_image(i, img, targetwidth, targetheight, newwidth, newheight);
+    stats_timer_stop(&timer);
+    stats_count("swf.image", 0, (double)img->width*img->height, 0);
+    return id;
+}
+
 int line_is_empty(gfxline_t*line)
 {
     while(line) {
@@ -2985,22 +3045,21 @@ static void swf_addfont(gfxdevice_t*dev, gfxfont_t*font)
     if(i->swffont && i->swffont->name && !strcmp((char*)i->swffont->name,font->id))
 	return; // the requested font is the current font
     
-    fontlist_t*last=0,*l = i->fontlist;
-    while(l) {
-	last = l;
-	if(!strcmp((char*)l->swffont->name, font->id)) {
-	    return; // we already know this font
-	}
-	l = l->next;
-    }
-    l = (fontlist_t*)rfx_calloc(sizeof(fontlist_t));
+    if(dict_contains(i->fontid2font, font->id))
+	return; // we already know this font
+
+    /* the list keeps the fonts in the order they're written out in swf_finish,
+       the dictionary is only an index into it */
+    fontlist_t*l = (fontlist_t*)rfx_calloc(sizeof(fontlist_t));
     l->swffont = gfxfont_to_swffont(font, font->id, (i->config_flashversion>=8 && !NO_FONT3)?3:2);
     l->next = 0;
-    if(last) {
-	last->next = l;
+    if(i->fontlist_end) {
+	i->fontlist_end->next = l;
     } else {
 	i->fontlist = l;
     }
+    i->fontlist_end = l;
+    dict_put(i->fontid2font, font->id, l->swffont);
     swf_FontSetID(l->swffont, getNewID(i->dev));
 
     if(getScreenLogLevel() >= LOGLEVEL_DEBUG)  {
@@ -3038,13 +3097,10 @@ static void swf_switchfont(gfxdevice_t*dev, const char*fontid)
     if(i->swffont && i->swffont->name && !strcmp((char*)i->swffont->name,fontid))
 	return; // the requested font is the current font
     
-    fontlist_t*l = i->fontlist;
-    while(l) {
-	if(!strcmp((char*)l->swffont->name, fontid)) {
-	    i->swffont = l->swffont;
-	    return; //done!
-	}
-	l = l->next;
+    SWFFONT*swffont = (SWFFONT*)dict_lookup(i->fontid2font, fontid);
+    if(swffont) {
+	i->swffont = swffont;
+	return; //done!
     }
     msg("<error> Unknown font id: %s", fontid);
     return;
@@ -57,6 +57,8 @@ static void maketransparent_fillbitmap(gfxfilter_t*f, gfxline_t*line, gfximage_t
     gfximage_t img2;
     img2.width = img->width;
     img2.height = img->height;
+    img2.jpeg = 0;
+    img2.jpeg_size = 0;
     img2.data = (gfxcolor_t*)rfx_alloc(img->width*img->height*4);
     int x,y; 
     for(y=0;y<img->height;y++)  {
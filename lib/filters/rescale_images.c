@@ -33,6 +33,7 @@
 
 typedef struct _internal {
     double config_subpixels;
+    gfximage_scaler_t config_scaler;
 } internal_t;
 
 int rescale_images_setparameter(gfxfilter_t*dev, const char*key, const char*value, gfxdevice_t*out)
@@ -40,6 +41,8 @@ int rescale_images_setparameter(gfxfilter_t*dev, const char*key, const char*valu
     internal_t*i = (internal_t*)dev->internal;
     if(!strcmp(key, "subpixels")) {
         i->config_subpixels  = atof(value);
+    } else if(!strcmp(key, "scaler")) {
+        gfximage_parse_scaler(value, &i->config_scaler);
     }
     return out->setparameter(out,key,value);
 }
@@ -70,7 +73,7 @@ void rescale_images_fillbitmap(gfxfilter_t*dev, gfxline_t*line, gfximage_t*img,
 
     if(new_width < img->width || new_height < img->height) {
 	msg("<verbose> Scaling %dx%d image to %dx%d", img->width, img->height, new_width, new_height);
-	gfximage_t*new_image = gfximage_rescale(img, new_width, new_height);
+	gfximage_t*new_image = gfximage_rescale2(img, new_width, new_height, i->config_scaler);
         gfxmatrix_t m = *matrix;
         m.m00 = (m.m00 * img->width) / new_width;
         m.m01 = (m.m01 * img->width) / new_width;
@@ -96,11 +99,13 @@ void gfxfilter_rescale_images_init(gfxfilter_t*f)
     internal_t*i = (internal_t*)rfx_calloc(sizeof(internal_t));
 
     i->config_subpixels = 1.0;
+    i->config_scaler = gfximage_scale_auto;
 
     f->internal = i;
     f->name = "rescale_images";
     f->type = gfxfilter_onepass;
 
+    f->setparameter = rescale_images_setparameter;
     f->fillbitmap = rescale_images_fillbitmap;
     f->finish = rescale_images_finish;
 }
@@ -126,6 +126,8 @@ static void pass2_drawchar(gfxfilter_t*f, gfxfont_t*font, int glyphnr, gfxcolor_
 	img.data = color;
 	img.width = 1;
 	img.height = 1;
+	img.jpeg = 0;
+	img.jpeg_size = 0;
 	out->fillbitmap(out, line, &img, &m, 0);
     }
     out->drawchar(out, font, glyphnr, color, matrix);
@@ -63,6 +63,12 @@ typedef struct _gfximage
     gfxcolor_t*data;
     unsigned width;
     unsigned height;
+
+    /* optional: the same image as a baseline JPEG file (in YCbCr or
+       grayscale, without alpha), e.g. if it was decoded from one.
+       Devices may store this instead of compressing data again. */
+    unsigned char*jpeg;
+    unsigned jpeg_size;
 } gfximage_t;
 
 /* gradients: A radial gradient will start at 0,0 and have a radius of 1,0 
@@ -300,7 +300,7 @@ static gfxresult_t* twopass_finish(gfxdevice_t*dev)
     } else {
         // switch to a new tempfile- this only happens for 3 passes or more
 	assert(i->num_passes>2);
-	gfxdevice_record_init(&i->record, /*use tempfile*/1);
+	gfxdevice_record_init2(&i->record, /*use tempfile*/1, /*precision*/0, /*compress*/1);
 	i->out = &i->record;
     }
 
@@ -319,7 +319,7 @@ gfxdevice_t*gfxtwopassfilter_apply(gfxtwopassfilter_t*_twopass, gfxdevice_t*out)
     gfxtwopassfilter_t*twopass = (gfxtwopassfilter_t*)rfx_alloc(sizeof(gfxtwopassfilter_t));
     memcpy(twopass, _twopass, sizeof(gfxtwopassfilter_t));
    
-    gfxdevice_record_init(&i->record, /*use tempfile*/1);
+    gfxdevice_record_init2(&i->record, /*use tempfile*/1, /*precision*/0, /*compress*/1);
 
     i->out = &i->record;
     i->final_out = out;
@@ -3,12 +3,21 @@
 #include <math.h>
 #include <memory.h>
 #include <assert.h>
+#include <string.h>
 #include "../config.h"
 #include "jpeg.h"
 #include "png.h"
 #include "mem.h"
 #include "gfximage.h"
 #include "types.h"
+#include "pipeline.h"
+#include "palette.h"
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #ifdef HAVE_FFTW3
 #include <fftw3.h>
 #endif
@@ -246,29 +255,12 @@ void blurImage(gfxcolor_t*src, int width, int height, int r)
 
 int gfximage_getNumberOfPaletteEntries(gfximage_t*img)
 {
-    int width = img->width;
-    int height = img->height;
-
-    int size = width*height;
-    int t;
-    U32* data = (U32*)img->data;
-    U32 color1 = data[0];
-    U32 color2 = 0;
-    for(t=1;t<size;t++) {
-	if(data[t] != color1) {
-	    color2 = data[t];
-	    break;
-	}
-    }
-    if(t==size)
-	return 1;
-
-    for(;t<size;t++) {
-	if(data[t] != color1 && data[t] != color2) {
-	    return width*height;
-	}
-    }
-    return 2;
+    /* callers only care about monochrome images */
+    palette_t pal;
+    palette_analyze(img->data, img->width, img->height, 2, &pal, 0, 0);
+    if(pal.num>2)
+	return img->width*img->height;
+    return pal.num;
 }
 
 gfximage_t* gfximage_rescale_old(gfximage_t*image, int newwidth, int newheight)
@@ -367,9 +359,448 @@ gfximage_t* gfximage_rescale_old(gfximage_t*image, int newwidth, int newheight)
     image2->data = newdata;
     image2->width = newwidth;
     image2->height = newheight;
+    image2->jpeg = 0;
+    image2->jpeg_size = 0;
+    return image2;
+}
+
+/* Separable fixed-point resampler. For every destination pixel of a row (or
+   column), a table holds the first source pixel and "taps" weights (in 1/256),
+   so both passes are plain multiply-accumulate loops over a fixed window.
+   gfximage_scale_auto uses the same weights as gfximage_rescale_old(), but
+   rounds instead of truncating. */
+
+typedef struct _scale_table {
+    int width;
+    int newwidth;
+    gfximage_scaler_t scaler;
+    int taps;      // even
+    int*start;
+    int*count;     // taps up to the last non-zero weight (rounded up to even with SSE2)
+    S16*weights;
+    int refcount;
+} scale_table_t;
+
+#define SCALE_CACHE_SIZE 8
+static scale_table_t*scale_cache[SCALE_CACHE_SIZE];
+static int scale_cache_next = 0;
+static int rescale_threads = 1;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t scale_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static double lanczos3(double x)
+{
+    if(x<0) x=-x;
+    if(x<1e-8) return 1.0;
+    if(x>=3) return 0.0;
+    return 3*sin(M_PI*x)*sin(M_PI*x/3)/(M_PI*M_PI*x*x);
+}
+
+static scale_table_t*scale_table_new(int width, int newwidth, gfximage_scaler_t scaler)
+{
+    scale_table_t*t = (scale_table_t*)rfx_calloc(sizeof(scale_table_t));
+    double fx = ((double)width)/((double)newwidth);
+    int maxcount, x, k;
+    t->width = width;
+    t->newwidth = newwidth;
+    t->scaler = scaler;
+
+    if(scaler == gfximage_scale_auto)
+	scaler = newwidth<=width ? gfximage_scale_box : gfximage_scale_bilinear;
+    if(scaler == gfximage_scale_lanczos)
+	maxcount = 2*(int)ceil(3*(fx>1?fx:1))+2;
+    else if(scaler == gfximage_scale_box && newwidth<=width)
+	maxcount = (int)ceil(fx)+2;
+    else
+	maxcount = 2;
+
+    /* collect (pos,weight) pairs for every destination pixel */
+    int*count = (int*)rfx_calloc(newwidth*sizeof(int));
+    int*pos = (int*)rfx_alloc(newwidth*maxcount*sizeof(int));
+    int*weight = (int*)rfx_alloc(newwidth*maxcount*sizeof(int));
+    double px = 0;
+    for(x=0;x<newwidth;x++) {
+	int*p = &pos[x*maxcount];
+	int*w = &weight[x*maxcount];
+	int n = 0;
+	if(scaler == gfximage_scale_lanczos) {
+	    double center = (x+0.5)*fx-0.5;
+	    double f = fx>1?fx:1;
+	    int from = (int)floor(center-3*f)+1;
+	    int to = (int)floor(center+3*f);
+	    double sum = 0, acc = 0;
+	    int xx;
+	    for(xx=from;xx<=to;xx++)
+		sum += lanczos3((xx-center)/f);
+	    for(xx=from;xx<=to;xx++) {
+		/* integer weights are rounded from the running sum, so that
+		   they always add up to exactly 256 */
+		int w1 = (int)floor(acc*256/sum+0.5);
+		acc += lanczos3((xx-center)/f);
+		int w2 = (int)floor(acc*256/sum+0.5);
+		p[n] = xx<0?0:(xx>=width?width-1:xx);
+		w[n] = w2-w1;
+		if(n && p[n]==p[n-1]) {
+		    w[n-1] += w[n];
+		} else {
+		    n++;
+		}
+	    }
+	} else if(scaler == gfximage_scale_box && newwidth<=width) {
+	    /* same weights as gfximage_rescale_old() */
+	    double ex = px + fx;
+	    int fromx = (int)px;
+	    int tox = (int)ex;
+	    double rem = fromx+1-px;
+	    int i = (int)(256/fx);
+	    int xweight = (int)(rem*256/fx);
+	    int xx, s = 0;
+	    if(tox>=width) tox = width-1;
+	    for(xx=fromx;xx<=tox;xx++) {
+		if(xx==fromx && xx==tox) w[n] = 256;
+		else if(xx==fromx) w[n] = xweight;
+		else if(xx==tox) w[n] = 256-s;
+		else w[n] = i;
+		s += w[n];
+		p[n++] = xx;
+	    }
+	    px = ex;
+	} else if(scaler == gfximage_scale_box) {
+	    /* nearest neighbor */
+	    p[n] = (int)px;
+	    w[n++] = 256;
+	    px += fx;
+	} else {
+	    int ix1 = (int)px;
+	    int ix2 = ix1+1;
+	    double r = px-ix1;
+	    if(ix2>=width) ix2=width-1;
+	    p[n] = ix1;
+	    w[n++] = (int)(256*(1-r));
+	    p[n] = ix2;
+	    w[n++] = 256-w[0];
+	    px += fx;
+	}
+	count[x] = n;
+    }
+
+    /* turn them into fixed size windows */
+    t->taps = 2;
+    for(x=0;x<newwidth;x++) {
+	int n = pos[x*maxcount+count[x]-1] - pos[x*maxcount] + 1;
+	if(n > t->taps)
+	    t->taps = n;
+    }
+    t->taps = (t->taps+1)&~1;
+    t->start = (int*)rfx_alloc(newwidth*sizeof(int));
+    t->weights = (S16*)rfx_calloc(newwidth*t->taps*sizeof(S16));
+    t->count = (int*)rfx_alloc(newwidth*sizeof(int));
+    for(x=0;x<newwidth;x++) {
+	int*p = &pos[x*maxcount];
+	int*w = &weight[x*maxcount];
+	S16*dest = &t->weights[x*t->taps];
+	t->start[x] = p[0];
+	for(k=0;k<count[x];k++) {
+	    dest[p[k]-p[0]] += w[k];
+	}
+	for(k=t->taps;k>1 && !dest[k-1];k--);
+#ifdef __SSE2__
+	k = (k+1)&~1;
+#endif
+	t->count[x] = k;
+    }
+    rfx_free(count);
+    rfx_free(pos);
+    rfx_free(weight);
+    return t;
+}
+
+static void scale_table_free(scale_table_t*t)
+{
+    rfx_free(t->start);
+    rfx_free(t->count);
+    rfx_free(t->weights);
+    rfx_free(t);
+}
+
+/* Images are often rescaled to the same sizes (e.g. all the pages of
+   a scanned document), so we keep the last few tables around. */
+static scale_table_t*scale_table_get(int width, int newwidth, gfximage_scaler_t scaler)
+{
+    scale_table_t*t = 0;
+    int i;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&scale_cache_mutex);
+#endif
+    for(i=0;i<SCALE_CACHE_SIZE;i++) {
+	t = scale_cache[i];
+	if(t && t->width == width && t->newwidth == newwidth && t->scaler == scaler)
+	    break;
+	t = 0;
+    }
+    if(!t) {
+	t = scale_table_new(width, newwidth, scaler);
+	scale_table_t*old = scale_cache[scale_cache_next];
+	if(old && !--old->refcount)
+	    scale_table_free(old);
+	scale_cache[scale_cache_next] = t;
+	scale_cache_next = (scale_cache_next+1)%SCALE_CACHE_SIZE;
+	t->refcount++;
+    }
+    t->refcount++;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&scale_cache_mutex);
+#endif
+    return t;
+}
+
+static void scale_table_release(scale_table_t*t)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&scale_cache_mutex);
+#endif
+    if(!--t->refcount)
+	scale_table_free(t);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&scale_cache_mutex);
+#endif
+}
+
+typedef struct _rescale_job {
+    U8*data;
+    int width, height;
+    int newwidth;
+    scale_table_t*tx;
+    scale_table_t*ty;
+    gfxcolor_t*newdata;
+    int band;      // number of destination lines per job
+} rescale_job_t;
+
+/* The intermediate line holds the vertically filtered values with two
+   fractional bits. With SSE2, they are stored as 16 bit (so that the
+   horizontal pass can use 16x16 bit multiplies), otherwise as int, and
+   the shift is done while reading them. Both give the same result. */
+#ifdef __SSE2__
+typedef S16 scale_tmp_t;
+#define TMP(v) (v)
+#else
+typedef int scale_tmp_t;
+#define TMP(v) ((v)>>2)
+#endif
+
+/* vertical pass: src lines (with weights w) -> dest (width*4 values) */
+static void rescale_vertical(U8**lines, S16*w, int taps, scale_tmp_t*dest, int len)
+{
+    int i = 0, k;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i round = _mm_set1_epi32(2);
+    for(;i+16<=len;i+=16) {
+	__m128i a0 = round, a1 = round, a2 = round, a3 = round;
+	for(k=0;k<taps;k+=2) {
+	    if(!w[k] && !w[k+1])
+		continue;
+	    __m128i wk = _mm_set1_epi32((U16)w[k] | ((U32)(U16)w[k+1])<<16);
+	    __m128i l0 = _mm_loadu_si128((__m128i*)&lines[k][i]);
+	    __m128i l1 = _mm_loadu_si128((__m128i*)&lines[k+1][i]);
+	    __m128i lo = _mm_unpacklo_epi8(l0, l1);
+	    __m128i hi = _mm_unpackhi_epi8(l0, l1);
+	    a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), wk));
+	    a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), wk));
+	    a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), wk));
+	    a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), wk));
+	}
+	a0 = _mm_srai_epi32(a0, 2);
+	a1 = _mm_srai_epi32(a1, 2);
+	a2 = _mm_srai_epi32(a2, 2);
+	a3 = _mm_srai_epi32(a3, 2);
+	_mm_storeu_si128((__m128i*)&dest[i], _mm_packs_epi32(a0, a1));
+	_mm_storeu_si128((__m128i*)&dest[i+8], _mm_packs_epi32(a2, a3));
+    }
+    for(;i<len;i++) {
+	int a = 2;
+	for(k=0;k<taps;k++)
+	    a += lines[k][i]*w[k];
+	dest[i] = a>>2;
+    }
+#else
+    /* taps is even, so lines are processed in pairs */
+    for(k=0;k<taps;k+=2) {
+	U8*l0 = lines[k];
+	U8*l1 = lines[k+1];
+	int w0 = w[k], w1 = w[k+1];
+	if(!k) {
+	    for(i=0;i<len;i++)
+		dest[i] = 2 + l0[i]*w0 + l1[i]*w1;
+	} else if(w0 || w1) {
+	    for(i=0;i<len;i++)
+		dest[i] += l0[i]*w0 + l1[i]*w1;
+	}
+    }
+#endif
+}
+
+/* horizontal pass: one line of 4-channel intermediate values -> pixels */
+static void rescale_horizontal(scale_tmp_t*src, scale_table_t*tx, U8*dest)
+{
+    int x, k;
+    int taps = tx->taps;
+    S16*w = tx->weights;
+    for(x=0;x<tx->newwidth;x++) {
+	scale_tmp_t*s = &src[tx->start[x]*4];
+#ifdef __SSE2__
+	__m128i a = _mm_set1_epi32(1<<13);
+	for(k=0;k<tx->count[x];k+=2) {
+	    /* r0 g0 b0 a0 r1 g1 b1 a1 -> r0 r1 g0 g1 b0 b1 a0 a1 */
+	    __m128i v = _mm_loadu_si128((__m128i*)&s[k*4]);
+	    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3,1,2,0));
+	    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3,1,2,0));
+	    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(3,1,2,0));
+	    __m128i wk = _mm_set1_epi32((U16)w[k] | ((U32)(U16)w[k+1])<<16);
+	    a = _mm_add_epi32(a, _mm_madd_epi16(v, wk));
+	}
+	a = _mm_srai_epi32(a, 14);
+	a = _mm_packs_epi32(a, a);
+	a = _mm_packus_epi16(a, a);
+	*(U32*)&dest[x*4] = _mm_cvtsi128_si32(a);
+#else
+	int r = 1<<13, g = 1<<13, b = 1<<13, al = 1<<13;
+	for(k=0;k<tx->count[x];k++) {
+	    r += TMP(s[0])*w[k];
+	    g += TMP(s[1])*w[k];
+	    b += TMP(s[2])*w[k];
+	    al += TMP(s[3])*w[k];
+	    s += 4;
+	}
+	r >>= 14; g >>= 14; b >>= 14; al >>= 14;
+	/* only the negative lobes of the Lanczos filter can overshoot */
+	if((unsigned)r > 255) r = r<0?0:255;
+	if((unsigned)g > 255) g = g<0?0:255;
+	if((unsigned)b > 255) b = b<0?0:255;
+	if((unsigned)al > 255) al = al<0?0:255;
+	dest[x*4+0] = r;
+	dest[x*4+1] = g;
+	dest[x*4+2] = b;
+	dest[x*4+3] = al;
+#endif
+	w += taps;
+    }
+}
+
+static void* rescale_band(int nr, void*_job)
+{
+    rescale_job_t*job = (rescale_job_t*)_job;
+    scale_table_t*ty = job->ty;
+    int taps = ty->taps;
+    int len = job->width*4;
+    /* the horizontal window may reach beyond the end of the line */
+    scale_tmp_t*tmp = (scale_tmp_t*)rfx_calloc((job->width+job->tx->taps)*4*sizeof(scale_tmp_t));
+    U8**lines = (U8**)rfx_alloc(taps*sizeof(U8*));
+    int y, k;
+    int y2 = (nr+1)*job->band;
+    if(y2 > ty->newwidth)
+	y2 = ty->newwidth;
+    for(y=nr*job->band;y<y2;y++) {
+	for(k=0;k<taps;k++) {
+	    int yy = ty->start[y]+k;
+	    if(yy >= job->height)
+		yy = job->height-1;
+	    lines[k] = &job->data[yy*len];
+	}
+	rescale_vertical(lines, &ty->weights[y*taps], ty->count[y], tmp, len);
+	rescale_horizontal(tmp, job->tx, (U8*)&job->newdata[y*job->newwidth]);
+    }
+    rfx_free(lines);
+    rfx_free(tmp);
+    return 0;
+}
+
+gfximage_t* gfximage_rescale2(gfximage_t*image, int newwidth, int newheight, gfximage_scaler_t scaler)
+{
+    int monochrome = 0;
+    gfxcolor_t monochrome_colors[2];
+
+    if(newwidth<1)
+	newwidth=1;
+    if(newheight<1)
+	newheight=1;
+
+    int width = image->width;
+    int height = image->height;
+    gfxcolor_t*data = image->data;
+
+    if(gfximage_getNumberOfPaletteEntries(image) == 2) {
+	monochrome=1;
+	/* don't modify the source image */
+	data = (gfxcolor_t*)rfx_alloc(width*height*sizeof(gfxcolor_t));
+	memcpy(data, image->data, width*height*sizeof(gfxcolor_t));
+	encodeMonochromeImage(data, width, height, monochrome_colors);
+        int r1 = width / newwidth;
+        int r2 = height / newheight;
+        int r = r1<r2?r1:r2;
+        if(r>4) {
+            /* high-resolution monochrome images are usually dithered, so 
+               low-pass filter them first to get rid of any moire patterns */
+            blurImage(data, width, height, r+1);
+        }
+    }
+
+    rescale_job_t job;
+    job.data = (U8*)data;
+    job.width = width;
+    job.height = height;
+    job.newwidth = newwidth;
+    job.tx = scale_table_get(width, newwidth, scaler);
+    job.ty = scale_table_get(height, newheight, scaler);
+    job.newdata = (gfxcolor_t*)rfx_alloc(newwidth*newheight*sizeof(gfxcolor_t));
+
+    /* only split large images between threads */
+    int jobs = (double)newwidth*newheight >= 65536 ? rescale_threads : 1;
+    if(jobs > 1) {
+	job.band = (newheight + jobs*4 - 1) / (jobs*4);
+	int num = (newheight + job.band - 1) / job.band, t;
+	pipeline_t*p = pipeline_new(num, jobs, num, rescale_band, &job);
+	for(t=0;t<num;t++)
+	    pipeline_get(p, t);
+	pipeline_destroy(p);
+    } else {
+	job.band = newheight;
+	rescale_band(0, &job);
+    }
+
+    scale_table_release(job.tx);
+    scale_table_release(job.ty);
+
+    if(monochrome) {
+	rfx_free(data);
+	decodeMonochromeImage(job.newdata, newwidth, newheight, monochrome_colors);
+    }
+
+    gfximage_t*image2 = (gfximage_t*)malloc(sizeof(gfximage_t));
+    image2->data = job.newdata;
+    image2->width = newwidth;
+    image2->height = newheight;
+    image2->jpeg = 0;
+    image2->jpeg_size = 0;
     return image2;
 }
 
+void gfximage_set_rescale_threads(int num)
+{
+    rescale_threads = num>1?num:1;
+}
+
+int gfximage_parse_scaler(const char*name, gfximage_scaler_t*scaler)
+{
+    if(!strcmp(name, "auto")) *scaler = gfximage_scale_auto;
+    else if(!strcmp(name, "box")) *scaler = gfximage_scale_box;
+    else if(!strcmp(name, "bilinear")) *scaler = gfximage_scale_bilinear;
+    else if(!strcmp(name, "lanczos")) *scaler = gfximage_scale_lanczos;
+    else return 0;
+    return 1;
+}
+
 #ifdef HAVE_FFTW3
 gfximage_t* gfximage_rescale_fft(gfximage_t*image, int newwidth, int newheight)
 {
@@ -464,6 +895,8 @@ gfximage_t* gfximage_rescale_fft(gfximage_t*image, int newwidth, int newheight)
     image2->data = rgba_new;
     image2->width = newwidth;
     image2->height = newheight;
+    image2->jpeg = 0;
+    image2->jpeg_size = 0;
     return image2;
 }
 #endif
@@ -472,12 +905,12 @@ gfximage_t* gfximage_rescale_fft(gfximage_t*image, int newwidth, int newheight)
 gfximage_t* gfximage_rescale(gfximage_t*image, int newwidth, int newheight)
 {
     //return gfximage_rescale_fft(image, newwidth, newheight);
-    return gfximage_rescale_old(image, newwidth, newheight);
+    return gfximage_rescale2(image, newwidth, newheight, gfximage_scale_auto);
 }
 #else
 gfximage_t* gfximage_rescale(gfximage_t*image, int newwidth, int newheight)
 {
-    return gfximage_rescale_old(image, newwidth, newheight);
+    return gfximage_rescale2(image, newwidth, newheight, gfximage_scale_auto);
 }
 #endif
 
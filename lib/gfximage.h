@@ -9,6 +9,15 @@ void gfximage_save_jpeg(gfximage_t*image, const char*filename, int quality);
 void gfximage_save_png(gfximage_t*image, const char*filename);
 void gfximage_save_png_quick(gfximage_t*image, const char*filename);
 gfximage_t* gfximage_rescale(gfximage_t*image, int newwidth, int newheight);
+
+/* resampling filters for gfximage_rescale2(). gfximage_scale_auto (used by
+   gfximage_rescale()) is box filtering for shrinking and bilinear
+   interpolation for enlarging. */
+typedef enum {gfximage_scale_auto, gfximage_scale_box, gfximage_scale_bilinear, gfximage_scale_lanczos} gfximage_scaler_t;
+gfximage_t* gfximage_rescale2(gfximage_t*image, int newwidth, int newheight, gfximage_scaler_t scaler);
+int gfximage_parse_scaler(const char*name, gfximage_scaler_t*scaler);
+/* split large images between <num> threads (default: 1) */
+void gfximage_set_rescale_threads(int num);
 bool gfximage_has_alpha(gfximage_t*image);
 void gfximage_free(gfximage_t*b);
 
@@ -0,0 +1,192 @@
+/* gfximage.test.c
+
+   Compares gfximage_rescale2() against the previous implementation,
+   gfximage_rescale_old(), and measures the speed of both.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "gfximage.h"
+
+gfximage_t* gfximage_rescale_old(gfximage_t*image, int newwidth, int newheight);
+
+/* the new code computes with 1/256 weights and a 16 bit intermediate line,
+   the old one with 1/65536 weights and a 32 bit one, so single pixels may
+   differ by one. Also, the old code truncates where the new one rounds, so
+   on anything but flat areas the new output is on average up to half a
+   unit brighter. */
+#define MAX_DIFF 1
+#define MAX_MEAN_DIFF 0.5
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+static gfximage_t* image_copy(gfximage_t*img)
+{
+    gfximage_t*copy = gfximage_new(img->width, img->height);
+    memcpy(copy->data, img->data, img->width*img->height*sizeof(gfxcolor_t));
+    return copy;
+}
+
+/* gradients, noise and hard edges. Colors are premultiplied with alpha,
+   like everywhere in gfx. */
+static gfximage_t* test_image(int type, int width, int height)
+{
+    gfximage_t*img = gfximage_new(width, height);
+    int x,y;
+    for(y=0;y<height;y++) {
+	for(x=0;x<width;x++) {
+	    gfxcolor_t*c = &img->data[y*width+x];
+	    switch(type) {
+		case 0: // smooth
+		    c->r = x*255/width;
+		    c->g = y*255/height;
+		    c->b = (x+y)*255/(width+height);
+		    c->a = 255;
+		break;
+		case 1: // noise
+		    c->r = lrand48();
+		    c->g = lrand48();
+		    c->b = lrand48();
+		    c->a = 255;
+		break;
+		case 2: // hard edges, with transparency
+		    c->a = ((x/7+y/5)&1) ? 255 : 0;
+		    c->r = c->a;
+		    c->g = (x%13<6) ? c->a : 0;
+		    c->b = 0;
+		break;
+		case 3: { // two colors (converted to a monochrome image internally)
+		    char on = ((x*x+y*y)/97)&1;
+		    c->r = on?0x20:0xf0;
+		    c->g = on?0x40:0xe0;
+		    c->b = on?0x80:0xd0;
+		    c->a = 255;
+		}
+		break;
+	    }
+	}
+    }
+    return img;
+}
+
+static int errors = 0;
+
+static void compare(int type, gfximage_t*img, int newwidth, int newheight)
+{
+    gfximage_t*copy = image_copy(img);
+    gfximage_t*old = gfximage_rescale_old(copy, newwidth, newheight);
+    gfximage_t*new = gfximage_rescale2(img, newwidth, newheight, gfximage_scale_auto);
+    gfximage_free(copy);
+
+    if(!old || !new || old->width != new->width || old->height != new->height) {
+	printf("image %d, %dx%d -> %dx%d: different sizes\n", type, img->width, img->height, newwidth, newheight);
+	errors++;
+    } else {
+	int t, max = 0, size = new->width*new->height;
+	double sum = 0;
+	for(t=0;t<size*4;t++) {
+	    int d = abs(((unsigned char*)old->data)[t] - ((unsigned char*)new->data)[t]);
+	    if(d > max) max = d;
+	    sum += d;
+	}
+	double mean = sum / (size*4);
+	if(max > MAX_DIFF || mean > MAX_MEAN_DIFF) {
+	    printf("image %d, %dx%d -> %dx%d: max difference %d, mean %.3f\n", type,
+		    img->width, img->height, newwidth, newheight, max, mean);
+	    errors++;
+	}
+    }
+
+    /* the threaded version has to produce exactly the same output */
+    gfximage_set_rescale_threads(4);
+    gfximage_t*threaded = gfximage_rescale2(img, newwidth, newheight, gfximage_scale_auto);
+    gfximage_set_rescale_threads(1);
+    if(new && threaded && memcmp(new->data, threaded->data, new->width*new->height*sizeof(gfxcolor_t))) {
+	printf("image %d, %dx%d -> %dx%d: threaded output differs\n", type, img->width, img->height, newwidth, newheight);
+	errors++;
+    }
+
+    if(old) gfximage_free(old);
+    if(new) gfximage_free(new);
+    if(threaded) gfximage_free(threaded);
+}
+
+static void benchmark(gfximage_t*img, int newwidth, int newheight, int runs)
+{
+    int t;
+    double t1 = now();
+    for(t=0;t<runs;t++) {
+	gfximage_t*copy = image_copy(img);
+	gfximage_free(gfximage_rescale_old(copy, newwidth, newheight));
+	gfximage_free(copy);
+    }
+    double t2 = now();
+    for(t=0;t<runs;t++) {
+	gfximage_t*copy = image_copy(img);
+	gfximage_free(gfximage_rescale2(copy, newwidth, newheight, gfximage_scale_auto));
+	gfximage_free(copy);
+    }
+    double t3 = now();
+    printf("%4dx%-4d -> %4dx%-4d: old %.2fms, new %.2fms (%.1fx)\n", img->width, img->height, newwidth, newheight,
+	    (t2-t1)*1000/runs, (t3-t2)*1000/runs, (t2-t1)/(t3-t2));
+}
+
+int main()
+{
+    int sizes[][4] = {
+	{640,480, 320,240},
+	{640,480, 213,160},
+	{640,480, 100,33},
+	{97,61, 400,300},
+	{97,61, 98,62},
+	{300,300, 1,1},
+	{1,200, 50,50},
+	{2000,1500, 1000,750},
+	{1500,1000, 1023,767},
+    };
+    int type, t;
+    srand48(1);
+    for(type=0;type<4;type++) {
+	for(t=0;t<sizeof(sizes)/sizeof(sizes[0]);t++) {
+	    gfximage_t*img = test_image(type, sizes[t][0], sizes[t][1]);
+	    compare(type, img, sizes[t][2], sizes[t][3]);
+	    gfximage_free(img);
+	}
+    }
+    if(errors) {
+	printf("%d errors\n", errors);
+	return 1;
+    }
+    printf("ok, new and old scaler differ by at most %d\n", MAX_DIFF);
+
+    gfximage_t*img = test_image(0, 2000, 1500);
+    benchmark(img, 1000, 750, 5);
+    benchmark(img, 640, 480, 5);
+    gfximage_free(img);
+    img = test_image(0, 300, 200);
+    benchmark(img, 1200, 800, 5);
+    gfximage_free(img);
+    return 0;
+}
@@ -852,68 +852,102 @@ void gfxmatrix_multiply(gfxmatrix_t*m1, gfxmatrix_t*m2, gfxmatrix_t*dest)
     dest->ty = m1->m01*m2->tx + m1->m11*m2->ty + m1->ty;
 }
 
+/* The first element of a font list carries a pointer to the last element,
+   and, once the list has FONTLIST_HASH_MIN entries, a hash index from font
+   id to the first list element with that id. Shorter lists are faster to
+   walk than to hash. The list itself stays a plain linked list, since the
+   python and ruby bindings walk it. */
+#define FONTLIST_HASH_MIN 32
+
+typedef struct _gfxfontindex
+{
+    dict_t*id2entry;
+    gfxfontlist_t*last;
+    int size;
+} gfxfontindex_t;
+
 gfxfontlist_t* gfxfontlist_create()
 {
     /* Initial list ist empty */
     return 0;
 }
 
-gfxfont_t*gfxfontlist_findfont(gfxfontlist_t*list, char*id)
+static gfxfontlist_t*gfxfontlist_find(gfxfontlist_t*list, const char*id)
 {
+    if(list && list->index && list->index->id2entry) {
+	return (gfxfontlist_t*)dict_lookup(list->index->id2entry, id);
+    }
     gfxfontlist_t*l = list;
     while(l) {
-	if(!strcmp((char*)l->font->id, id)) {
-	    return l->font;
+	if(l->font->id == id || !strcmp((char*)l->font->id, id)) {
+	    return l;
 	}
 	l = l->next;
     }
     return 0;
 }
+
+gfxfont_t*gfxfontlist_findfont(gfxfontlist_t*list, char*id)
+{
+    gfxfontlist_t*l = gfxfontlist_find(list, id);
+    return l?l->font:0;
+}
 char gfxfontlist_hasfont(gfxfontlist_t*list, gfxfont_t*font)
 {
-    gfxfontlist_t*l = list;
-    while(l) {
-	if(!strcmp((char*)l->font->id, font->id)) {
-	    return 1;
-	}
-	l = l->next;
-    }
-    return 0;
+    return gfxfontlist_find(list, font->id)!=0;
 }
 void*gfxfontlist_getuserdata(gfxfontlist_t*list, const char*id)
 {
-    gfxfontlist_t*l = list;
-    while(l) {
-	if(!strcmp((char*)l->font->id, id)) {
-	    return l->user;
-	}
-	l = l->next;
-    }
-    return 0;
+    gfxfontlist_t*l = gfxfontlist_find(list, id);
+    return l?l->user:0;
 }
 gfxfontlist_t*gfxfontlist_addfont2(gfxfontlist_t*list, gfxfont_t*font, void*user)
 {
-    gfxfontlist_t*last=0,*l = list;
+    if(!font) {
+	fprintf(stderr, "Tried to add zero font\n");
+	return list;
+    }
+    gfxfontlist_t*l = gfxfontlist_find(list, font->id);
+    gfxfontlist_t*first = l;
+    /* different fonts may share an id- only the identical font is
+       a duplicate */
     while(l) {
-	last = l;
 	if(l->font == font) {
 	    return list; // we already know this font
 	}
 	l = l->next;
     }
-    if(!font) {
-	fprintf(stderr, "Tried to add zero font\n");
-    }
     l = (gfxfontlist_t*)rfx_calloc(sizeof(gfxfontlist_t));
     l->font = font;
     l->user = user;
     l->next = 0;
-    if(last) {
+    if(!list) {
+	l->index = (gfxfontindex_t*)rfx_calloc(sizeof(gfxfontindex_t));
+	list = l;
+    } else if(!list->index) {
+	/* a tail of some other list- no index, append the slow way */
+	gfxfontlist_t*last = list;
+	while(last->next)
+	    last = last->next;
 	last->next = l;
 	return list;
     } else {
-	return l;
+	list->index->last->next = l;
     }
+    list->index->last = l;
+    list->index->size++;
+    if(list->index->id2entry) {
+	if(!first)
+	    dict_put(list->index->id2entry, font->id, l);
+    } else if(list->index->size >= FONTLIST_HASH_MIN) {
+	dict_t*d = dict_new();
+	for(l=list;l;l=l->next) {
+	    if(!dict_contains(d, l->font->id))
+		dict_put(d, l->font->id, l);
+	}
+	list->index->id2entry = d;
+    }
+    return list;
 }
 gfxfontlist_t*gfxfontlist_addfont(gfxfontlist_t*list, gfxfont_t*font)
 {
@@ -921,6 +955,12 @@ gfxfontlist_t*gfxfontlist_addfont(gfxfontlist_t*list, gfxfont_t*font)
 }
 void gfxfontlist_free(gfxfontlist_t*list, char deletefonts)
 {
+    if(list && list->index) {
+	if(list->index->id2entry)
+	    dict_destroy(list->index->id2entry);
+	free(list->index);
+	list->index = 0;
+    }
     gfxfontlist_t*l = list;
     while(l) {
 	gfxfontlist_t*next = l->next;
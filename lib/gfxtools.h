@@ -52,6 +52,7 @@ typedef struct _gfxfontlist
     gfxfont_t*font;
     void*user;
     struct _gfxfontlist*next;
+    struct _gfxfontindex*index; // only set in the first element
 } gfxfontlist_t;
 
 void gfxdrawer_target_gfxline(gfxdrawer_t*d);
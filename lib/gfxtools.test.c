@@ -0,0 +1,175 @@
+/* gfxtools.test.c
+
+   Tests the gfxfontlist_* functions, below and above the size at which
+   the list gets a hash index, and compares the speed of the lookup with
+   a plain walk over the list.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "gfxtools.h"
+#include "mem.h"
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+static int errors = 0;
+#define CHECK(c) if(!(c)) {printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #c);errors++;}
+
+/* font ids like the pdf reader generates them for embedded subset fonts */
+static gfxfont_t* make_font(int nr)
+{
+    char id[80];
+    sprintf(id, "font-%d-ABCDEF+Subset%d", nr, nr*7919%1000);
+    gfxfont_t*font = (gfxfont_t*)rfx_calloc(sizeof(gfxfont_t));
+    font->id = strdup(id);
+    return font;
+}
+
+/* how the lookup worked before the list had an index */
+static gfxfont_t* linear_findfont(gfxfontlist_t*l, const char*id)
+{
+    while(l) {
+	if(!strcmp(l->font->id, id))
+	    return l->font;
+	l = l->next;
+    }
+    return 0;
+}
+
+static void test_list(int num)
+{
+    gfxfont_t**fonts = (gfxfont_t**)rfx_calloc(sizeof(gfxfont_t*)*num);
+    gfxfontlist_t*list = gfxfontlist_create();
+    int t;
+    for(t=0;t<num;t++) {
+	fonts[t] = make_font(t);
+	list = gfxfontlist_addfont2(list, fonts[t], &fonts[t]);
+    }
+    /* adding the same font again doesn't change anything */
+    for(t=0;t<num;t+=3) {
+	list = gfxfontlist_addfont2(list, fonts[t], 0);
+    }
+    /* a different font with a known id is appended, but the lookup
+       still finds the first one */
+    gfxfont_t*dup = make_font(0);
+    list = gfxfontlist_addfont(list, dup);
+
+    gfxfontlist_t*l = list;
+    for(t=0;t<num;t++) {
+	CHECK(l && l->font == fonts[t]);
+	l = l?l->next:0;
+    }
+    CHECK(l && l->font == dup && !l->next);
+
+    for(t=0;t<num;t++) {
+	/* look up by a copy of the id, so pointer compares don't help */
+	char*id = strdup(fonts[t]->id);
+	CHECK(gfxfontlist_findfont(list, id) == fonts[t]);
+	CHECK(gfxfontlist_getuserdata(list, id) == &fonts[t]);
+	CHECK(gfxfontlist_hasfont(list, fonts[t]));
+	free(id);
+    }
+    gfxfont_t*unknown = make_font(num);
+    CHECK(!gfxfontlist_findfont(list, (char*)unknown->id));
+    CHECK(!gfxfontlist_getuserdata(list, unknown->id));
+    CHECK(!gfxfontlist_hasfont(list, unknown));
+    CHECK(!gfxfontlist_findfont(0, (char*)unknown->id));
+
+    /* the tail of a list has no index, but has to work just the same */
+    if(num>1) {
+	CHECK(gfxfontlist_findfont(list->next, (char*)fonts[num-1]->id) == fonts[num-1]);
+	CHECK(gfxfontlist_findfont(list->next, (char*)fonts[0]->id) == dup);
+    }
+
+    gfxfontlist_free(list, 0);
+    for(t=0;t<num;t++) {
+	free((char*)fonts[t]->id);
+	free(fonts[t]);
+    }
+    free((char*)dup->id);free(dup);
+    free((char*)unknown->id);free(unknown);
+    free(fonts);
+}
+
+static void benchmark(int num, int lookups)
+{
+    gfxfont_t**fonts = (gfxfont_t**)rfx_calloc(sizeof(gfxfont_t*)*num);
+    char**ids = (char**)rfx_calloc(sizeof(char*)*num);
+    gfxfontlist_t*list = gfxfontlist_create();
+    int t;
+    for(t=0;t<num;t++) {
+	fonts[t] = make_font(t);
+	ids[t] = strdup(fonts[t]->id);
+	list = gfxfontlist_addfont(list, fonts[t]);
+    }
+    int found = 0;
+    double t1 = now();
+    for(t=0;t<lookups;t++) {
+	found += linear_findfont(list, ids[lrand48()%num])!=0;
+    }
+    double t2 = now();
+    for(t=0;t<lookups;t++) {
+	found += gfxfontlist_findfont(list, ids[lrand48()%num])!=0;
+    }
+    double t3 = now();
+    CHECK(found == lookups*2);
+    printf("%5d fonts, %d lookups: list walk %.2fms, findfont %.2fms (%.1fx)\n", num, lookups,
+	    (t2-t1)*1000, (t3-t2)*1000, (t2-t1)/(t3-t2));
+
+    gfxfontlist_free(list, 0);
+    for(t=0;t<num;t++) {
+	free((char*)fonts[t]->id);
+	free(fonts[t]);
+	free(ids[t]);
+    }
+    free(fonts);
+    free(ids);
+}
+
+int main()
+{
+    srand48(1);
+    test_list(1);
+    test_list(2);
+    test_list(17);
+    /* the index is built when the list reaches 32 entries, here
+       while the duplicate id is added, or just before, or after */
+    test_list(30);
+    test_list(31);
+    test_list(32);
+    test_list(1000);
+    if(errors) {
+	printf("%d errors\n", errors);
+	return 1;
+    }
+    printf("ok, font list lookups\n");
+
+    benchmark(10, 1000000);
+    benchmark(20, 500000);
+    benchmark(40, 250000);
+    benchmark(100, 100000);
+    benchmark(1000, 10000);
+    return errors?1:0;
+}
@@ -26,6 +26,9 @@
 #include "../rfxswf.h"
 #include "h263tables.h"
 #include "dct.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* TODO:
    - use prepare* / write* in encode_IFrame_block
@@ -239,24 +242,77 @@ static void getmvdregion(block_t* bb, YUV*pic, int posx, int posy, int mvdx, int
     }
 }
 
+static inline void rgb2yuv_pixel(YUV*dest, RGBA*src)
+{
+    int r = src->r;
+    int g = src->g;
+    int b = src->b;
+    /*dest->y = (r*0.299 + g*0.587 + b*0.114);
+    dest->u = (r*-0.169 + g*-0.332 + b*0.500 + 128.0);
+    dest->v = (r*0.500 + g*-0.419 + b*-0.0813 + 128.0);*/
+    dest->y = (r*((int)( 0.299*256)) + g*((int)( 0.587*256)) + b*((int)( 0.114 *256)))>>8;
+    dest->u = (r*((int)(-0.169*256)) + g*((int)(-0.332*256)) + b*((int)( 0.500 *256))+ 128*256)>>8;
+    dest->v = (r*((int)( 0.500*256)) + g*((int)(-0.419*256)) + b*((int)(-0.0813*256))+ 128*256)>>8;
+}
+
+#ifdef __SSE2__
+/* Converts eight pixels at once. All the sums above are in the range
+   0..65535, so they can be computed modulo 2^16 in 16 bit lanes, and the
+   result is identical to rgb2yuv_pixel(). */
+static inline void rgb2yuv_8pixels(YUV*dest, RGBA*src)
+{
+    __m128i mask = _mm_set1_epi32(0xff);
+    __m128i p0 = _mm_loadu_si128((__m128i*)&src[0]);
+    __m128i p1 = _mm_loadu_si128((__m128i*)&src[4]);
+    __m128i r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                                _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+    __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                                _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+    __m128i b = _mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+    __m128i bias = _mm_set1_epi16((short)0x8000);
+    __m128i y, u, v;
+    U8 out[32];
+    int t;
+
+    y = _mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(r, _mm_set1_epi16((int)( 0.299*256))),
+            _mm_mullo_epi16(g, _mm_set1_epi16((int)( 0.587*256)))),
+            _mm_mullo_epi16(b, _mm_set1_epi16((int)( 0.114*256))));
+    u = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(r, _mm_set1_epi16((int)(-0.169*256))),
+            _mm_mullo_epi16(g, _mm_set1_epi16((int)(-0.332*256)))),
+            _mm_mullo_epi16(b, _mm_set1_epi16((int)( 0.500*256)))), bias);
+    v = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(r, _mm_set1_epi16((int)( 0.500*256))),
+            _mm_mullo_epi16(g, _mm_set1_epi16((int)(-0.419*256)))),
+            _mm_mullo_epi16(b, _mm_set1_epi16((int)(-0.0813*256)))), bias);
+    y = _mm_srli_epi16(y, 8);
+    u = _mm_srli_epi16(u, 8);
+    v = _mm_srli_epi16(v, 8);
+    _mm_storeu_si128((__m128i*)&out[0], _mm_packus_epi16(y, u));
+    _mm_storeu_si128((__m128i*)&out[16], _mm_packus_epi16(v, v));
+    for(t=0;t<8;t++) {
+        dest[t].y = out[t];
+        dest[t].u = out[t+8];
+        dest[t].v = out[t+16];
+    }
+}
+#endif
+
 static void rgb2yuv(YUV*dest, RGBA*src, int dlinex, int slinex, int width, int height)
 {
     int x,y;
     for(y=0;y<height;y++) {
-	for(x=0;x<width;x++) {
-	    int r,g,b;
-	    r = src[y*slinex+x].r;
-	    g = src[y*slinex+x].g;
-	    b = src[y*slinex+x].b;
-	    /*dest[y*dlinex+x].y = (r*0.299 + g*0.587 + b*0.114);
-	    dest[y*dlinex+x].u = (r*-0.169 + g*-0.332 + b*0.500 + 128.0);
-	    dest[y*dlinex+x].v = (r*0.500 + g*-0.419 + b*-0.0813 + 128.0);*/
-
-	    //dest[y*dlinex+x].y = 128;//(r*((int)( 0.299*256)) + g*((int)( 0.587*256)) + b*((int)( 0.114 *256)))>>8;
-
-	    dest[y*dlinex+x].y = (r*((int)( 0.299*256)) + g*((int)( 0.587*256)) + b*((int)( 0.114 *256)))>>8;
-	    dest[y*dlinex+x].u = (r*((int)(-0.169*256)) + g*((int)(-0.332*256)) + b*((int)( 0.500 *256))+ 128*256)>>8;
-	    dest[y*dlinex+x].v = (r*((int)( 0.500*256)) + g*((int)(-0.419*256)) + b*((int)(-0.0813*256))+ 128*256)>>8;
+	YUV*d = &dest[y*dlinex];
+	RGBA*s = &src[y*slinex];
+	x = 0;
+#ifdef __SSE2__
+	for(;x+8<=width;x+=8) {
+	    rgb2yuv_8pixels(&d[x], &s[x]);
+	}
+#endif
+	for(;x<width;x++) {
+	    rgb2yuv_pixel(&d[x], &s[x]);
 	}
     }
 }
@@ -272,18 +328,54 @@ static void copyregion(VIDEOSTREAM*s, YUV*dest, YUV*src, int bx, int by)
     }
 }
 
+static inline void yuv2rgb_pixel(RGBA*dest, YUV*src)
+{
+    int u = src->u;
+    int v = src->v;
+    int yy = src->y;
+    dest->r = truncate256(yy + ((360*(v-128))>>8));
+    dest->g = truncate256(yy - ((88*(u-128)+183*(v-128))>>8));
+    dest->b = truncate256(yy + ((455 * (u-128))>>8));
+}
+
+#ifdef __SSE2__
+/* Converts four pixels. The products don't fit into 16 bits, so (u,v) pairs
+   are multiplied and summed into 32 bit lanes with pmaddwd. */
+static inline void yuv2rgb_4pixels(RGBA*dest, YUV*src)
+{
+    __m128i yy = _mm_setr_epi32(src[0].y, src[1].y, src[2].y, src[3].y);
+    __m128i uv = _mm_setr_epi16(src[0].u-128, src[0].v-128, src[1].u-128, src[1].v-128,
+                                src[2].u-128, src[2].v-128, src[3].u-128, src[3].v-128);
+    __m128i r = _mm_srai_epi32(_mm_madd_epi16(uv, _mm_setr_epi16(0,360,0,360,0,360,0,360)), 8);
+    __m128i g = _mm_srai_epi32(_mm_madd_epi16(uv, _mm_setr_epi16(88,183,88,183,88,183,88,183)), 8);
+    __m128i b = _mm_srai_epi32(_mm_madd_epi16(uv, _mm_setr_epi16(455,0,455,0,455,0,455,0)), 8);
+    __m128i rg = _mm_packs_epi32(_mm_add_epi32(yy, r), _mm_sub_epi32(yy, g));
+    __m128i bb = _mm_packs_epi32(_mm_add_epi32(yy, b), _mm_setzero_si128());
+    U8 out[16];
+    int t;
+    _mm_storeu_si128((__m128i*)out, _mm_packus_epi16(rg, bb));
+    for(t=0;t<4;t++) {
+        dest[t].r = out[t];
+        dest[t].g = out[t+4];
+        dest[t].b = out[t+8];
+    }
+}
+#endif
+
 static void yuv2rgb(RGBA*dest, YUV*src, int linex, int width, int height)
 {
     int x,y;
     for(y=0;y<height;y++) {
-	for(x=0;x<width;x++) {
-	    int u,v,yy;
-	    u = src[y*linex+x].u;
-	    v = src[y*linex+x].v;
-	    yy = src[y*linex+x].y;
-	    dest[y*linex+x].r = truncate256(yy + ((360*(v-128))>>8));
-	    dest[y*linex+x].g = truncate256(yy - ((88*(u-128)+183*(v-128))>>8));
-	    dest[y*linex+x].b = truncate256(yy + ((455 * (u-128))>>8));
+	RGBA*d = &dest[y*linex];
+	YUV*s = &src[y*linex];
+	x = 0;
+#ifdef __SSE2__
+	for(;x+4<=width;x+=4) {
+	    yuv2rgb_4pixels(&d[x], &s[x]);
+	}
+#endif
+	for(;x<width;x++) {
+	    yuv2rgb_pixel(&d[x], &s[x]);
 	}
     }
 }
@@ -319,7 +411,38 @@ static int compare_pic_pic(VIDEOSTREAM*s, YUV*pp1, YUV*pp2, int bx, int by)
     YUV*p1 = &pp1[by*linex*16+bx*16];
     YUV*p2 = &pp2[by*linex*16+bx*16];
     int diffy=0, diffuv = 0;
-    int x,y;
+    int y;
+#ifdef __SSE2__
+    /* A row of a block is 16*3 = 48 bytes. psadbw sums up the differences
+       of all of them, and a second pass over only the y bytes separates
+       luminance from chrominance. */
+    __m128i ymask0 = _mm_setr_epi8(-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1);
+    __m128i ymask1 = _mm_setr_epi8(0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0);
+    __m128i ymask2 = _mm_setr_epi8(0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0);
+    __m128i all = _mm_setzero_si128();
+    __m128i lum = _mm_setzero_si128();
+    for(y=0;y<16;y++) {
+	__m128i a0 = _mm_loadu_si128((__m128i*)((U8*)p1+0));
+	__m128i a1 = _mm_loadu_si128((__m128i*)((U8*)p1+16));
+	__m128i a2 = _mm_loadu_si128((__m128i*)((U8*)p1+32));
+	__m128i b0 = _mm_loadu_si128((__m128i*)((U8*)p2+0));
+	__m128i b1 = _mm_loadu_si128((__m128i*)((U8*)p2+16));
+	__m128i b2 = _mm_loadu_si128((__m128i*)((U8*)p2+32));
+	all = _mm_add_epi64(all, _mm_sad_epu8(a0, b0));
+	all = _mm_add_epi64(all, _mm_sad_epu8(a1, b1));
+	all = _mm_add_epi64(all, _mm_sad_epu8(a2, b2));
+	lum = _mm_add_epi64(lum, _mm_sad_epu8(_mm_and_si128(a0, ymask0), _mm_and_si128(b0, ymask0)));
+	lum = _mm_add_epi64(lum, _mm_sad_epu8(_mm_and_si128(a1, ymask1), _mm_and_si128(b1, ymask1)));
+	lum = _mm_add_epi64(lum, _mm_sad_epu8(_mm_and_si128(a2, ymask2), _mm_and_si128(b2, ymask2)));
+	p1+=linex;
+	p2+=linex;
+    }
+    all = _mm_add_epi64(all, _mm_srli_si128(all, 8));
+    lum = _mm_add_epi64(lum, _mm_srli_si128(lum, 8));
+    diffy = _mm_cvtsi128_si32(lum);
+    diffuv = _mm_cvtsi128_si32(all) - diffy;
+#else
+    int x;
     for(y=0;y<16;y++) {
 	for(x=0;x<16;x++) {
 	    YUV*m = &p1[x];
@@ -333,6 +456,7 @@ static int compare_pic_pic(VIDEOSTREAM*s, YUV*pp1, YUV*pp2, int bx, int by)
 	p1+=linex;
 	p2+=linex;
     }
+#endif
     return diffy + diffuv/4;
 }
 
@@ -1428,6 +1552,43 @@ void test_copy_diff()
     }
 }
 
+/* the vectorized color conversions have to match the per-pixel ones */
+void test_yuv_conversion()
+{
+    int width = 263, height = 17; // not a multiple of the vector size
+    RGBA*pic = (RGBA*)rfx_alloc(width*height*sizeof(RGBA));
+    RGBA*pic2 = (RGBA*)rfx_alloc(width*height*sizeof(RGBA));
+    YUV*yuv = (YUV*)rfx_alloc(width*height*sizeof(YUV));
+    int t;
+    srand(4711);
+    for(t=0;t<width*height;t++) {
+	pic[t].a = 255;
+	pic[t].r = t<256 ? t : rand();
+	pic[t].g = t<256 ? 255-t : rand();
+	pic[t].b = t<256 ? t*7 : rand();
+    }
+    rgb2yuv(yuv, pic, width, width, width, height);
+    for(t=0;t<width*height;t++) {
+	YUV c;
+	rgb2yuv_pixel(&c, &pic[t]);
+	assert(abs(c.y-yuv[t].y)<=1 && abs(c.u-yuv[t].u)<=1 && abs(c.v-yuv[t].v)<=1);
+    }
+    for(t=0;t<width*height;t++) {
+	yuv[t].y = rand();
+	yuv[t].u = rand();
+	yuv[t].v = rand();
+    }
+    yuv2rgb(pic2, yuv, width, width, height);
+    for(t=0;t<width*height;t++) {
+	RGBA c;
+	yuv2rgb_pixel(&c, &yuv[t]);
+	assert(abs(c.r-pic2[t].r)<=1 && abs(c.g-pic2[t].g)<=1 && abs(c.b-pic2[t].b)<=1);
+    }
+    rfx_free(pic);
+    rfx_free(pic2);
+    rfx_free(yuv);
+}
+
 #endif
 
 #ifdef MAIN
@@ -1526,6 +1687,7 @@ int main(int argn, char*argv[])
 
 #ifdef TESTS
     test_copy_diff();
+    test_yuv_conversion();
 #endif
 
     mkblack();
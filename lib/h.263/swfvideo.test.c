@@ -0,0 +1,34 @@
+/* swfvideo.test.c
+
+   Runs the self tests of the h.263 encoder: block copy and compare, and
+   the vectorized rgb<->yuv conversions against the per-pixel ones.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdio.h>
+
+/* in swfvideo.c, which asserts on every failed check */
+void test_copy_diff();
+void test_yuv_conversion();
+
+int main()
+{
+    test_copy_diff();
+    test_yuv_conversion();
+    printf("ok, h.263 block compare and yuv conversion\n");
+    return 0;
+}
@@ -501,3 +501,65 @@ void jpeg_get_size(const char *fname, unsigned *width, unsigned *height)
 }
 
 #endif
+
+/* Check whether data is a baseline (8 bit, huffman coded, sequential) JPEG
+   file with either one (gray) or three (YCbCr) components. Those are the
+   files every JPEG decoder, including the Flash Player, can display- and
+   will display the same way. */
+int jpeg_is_baseline(const unsigned char*data, int size, unsigned*width, unsigned*height, int*components)
+{
+    int pos = 2;
+    int comps = 0;
+    int ids[3] = {0,0,0};
+    int jfif = 0;
+    int transform = -1;
+    int t;
+    if(size<4 || data[0]!=0xff || data[1]!=0xd8)
+	return 0;
+    while(1) {
+	if(pos+4 > size || data[pos]!=0xff)
+	    return 0;
+	int marker = data[pos+1];
+	if(marker == 0xff) {
+	    pos++; // fill byte
+	    continue;
+	}
+	int len = data[pos+2]<<8|data[pos+3];
+	if(len<2 || pos+2+len > size)
+	    return 0;
+	const unsigned char*seg = &data[pos+4];
+	len -= 2;
+	if(marker == 0xc0) { // SOF0
+	    if(len<6 || seg[0]!=8)
+		return 0;
+	    *height = seg[1]<<8|seg[2];
+	    *width = seg[3]<<8|seg[4];
+	    comps = seg[5];
+	    if((comps!=1 && comps!=3) || len<6+comps*3)
+		return 0;
+	    for(t=0;t<comps;t++)
+		ids[t] = seg[6+t*3];
+	} else if(marker>=0xc1 && marker<=0xcf && marker!=0xc4 && marker!=0xc8 && marker!=0xcc) {
+	    return 0; // progressive, lossless or arithmetic coded
+	} else if(marker == 0xe0 && len>=5 && !memcmp(seg, "JFIF\0", 5)) {
+	    jfif = 1;
+	} else if(marker == 0xee && len>=12 && !memcmp(seg, "Adobe", 5)) {
+	    transform = seg[11];
+	} else if(marker == 0xda) { // start of scan
+	    break;
+	}
+	pos += 2+2+len;
+    }
+    if(!comps || !*width || !*height)
+	return 0;
+    if(comps == 3) {
+	/* decoders guess the color space of files without an Adobe marker
+	   from the component ids, and don't always agree */
+	if(transform>=0 && transform!=1)
+	    return 0;
+	if(transform<0 && !jfif && ids[0]=='R' && ids[1]=='G' && ids[2]=='B')
+	    return 0;
+    }
+    *components = comps;
+    return 1;
+}
@@ -14,6 +14,7 @@ int jpeg_save_to_mem(unsigned char*data, unsigned width, unsigned height, int qu
 int jpeg_load(const char*filename, unsigned char**dest, unsigned int*width, unsigned int*height);
 int jpeg_load_from_mem(unsigned char*_data, int _size, unsigned char**dest, unsigned int*width, unsigned int*height);
 void jpeg_get_size(const char *fname, unsigned int *width, unsigned int *height);
+int jpeg_is_baseline(const unsigned char*data, int size, unsigned int*width, unsigned int*height, int*components);
 
 #ifdef __cplusplus
 }
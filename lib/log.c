@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include "../config.h"
 #ifdef WIN32
 //#include "stdafx.h"
 #include <malloc.h>
@@ -34,6 +35,10 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #include "log.h"
 
 int maxloglevel = 1;
@@ -58,6 +63,10 @@ void setConsoleLogging(int level)
 }
 void setFileLogging(char*filename, int level, char append)
 {
+    /* the writer thread might be using the old file */
+    int kbytes = getLogBuffer();
+    if(kbytes)
+	setLogBuffer(0);
     if(level>maxloglevel)
         maxloglevel=level;
     if(logFile) {
@@ -70,6 +79,8 @@ void setFileLogging(char*filename, int level, char append)
         logFile = 0;
         fileloglevel = 0;
     }
+    if(kbytes)
+	setLogBuffer(kbytes);
 }
 /* deprecated */
 void initLog(char* filename, int filelevel, char* s00, char* s01, int s02, int screenlevel)
@@ -80,6 +91,7 @@ void initLog(char* filename, int filelevel, char* s00, char* s01, int s02, int s
 
 void exitLog()
 {
+   setLogBuffer(0);
    // close file
    if(logFile != NULL) {
      fclose(logFile);
@@ -94,40 +106,251 @@ static char * logimportance[]= {"Fatal","Error","Warning","Notice","Verbose","De
 static int loglevels=7;
 static char * logimportance2[]= {"       ","FATAL  ","ERROR  ","WARNING","NOTICE ","VERBOSE","DEBUG  ", "TRACE  "};
 
+static void log_output(int level, const char*line, int len, char flush)
+{
+   if (level <= screenloglevel)
+   {
+       fwrite(line, len, 1, stdout);
+       fputc('\n', stdout);
+       if(flush)
+           fflush(stdout);
+   }
+
+   if (level <= fileloglevel)
+   {
+       if (logFile != NULL)
+       {
+	  fwrite(line, len, 1, logFile);
+	  fwrite("\r\n", 2, 1, logFile);
+	  if(flush)
+	      fflush(logFile);
+       }
+   }
+}
+
+#ifdef HAVE_PTHREAD_H
+/* Buffered logging: messages are appended to a ring buffer, which
+   a background thread writes out to the screen and the log file. This
+   saves the fflush() for every message at high verbosity levels.
+   Each entry in the buffer is
+
+     U8 level+1, U16 len, char text[len]
+
+   If the buffer is full, verbose/debug/trace messages are dropped
+   (and counted), everything else waits for the writer thread.
+   Errors and fatal messages are written synchronously, after
+   everything before them. */
+
+typedef struct _logbuffer {
+    unsigned char*data;
+    unsigned char*out; // messages currently being written
+    int size;
+    int start;  // read position
+    int used;
+    int dropped;
+    char busy;  // writer thread is using out[]
+    char stop;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+    pthread_cond_t notfull;
+} logbuffer_t;
+
+static logbuffer_t*logbuffer = 0;
+
+#define LOG_MAXLINE 4096
+/* how often the writer thread looks at the buffer (in ms) */
+#define LOG_INTERVAL 100
+
+static void buffer_write(logbuffer_t*b, const void*src, int len)
+{
+    int pos = (b->start+b->used) % b->size;
+    int l = b->size - pos;
+    if(l > len) l = len;
+    memcpy(b->data+pos, src, l);
+    memcpy(b->data, (const char*)src+l, len-l);
+    b->used += len;
+}
+
+/* move the buffer contents to out[]. Called with the mutex held. */
+static int buffer_take(logbuffer_t*b, int*dropped)
+{
+    int len = b->used;
+    int l = b->size - b->start;
+    if(l > len) l = len;
+    memcpy(b->out, b->data+b->start, l);
+    memcpy(b->out+l, b->data, len-l);
+    b->start = 0;
+    b->used = 0;
+    *dropped = b->dropped;
+    b->dropped = 0;
+    return len;
+}
+
+static void buffer_output(logbuffer_t*b, int len, int dropped)
+{
+    int pos = 0;
+    while(pos < len) {
+	unsigned char*head = &b->out[pos];
+	int l = head[1]|head[2]<<8;
+	log_output(head[0]-1, (char*)head+3, l, 0);
+	pos += 3+l;
+    }
+    if(dropped) {
+	char line[80];
+	int l = sprintf(line, "%s %d log messages dropped", logimportance2[LOGLEVEL_WARNING+1], dropped);
+	log_output(LOGLEVEL_WARNING, line, l, 0);
+    }
+    fflush(stdout);
+    if(logFile)
+	fflush(logFile);
+}
+
+static void* log_writer(void*_b)
+{
+    logbuffer_t*b = (logbuffer_t*)_b;
+    pthread_mutex_lock(&b->mutex);
+    while(1) {
+	if(!b->stop && b->used < b->size/2) {
+	    struct timespec ts;
+	    clock_gettime(CLOCK_REALTIME, &ts);
+	    ts.tv_nsec += LOG_INTERVAL*1000000;
+	    if(ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	    }
+	    pthread_cond_timedwait(&b->wakeup, &b->mutex, &ts);
+	}
+	if(!b->used && !b->dropped) {
+	    if(b->stop)
+		break;
+	    continue;
+	}
+	int dropped;
+	int len = buffer_take(b, &dropped);
+	b->busy = 1;
+	pthread_cond_broadcast(&b->notfull);
+	pthread_mutex_unlock(&b->mutex);
+
+	buffer_output(b, len, dropped);
+
+	pthread_mutex_lock(&b->mutex);
+	b->busy = 0;
+	pthread_cond_broadcast(&b->notfull);
+    }
+    pthread_mutex_unlock(&b->mutex);
+    return 0;
+}
+
+static void log_buffered(int level, const char*line, int len)
+{
+    logbuffer_t*b = logbuffer;
+    if(len > LOG_MAXLINE)
+	len = LOG_MAXLINE;
+    int size = len+3;
+    unsigned char head[3];
+    head[0] = level+1;
+    head[1] = len;
+    head[2] = len>>8;
+    pthread_mutex_lock(&b->mutex);
+    if(level <= LOGLEVEL_ERROR) {
+	/* make sure errors end up on the screen, even if we crash
+	   directly afterwards */
+	while(b->busy)
+	    pthread_cond_wait(&b->notfull, &b->mutex);
+	int dropped;
+	int l = buffer_take(b, &dropped);
+	buffer_output(b, l, dropped);
+	log_output(level, line, len, 1);
+	pthread_mutex_unlock(&b->mutex);
+	return;
+    }
+    while(b->used + size > b->size) {
+	if(level >= LOGLEVEL_VERBOSE || size > b->size) {
+	    b->dropped++;
+	    pthread_mutex_unlock(&b->mutex);
+	    return;
+	}
+	pthread_cond_signal(&b->wakeup);
+	pthread_cond_wait(&b->notfull, &b->mutex);
+    }
+    buffer_write(b, head, 3);
+    buffer_write(b, line, len);
+    if(b->used >= b->size/2)
+	pthread_cond_signal(&b->wakeup);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+static void log_atexit()
+{
+    setLogBuffer(0);
+}
+#endif
+
+int getLogBuffer()
+{
+#ifdef HAVE_PTHREAD_H
+    if(logbuffer)
+	return logbuffer->size/1024;
+#endif
+    return 0;
+}
+
+void setLogBuffer(int kbytes)
+{
+#ifdef HAVE_PTHREAD_H
+    if(logbuffer) {
+	logbuffer_t*b = logbuffer;
+	pthread_mutex_lock(&b->mutex);
+	b->stop = 1;
+	pthread_cond_signal(&b->wakeup);
+	pthread_mutex_unlock(&b->mutex);
+	pthread_join(b->thread, 0);
+	logbuffer = 0;
+	pthread_mutex_destroy(&b->mutex);
+	pthread_cond_destroy(&b->wakeup);
+	pthread_cond_destroy(&b->notfull);
+	free(b->data);
+	free(b->out);
+	free(b);
+    }
+    if(kbytes <= 0)
+	return;
+    logbuffer_t*b = (logbuffer_t*)calloc(1, sizeof(logbuffer_t));
+    b->size = kbytes*1024;
+    b->data = (unsigned char*)malloc(b->size);
+    b->out = (unsigned char*)malloc(b->size);
+    pthread_mutex_init(&b->mutex, 0);
+    pthread_cond_init(&b->wakeup, 0);
+    pthread_cond_init(&b->notfull, 0);
+    if(!b->data || !b->out || pthread_create(&b->thread, 0, log_writer, b)) {
+	pthread_mutex_destroy(&b->mutex);
+	pthread_cond_destroy(&b->wakeup);
+	pthread_cond_destroy(&b->notfull);
+	free(b->data);
+	free(b->out);
+	free(b);
+	return;
+    }
+    static char registered = 0;
+    if(!registered) {
+	atexit(log_atexit);
+	registered = 1;
+    }
+    logbuffer = b;
+#endif
+}
+
 static inline void log_str(const char* logString)
 {
-   char timebuffer[32];
-   char* logBuffer;
-   char dbuffer[9];
-   char tbuffer[9];
+   char buffer[1024+16];
+   char*logBuffer = buffer;
+   int size = sizeof(buffer);
    int level;
    char*lt;
    char*gt;
    int l;
 
-   logBuffer = (char*)malloc (strlen(logString) + 24 + 15);
-#ifndef __NT__
-   {
-     /*time_t t = time(0);
-     tm*t2 = localtime(t);
-     strftime(dbuffer, 8, "%m %d", t2);
-     strftime(tbuffer, 8, "%m %d", t2);
-     dbuffer[0]=0; //FIXME
-     tbuffer[0]=0;*/
-     time_t t = time(0);
-     char* a = ctime(&t);
-     int l = strlen(a);
-     while(a[l-1] == 13 || a[l-1] == 10)
-       l--;
-     a[l]=0;
-     sprintf(timebuffer, "%s", a);
-   }
-#else
-   _strdate( dbuffer );
-   _strtime( tbuffer );
-   sprintf(timebuffer, "%s - %s",dbuffer,tbuffer);
-#endif
-
    // search for <level> field
    level = -1;
    lt=strchr(logString, '<');
@@ -151,34 +374,29 @@ static inline void log_str(const char* logString)
        }
    }
    
-//   sprintf(logBuffer, "%s: %s %s", timebuffer, logimportance2[level + 1],logString);
-   sprintf(logBuffer, "%s %s", logimportance2[level + 1],logString);
+   l = strlen(logString) + 16;
+   if(l > size) {
+       size = l;
+       logBuffer = (char*)malloc(size);
+   }
+   l = sprintf(logBuffer, "%s %s", logimportance2[level + 1],logString);
 
    // we always do exactly one newline.
-   
-   l=strlen(logBuffer)-1;
-   while((logBuffer[l]==13 || logBuffer[l]==10) && l>=0)
-   {
-       logBuffer[l]=0;
+   while(l>0 && (logBuffer[l-1]==13 || logBuffer[l-1]==10))
        l--;
-   }
+   logBuffer[l] = 0;
 
-   if (level <= screenloglevel)
-   {
-       printf("%s\n", logBuffer); 
-       fflush(stdout);
-   }
-
-   if (level <= fileloglevel)
-   {
-       if (logFile != NULL)
-       {
-	  fprintf(logFile, "%s\r\n", logBuffer); 
-	  fflush(logFile);
-       }
+   if(level <= screenloglevel || (level <= fileloglevel && logFile)) {
+#ifdef HAVE_PTHREAD_H
+       if(logbuffer)
+	   log_buffered(level, logBuffer, l);
+       else
+#endif
+	   log_output(level, logBuffer, l, 1);
    }
 
-   free (logBuffer);
+   if(logBuffer != buffer)
+       free(logBuffer);
 }
 
 void msg_str(const char* buf)
@@ -44,11 +44,27 @@ extern void initLog(char* pLogDir, int fileloglevel, char* servAddr, char* logPo
 extern void setConsoleLogging(int level);
 extern void setFileLogging(char*filename, int level, char append);
 
+/* write log messages from a background thread, using a buffer of the given
+   size. Verbose messages are dropped if the buffer overflows. 0 = write
+   every message directly (the default) */
+extern void setLogBuffer(int kbytes);
+extern int getLogBuffer();
+
 extern int maxloglevel;
 extern char char2loglevel[32];
 
+/* compiling with e.g. -DLOG_COMPILE_LEVEL=LOGLEVEL_NOTICE removes all
+   messages above that level (including the evaluation of their arguments) */
+#ifdef LOG_COMPILE_LEVEL
+#define LOG_LEVEL_OF(fmt) \
+    ((fmt)[1]=='f'?LOGLEVEL_FATAL:(fmt)[1]=='e'?LOGLEVEL_ERROR:(fmt)[1]=='w'?LOGLEVEL_WARNING: \
+     (fmt)[1]=='n'?LOGLEVEL_NOTICE:(fmt)[1]=='v'?LOGLEVEL_VERBOSE:(fmt)[1]=='d'?LOGLEVEL_DEBUG:LOGLEVEL_TRACE)
+#define msg(fmt,args...) \
+    (((fmt)[0]=='<' && LOG_LEVEL_OF(fmt)<=LOG_COMPILE_LEVEL && char2loglevel[(fmt)[1]&31]<=maxloglevel)?msg_internal((fmt),## args):0)
+#else
 #define msg(fmt,args...) \
     (((fmt)[0]=='<' && char2loglevel[(fmt)[1]&31]<=maxloglevel)?msg_internal((fmt),## args):0)
+#endif
 
 extern int msg_internal(const char* logFormat, ...);
 extern void msg_str(const char* log);
@@ -44,6 +44,7 @@ extern "C" {
 #endif // HAVE_JPEGLIB
 
 #include "../rfxswf.h"
+#include "../palette.h"
 
 #define OUTBUFFER_SIZE 0x8000
 
@@ -61,111 +62,15 @@ int swf_ImageHasAlpha(RGBA*img, int width, int height)
     return hasalpha;
 }
 
-/*int swf_ImageGetNumberOfPaletteEntries(RGBA*img, int width, int height, RGBA*palette)
-{
-    int len = width*height;
-    int t;
-    int palsize = 0;
-    RGBA pal[512];
-    U32*pal32=(U32*)pal;
-    int palette_overflow = 0;
-    U32 lastcol32 = 0;
-
-    if(sizeof(RGBA)!=sizeof(U32))
-	fprintf(stderr, "rfxswf: sizeof(RGBA)!=sizeof(U32))");
-
-    lastcol32 = pal32[palsize++] = *(U32*)&img[0];
-
-    for(t=1;t<len;t++) {
-	RGBA col = img[t];
-	U32 col32 = *(U32*)&img[t];
-	int i;
-	if(col32==lastcol32)
-	    continue;
-	for(i=0;i<palsize;i++) {
-	    if(col32 == pal32[i])
-		break;
-	}
-	if(i==palsize) {
-	    if(palsize==512) {
-		palette_overflow = 1;
-		break;
-	    }
-	    pal32[palsize++] = col32;
-	}
-	lastcol32 = col32;
-    }
-    if(palette_overflow)
-	return width*height;
-    if(palette)
-	memcpy(palette, pal, palsize*sizeof(RGBA));
-    return palsize;
-}*/
-
 int swf_ImageGetNumberOfPaletteEntries(RGBA*img, int width, int height, RGBA*palette)
 {
-    int len = width*height;
-    int t;
-    int palsize = 0;
-    U32* pal;
-    int size[256];
-    int palette_overflow = 0;
-    U32 lastcol32 = 0;
-
-    pal = (U32*)malloc(65536*sizeof(U32));
-
-    memset(size, 0, sizeof(size));
-
-    if(sizeof(RGBA)!=sizeof(U32))
-	fprintf(stderr, "rfxswf: sizeof(RGBA)!=sizeof(U32))");
-
-    lastcol32 = (*(U32*)&img[0])^0xffffffff; // don't match
-
-    for(t=0;t<len;t++) {
-	RGBA col = img[t];
-	U32 col32 = *(U32*)&img[t];
-	int i;
-	int csize;
-	U32 hash;
-	U32* cpal;
-	if(col32 == lastcol32)
-	    continue;
-	hash = (col32 >> 17) ^ col32;
-	hash ^= ((hash>>8) + 1) ^ hash;
-	hash &= 255;
-
-	csize = size[hash];
-	cpal = &pal[hash*256];
-	for(i=0;i<csize;i++) {
-	    if(col32 == cpal[i])
-		break;
-	}
-	if(i==csize) {
-	    if(palsize==256) {
-		palette_overflow = 1;
-		break;
-	    }
-	    cpal[size[hash]++] = col32;
-	    palsize++;
-	}
-	lastcol32 = col32;
-    }
-    if(palette_overflow) {
-	free(pal);
+    palette_t pal;
+    palette_analyze(img, width, height, 256, &pal, 0, 0);
+    if(pal.num>256)
 	return width*height;
-    }
-    if(palette) {
-	int i = 0;
-	for(t=0;t<256;t++) {
-	    int s;
-	    int csize = size[t];
-	    U32* cpal = &pal[t*256];
-	    for(s=0;s<csize;s++)
-		palette[i++] = *(RGBA*)(&cpal[s]);
-	}
-    }
-    free(pal);
-    return palsize;
+    if(palette)
+	memcpy(palette, pal.colors, pal.num*sizeof(RGBA));
+    return pal.num;
 }
 
 
@@ -880,53 +785,51 @@ void swf_PreMultiplyAlpha(RGBA*data, int width, int height)
     }
 }
 
-/* expects mem to be non-premultiplied */
-void swf_SetLosslessImage(TAG*tag, RGBA*data, int width, int height)
+/* store an image which was already scanned with palette_analyze(),
+   with indices (if given) in BYTES_PER_SCANLINE(width) sized rows */
+static void swf_SetLosslessImageAnalyzed(TAG*tag, RGBA*data, int width, int height, palette_t*pal, U8*indices)
 {
-    int hasalpha = swf_ImageHasAlpha(data, width, height);
-    int num;
-    if(!hasalpha) {
+    if(!pal->alpha) {
 	tag->id = ST_DEFINEBITSLOSSLESS;
     } else {
 	tag->id = ST_DEFINEBITSLOSSLESS2;
 	/* FIXME: we're destroying the callers data here */
 	swf_PreMultiplyAlpha(data, width, height);
+	/* premultiplying might merge some colors, but the indices
+	   stay valid */
+	swf_PreMultiplyAlpha((RGBA*)pal->colors, pal->num, 1);
     }
-    num = swf_ImageGetNumberOfPaletteEntries(data, width, height, 0);
-    if(num>1 && num<=256) {
-	RGBA*palette = (RGBA*)malloc(sizeof(RGBA)*num);
-	int width2 = BYTES_PER_SCANLINE(width);
-	U8*data2 = (U8*)malloc(width2*height);
-	int len = width*height;
-	int x,y;
-	int r;
-	swf_ImageGetNumberOfPaletteEntries(data, width, height, palette);
-	for(y=0;y<height;y++) {
-	    RGBA*src = &data[width*y];
-	    U8*dest = &data2[width2*y];
-	    for(x=0;x<width;x++) {
-		RGBA col = src[x];
-		for(r=0;r<num;r++) {
-		    if(*(U32*)&col == *(U32*)&palette[r]) {
-			dest[x] = r;
-			break;
-		    }
-		}
-		if(r==num) {
-		    fprintf(stderr, "Internal error: Couldn't find color %02x%02x%02x%02x in palette (%d entries)\n",
-			    col.r, col.g, col.b, col.a, num);
-		    dest[x] = 0;
-		}
-	    }
-	}
-	swf_SetLosslessBitsIndexed(tag, width, height, data2, palette, num);
-	free(data2);
-	free(palette);
+    if(pal->num>1 && pal->num<=256 && indices) {
+	swf_SetLosslessBitsIndexed(tag, width, height, indices, (RGBA*)pal->colors, pal->num);
     } else {
 	swf_SetLosslessBits(tag, width, height, data, BMF_32BIT);
     }
 }
 
+/* expects mem to be non-premultiplied */
+void swf_SetLosslessImage(TAG*tag, RGBA*data, int width, int height)
+{
+    palette_t pal;
+    U8*indices = (U8*)rfx_calloc(BYTES_PER_SCANLINE(width)*height);
+    palette_analyze(data, width, height, 256, &pal, indices, BYTES_PER_SCANLINE(width));
+    swf_SetLosslessImageAnalyzed(tag, data, width, height, &pal, indices);
+    rfx_free(indices);
+}
+
+/* like swf_SetLosslessImage(), but reduces images with more than
+   256 colors to numcolors colors (lossy) */
+void swf_SetLosslessImageQuantized(TAG*tag, RGBA*data, int width, int height, int numcolors)
+{
+    palette_t pal;
+    U8*indices = (U8*)rfx_calloc(BYTES_PER_SCANLINE(width)*height);
+    palette_analyze(data, width, height, 256, &pal, indices, BYTES_PER_SCANLINE(width));
+    if(pal.num>256) {
+	pal.num = palette_quantize(data, width, height, numcolors, pal.colors, indices, BYTES_PER_SCANLINE(width));
+    }
+    swf_SetLosslessImageAnalyzed(tag, data, width, height, &pal, indices);
+    rfx_free(indices);
+}
+
 RGBA *swf_DefineLosslessBitsTagToImage(TAG * tag, int *dwidth, int *dheight)
 {
     int id, format, height, width, pos;
@@ -1153,11 +1056,16 @@ int swf_SetJPEGBits3(TAG * tag, U16 width, U16 height, RGBA * bitmap, int qualit
 #endif
 
 
-/* expects mem to be non-premultiplied */
-TAG* swf_AddImage(TAG*tag, int bitid, RGBA*mem, int width, int height, int quality)
+/* expects mem to be non-premultiplied. If numcolors is given, the lossless
+   version of images with more than 256 colors is reduced to numcolors colors. */
+TAG* swf_AddImageQuantized(TAG*tag, int bitid, RGBA*mem, int width, int height, int quality, int numcolors)
 {
     TAG *tag1 = 0, *tag2 = 0;
-    int has_alpha = swf_ImageHasAlpha(mem,width,height);
+    palette_t pal;
+    int stride = BYTES_PER_SCANLINE(width);
+    U8*indices = (U8*)rfx_calloc(stride*height);
+    palette_analyze(mem, width, height, 256, &pal, indices, stride);
+    int has_alpha = pal.alpha;
 
     /* try lossless image */
 
@@ -1167,8 +1075,11 @@ TAG* swf_AddImage(TAG*tag, int bitid, RGBA*mem, int width, int height, int quali
 #else
     tag1 = swf_InsertTag(0, /*ST_DEFINEBITSLOSSLESS1/2*/0);
     swf_SetU16(tag1, bitid);
-    swf_SetLosslessImage(tag1, mem, width, height);
+    if(pal.num>256 && numcolors>0)
+	pal.num = palette_quantize(mem, width, height, numcolors, pal.colors, indices, stride);
+    swf_SetLosslessImageAnalyzed(tag1, mem, width, height, &pal, indices);
 #endif
+    rfx_free(indices);
 
 #if defined(HAVE_JPEGLIB)
     /* try jpeg image. Notice that if (and only if) we tried the lossless compression
@@ -1200,6 +1111,12 @@ TAG* swf_AddImage(TAG*tag, int bitid, RGBA*mem, int width, int height, int quali
     return tag;
 }
 
+/* expects mem to be non-premultiplied */
+TAG* swf_AddImage(TAG*tag, int bitid, RGBA*mem, int width, int height, int quality)
+{
+    return swf_AddImageQuantized(tag, bitid, mem, width, height, quality, 0);
+}
+
 RGBA *swf_ExtractImage(TAG * tag, int *dwidth, int *dheight)
 {
     RGBA *img;
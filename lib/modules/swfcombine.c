@@ -0,0 +1,835 @@
+/* swfcombine.c
+
+   Merging of SWF files (the core of swfcombine(1)): Replace an object
+   (or a frame) of a master file by the contents of a slave file.
+
+   Extension module for the rfxswf library.
+   Part of the swftools package.
+
+   Copyright (c) 2001,2002,2003 Matthias Kramm <kramm@quiss.org>
+ 
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include "../rfxswf.h"
+#include "../log.h"
+
+typedef struct _combine {
+    COMBINEOPTIONS*config;
+    char*slavename;
+    int slaveid;
+    int slaveframe;
+    char masterbitmap[65536];
+    char depthbitmap[65536];
+} combine_t;
+
+void swf_CombineOptionsInit(COMBINEOPTIONS*options)
+{
+    memset(options, 0, sizeof(COMBINEOPTIONS));
+    options->scalex = options->scaley = 1.0;
+    options->masterscalex = options->masterscaley = 1.0;
+}
+
+void swf_CombinePrepare(SWF*swf)
+{
+    swf_RemoveJPEGTables(swf);
+
+    /* tags which may only occur once in a file */
+    TAG*tag = swf->firstTag;
+    while(tag) {
+	if(tag->id == ST_SCENEDESCRIPTION ||
+	   tag->id == ST_FILEATTRIBUTES ||
+	   tag->id == ST_REFLEX) {
+	    tag = swf_DeleteTag(swf, tag);
+	} else {
+	    tag = tag->next;
+	}
+    }
+}
+
+#define FLAGS_WRITEDEFINES 1
+#define FLAGS_WRITENONDEFINES 2
+#define FLAGS_WRITESPRITE 4
+#define FLAGS_WRITESLAVE 8
+
+static int get_free_id(char*bitmap)
+{
+    int t;
+    for(t=1;t<65536;t++)
+	if(!bitmap[t]) {
+	    bitmap[t] = 1;
+	    return t;
+	}
+    return -1;
+}
+
+static void jpeg_assert(SWF*master, SWF*slave)
+{
+    /* TODO: if there's a jpegtable found, store it
+       and handle it together with the flash file
+       headers */
+
+    /* check that master and slave don't have both
+       jpegtables (which would be fatal) */
+    int pos;
+    TAG *mpos=0, *spos=0;
+    TAG *mtag,*stag;
+    pos = 0;
+    mtag = master->firstTag;
+    stag = slave->firstTag;
+    while(mtag)
+    {
+	if(mtag->id  == ST_JPEGTABLES)
+	    mpos = mtag;
+	mtag = mtag->next;
+    }
+    while(stag)
+    {
+	if(stag->id == ST_JPEGTABLES)
+	    spos = stag;
+	stag = stag->next;
+    }
+    if(mpos && spos)
+    {
+	if(spos->len == mpos->len &&
+	!memcmp(spos->data, mpos->data, mpos->len))
+	{
+	    // ok, both have jpegtables, but they're identical.
+	    // delete one and don't throw an error
+	    swf_DeleteTag(slave, spos);
+	    spos = 0;
+	}
+    }
+    if(spos && mpos) {
+	msg("<error> Master and slave have incompatible JPEGTABLES.");
+    }
+}
+
+static TAG* write_sprite_defines(TAG*tag, SWF*sprite)
+{
+    TAG*rtag = sprite->firstTag;
+    while(rtag && rtag->id!=ST_END) {
+	if(!swf_isAllowedSpriteTag(rtag)) {
+	    msg("<debug> processing sprite tag %02x", tag->id);
+	    if(swf_isDefiningTag(rtag))
+	    {
+		msg("<debug> [sprite defs] write tag %02x (%d bytes in body)", 
+			tag->id, tag->len);
+		tag = swf_InsertTag(tag, rtag->id);
+		swf_SetBlock(tag, rtag->data, rtag->len);
+	    }
+	    else if(swf_isPseudoDefiningTag(rtag))
+	    {
+		msg("<debug> [sprite defs] write tag %02x (%d bytes in body)", 
+			tag->id, tag->len);
+		tag = swf_InsertTag(tag, rtag->id);
+		swf_SetBlock(tag, rtag->data, rtag->len);
+	    }
+	    else {
+		switch(rtag->id)
+		{
+		    case ST_JPEGTABLES:
+			   /* if we get here, jpeg_assert has already run,
+			      ensuring this is the only one of it's kind,
+			      so we may safely write it out */
+			   tag = swf_InsertTag(tag, rtag->id);
+			   swf_SetBlock(tag, rtag->data, rtag->len);
+		       break;
+		    case ST_EXPORTASSETS:
+		       msg("<debug> deliberately ignoring EXPORTASSETS tag");
+		       break;
+		    case ST_ENABLEDEBUGGER:
+		       msg("<debug> deliberately ignoring ENABLEDEBUGGER tag");
+		       break;
+		    case ST_SETBACKGROUNDCOLOR:
+		       msg("<debug> deliberately ignoring BACKGROUNDCOLOR tag");
+		       break;
+		    case ST_SHOWFRAME:
+		       msg("<debug> deliberately ignoring SHOWFRAME tag");
+		       break;
+		    case ST_REFLEX:
+		       msg("<debug> deliberately ignoring REFLEX tag");
+		       break;
+		    case 40:
+		    case 49:
+		    case 51:
+		       msg("<notice> found tag %d. This is a Generator template, isn't it?", rtag->id);
+		       break;
+		    default:
+		       msg("<notice> funny tag: %d is neither defining nor sprite", rtag->id);
+		}
+	    }
+	}
+	rtag = rtag->next;
+    }
+    return tag;
+}
+
+static void changedepth(TAG*tag, int add)
+{
+    if(tag->id == ST_PLACEOBJECT)
+	PUT16(&tag->data[2],GET16(&tag->data[2])+add);
+    if(tag->id == ST_PLACEOBJECT2)
+	PUT16(&tag->data[1],GET16(&tag->data[1])+add);
+    if(tag->id == ST_PLACEOBJECT3)
+	PUT16(&tag->data[2],GET16(&tag->data[2])+add);
+    if(tag->id == ST_REMOVEOBJECT)
+	PUT16(&tag->data[2],GET16(&tag->data[2])+add);
+    if(tag->id == ST_REMOVEOBJECT2)
+	PUT16(&tag->data[0],GET16(&tag->data[0])+add);
+    if((tag->id == ST_PLACEOBJECT2) || (tag->id == ST_PLACEOBJECT3)) {
+	SWFPLACEOBJECT obj;
+	U8 flags;
+	U8 flags2 = 0;
+	swf_SetTagPos(tag, 0);
+	flags = swf_GetU8(tag);
+	if(tag->id == ST_PLACEOBJECT3) {
+	    flags2 = swf_GetU8(tag);
+	}
+	swf_GetU16(tag); //depth
+	if((flags2&8) || // hasClassname or (hasImage & hasCharacter)
+           ((flags2&16) && (flags&2))) swf_GetString(tag); //classname
+	if(flags&2) swf_GetU16(tag); //id
+	if(flags&4) swf_GetMatrix(tag, 0);
+	if(flags&8) swf_GetCXForm(tag, 0,1);
+	if(flags&16) swf_GetU16(tag); //ratio
+	if(flags&32) swf_GetString(tag); //name
+	if(flags&64) { //clipdepth
+	    swf_ResetReadBits(tag);
+	    msg("<debug> clipdepth %d->%d", GET16(&tag->data[tag->pos]),
+		               GET16(&tag->data[tag->pos])+add);
+	    PUT16(&tag->data[tag->pos],GET16(&tag->data[tag->pos])+add);
+	}
+	msg("<warning> Depth relocation not fully working yet with clipdepths", tag->id);
+    }
+}
+
+static void matrix_adjust(MATRIX*m, int movex, int movey, float scalex, float scaley, int scalepos)
+{
+    m->sx = (int)(m->sx*scalex);
+    m->sy = (int)(m->sy*scaley);
+    m->r1 = (int)(m->r1*scalex);
+    m->r0 = (int)(m->r0*scaley);
+    if(scalepos) {
+	m->tx *= scalex;
+	m->ty *= scaley;
+    }
+    m->tx += movex;
+    m->ty += movey;
+}
+
+static void write_changepos(TAG*output, TAG*tag, int movex, int movey, float scalex, float scaley, int scalepos)
+{
+    if(movex || movey || scalex != 1.0 || scaley != 1.0)
+    {
+	switch(tag->id)
+	{
+	    case ST_PLACEOBJECT2: // FALLTHROUGH
+	    case ST_PLACEOBJECT3: {
+		MATRIX m;
+		U8 flags;
+		U8 flags2 = 0;
+		swf_GetMatrix(0, &m);
+		tag->pos = 0;
+		tag->readBit = 0;
+
+		flags = swf_GetU8(tag);
+		swf_SetU8(output, flags|4); //hasMatrix
+		if(tag->id == ST_PLACEOBJECT3) {
+		    flags2 = swf_GetU8(tag);
+		    swf_SetU8(output, flags2);
+		}
+		swf_SetU16(output, swf_GetU16(tag)); //depth
+
+		if (flags2&8) {
+		    swf_SetString(output, swf_GetString(tag)); //classname
+		}
+		//flags&1: move
+		if(flags&2) {
+		    swf_SetU16(output, swf_GetU16(tag)); //id
+		}
+		if(flags&4) {
+		    swf_GetMatrix(tag, &m);
+		} else {
+		    swf_GetMatrix(0, &m);
+		}
+		matrix_adjust(&m, movex, movey, scalex, scaley, scalepos);
+		swf_SetMatrix(output, &m);
+
+		if (tag->readBit)  { tag->pos++; tag->readBit = 0; } //swf_ResetReadBits(tag);
+
+		swf_SetBlock(output, &tag->data[tag->pos], tag->len - tag->pos);
+		break;
+	    }
+	    case ST_PLACEOBJECT: {
+		MATRIX m;
+		swf_SetU16(output, swf_GetU16(tag)); //id
+		swf_SetU16(output, swf_GetU16(tag)); //depth
+		
+		swf_GetMatrix(tag, &m);
+		matrix_adjust(&m, movex, movey, scalex, scaley, scalepos);
+		swf_SetMatrix(output, &m);
+		
+		if (tag->readBit)  { tag->pos++; tag->readBit = 0; } //swf_ResetReadBits(tag);
+
+		swf_SetBlock(output, &tag->data[tag->pos], tag->len - tag->pos);
+		break;
+	    }
+	    default:
+	    swf_SetBlock(output, tag->data, tag->len);
+	}
+    } 
+    else 
+    {
+	    swf_SetBlock(output, tag->data, tag->len);
+    }
+}
+
+static TAG* write_sprite(combine_t*c, TAG*tag, SWF*sprite, int spriteid, int replaceddefine)
+{
+    TAG* definespritetag;
+    TAG* rtag;
+    int tmp;
+
+    definespritetag = tag = swf_InsertTag(tag, ST_DEFINESPRITE);
+    swf_SetU16(tag, spriteid);
+    swf_SetU16(tag, sprite->frameCount);
+    msg ("<notice> sprite id is %d", spriteid);
+
+    tmp = sprite->frameCount;
+    msg("<debug> %d frames to go",tmp);
+
+    if(c->config->clip) {
+	tag = swf_InsertTag(tag, ST_PLACEOBJECT2);
+	swf_SetU8(tag, 2+64); //flags: character+clipdepth
+	swf_SetU16(tag, 0); //depth
+	swf_SetU16(tag, replaceddefine); //id
+	swf_SetU16(tag, 65535); //clipdepth
+    }
+
+    if(c->config->overlay && !c->config->isframe) {
+	tag = swf_InsertTag(tag, ST_PLACEOBJECT2);
+	swf_SetU8(tag, 2); //flags: character
+	swf_SetU16(tag, 1); //depth
+	swf_SetU16(tag, replaceddefine); //id
+    }
+
+    rtag = sprite->firstTag;
+    while(rtag && rtag->id!=ST_END)
+    {
+	if (swf_isAllowedSpriteTag(rtag)) {
+
+	    msg("<debug> [sprite main] write tag %02x (%d bytes in body)", 
+		    rtag->id, rtag->len);
+	    tag = swf_InsertTag(tag, rtag->id);
+	    write_changepos(tag, rtag, c->config->movex, c->config->movey, c->config->scalex, c->config->scaley, 0);
+
+	    if(c->config->clip || (c->config->overlay && !c->config->isframe))
+		changedepth(tag, +2);
+
+	    if(tag->id == ST_SHOWFRAME)
+	    {
+		tmp--;
+		msg("<debug> %d frames to go",tmp);
+	    }
+	}
+	rtag = rtag->next;
+    }
+    tag = swf_InsertTag(tag, ST_END);
+    return tag;
+}
+
+static char tag_ok_for_slave(int id)
+{
+    if(id == ST_SETBACKGROUNDCOLOR)
+	return 0;
+    return 1;
+}
+
+static TAG* write_master(combine_t*c, TAG*tag, SWF*master, SWF*slave, int spriteid, int replaceddefine, int flags)
+{
+    int outputslave = 0;
+    int frame = 1;
+    int sframe = 0;
+    int slavewritten = 0;
+    int deletedepth = -1;
+
+    TAG* rtag = master->firstTag;
+    TAG* stag = slave->firstTag;
+
+    while(rtag && rtag->id!=ST_END)
+    {
+	if(rtag->id == ST_SHOWFRAME && outputslave)
+	{
+	    while(stag && stag->id!=ST_END) {
+		if(stag->id == ST_SHOWFRAME) {
+		    stag = stag->next;
+		    sframe++;
+		    break;
+		}
+		if(tag_ok_for_slave(stag->id)) {
+		    tag = swf_InsertTag(tag, stag->id);
+		    write_changepos(tag, stag, c->config->movex, c->config->movey, c->config->scalex, c->config->scaley, 0);
+		}
+		stag = stag->next;
+	    }
+	}
+	if(rtag->id == ST_SHOWFRAME)
+	{
+	    frame ++;
+	    tag = swf_InsertTag(tag, ST_SHOWFRAME);
+            if(deletedepth>=0) {
+                tag = swf_InsertTag(tag, ST_REMOVEOBJECT2);
+                swf_SetU16(tag, deletedepth);
+                deletedepth=-1;
+            }
+	    rtag = rtag->next;
+            continue;
+	}
+
+	if(swf_isDefiningTag(rtag) && (flags&FLAGS_WRITEDEFINES))
+	{
+	    msg("<debug> [master] write tag %02x (%d bytes in body)", 
+		    rtag->id, rtag->len);
+	    if(swf_GetDefineID(rtag) == spriteid && !c->config->isframe)
+	    {
+		if(c->config->overlay)
+		{
+		    tag = swf_InsertTag(tag, rtag->id);
+		    swf_SetBlock(tag, rtag->data, rtag->len);
+		    swf_SetDefineID(tag, replaceddefine);
+		} else {
+		    /* don't write this tag */
+		    msg("<verbose> replacing tag %d ID %d with sprite", rtag->id ,spriteid);
+		}
+
+		if(flags&FLAGS_WRITESPRITE)
+		{
+		    msg("<debug> writing sprite defines");
+		    tag = write_sprite_defines(tag, slave);
+		    msg("<debug> writing sprite");
+		    tag = write_sprite(c, tag, slave, spriteid, replaceddefine);
+		}
+		if(flags&FLAGS_WRITESLAVE)
+		{
+		    msg("<debug> writing slave");
+		    outputslave = 1;
+		}
+	    } else { 
+		tag = swf_InsertTag(tag, rtag->id);
+		swf_SetBlock(tag, rtag->data, rtag->len);
+	    }
+	}
+	if(frame == c->slaveframe) /* only happens with isframe: put slave at specific frame */
+	{
+	    if(flags&FLAGS_WRITESLAVE) {
+		outputslave = 1;
+		slavewritten = 1;
+	    }
+	    if((flags&FLAGS_WRITESPRITE) && !slavewritten)
+	    {
+		int id = get_free_id(c->masterbitmap);
+		int depth = 65535;
+		deletedepth = 65535;
+		if(c->config->clip) {
+		    msg("<fatal> Can't combine --clip and --frame");
+		}
+		
+		tag = write_sprite_defines(tag, slave);
+		tag = write_sprite(c, tag, slave, id, -1);
+
+		tag = swf_InsertTag(tag, ST_PLACEOBJECT2);
+		    swf_SetU8(tag, 2); //flags: id
+		    swf_SetU16(tag, depth);
+		    swf_SetU16(tag, id);
+
+		slavewritten = 1;
+	    }
+	}
+	if(!swf_isDefiningTag(rtag) && (flags&FLAGS_WRITENONDEFINES))
+	{
+	    int dontwrite = 0;
+	    switch(rtag->id) {
+		case ST_PLACEOBJECT:
+		case ST_PLACEOBJECT2:
+		case ST_PLACEOBJECT3:
+		    if(frame == c->slaveframe && !c->config->overlay)
+			dontwrite = 1;
+		case ST_REMOVEOBJECT:
+		    /* place/removetags for the object we replaced
+		       should be discarded, too, as the object to insert 
+		       isn't a sprite 
+		     */
+		    if(spriteid>=0 && swf_GetPlaceID(rtag) == spriteid && 
+			    !c->config->isframe && c->config->merge)
+			dontwrite = 1;
+		break;
+		case ST_REMOVEOBJECT2:
+		break;
+	    }
+	    if(!dontwrite) {
+		msg("<debug> [master] write tag %02x (%d bytes in body)", 
+			rtag->id, rtag->len);
+		tag = swf_InsertTag(tag, rtag->id);
+		write_changepos(tag, rtag, c->config->mastermovex, c->config->mastermovey, c->config->masterscalex, c->config->masterscaley, 1);
+		
+	    }
+	}
+	rtag = rtag->next;
+    }
+   
+    if(outputslave) 
+    while(stag && stag->id!=ST_END)
+    {
+	    if(tag_ok_for_slave(stag->id)) {
+		msg("<debug> [slave] write tag %02x (%d bytes in body), %.2f %.2f", rtag->id, rtag->len, c->config->movex /20.0, c->config->movey /20.0);
+		tag = swf_InsertTag(tag, stag->id);
+		write_changepos(tag, stag, c->config->movex, c->config->movey, c->config->scalex, c->config->scaley, 0);
+	    }
+	    stag = stag->next;
+    }
+    if(!slavewritten && c->config->isframe && (flags&(FLAGS_WRITESLAVE|FLAGS_WRITESPRITE)))
+    {
+	if(c->slaveframe>=0)
+	    msg("<warning> Frame %d doesn't exist in file. No substitution will occur",
+		    c->slaveframe);
+	else
+	    msg("<warning> Frame \"%s\" doesn't exist in file. No substitution will occur",
+		    c->slavename);
+    }
+    tag = swf_InsertTag(tag, ST_END);
+    return tag;
+}
+
+static void adjustheader(combine_t*c, SWF*swf)
+{
+    if(c->config->framerate)
+	swf->frameRate = c->config->framerate;
+    if(c->config->hassizex) {
+	swf->movieSize.xmax = 
+	swf->movieSize.xmin + c->config->sizex;
+    }
+    if(c->config->hassizey) {
+	swf->movieSize.ymax = 
+	swf->movieSize.ymin + c->config->sizey;
+    }
+    if(c->config->flashversion)
+	swf->fileVersion = c->config->flashversion;
+}
+
+static int catcombine(combine_t*c, SWF*master, SWF*slave, SWF*newswf)
+{
+    char* depths;
+    int t;
+    TAG*tag;
+    TAG*mtag,*stag;
+    if(c->config->isframe) {
+	msg("<error> Can't combine --cat and --frame");
+	return -1;
+    }
+    if(c->config->flashversion)
+	master->fileVersion = c->config->flashversion;
+   
+    tag = master->firstTag;
+    while(tag)
+    {
+	if(swf_isDefiningTag(tag)) {
+	    int defineid = swf_GetDefineID(tag);
+	    msg("<debug> tagid %02x defines object %d", tag->id, defineid);
+	    c->masterbitmap[defineid] = 1;
+	}
+	tag = tag->next;
+    }
+    
+    swf_Relocate(slave, c->masterbitmap);
+    jpeg_assert(master, slave);
+    
+    memcpy(newswf, master, sizeof(SWF));
+    adjustheader(c, newswf);
+
+    tag = newswf->firstTag = swf_InsertTag(0, ST_REFLEX); // to be removed later
+
+    depths = malloc(65536);
+    if(!depths) {
+	msg("<error> Couldn't allocate %d bytes of memory", 65536);
+	return -1;
+    }
+    memset(depths, 0, 65536);
+    mtag = master->firstTag;
+    while(mtag && mtag->id!=ST_END)
+    {
+	U16 depth;
+	msg("<debug> [master] write tag %02x (%d bytes in body)", 
+		mtag->id, mtag->len);
+	switch(mtag->id) {
+	    case ST_PLACEOBJECT2: // FALLTHROUGH
+	    case ST_PLACEOBJECT3: // FALLTHROUGH
+	    case ST_PLACEOBJECT: {
+	       depth = swf_GetDepth(mtag);
+	       depths[depth] = 1;
+	    }
+	    break;
+	    case ST_REMOVEOBJECT: {
+	       depth = swf_GetDepth(mtag);
+	       depths[depth] = 0;
+	    }
+	    break;
+	    case ST_REMOVEOBJECT2: {
+	       depth = swf_GetDepth(mtag);
+	       depths[depth] = 0;
+	    }
+	    break;
+	}
+	tag = swf_InsertTag(tag, mtag->id);
+	swf_SetBlock(tag, mtag->data, mtag->len);
+
+	mtag = mtag->next;
+    }
+
+    for(t=0;t<65536;t++) 
+    if(depths[t])
+    {
+	char data[16];
+	int len;
+	tag = swf_InsertTag(tag, ST_REMOVEOBJECT2);
+	swf_SetU16(tag, t);
+    }
+    free(depths);
+
+    stag = slave->firstTag;
+    while(stag && stag->id!=ST_END)
+    {
+	msg("<debug> [slave] write tag %02x (%d bytes in body)", 
+		stag->id, stag->len);
+	tag = swf_InsertTag(tag, stag->id);
+	swf_SetBlock(tag, stag->data, stag->len);
+	stag = stag->next;
+    }
+    tag = swf_InsertTag(tag, ST_END);
+
+    swf_DeleteTag(newswf, tag);
+    return 0;
+}
+
+static void normalcombine(combine_t*c, SWF*master, SWF*slave, SWF*newswf)
+{
+    int spriteid = -1;
+    int replaceddefine = -1;
+    int frame = 0;
+    char*framelabel;
+    TAG * tag = master->firstTag;
+
+    memset(c->depthbitmap, 0, sizeof(c->depthbitmap));
+    
+    // set the idtab
+    while(tag)
+    {
+	int depth = swf_GetDepth(tag);
+	if(depth>=0) {
+	    c->depthbitmap[depth] = 1;
+	}
+	if(swf_isDefiningTag(tag)) {
+	    int defineid = swf_GetDefineID(tag);
+	    msg("<debug> tagid %02x defines object %d", tag->id, defineid);
+	    c->masterbitmap[defineid] = 1;
+
+	    if (!c->slavename && defineid==c->slaveid) {
+		if(defineid>=0) {
+		  spriteid = defineid;
+		  msg("<notice> Slave file attached to object %d.", defineid);
+		}
+	    }
+	} else if(tag->id == ST_EXPORTASSETS) {
+	    int t;
+	    int num = swf_GetU16(tag);
+	    for(t=0;t<num;t++)
+	    {
+		U16 id = swf_GetU16(tag);
+		char*name = swf_GetString(tag);
+		if(spriteid<0 && c->slavename && !strcmp(name,c->slavename)) {
+		    spriteid = id;
+		    msg("<notice> Slave file attached to object %d exported as %s.", id, name);
+		}
+	    }
+	} else if(tag->id == ST_SYMBOLCLASS) {
+	    /* a symbolclass tag is like a define tag: it defines id 0000 */
+	    int num = swf_GetU16(tag);
+	    int t;
+	    for(t=0;t<num;t++) {
+		U16 id = swf_GetU16(tag);
+		if(!id) {
+		    c->masterbitmap[id] = 1;
+		}
+		swf_GetString(tag);
+	    }
+	} else if((tag->id == ST_PLACEOBJECT2) || (tag->id == ST_PLACEOBJECT3)) {
+	    char * name = swf_GetName(tag);
+	    int id = swf_GetPlaceID(tag);
+
+	    {
+		SWFPLACEOBJECT obj;
+		swf_GetPlaceObject(tag, &obj);
+		swf_PlaceObjectFree(&obj);
+		if(obj.clipdepth) {
+		    c->depthbitmap[obj.clipdepth] = 1;
+		}
+	    }
+
+	    if(name)
+	      msg("<verbose> tagid %02x places object %d named \"%s\"", tag->id, id, name);
+	    else
+	      msg("<verbose> tagid %02x places object %d (no name)", tag->id, id);
+
+	    if (name && c->slavename && !strcmp(name,c->slavename)) {
+		if(id>=0) {
+		  spriteid = id;
+		  msg("<notice> Slave file attached to named object %s (%d).", name, id);
+		}
+	    }
+	} else if(tag->id == ST_SHOWFRAME) {
+	    if(c->slaveframe>=0 && frame==c->slaveframe) {
+		msg("<notice> Slave file attached to frame %d.", frame);
+	    }
+	    frame++;
+	} else if(tag->id == ST_FRAMELABEL) {
+	    char * name = tag->data;
+	    if(name && c->slavename && c->config->isframe && !strcmp(name, c->slavename)) {
+		c->slaveframe = frame;
+		msg("<notice> Slave file attached to frame %d (%s).", frame, name);
+	    }
+	}
+	tag = tag->next;
+    };
+
+    if (spriteid<0 && !c->config->isframe) {
+	if(c->slavename) {
+	    if(strcmp(c->slavename,"!!dummy!!")) {
+		msg("<warning> Didn't find anything named %s in file. No substitutions will occur.", c->slavename);
+		if(!strcmp(c->slavename, "swf")) {
+		    msg("<warning> (If you were trying to combine rfxview with a document, try replacing 'swf' with 'viewport'.");
+		}
+	    }
+	}
+	else
+	    msg("<warning> Didn't find id %d in file. No substitutions will occur.", c->slaveid);
+	spriteid = get_free_id(c->masterbitmap);
+    }
+
+    swf_Relocate (slave, c->masterbitmap);
+    
+    if(c->config->merge)
+	swf_RelocateDepth (slave, c->depthbitmap);
+    jpeg_assert(slave, master);
+    
+    if (c->config->overlay)
+	replaceddefine = get_free_id(c->masterbitmap);
+    
+    // write file 
+
+    memcpy(newswf, master, sizeof(SWF));
+    adjustheader(c, newswf);
+
+    newswf->firstTag = tag = swf_InsertTag(0, ST_REFLEX); // to be removed later
+
+    if (c->config->antistream) {
+	if (c->config->merge) {
+	    msg("<fatal> Can't combine --antistream and --merge");
+	}
+	tag = write_sprite_defines(tag, slave);
+	tag = write_sprite(c, tag, slave, spriteid, replaceddefine);
+	tag = write_master(c, tag, master, slave, spriteid, replaceddefine, FLAGS_WRITEDEFINES);
+	tag = write_master(c, tag, master, slave, spriteid, replaceddefine, FLAGS_WRITENONDEFINES);
+    } else {
+	if (c->config->merge)
+	    tag = write_master(c, tag, master, slave, spriteid, replaceddefine, 
+		FLAGS_WRITEDEFINES|FLAGS_WRITENONDEFINES|   FLAGS_WRITESLAVE	);
+	else
+	    tag = write_master(c, tag, master, slave, spriteid, replaceddefine, 
+		FLAGS_WRITEDEFINES|FLAGS_WRITENONDEFINES|   FLAGS_WRITESPRITE	);
+    }
+
+    swf_DeleteTag(newswf, newswf->firstTag);
+}
+
+int swf_Combine(SWF*master, const char*slave_name, SWF*slave, SWF*newswf, COMBINEOPTIONS*options)
+{
+    int ret = 0;
+    combine_t*c = (combine_t*)rfx_calloc(sizeof(combine_t));
+    c->config = options;
+    c->slavename = (char*)slave_name;
+    c->slaveid = -1;
+    c->slaveframe = -1;
+
+    if(!master->fileVersion && slave)
+	master->fileVersion = slave->fileVersion;
+        
+    master->fileAttributes |= slave->fileAttributes;
+
+    swf_FoldAll(master);
+    swf_FoldAll(slave);
+
+    if(c->slavename[0] == '#')
+    {
+	c->slaveid = atoi(&c->slavename[1]);
+	c->slavename = 0;
+    }
+
+    if(c->config->isframe)
+    {
+	if(c->slavename && c->slavename[0]!='#') {
+	    int tmp;
+	    int len;
+	    sscanf(c->slavename, "%d%n", &tmp, &len);
+	    if(len == strlen(c->slavename)) {
+	    /* if the name the slave should replace 
+	       consists only of digits and the -f
+	       option is given, it probably is not
+	       a frame name but a frame number.
+	     */
+		c->slaveid = tmp;
+		c->slavename = 0;
+	    }
+	}
+
+	if(c->slaveid>=0) {
+	    c->slaveframe = c->slaveid;
+	    c->slaveid = -1;
+	} else {
+	/* if id wasn't given as either #number or number,
+	   the name is a frame label. BTW: The user wouldn't necessarily have
+	   needed to supply the -f option in this case */
+	}
+    }
+
+    msg("<debug> move x (%d)", c->config->movex);
+    msg("<debug> move y (%d)", c->config->movey);
+    msg("<debug> scale x (%f)", c->config->scalex);
+    msg("<debug> scale y (%f)", c->config->scaley);
+    msg("<debug> master move x (%d)", c->config->mastermovex);
+    msg("<debug> master move y (%d)", c->config->mastermovey);
+    msg("<debug> master scale x (%f)", c->config->masterscalex);
+    msg("<debug> master scale y (%f)", c->config->masterscaley);
+    msg("<debug> is frame (%d)", c->config->isframe);
+    
+    memset(c->masterbitmap, 0, sizeof(c->masterbitmap));
+
+    if(c->config->cat) 
+	ret = catcombine(c, master, slave, newswf);
+    else
+	normalcombine(c, master, slave, newswf);
+
+    free(c);
+    return ret;
+}
+
@@ -1089,42 +1089,197 @@ void swf_ParseDefineShape(TAG*tag, SHAPE2*shape)
     l = shape->lines;
 }
 
-static void free_lines(SHAPELINE* lines)
+/* Bit level access to shape records, for swf_TranscodeShapeRecords().
+   Unlike swf_GetBits()/swf_SetBits(), these move up to 32 bits at once. */
+typedef struct _bitreader {
+    U8*data;
+    int pos;  // in bits
+    int len;  // in bits
+} bitreader_t;
+
+typedef struct _bitwriter {
+    TAG*tag;
+    U64 buf;
+    int bits; // number of bits in buf (<8 between calls)
+} bitwriter_t;
+
+static inline U32 bits_get(bitreader_t*r, int n)
 {
-    if (lines->next)
-        free_lines(lines->next);
-    free(lines);
+    U32 v = 0;
+    while(n) {
+	int bit = r->pos&7;
+	int take = 8-bit < n ? 8-bit : n;
+	U8 b = r->pos < r->len ? r->data[r->pos>>3] : 0;
+	v = v<<take | ((b>>(8-bit-take)) & ((1<<take)-1));
+	r->pos += take;
+	n -= take;
+    }
+    return v;
 }
-
-void swf_RecodeShapeData(U8*data, int bitlen, int in_bits_fill, int in_bits_line, 
-                         U8**destdata, U32*destbitlen, int out_bits_fill, int out_bits_line)
+static inline S32 bits_getsigned(bitreader_t*r, int n)
 {
-    SHAPE2 s2;
-    SHAPE s;
-    SHAPELINE*line;
-    memset(&s2, 0, sizeof(s2));
-    s2.lines = swf_ParseShapeData(data, bitlen, in_bits_fill, in_bits_line, 1, 0);
-    s2.numfillstyles = out_bits_fill?1<<(out_bits_fill-1):0;
-    s2.numlinestyles = out_bits_line?1<<(out_bits_line-1):0;
-    s2.fillstyles = (FILLSTYLE*)rfx_calloc(sizeof(FILLSTYLE)*s2.numfillstyles);
-    s2.linestyles = (LINESTYLE*)rfx_calloc(sizeof(LINESTYLE)*s2.numlinestyles);
-
-    line = s2.lines;
-    while(line) {
-        if(line->fillstyle0 > s2.numfillstyles) line->fillstyle0 = 0;
-        if(line->fillstyle1 > s2.numfillstyles) line->fillstyle1 = 0;
-        if(line->linestyle > s2.numlinestyles) line->linestyle = 0;
-        line = line->next;
+    U32 v = bits_get(r, n);
+    if(n && n<32 && (v&(1<<(n-1))))
+	v |= 0xffffffff<<n;
+    return (S32)v;
+}
+static inline void bits_put(bitwriter_t*w, U32 v, int n)
+{
+    if(!n)
+	return;
+    w->buf = w->buf<<n | (v & (0xffffffff>>(32-n)));
+    w->bits += n;
+    while(w->bits >= 8) {
+	w->bits -= 8;
+	swf_SetU8(w->tag, (U8)(w->buf>>w->bits));
+    }
+}
+static inline void bits_copy(bitreader_t*r, bitwriter_t*w, int n)
+{
+    while(n > 32) {
+	bits_put(w, bits_get(r, 32), 32);
+	n -= 32;
     }
+    bits_put(w, bits_get(r, n), n);
+}
+static inline void bits_flush(bitwriter_t*w)
+{
+    if(w->bits)
+	bits_put(w, 0, 8-w->bits);
+}
+static void bits_putmove(bitwriter_t*w, S32 x, S32 y)
+{
+    int b = swf_CountBits(x,0);
+    b = swf_CountBits(y,b);
+    if(b>31) {
+	fprintf(stderr, "Warning: bad moveTo (%f,%f)\n", x/20.0, y/20.0);
+	b=31;
+    }
+    bits_put(w, b, 5);
+    bits_put(w, x, b);
+    bits_put(w, y, b);
+}
 
-    swf_Shape2ToShape(&s2,&s);
+static void remapcallback(TAG*tag, int pos, void*idmap)
+{
+    U16 id = ((U16*)idmap)[GET16(&tag->data[pos])];
+    PUT16(&tag->data[pos], id);
+}
 
-    free_lines(s2.lines);
-    free(s2.fillstyles);
-    free(s2.linestyles);
-    free(s.fillstyle.data);
-    free(s.linestyle.data);
-    *destdata = s.data;
-    *destbitlen = s.bitlen;
+int swf_TranscodeShapeRecords(TAG*tag, U8*data, int bitlen, int version,
+			      int in_bits_fill, int in_bits_line, int out_bits_fill, int out_bits_line,
+			      S32 dx, S32 dy, U16*idmap)
+{
+    bitreader_t r = {data, 0, bitlen};
+    bitwriter_t w = {tag, 0, 0};
+    U32 maxfill = out_bits_fill ? 0xffffffff>>(32-out_bits_fill) : 0;
+    U32 maxline = out_bits_line ? 0xffffffff>>(32-out_bits_line) : 0;
+    char moved = !dx && !dy;
+    char ended = 0;
+    TAG _styles;
+
+    swf_ResetWriteBits(tag);
+    while(r.pos < bitlen) {
+	if(!bits_get(&r, 1)) {
+	    /* style change */
+	    U32 flags = bits_get(&r, 5);
+	    U32 fill0=0, fill1=0, line=0;
+	    if(!flags) {
+		ended = 1;
+		break;
+	    }
+	    bits_put(&w, 0, 1);
+	    bits_put(&w, flags|(moved?0:SF_MOVETO), 5);
+	    if(flags&SF_MOVETO) {
+		int n = bits_get(&r, 5);
+		S32 x = bits_getsigned(&r, n);
+		S32 y = bits_getsigned(&r, n);
+		bits_putmove(&w, x+dx, y+dy);
+	    } else if(!moved) {
+		/* the pen starts at (0,0), so we need an explicit move */
+		bits_putmove(&w, dx, dy);
+	    }
+	    moved = 1;
+	    if(flags&SF_FILL0) fill0 = bits_get(&r, in_bits_fill);
+	    if(flags&SF_FILL1) fill1 = bits_get(&r, in_bits_fill);
+	    if(flags&SF_LINE)  line  = bits_get(&r, in_bits_line);
+	    /* styles which don't fit into the new bit widths are dropped */
+	    if(flags&SF_FILL0) bits_put(&w, fill0>maxfill?0:fill0, out_bits_fill);
+	    if(flags&SF_FILL1) bits_put(&w, fill1>maxfill?0:fill1, out_bits_fill);
+	    if(flags&SF_LINE)  bits_put(&w, line>maxline?0:line, out_bits_line);
+	    if(flags&SF_NEWSTYLE) {
+		/* the new style arrays are byte aligned and copied verbatim.
+		   After them, the bit widths are given again, so from there on
+		   we keep the original ones */
+		int start, end;
+		TAG*t = &_styles;
+		memset(t, 0, sizeof(TAG));
+		t->data = data;
+		t->len = t->memsize = (bitlen+7)/8;
+		t->pos = start = (r.pos+7)/8;
+		t->id = version==1?ST_DEFINESHAPE:(version==2?ST_DEFINESHAPE2:(version==3?ST_DEFINESHAPE3:ST_DEFINESHAPE4));
+		enumerateUsedIDs_styles(t, dummycallback1, 0, version, 0);
+		swf_ResetReadBits(t);
+		end = t->pos;
+
+		bits_flush(&w);
+		int outpos = tag->len;
+		swf_SetBlock(tag, &data[start], end-start);
+		if(idmap) {
+		    t->data = &tag->data[outpos];
+		    t->len = t->memsize = end-start;
+		    t->pos = 0;
+		    enumerateUsedIDs_styles(t, remapcallback, idmap, version, 0);
+		}
+		r.pos = end*8;
+		in_bits_fill = out_bits_fill = bits_get(&r, 4);
+		in_bits_line = out_bits_line = bits_get(&r, 4);
+		maxfill = maxline = 0xffffffff;
+		bits_put(&w, in_bits_fill, 4);
+		bits_put(&w, in_bits_line, 4);
+	    }
+	} else {
+	    if(!moved) {
+		bits_put(&w, 0, 1);
+		bits_put(&w, SF_MOVETO, 5);
+		bits_putmove(&w, dx, dy);
+		moved = 1;
+	    }
+	    bits_put(&w, 1, 1);
+	    if(bits_get(&r, 1)) {
+		/* straight edge */
+		int n = bits_get(&r, 4);
+		bits_put(&w, 1, 1);
+		bits_put(&w, n, 4);
+		if(bits_get(&r, 1)) {
+		    bits_put(&w, 1, 1);
+		    bits_copy(&r, &w, 2*(n+2));
+		} else {
+		    bits_put(&w, 0, 1);
+		    bits_copy(&r, &w, 1+(n+2));
+		}
+	    } else {
+		/* curved edge */
+		int n = bits_get(&r, 4);
+		bits_put(&w, 0, 1);
+		bits_put(&w, n, 4);
+		bits_copy(&r, &w, 4*(n+2));
+	    }
+	}
+    }
+    /* end of shape */
+    bits_put(&w, 0, 6);
+    bits_flush(&w);
+    return ended?0:-1;
+}
+
+void swf_RecodeShapeData(U8*data, int bitlen, int in_bits_fill, int in_bits_line, 
+                         U8**destdata, U32*destbitlen, int out_bits_fill, int out_bits_line)
+{
+    TAG*tag = swf_InsertTag(0,0);
+    swf_TranscodeShapeRecords(tag, data, bitlen, 1, in_bits_fill, in_bits_line, out_bits_fill, out_bits_line, 0, 0, 0);
+    *destdata = tag->data;
+    *destbitlen = tag->len*8;
+    free(tag);
 }
 
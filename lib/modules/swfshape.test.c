@@ -0,0 +1,412 @@
+/* swfshape.test.c
+
+   Round trip tests for swf_TranscodeShapeRecords(), and a comparison
+   with the parse/re-serialize code it replaced
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../rfxswf.h"
+
+#define SF_NEWSTYLE     0x10
+
+#define NUM_SHAPES 2000
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+static int errors = 0;
+static void fail(int nr, const char*test, const char*what)
+{
+    if(errors < 20)
+	fprintf(stderr, "shape %d, %s: %s\n", nr, test, what);
+    errors++;
+}
+
+static SHAPE* random_styles()
+{
+    SHAPE*s;
+    swf_ShapeNew(&s);
+    int t, num = 1 + lrand48()%20;
+    for(t=0;t<num;t++) {
+	RGBA c = {255, lrand48(), lrand48(), lrand48()};
+	if(lrand48()&1) {
+	    MATRIX m;
+	    swf_GetMatrix(0, &m);
+	    swf_ShapeAddBitmapFillStyle(s, &m, 1 + lrand48()%50, lrand48()&1);
+	} else {
+	    swf_ShapeAddSolidFillStyle(s, &c);
+	}
+    }
+    num = lrand48()%10;
+    for(t=0;t<num;t++) {
+	RGBA c = {255, lrand48(), lrand48(), lrand48()};
+	swf_ShapeAddLineStyle(s, 20 + lrand48()%100, &c);
+    }
+    return s;
+}
+
+static int random_coord(int range)
+{
+    return lrand48()%(2*range+1) - range;
+}
+
+/* Writes a DEFINESHAPE3 tag with random edges, moves and style changes.
+   If newstyles is set, some style changes define new (inline) style
+   arrays, with bitmap fills in them. *records is the position of the shape records in the tag, and
+   *fillbits/*linebits are the index widths at the start of the records. */
+static TAG* random_shape(int*records, int*fillbits, int*linebits, char newstyles)
+{
+    TAG*tag = swf_InsertTag(0, ST_DEFINESHAPE3);
+    SRECT r = {-20000, -20000, 20000, 20000};
+    swf_SetU16(tag, 1);
+    swf_SetRect(tag, &r);
+
+    SHAPE*s = random_styles();
+    swf_SetShapeHeader(tag, s);
+    *records = tag->len;
+    *fillbits = s->bits.fill;
+    *linebits = s->bits.line;
+
+    /* the first record is either a style change (with or without a move),
+       or an edge starting at (0,0) */
+    switch(lrand48()%3) {
+	case 0:
+	    swf_ShapeSetAll(tag, s, random_coord(5000), random_coord(5000), 0, 1, 0);
+	break;
+	case 1:
+	    swf_ShapeSetStyle(tag, s, 0, 1, 0);
+	break;
+    }
+
+    int t, num = lrand48()%200;
+    for(t=0;t<num;t++) {
+	int what = lrand48()%20;
+	if(what < 10) {
+	    int range = what<5 ? 100 : 100000;
+	    swf_ShapeSetLine(tag, s, random_coord(range), random_coord(range));
+	} else if(what < 14) {
+	    swf_ShapeSetCurve(tag, s, random_coord(1000), random_coord(1000), random_coord(1000), random_coord(1000));
+	} else if(what < 17) {
+	    /* (with all three styles 0, this would be an end record) */
+	    int line = s->linestyle.n ? lrand48()%(s->linestyle.n+1) : 0;
+	    swf_ShapeSetStyle(tag, s, line, 1+lrand48()%s->fillstyle.n, lrand48()%(s->fillstyle.n+1));
+	} else if(what < 19 || !newstyles) {
+	    swf_ShapeSetMove(tag, s, random_coord(10000), random_coord(10000));
+	} else {
+	    /* new style arrays, and new index widths */
+	    swf_ShapeFree(s);
+	    s = random_styles();
+	    swf_SetBits(tag, 0, 1);
+	    swf_SetBits(tag, SF_NEWSTYLE, 5);
+	    swf_ResetWriteBits(tag);
+	    swf_SetShapeHeader(tag, s);
+	}
+    }
+    swf_ShapeSetEnd(tag);
+    swf_ShapeFree(s);
+    return tag;
+}
+
+/* a copy of the header of orig, with different index widths, and the
+   given shape records */
+static TAG* replace_records(TAG*orig, int records, TAG*data, int fillbits, int linebits)
+{
+    TAG*tag = swf_InsertTag(0, ST_DEFINESHAPE3);
+    swf_SetBlock(tag, orig->data, records-1);
+    swf_SetU8(tag, fillbits<<4|linebits);
+    swf_SetBlock(tag, data->data, data->len);
+    return tag;
+}
+
+static TAG* transcode(TAG*orig, int records, int in_fill, int in_line, int out_fill, int out_line,
+		      S32 dx, S32 dy, U16*idmap)
+{
+    TAG*data = swf_InsertTag(0, 0);
+    int ret = swf_TranscodeShapeRecords(data, &orig->data[records], (orig->len-records)*8, 3,
+					in_fill, in_line, out_fill, out_line, dx, dy, idmap);
+    TAG*tag = 0;
+    if(ret>=0)
+	tag = replace_records(orig, records, data, out_fill, out_line);
+    swf_DeleteTag(0, data);
+    return tag;
+}
+
+/* compares the edges of two shapes. Moves are only compared indirectly,
+   through the start points of the edges, as a shifted shape might need
+   an explicit move at the beginning where the original didn't. */
+static char same_edges(SHAPE2*s1, SHAPE2*s2, S32 dx, S32 dy)
+{
+    SHAPELINE*l1 = s1->lines, *l2 = s2->lines;
+    S32 x1=0,y1=0,x2=0,y2=0;
+    while(1) {
+	while(l1 && l1->type == moveTo) {x1 = l1->x;y1 = l1->y;l1 = l1->next;}
+	while(l2 && l2->type == moveTo) {x2 = l2->x;y2 = l2->y;l2 = l2->next;}
+	if(!l1 || !l2)
+	    return !l1 && !l2;
+	if(l1->type != l2->type ||
+	   x1+dx != x2 || y1+dy != y2 ||
+	   l1->x+dx != l2->x || l1->y+dy != l2->y ||
+	   (l1->type == splineTo && (l1->sx+dx != l2->sx || l1->sy+dy != l2->sy)) ||
+	   l1->fillstyle0 != l2->fillstyle0 ||
+	   l1->fillstyle1 != l2->fillstyle1 ||
+	   l1->linestyle != l2->linestyle)
+	    return 0;
+	x1 = l1->x;y1 = l1->y;l1 = l1->next;
+	x2 = l2->x;y2 = l2->y;l2 = l2->next;
+    }
+}
+
+/* fill styles from the header are left alone, only the ones in the
+   shape records are mapped */
+static char same_styles(SHAPE2*s1, SHAPE2*s2, int numheaderstyles, U16*idmap)
+{
+    int t;
+    if(s1->numfillstyles != s2->numfillstyles || s1->numlinestyles != s2->numlinestyles)
+	return 0;
+    for(t=0;t<s1->numfillstyles;t++) {
+	FILLSTYLE*f1 = &s1->fillstyles[t];
+	FILLSTYLE*f2 = &s2->fillstyles[t];
+	if(f1->type != f2->type)
+	    return 0;
+	if(f1->type == FILL_SOLID && memcmp(&f1->color, &f2->color, sizeof(RGBA)))
+	    return 0;
+	if(f1->type != FILL_SOLID) {
+	    U16 id = (idmap && t >= numheaderstyles) ? idmap[f1->id_bitmap] : f1->id_bitmap;
+	    if(f2->id_bitmap != id)
+		return 0;
+	}
+    }
+    for(t=0;t<s1->numlinestyles;t++) {
+	if(s1->linestyles[t].width != s2->linestyles[t].width ||
+	   memcmp(&s1->linestyles[t].color, &s2->linestyles[t].color, sizeof(RGBA)))
+	    return 0;
+    }
+    return 1;
+}
+
+static char same_records(TAG*t1, TAG*t2, int records)
+{
+    return t1->len == t2->len && !memcmp(&t1->data[records], &t2->data[records], t1->len-records);
+}
+
+/* swf_RecodeShapeData() as it was before swf_TranscodeShapeRecords():
+   parse the records into a SHAPELINE list, and serialize them again
+   with dummy style arrays of the new sizes. swf_ParseShapeData() is
+   static, so the records are parsed from a DEFINESHAPE without styles.
+   (The original crashed on shapes without edges, this one doesn't.) */
+static void recode_old(U8*data, int bitlen, int in_bits_fill, int in_bits_line,
+		       U8**destdata, U32*destbitlen, int out_bits_fill, int out_bits_line)
+{
+    SHAPE2 s2;
+    SHAPE s;
+    SHAPELINE*line;
+    SRECT r = {0,0,0,0};
+    TAG*tag = swf_InsertTag(0, ST_DEFINESHAPE);
+    swf_SetU16(tag, 1);
+    swf_SetRect(tag, &r);
+    swf_SetU8(tag, 0); // fill styles
+    swf_SetU8(tag, 0); // line styles
+    swf_SetU8(tag, in_bits_fill<<4|in_bits_line);
+    swf_SetBlock(tag, data, (bitlen+7)/8);
+    swf_ParseDefineShape(tag, &s2);
+    swf_DeleteTag(0, tag);
+
+    free(s2.fillstyles);
+    free(s2.linestyles);
+    s2.numfillstyles = out_bits_fill?1<<(out_bits_fill-1):0;
+    s2.numlinestyles = out_bits_line?1<<(out_bits_line-1):0;
+    s2.fillstyles = (FILLSTYLE*)rfx_calloc(sizeof(FILLSTYLE)*s2.numfillstyles);
+    s2.linestyles = (LINESTYLE*)rfx_calloc(sizeof(LINESTYLE)*s2.numlinestyles);
+
+    line = s2.lines;
+    while(line) {
+        if(line->fillstyle0 > s2.numfillstyles) line->fillstyle0 = 0;
+        if(line->fillstyle1 > s2.numfillstyles) line->fillstyle1 = 0;
+        if(line->linestyle > s2.numlinestyles) line->linestyle = 0;
+        line = line->next;
+    }
+
+    swf_Shape2ToShape(&s2,&s);
+
+    swf_Shape2Free(&s2);
+    free(s.fillstyle.data);
+    free(s.linestyle.data);
+    *destdata = s.data;
+    *destbitlen = s.bitlen;
+}
+
+/* The old code only handled records without inline style arrays, and
+   re-encoded every record. So the input here is what swf_Shape2ToShape()
+   writes, which it reproduces. It also kept only 2^(bits-1) styles, so
+   the indices are widened by at least one bit, which keeps all of them. */
+static void compare_with_old(int nr, double*told, double*tnew)
+{
+    int records, fill, line;
+    TAG*orig = random_shape(&records, &fill, &line, 0);
+    SHAPE2 s2;
+    SHAPE in;
+    swf_ParseDefineShape(orig, &s2);
+    swf_Shape2ToShape(&s2, &in);
+    int out_fill = in.bits.fill + 1 + lrand48()%3;
+    int out_line = in.bits.line + 1 + lrand48()%3;
+
+    U8*olddata;
+    U32 oldbitlen;
+    double t1 = now();
+    recode_old(in.data, in.bitlen, in.bits.fill, in.bits.line, &olddata, &oldbitlen, out_fill, out_line);
+    double t2 = now();
+    TAG*tag = swf_InsertTag(0, 0);
+    int ret = swf_TranscodeShapeRecords(tag, in.data, in.bitlen, 1, in.bits.fill, in.bits.line,
+					out_fill, out_line, 0, 0, 0);
+    double t3 = now();
+    *told += t2-t1;
+    *tnew += t3-t2;
+
+    if(ret<0)
+	fail(nr, "old", "transcoding failed");
+    else if(tag->len*8 != oldbitlen || memcmp(tag->data, olddata, tag->len))
+	fail(nr, "old", "records differ from the old implementation");
+
+    swf_DeleteTag(0, tag);
+    free(olddata);
+    free(in.data);
+    free(in.fillstyle.data);
+    free(in.linestyle.data);
+    swf_Shape2Free(&s2);
+    swf_DeleteTag(0, orig);
+}
+
+int main()
+{
+    static U16 idmap[65536];
+    int t, nr;
+    for(t=0;t<65536;t++)
+	idmap[t] = t;
+    for(t=1;t<=50;t++)
+	idmap[t] = 1000 + t*7;
+
+    srand48(1);
+    for(nr=0;nr<NUM_SHAPES;nr++) {
+	int records, fill, line;
+	TAG*orig = random_shape(&records, &fill, &line, 1);
+	SHAPE2 s1, s2;
+	swf_ParseDefineShape(orig, &s1);
+	int numheaderstyles = 0;
+	{
+	    SHAPE2 header;
+	    TAG*empty = swf_InsertTag(0, ST_DEFINESHAPE3);
+	    swf_SetBlock(empty, orig->data, records);
+	    swf_ShapeSetEnd(empty);
+	    swf_ParseDefineShape(empty, &header);
+	    numheaderstyles = header.numfillstyles;
+	    swf_Shape2Free(&header);
+	    swf_DeleteTag(0, empty);
+	}
+
+	/* same bit widths: the records are copied unchanged */
+	TAG*tag = transcode(orig, records, fill, line, fill, line, 0, 0, 0);
+	if(!tag || !same_records(orig, tag, records))
+	    fail(nr, "copy", "records changed");
+	if(tag) swf_DeleteTag(0, tag);
+
+	/* wider indices, and back */
+	TAG*wide = transcode(orig, records, fill, line, fill+3, line+2, 0, 0, 0);
+	if(!wide) {
+	    fail(nr, "widths", "transcoding failed");
+	} else {
+	    swf_ParseDefineShape(wide, &s2);
+	    if(!same_edges(&s1, &s2, 0, 0) || !same_styles(&s1, &s2, numheaderstyles, 0))
+		fail(nr, "widths", "shapes differ");
+	    swf_Shape2Free(&s2);
+	    tag = transcode(wide, records, fill+3, line+2, fill, line, 0, 0, 0);
+	    if(!tag || !same_records(orig, tag, records))
+		fail(nr, "widths", "round trip changed the records");
+	    if(tag) swf_DeleteTag(0, tag);
+	    swf_DeleteTag(0, wide);
+	}
+
+	/* move by (dx,dy), and back */
+	S32 dx = random_coord(30000), dy = random_coord(30000);
+	TAG*moved = transcode(orig, records, fill, line, fill, line, dx, dy, 0);
+	if(!moved) {
+	    fail(nr, "move", "transcoding failed");
+	} else {
+	    swf_ParseDefineShape(moved, &s2);
+	    if(!same_edges(&s1, &s2, dx, dy) || !same_styles(&s1, &s2, numheaderstyles, 0))
+		fail(nr, "move", "shape wasn't moved correctly");
+	    swf_Shape2Free(&s2);
+	    tag = transcode(moved, records, fill, line, fill, line, -dx, -dy, 0);
+	    if(!tag) {
+		fail(nr, "move", "transcoding failed");
+	    } else {
+		swf_ParseDefineShape(tag, &s2);
+		if(!same_edges(&s1, &s2, 0, 0) || !same_styles(&s1, &s2, numheaderstyles, 0))
+		    fail(nr, "move", "round trip changed the shape");
+		swf_Shape2Free(&s2);
+		swf_DeleteTag(0, tag);
+	    }
+	    swf_DeleteTag(0, moved);
+	}
+
+	/* bitmap ids in the inline style arrays */
+	tag = transcode(orig, records, fill, line, fill, line, 0, 0, idmap);
+	if(!tag) {
+	    fail(nr, "idmap", "transcoding failed");
+	} else {
+	    swf_ParseDefineShape(tag, &s2);
+	    if(!same_edges(&s1, &s2, 0, 0) || !same_styles(&s1, &s2, numheaderstyles, idmap))
+		fail(nr, "idmap", "ids weren't mapped correctly");
+	    swf_Shape2Free(&s2);
+	    swf_DeleteTag(0, tag);
+	}
+
+	/* everything at once */
+	tag = transcode(orig, records, fill, line, fill+1, line+1, dx, dy, idmap);
+	if(!tag) {
+	    fail(nr, "all", "transcoding failed");
+	} else {
+	    swf_ParseDefineShape(tag, &s2);
+	    if(!same_edges(&s1, &s2, dx, dy) || !same_styles(&s1, &s2, numheaderstyles, idmap))
+		fail(nr, "all", "shapes differ");
+	    swf_Shape2Free(&s2);
+	    swf_DeleteTag(0, tag);
+	}
+
+	swf_Shape2Free(&s1);
+	swf_DeleteTag(0, orig);
+    }
+
+    double told = 0, tnew = 0;
+    for(nr=0;nr<NUM_SHAPES;nr++)
+	compare_with_old(nr, &told, &tnew);
+
+    if(errors) {
+	printf("%d errors in %d shapes\n", errors, NUM_SHAPES);
+	return 1;
+    }
+    printf("ok, %d shapes\n", NUM_SHAPES);
+    printf("recoding %d shapes: old %.2fms, new %.2fms (%.1fx)\n", NUM_SHAPES, told*1000, tnew*1000, told/tnew);
+    return 0;
+}
@@ -24,6 +24,7 @@
 // Matrix & Math tools for SWF files
 
 #include "../rfxswf.h"
+#include "../q.h"
 
 #define S64 long long
 SFIXED RFXSWF_SP(SFIXED a1,SFIXED a2,SFIXED b1,SFIXED b2)
@@ -1229,27 +1230,95 @@ TAG* swf_Concatenate (TAG*list1,TAG*list2)
     return swf1.firstTag;
 }
 
-static int tagHash(TAG*tag)
+/* swf_Optimize() merges identical definitions. A definition is identified
+   by its contents (without its own id) and by the contents of its helper
+   tags (DEFINEFONTINFO, DEFINEBUTTONCXFORM etc.). Tags are processed in
+   order, and the ids a tag uses are mapped to their canonical ids before
+   it is hashed. Hence two sprites, buttons or texts which only differ in
+   the ids of (identical) dependencies are merged, too. */
+
+typedef struct _helpers {
+    TAG**tags;
+    int num;
+    int size;
+} helpers_t;
+
+typedef struct _definition {
+    TAG*tag;
+    helpers_t*helpers;
+    U64 hash;
+} definition_t;
+
+static char definition_equals(const void*_d1, const void*_d2)
+{
+    const definition_t*d1 = (const definition_t*)_d1;
+    const definition_t*d2 = (const definition_t*)_d2;
+    if(d1->hash != d2->hash || d1->tag->id != d2->tag->id || d1->tag->len != d2->tag->len)
+	return 0;
+    if(memcmp(&d1->tag->data[2], &d2->tag->data[2], d1->tag->len-2))
+	return 0;
+    int n1 = d1->helpers?d1->helpers->num:0;
+    int n2 = d2->helpers?d2->helpers->num:0;
+    if(n1 != n2)
+	return 0;
+    int t;
+    for(t=0;t<n1;t++) {
+	TAG*h1 = d1->helpers->tags[t];
+	TAG*h2 = d2->helpers->tags[t];
+	if(h1->id != h2->id || h1->len != h2->len ||
+	   memcmp(&h1->data[2], &h2->data[2], h1->len-2))
+	    return 0;
+    }
+    return 1;
+}
+static unsigned int definition_hash(const void*d)
+{
+    return (unsigned int)((const definition_t*)d)->hash;
+}
+static void* definition_dup(const void*d)
 {
-    int t, h=0;
-    unsigned int a = 0x6b973e5a;
-    /* start at pos 2, as 0 and 1 are the id */
-    for(t=2;t<tag->len;t++) {
-        unsigned int b = a;
-        a >>= 8;
-        a += tag->data[t]*0xefbc35a5*b*(t+1);
+    return (void*)d;
+}
+static void definition_free(void*_d)
+{
+    definition_t*d = (definition_t*)_d;
+    if(d->helpers) {
+	rfx_free(d->helpers->tags);
+	rfx_free(d->helpers);
     }
-    return a&0x7fffffff; //always return positive number
+    rfx_free(d);
+}
+static type_t definition_type = {
+    equals: definition_equals,
+    hash: definition_hash,
+    dup: definition_dup,
+    free: definition_free
+};
+
+static void callbackRemap(TAG*t, int pos, void*data)
+{
+    /* for sprites, t is a temporary copy of the inner tag, and pos is
+       relative to the sprite */
+    void**d = (void**)data;
+    TAG*tag = (TAG*)d[0];
+    U16*remap = (U16*)d[1];
+    U16 id = remap[GET16(&tag->data[pos])];
+    PUT16(&tag->data[pos], id);
+}
+static void remapUsedIDs(TAG*tag, U16*remap)
+{
+    void*data[2] = {tag, remap};
+    enumerateUsedIDs(tag, 0, callbackRemap, data);
 }
 
 void swf_Optimize(SWF*swf)
 {
-    const int hash_size = 131072;
-    char* dontremap = (char*)rfx_calloc(sizeof(char)*65536);
-    U16* remap = (U16*)rfx_alloc(sizeof(U16)*65536);
-    TAG* id2tag = (TAG*)rfx_calloc(sizeof(TAG*)*65536);
-    TAG** hashmap = (TAG**)rfx_calloc(sizeof(TAG*)*hash_size);
-    TAG* tag;
+    U16*remap = (U16*)rfx_alloc(sizeof(U16)*65536);
+    dict_t*id2helpers = dict_new2(&int_type);
+    dict_t*definitions = dict_new2(&definition_type);
+    TAG**dead = 0;
+    int num_dead = 0, dead_size = 0;
+    TAG*tag;
     int t;
     for(t=0;t<65536;t++) {
         remap[t] = t;
@@ -1257,78 +1326,86 @@ void swf_Optimize(SWF*swf)
 
     swf_FoldAll(swf);
 
-    tag = swf->firstTag;
-    while(tag) {
-        /* make sure we don't remap to this tag,
-           as it might have different "helper tags" 
-           FIXME: a better way would be to compare
-                  the helper tags, too.
-         */
-        if(swf_isPseudoDefiningTag(tag) &&
-           tag->id != ST_NAMECHARACTER) {
-            dontremap[swf_GetDefineID(tag)] = 1;
+    /* collect the helper tags of every id */
+    for(tag=swf->firstTag;tag;tag=tag->next) {
+        if(!swf_isPseudoDefiningTag(tag))
+            continue;
+        int id = swf_GetDefineID(tag);
+        helpers_t*h = (helpers_t*)dict_lookup(id2helpers, (void*)(ptroff_t)id);
+        if(!h) {
+            h = (helpers_t*)rfx_calloc(sizeof(helpers_t));
+            dict_put(id2helpers, (void*)(ptroff_t)id, h);
         }
-        tag=tag->next;
-    }
-    tag = swf->firstTag;
-    while(tag) {
-        TAG*next = tag->next;
-
-        /* remap the tag */
-        int num = swf_GetNumUsedIDs(tag);
-        int*positions = (int*)rfx_alloc(sizeof(int)*num);
-        int t;
-        swf_GetUsedIDs(tag, positions);
-        for(t=0;t<num;t++) {
-            int id = GET16(&tag->data[positions[t]]);
-            id = remap[id];
-            PUT16(&tag->data[positions[t]], id);
+        if(h->num == h->size) {
+            h->size = h->size?h->size*2:4;
+            h->tags = (TAG**)rfx_realloc(h->tags, sizeof(TAG*)*h->size);
         }
-        rfx_free(positions);
-
-        /* now look for previous tags with the same
-           content */
-        if(swf_isDefiningTag(tag)) {
-            TAG*tag2;
-            int id = swf_GetDefineID(tag);
-            int hash = tagHash(tag);
-            int match=0;
-            if(!dontremap[id]) 
-            while((tag2 = hashmap[hash%hash_size])) {
-                if(tag2 != (TAG*)0 && tag->len == tag2->len) {
-		    if(memcmp(&tag->data[2],&tag2->data[2],tag->len-2) == 0) {
-			match = 1;
-			break;
-		    }
-                }
-                hash++;
-            }
-            if(!match) {
-                while(hashmap[hash%hash_size]) hash++;
-                hashmap[hash%hash_size] = tag;
-            } else {
-		/* we found two identical tags- remap one
-		   of them */
-                remap[id] = swf_GetDefineID(tag2);
-                swf_DeleteTag(swf, tag);
-            }
-        } else if(swf_isPseudoDefiningTag(tag)) {
-            int id = swf_GetDefineID(tag);
-            if(remap[id]!=id) {
-                /* if this tag was remapped, we don't
-                   need the helper tag anymore. Discard
-                   it. */
-                swf_DeleteTag(swf, tag);
+        h->tags[h->num++] = tag;
+    }
+
+    for(tag=swf->firstTag;tag;tag=tag->next) {
+        remapUsedIDs(tag, remap);
+
+        if(!swf_isDefiningTag(tag) || tag->len < 2)
+            continue;
+
+        int id = swf_GetDefineID(tag);
+        helpers_t*h = (helpers_t*)dict_lookup(id2helpers, (void*)(ptroff_t)id);
+
+        definition_t*d = (definition_t*)rfx_calloc(sizeof(definition_t));
+        d->tag = tag;
+        d->hash = memory_hash64(&tag->data[2], tag->len-2, tag->id);
+        if(h) {
+            d->helpers = (helpers_t*)rfx_calloc(sizeof(helpers_t));
+            d->helpers->tags = (TAG**)rfx_alloc(sizeof(TAG*)*h->num);
+            for(t=0;t<h->num;t++) {
+                TAG*helper = h->tags[t];
+                /* names don't change how a character looks, so they don't
+                   prevent merging (the name of a merged character is lost) */
+                if(helper->id == ST_NAMECHARACTER)
+                    continue;
+                /* helpers can appear after this tag, so remap them now */
+                remapUsedIDs(helper, remap);
+                d->hash = memory_hash64(&helper->data[2], helper->len-2, d->hash ^ helper->id);
+                d->helpers->tags[d->helpers->num++] = helper;
             }
         }
 
-        tag = next;
+        definition_t*d2 = (definition_t*)dict_lookup(definitions, d);
+        if(!d2) {
+            dict_put(definitions, d, d);
+            continue;
+        }
+
+        /* we found two identical definitions- map this one to the
+           earlier one, and remove it together with its helper tags */
+        remap[id] = swf_GetDefineID(d2->tag);
+        int num = 1 + (h?h->num:0);
+        if(num_dead + num > dead_size) {
+            dead_size = (num_dead + num)*2;
+            dead = (TAG**)rfx_realloc(dead, sizeof(TAG*)*dead_size);
+        }
+        dead[num_dead++] = tag;
+        for(t=0;h && t<h->num;t++) {
+            dead[num_dead++] = h->tags[t];
+        }
+        definition_free(d);
     }
-    
-    rfx_free(dontremap);
+
+    /* tags are only deleted now, as the helper tags of a merged
+       definition might not have been reached yet */
+    for(t=0;t<num_dead;t++) {
+        swf_DeleteTag(swf, dead[t]);
+    }
+
+    dict_destroy(definitions);
+    DICT_ITERATE_DATA(id2helpers, helpers_t*, h) {
+        rfx_free(h->tags);
+        rfx_free(h);
+    }
+    dict_destroy(id2helpers);
+    rfx_free(dead);
     rfx_free(remap);
-    rfx_free(id2tag);
-    rfx_free(hashmap);
 }
 
 void swf_SetDefineBBox(TAG * tag, SRECT newbbox)
@@ -0,0 +1,327 @@
+/* palette.c
+   Color counting and color reduction for palette based image formats.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include <string.h>
+#include "mem.h"
+#include "palette.h"
+
+static inline U32 color_hash(U32 color, int bits)
+{
+    return (color*0x9e3779b1u) >> (32-bits);
+}
+
+static inline U8 color_alpha(const U32*color)
+{
+    return ((const U8*)color)[0];
+}
+
+/* open addressing, with twice as many slots as a palette has entries */
+#define PALETTE_HASH_BITS 9
+#define PALETTE_HASH_SIZE (1<<PALETTE_HASH_BITS)
+
+void palette_analyze(const void*image, int width, int height, int maxcolors, palette_t*p, U8*indices, int stride)
+{
+    const U32*img = (const U32*)image;
+    U32 keys[PALETTE_HASH_SIZE];
+    U16 slots[PALETTE_HASH_SIZE]; // palette index+1, 0 = empty
+    int len = width*height;
+    int num = 0;
+    int alpha = 0;
+    int transparent = 0;
+    int x, y, t = 0;
+    U8 index = 0;
+    U32 last;
+
+    if(maxcolors>256)
+	maxcolors = 256;
+    memset(slots, 0, sizeof(slots));
+    p->num = p->alpha = p->transparent = 0;
+    if(len<=0)
+	return;
+
+    last = ~img[0]; // don't match
+    for(y=0;y<height;y++) {
+	const U32*line = &img[y*width];
+	U8*dest = indices?&indices[y*stride]:0;
+	for(x=0;x<width;x++) {
+	    U32 col = line[x];
+	    if(col != last) {
+		U8 a = color_alpha(&line[x]);
+		if(a!=255) {
+		    transparent = 1;
+		    if(a>=4 && a<0xfc)
+			alpha = 2;
+		    else if(a<4 && !alpha)
+			alpha = 1;
+		}
+		U32 h = color_hash(col, PALETTE_HASH_BITS);
+		while(slots[h] && keys[h]!=col)
+		    h = (h+1)&(PALETTE_HASH_SIZE-1);
+		if(!slots[h]) {
+		    if(num == maxcolors) {
+			num++;
+			t = y*width+x;
+			goto overflow;
+		    }
+		    keys[h] = col;
+		    p->colors[num] = col;
+		    slots[h] = ++num;
+		}
+		index = slots[h]-1;
+		last = col;
+	    }
+	    if(dest)
+		dest[x] = index;
+	}
+    }
+    p->num = num;
+    p->alpha = alpha;
+    p->transparent = transparent;
+    return;
+
+overflow:
+    /* too many colors. All that's left to do is to check for alpha. */
+    for(;t<len && alpha<2;t++) {
+	U8 a = color_alpha(&img[t]);
+	if(a!=255) {
+	    transparent = 1;
+	    if(a>=4 && a<0xfc)
+		alpha = 2;
+	    else if(a<4)
+		alpha = 1;
+	}
+    }
+    p->num = num;
+    p->alpha = alpha;
+    p->transparent = transparent;
+}
+
+/* ----------------------------- median cut ------------------------------ */
+
+typedef struct _colorcount {
+    U32 color;
+    U32 count;
+    int box;
+} colorcount_t;
+
+typedef struct _colortable {
+    colorcount_t*entries;
+    int*slots; // entry+1, 0 = empty
+    int num;
+    int bits;
+} colortable_t;
+
+static int colortable_find(colortable_t*t, U32 color)
+{
+    int mask = (1<<t->bits)-1;
+    U32 h = color_hash(color, t->bits);
+    while(t->slots[h]) {
+	int e = t->slots[h]-1;
+	if(t->entries[e].color == color)
+	    return e;
+	h = (h+1)&mask;
+    }
+    return -1;
+}
+
+static int colortable_add(colortable_t*t, U32 color)
+{
+    int size = 1<<t->bits;
+    U32 h = color_hash(color, t->bits);
+    while(t->slots[h]) {
+	int e = t->slots[h]-1;
+	if(t->entries[e].color == color)
+	    return e;
+	h = (h+1)&(size-1);
+    }
+    if(t->num*2 >= size) {
+	/* grow, and rehash all entries */
+	int e;
+	t->bits++;
+	size = 1<<t->bits;
+	t->slots = (int*)rfx_realloc(t->slots, sizeof(int)*size);
+	memset(t->slots, 0, sizeof(int)*size);
+	t->entries = (colorcount_t*)rfx_realloc(t->entries, sizeof(colorcount_t)*size/2);
+	for(e=0;e<t->num;e++) {
+	    h = color_hash(t->entries[e].color, t->bits);
+	    while(t->slots[h])
+		h = (h+1)&(size-1);
+	    t->slots[h] = e+1;
+	}
+	return colortable_add(t, color);
+    }
+    t->entries[t->num].color = color;
+    t->entries[t->num].count = 0;
+    t->entries[t->num].box = 0;
+    t->slots[h] = ++t->num;
+    return t->num-1;
+}
+
+typedef struct _box {
+    int start, end; // range in the sorted entry list
+    int channel;    // the channel with the largest range
+    int range;
+} box_t;
+
+static inline int channel(colortable_t*t, int e, int c)
+{
+    return ((U8*)&t->entries[e].color)[c];
+}
+
+static void box_measure(colortable_t*t, int*order, box_t*b)
+{
+    int min[4] = {255,255,255,255};
+    int max[4] = {0,0,0,0};
+    int i, c;
+    for(i=b->start;i<b->end;i++) {
+	for(c=0;c<4;c++) {
+	    int v = channel(t, order[i], c);
+	    if(v<min[c]) min[c] = v;
+	    if(v>max[c]) max[c] = v;
+	}
+    }
+    b->range = -1;
+    b->channel = 0;
+    for(c=0;c<4;c++) {
+	if(max[c]-min[c] > b->range) {
+	    b->range = max[c]-min[c];
+	    b->channel = c;
+	}
+    }
+}
+
+/* counting sort of the box' entries by one channel */
+static void box_sort(colortable_t*t, int*order, int*tmp, box_t*b)
+{
+    int pos[256];
+    int i, sum = 0;
+    memset(pos, 0, sizeof(pos));
+    for(i=b->start;i<b->end;i++)
+	pos[channel(t, order[i], b->channel)]++;
+    for(i=0;i<256;i++) {
+	int n = pos[i];
+	pos[i] = sum;
+	sum += n;
+    }
+    for(i=b->start;i<b->end;i++)
+	tmp[pos[channel(t, order[i], b->channel)]++] = order[i];
+    memcpy(&order[b->start], tmp, sizeof(int)*(b->end-b->start));
+}
+
+int palette_quantize(const void*image, int width, int height, int numcolors, U32*palette, U8*indices, int stride)
+{
+    const U32*img = (const U32*)image;
+    colortable_t table;
+    box_t boxes[256];
+    int numboxes = 1;
+    int x, y, i;
+
+    if(numcolors>256)
+	numcolors = 256;
+    if(numcolors<1 || width<=0 || height<=0)
+	return 0;
+
+    /* count all colors */
+    table.bits = 12;
+    table.num = 0;
+    table.slots = (int*)rfx_calloc(sizeof(int)<<table.bits);
+    table.entries = (colorcount_t*)rfx_alloc(sizeof(colorcount_t)<<(table.bits-1));
+    int e = colortable_add(&table, img[0]);
+    for(i=0;i<width*height;i++) {
+	if(img[i] != table.entries[e].color)
+	    e = colortable_add(&table, img[i]);
+	table.entries[e].count++;
+    }
+
+    int*order = (int*)rfx_alloc(sizeof(int)*table.num);
+    int*tmp = (int*)rfx_alloc(sizeof(int)*table.num);
+    for(i=0;i<table.num;i++)
+	order[i] = i;
+
+    /* split the box with the largest extent at the median of its
+       pixels, until there are enough boxes */
+    boxes[0].start = 0;
+    boxes[0].end = table.num;
+    box_measure(&table, order, &boxes[0]);
+    while(numboxes < numcolors) {
+	int best = -1;
+	for(i=0;i<numboxes;i++) {
+	    if(boxes[i].end-boxes[i].start > 1 && boxes[i].range > 0 &&
+	       (best<0 || boxes[i].range > boxes[best].range))
+		best = i;
+	}
+	if(best<0)
+	    break;
+	box_t*b = &boxes[best];
+	box_sort(&table, order, tmp, b);
+
+	U64 total = 0, sum = 0;
+	for(i=b->start;i<b->end;i++)
+	    total += table.entries[order[i]].count;
+	int split = b->start+1;
+	for(i=b->start;i<b->end-1;i++) {
+	    sum += table.entries[order[i]].count;
+	    split = i+1;
+	    if(sum*2 >= total)
+		break;
+	}
+
+	box_t*b2 = &boxes[numboxes++];
+	b2->start = split;
+	b2->end = b->end;
+	b->end = split;
+	box_measure(&table, order, b);
+	box_measure(&table, order, b2);
+    }
+
+    /* every box contributes the average of its pixels */
+    for(i=0;i<numboxes;i++) {
+	U64 sum[4] = {0,0,0,0};
+	U64 count = 0;
+	U8 col[4];
+	int j, c;
+	for(j=boxes[i].start;j<boxes[i].end;j++) {
+	    colorcount_t*entry = &table.entries[order[j]];
+	    for(c=0;c<4;c++)
+		sum[c] += (U64)((U8*)&entry->color)[c] * entry->count;
+	    count += entry->count;
+	    entry->box = i;
+	}
+	for(c=0;c<4;c++)
+	    col[c] = (U8)((sum[c] + count/2) / count);
+	memcpy(&palette[i], col, 4);
+    }
+
+    for(y=0;y<height;y++) {
+	const U32*line = &img[y*width];
+	U8*dest = &indices[y*stride];
+	for(x=0;x<width;x++) {
+	    if(line[x] != table.entries[e].color)
+		e = colortable_find(&table, line[x]);
+	    dest[x] = table.entries[e].box;
+	}
+    }
+
+    rfx_free(order);
+    rfx_free(tmp);
+    rfx_free(table.slots);
+    rfx_free(table.entries);
+    return numboxes;
+}
@@ -0,0 +1,59 @@
+/* palette.h
+   Header file for palette.c.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __palette_h__
+#define __palette_h__
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Images are arrays of 32 bit pixels with the alpha value in the first
+   byte, i.e. RGBA, gfxcolor_t or the COL of png.c. */
+
+typedef struct _palette {
+    /* number of different colors, or maxcolors+1 if there are more */
+    int num;
+    /* 0: opaque, 1: only (nearly) fully transparent pixels,
+       2: semi-transparent pixels (like swf_ImageHasAlpha()) */
+    int alpha;
+    /* set if any pixel has an alpha value other than 255 */
+    int transparent;
+    /* the colors, in the order they first appear in the image */
+    U32 colors[256];
+} palette_t;
+
+/* Scan an image once, counting its colors (up to maxcolors<=256) and
+   detecting alpha. If indices is given, it receives the palette index of
+   every pixel (with stride bytes per row), which is only valid if
+   num<=maxcolors. Images with more colors are still scanned for alpha. */
+void palette_analyze(const void*image, int width, int height, int maxcolors, palette_t*palette, U8*indices, int stride);
+
+/* Reduce an image to at most numcolors (<=256) colors, using median cut.
+   Fills palette and the index of every pixel, and returns the number
+   of palette entries. */
+int palette_quantize(const void*image, int width, int height, int numcolors, U32*palette, U8*indices, int stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -37,6 +37,7 @@
 #endif
 
 #include "../log.h"
+#include "../stats.h"
 #include "../png.h"
 #include "../devices/record.h"
 #include "../gfxtools.h"
@@ -195,6 +196,8 @@ void BitmapOutputDev::flushBitmap()
 	msg("<error> sizeof(SplashColor)!=3");
 	return;
     }
+    stats_timer_t timer;
+    stats_timer_start(&timer, "bitmap.flush");
 
     /*static int counter=0;
     if(!counter) {
@@ -263,6 +266,8 @@ void BitmapOutputDev::flushBitmap()
 	img->data = (gfxcolor_t*)malloc(rangex * rangey * 4);
 	img->width = rangex;
 	img->height = rangey;
+	img->jpeg = 0;
+	img->jpeg_size = 0;
 	int x,y;
 	for(y=0;y<rangey;y++) {
 	    SplashColorPtr in=&rgb[((y+ymin)*bitmap_width+xmin)*sizeof(SplashColor)];
@@ -328,6 +333,7 @@ void BitmapOutputDev::flushBitmap()
     memset(rgbbitmap->getDataPtr(), 0, rgbbitmap->getRowSize()*rgbbitmap->getHeight());
 
     this->emptypage = 0;
+    stats_timer_stop(&timer);
 }
 
 void BitmapOutputDev::flushText()
@@ -1466,7 +1472,10 @@ void BitmapOutputDev::stroke(GfxState *state)
     bbox.xmin -= width; bbox.ymin -= width;
     bbox.xmax += width; bbox.ymax += width;
     checkNewBitmap(bbox.xmin, bbox.ymin, ceil(bbox.xmax), ceil(bbox.ymax));
+    stats_timer_t timer;
+    stats_timer_start(&timer, "bitmap.rasterize");
     rgbdev->stroke(state);
+    stats_timer_stop(&timer);
     dbg_newdata("stroke");
 }
 
@@ -1509,7 +1518,10 @@ void BitmapOutputDev::fill(GfxState *state)
 	}
     }
     checkNewBitmap(bbox.xmin, bbox.ymin, ceil(bbox.xmax), ceil(bbox.ymax));
+    stats_timer_t timer;
+    stats_timer_start(&timer, "bitmap.rasterize");
     rgbdev->fill(state);
+    stats_timer_stop(&timer);
     dbg_newdata("fill");
 }
 void BitmapOutputDev::eoFill(GfxState *state)
@@ -1518,7 +1530,10 @@ void BitmapOutputDev::eoFill(GfxState *state)
     boolpolydev->eoFill(state);
     gfxbbox_t bbox = getBBox(state);
     checkNewBitmap(bbox.xmin, bbox.ymin, ceil(bbox.xmax), ceil(bbox.ymax));
+    stats_timer_t timer;
+    stats_timer_start(&timer, "bitmap.rasterize");
     rgbdev->eoFill(state);
+    stats_timer_stop(&timer);
     dbg_newdata("eofill");
 }
 
@@ -1923,7 +1938,10 @@ void BitmapOutputDev::drawImageMask(GfxState *state, Object *ref, Stream *str,
     boolpolydev->drawImageMask(state, ref, str, width, height, invert, POPPLER_INTERPOLATE_ARG inlineImg);
     gfxbbox_t bbox = getImageBBox(state);
     checkNewBitmap(bbox.xmin, bbox.ymin, ceil(bbox.xmax), ceil(bbox.ymax));
+    stats_timer_t timer;
+    stats_timer_start(&timer, "bitmap.rasterize");
     rgbdev->drawImageMask(state, ref, str, width, height, invert, POPPLER_INTERPOLATE_ARG inlineImg);
+    stats_timer_stop(&timer);
     delete cpystr;
     dbg_newdata("imagemask");
 }
@@ -1941,7 +1959,10 @@ void BitmapOutputDev::drawImage(GfxState *state, Object *ref, Stream *str,
     boolpolydev->drawImage(state, ref, str, width, height, colorMap, POPPLER_INTERPOLATE_ARG maskColors, inlineImg);
     gfxbbox_t bbox=getImageBBox(state);
     checkNewBitmap(bbox.xmin, bbox.ymin, ceil(bbox.xmax), ceil(bbox.ymax));
+    stats_timer_t timer;
+    stats_timer_start(&timer, "bitmap.rasterize");
     rgbdev->drawImage(state, ref, str, width, height, colorMap, POPPLER_INTERPOLATE_ARG maskColors, inlineImg);
+    stats_timer_stop(&timer);
     delete cpystr;
     dbg_newdata("image");
 }
@@ -1961,7 +1982,10 @@ void BitmapOutputDev::drawMaskedImage(GfxState *state, Object *ref, Stream *str,
     boolpolydev->drawMaskedImage(state, ref, str, width, height, colorMap, POPPLER_INTERPOLATE_ARG maskStr, maskWidth, maskHeight, maskInvert POPPLER_MASK_INTERPOLATE_ARG);
     gfxbbox_t bbox=getImageBBox(state);
     checkNewBitmap(bbox.xmin, bbox.ymin, ceil(bbox.xmax), ceil(bbox.ymax));
+    stats_timer_t timer;
+    stats_timer_start(&timer, "bitmap.rasterize");
     rgbdev->drawMaskedImage(state, ref, str, width, height, colorMap, POPPLER_INTERPOLATE_ARG maskStr, maskWidth, maskHeight, maskInvert POPPLER_MASK_INTERPOLATE_ARG);
+    stats_timer_stop(&timer);
     delete cpystr;
     dbg_newdata("maskedimage");
 }
@@ -1982,7 +2006,10 @@ void BitmapOutputDev::drawSoftMaskedImage(GfxState *state, Object *ref, Stream *
     boolpolydev->drawSoftMaskedImage(state, ref, str, width, height, colorMap, POPPLER_INTERPOLATE_ARG maskStr, maskWidth, maskHeight, maskColorMap POPPLER_MASK_INTERPOLATE_ARG);
     gfxbbox_t bbox=getImageBBox(state);
     checkNewBitmap(bbox.xmin, bbox.ymin, ceil(bbox.xmax), ceil(bbox.ymax));
+    stats_timer_t timer;
+    stats_timer_start(&timer, "bitmap.rasterize");
     rgbdev->drawSoftMaskedImage(state, ref, str, width, height, colorMap, POPPLER_INTERPOLATE_ARG maskStr, maskWidth, maskHeight, maskColorMap POPPLER_MASK_INTERPOLATE_ARG);
+    stats_timer_stop(&timer);
     delete cpystr;
     dbg_newdata("softmaskimage");
 }
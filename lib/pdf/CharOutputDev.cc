@@ -262,12 +262,9 @@ static inline char islowercase(char c)
     return (c>='a' && c<='z');
 }
 
-char* fontconfig_searchForFont(char*name)
-{
 #ifdef HAVE_FONTCONFIG
-    if(!config_use_fontconfig)
-	return 0;
-    
+static void fontconfig_init()
+{
     // call init ony once
     if (!fcinitcalled) {
         fcinitcalled = 1;
@@ -310,13 +307,13 @@ char* fontconfig_searchForFont(char*name)
 	if(!FcInit()) {
             msg("<debug> FontConfig Initialization failed. Disabling.");
             config_use_fontconfig = 0;
-            return 0;
+            return;
         }
 	FcConfig * config = FcConfigGetCurrent();
 	if(!config) {
             msg("<debug> FontConfig Config Initialization failed. Disabling.");
             config_use_fontconfig = 0;
-            return 0;
+            return;
         }
 
         /* add external fonts to fontconfig's config, too. */
@@ -332,7 +329,7 @@ char* fontconfig_searchForFont(char*name)
 	if(!set || !set->nfont) {
             msg("<debug> FontConfig has zero fonts. Disabling.");
             config_use_fontconfig = 0;
-            return 0;
+            return;
         }
 
 	if(getLogLevel() >= LOGLEVEL_TRACE) {
@@ -357,6 +354,17 @@ char* fontconfig_searchForFont(char*name)
 	    }
 	}
     }
+}
+#endif
+
+char* fontconfig_searchForFont(char*name)
+{
+#ifdef HAVE_FONTCONFIG
+    if(!config_use_fontconfig)
+	return 0;
+    fontconfig_init();
+    if(!config_use_fontconfig)
+	return 0;
 
     char*family = strdup(name);
     int len = strlen(family);
@@ -432,6 +440,36 @@ static DisplayFontParamKind detectFontType(const char*filename)
     return displayFontTT;
 }
 
+static DisplayFontParam *getStdFont(fontentry*f)
+{
+    if(!f->fullfilename) {
+	f->fullfilename = writeOutStdFont(f);
+	if(!f->fullfilename) {
+	    msg("<error> Couldn't save default font- is the Temp Directory writable?");
+	} else {
+	    msg("<verbose> Storing standard PDF font %s at %s", f->pdffont, f->fullfilename);
+	}
+	DisplayFontParam *dfp = new DisplayFontParam(new GString(f->pdffont), displayFontT1);
+	dfp->t1.fileName = new GString(f->fullfilename);
+	f->dfp = dfp;
+    }
+    return f->dfp;
+}
+
+/* Font lookups are normally done on demand. A process which converts many
+   documents does them upfront instead. */
+void GFXGlobalParams::preloadFonts()
+{
+    int t;
+    for(t=0;t<sizeof(pdf2t1map)/sizeof(fontentry);t++) {
+	getStdFont(&pdf2t1map[t]);
+    }
+#ifdef HAVE_FONTCONFIG
+    if(config_use_fontconfig)
+	fontconfig_init();
+#endif
+}
+
 DisplayFontParam *GFXGlobalParams::getDisplayFont(GString *fontName)
 {
     msg("<verbose> looking for font %s", fontName->getCString());
@@ -442,18 +480,7 @@ DisplayFontParam *GFXGlobalParams::getDisplayFont(GString *fontName)
     int t;
     for(t=0;t<sizeof(pdf2t1map)/sizeof(fontentry);t++) {
 	if(!strcmp(name, pdf2t1map[t].pdffont)) {
-	    if(!pdf2t1map[t].fullfilename) {
-		pdf2t1map[t].fullfilename = writeOutStdFont(&pdf2t1map[t]);
-		if(!pdf2t1map[t].fullfilename) {
-		    msg("<error> Couldn't save default font- is the Temp Directory writable?");
-		} else {
-		    msg("<verbose> Storing standard PDF font %s at %s", name, pdf2t1map[t].fullfilename);
-		}
-		DisplayFontParam *dfp = new DisplayFontParam(new GString(fontName), displayFontT1);
-		dfp->t1.fileName = new GString(pdf2t1map[t].fullfilename);
-		pdf2t1map[t].dfp = dfp;
-	    }
-	    return pdf2t1map[t].dfp;
+	    return getStdFont(&pdf2t1map[t]);
 	}
     }
     
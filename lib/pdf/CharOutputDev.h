@@ -114,6 +114,7 @@ class GFXGlobalParams:  public GlobalParams {
     ~GFXGlobalParams();
     virtual DisplayFontParam *getDisplayFont(GString *fontName);
     virtual DisplayFontParam *getDisplayCIDFont(GString *fontName, GString *collection);
+    void preloadFonts();
 };
 
 #endif //__charoutputdev_h__
@@ -152,6 +152,8 @@ void FullBitmapOutputDev::flushBitmap()
     img->data = (gfxcolor_t*)malloc(rangex * rangey * 4);
     img->width = rangex;
     img->height = rangey;
+    img->jpeg = 0;
+    img->jpeg_size = 0;
     int x,y;
     for(y=0;y<rangey;y++) {
 	SplashColorPtr in=&rgb[((y+ymin)*width+xmin)*sizeof(SplashColor)];
@@ -9,6 +9,8 @@
 #include "../q.h"
 #include "../gfxdevice.h"
 #include "../gfxfont.h"
+#include "../bitio.h"
+#include "fontcache.h"
 #include <math.h>
 #include <assert.h>
 
@@ -108,6 +110,8 @@ InfoOutputDev::InfoOutputDev(XRef*xref)
     last_font = 0;
     current_type3_font = 0;
     fontcache = dict_new2(&fontclass_type);
+    pagefonts = dict_new2(&int_type);
+    current_page = 0;
 }
 InfoOutputDev::~InfoOutputDev() 
 {
@@ -117,6 +121,14 @@ InfoOutputDev::~InfoOutputDev()
 	delete fd;
     }
     dict_destroy(this->fontcache);this->fontcache=0;
+    DICT_ITERATE_DATA(this->pagefonts, fontinfolist_t*, l) {
+	while(l) {
+	    fontinfolist_t*next = l->next;
+	    free(l);
+	    l = next;
+	}
+    }
+    dict_destroy(this->pagefonts);this->pagefonts=0;
 
     delete splash;splash=0;
 }
@@ -142,6 +154,8 @@ FontInfo::FontInfo(fontclass_t*fontclass)
 
     this->fontclass = (fontclass_t*)fontclass_type.dup(fontclass);
     this->seen = 0;
+    this->last_page = 0;
+    this->has_digest = 0;
     this->num_glyphs = 0;
     this->glyphs = 0;
     this->gfxfont = 0;
@@ -411,10 +425,102 @@ static float find_average_glyph_advance(gfxfont_t*f)
     return m;
 }
 
+/* serializes everything createGfxFont() depends on: the glyph outlines
+   that were collected for this font, the font transformation and the
+   conversion settings */
+void FontInfo::writeCacheKey(writer_t*w)
+{
+    writer_writeU32(w, 1); // key format version
+    writer_writeU32(w, config_fontquality);
+    writer_writeU8(w, config_bigchar);
+    writer_writeU8(w, config_remove_font_transforms);
+    writer_writeU8(w, config_normalize_fonts);
+    writer_writeU8(w, config_remove_invisible_outlines);
+    writer_writeFloat(w, fontclass->m00);
+    writer_writeFloat(w, fontclass->m01);
+    writer_writeFloat(w, fontclass->m10);
+    writer_writeFloat(w, fontclass->m11);
+    writer_writeU8(w, fontclass->alpha);
+    writer_writeDouble(w, this->max_size);
+    writer_writeDouble(w, this->ascender);
+    writer_writeDouble(w, this->descender);
+    writer_writeU32(w, this->num_glyphs);
+    int t;
+    for(t=0;t<this->num_glyphs;t++) {
+	GlyphInfo*g = this->glyphs[t];
+	if(!g) {
+	    writer_writeU8(w, 0);
+	    continue;
+	}
+	writer_writeU8(w, 1);
+	writer_writeU32(w, g->unicode);
+	writer_writeDouble(w, g->advance);
+	writer_writeDouble(w, g->advance_max);
+	int len = g->path?g->path->getLength():0;
+	writer_writeU32(w, len);
+	int s;
+	for(s=0;s<len;s++) {
+	    Guchar f;
+	    double x, y;
+	    g->path->getPoint(s, &x, &y, &f);
+	    writer_writeDouble(w, x);
+	    writer_writeDouble(w, y);
+	    writer_writeU8(w, f);
+	}
+    }
+}
+
+/* for the page cache: identifies the font, and everything it was
+   converted from. (The glyph data of a font can be large, and is the
+   same for every page using it, so we only store its digest) */
+void FontInfo::writePageKey(writer_t*w)
+{
+    if(!this->has_digest) {
+	writer_t k;
+	writer_init_growingmemwriter(&k, 4096);
+	this->writeCacheKey(&k);
+	int len = 0;
+	void*data = writer_growmemwrite_memptr(&k, &len);
+	this->digest[0] = memory_hash64(data, len, 0);
+	this->digest[1] = memory_hash64(data, len, 0x5bd1e995);
+	k.finish(&k);
+	this->has_digest = 1;
+    }
+    writer_writeString(w, this->id);
+    w->write(w, this->digest, sizeof(this->digest));
+}
+
+gfxfont_t* FontInfo::loadOrCreateGfxFont()
+{
+    if(!fontcache_enabled())
+	return this->createGfxFont();
+
+    writer_t w;
+    writer_init_growingmemwriter(&w, 4096);
+    this->writeCacheKey(&w);
+    int keylen = 0;
+    void*key = writer_growmemwrite_memptr(&w, &keylen);
+
+    gfxfont_t*font = fontcache_load(key, keylen, &this->scale);
+    if(font) {
+	/* createGfxFont() assigns the glyph ids as a side effect */
+	int t, num = 0;
+	for(t=0;t<this->num_glyphs;t++) {
+	    if(this->glyphs[t])
+		this->glyphs[t]->glyphid = num++;
+	}
+    } else {
+	font = this->createGfxFont();
+	fontcache_store(key, keylen, font, this->scale);
+    }
+    w.finish(&w);
+    return font;
+}
+
 gfxfont_t* FontInfo::getGfxFont()
 {
     if(!this->gfxfont) {
-        this->gfxfont = this->createGfxFont();
+        this->gfxfont = this->loadOrCreateGfxFont();
         this->gfxfont->id = strdup(this->id);
 	this->space_char = findSpace(this->gfxfont);
 	this->average_advance = find_average_glyph_advance(this->gfxfont);
@@ -473,6 +579,7 @@ void InfoOutputDev::startPage(int pageNum, GfxState *state)
     this->x2 = (int)x2;
     this->y2 = (int)y2;
     msg("<verbose> Generating info structure for page %d", pageNum);
+    current_page = pageNum;
     num_links = 0;
     num_jpeg_images = 0;
     num_ppm_images = 0;
@@ -707,9 +814,42 @@ FontInfo* InfoOutputDev::getOrCreateFontInfo(GfxState*state)
 
     this->last_font = fontinfo;
     fontclass_clear(&fontclass);
+    usedOnPage(fontinfo);
     return fontinfo;
 }
 
+void InfoOutputDev::usedOnPage(FontInfo*fontinfo)
+{
+    if(fontinfo->last_page == current_page)
+	return;
+    fontinfo->last_page = current_page;
+    fontinfolist_t*l = (fontinfolist_t*)malloc(sizeof(fontinfolist_t));
+    l->font = fontinfo;
+    l->next = 0;
+    fontinfolist_t*first = getPageFonts(current_page);
+    if(!first) {
+	dict_put(pagefonts, (void*)(ptroff_t)current_page, l);
+    } else {
+	while(first->next)
+	    first = first->next;
+	first->next = l;
+    }
+}
+
+fontinfolist_t* InfoOutputDev::getPageFonts(int page)
+{
+    return (fontinfolist_t*)dict_lookup(pagefonts, (void*)(ptroff_t)page);
+}
+
+void InfoOutputDev::writePageKey(int page, writer_t*w)
+{
+    fontinfolist_t*l;
+    for(l=getPageFonts(page);l;l=l->next) {
+	l->font->writePageKey(w);
+    }
+    writer_writeU8(w, 0);
+}
+
 FontInfo* InfoOutputDev::getFontInfo(GfxState*state)
 {
     fontclass_t fontclass = fontclass_from_state(state);
@@ -856,6 +996,7 @@ GBool InfoOutputDev::beginType3Char(GfxState *state, double x, double y, double
 	num_fonts++;
     }
     fontclass_clear(&fontclass);
+    usedOnPage(fontinfo);
 
     current_type3_font = fontinfo;
     fontinfo->grow(code+1);
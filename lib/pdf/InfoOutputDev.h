@@ -48,6 +48,7 @@
 #include "../gfxdevice.h"
 #include "../gfxtools.h"
 #include "../gfxfont.h"
+#include "../bitio.h"
 #include "../q.h"
 
 #define INTERNAL_FONT_SIZE 1024.0
@@ -64,6 +65,12 @@ struct GlyphInfo
     double advance_max;
 };
 
+class FontInfo;
+typedef struct _fontinfolist {
+    FontInfo*font;
+    struct _fontinfolist*next;
+} fontinfolist_t;
+
 typedef struct _fontclass {
     float m00,m01,m10,m11;
     char*id;
@@ -78,6 +85,11 @@ class FontInfo
     double scale;
     
     gfxfont_t* createGfxFont();
+    gfxfont_t* loadOrCreateGfxFont();
+    void writeCacheKey(writer_t*w);
+
+    char has_digest;
+    U64 digest[2];
 public:
     fontclass_t*fontclass;
     FontInfo(fontclass_t*fontclass);
@@ -102,7 +114,10 @@ public:
     int num_glyphs;
     GlyphInfo**glyphs;
 
+    void writePageKey(writer_t*w);
+
     char seen;
+    int last_page;
     int space_char;
     float average_advance;
 
@@ -121,6 +136,8 @@ class InfoOutputDev: public OutputDev
     Page *page;
 
     dict_t*fontcache;
+    dict_t*pagefonts; // page number -> fontinfolist_t
+    int current_page;
     FontInfo*last_font;
     FontInfo*current_type3_font;
     SplashFont*current_splash_font;
@@ -140,6 +157,10 @@ class InfoOutputDev: public OutputDev
     void dumpfonts(gfxdevice_t*dev);
     FontInfo* getFontInfo(GfxState*state);
 
+    /* the fonts used on a given page, in the order they first appear */
+    fontinfolist_t* getPageFonts(int page);
+    void writePageKey(int page, writer_t*w);
+
     InfoOutputDev(XRef*xref);
     virtual ~InfoOutputDev(); 
     virtual GBool useTilingPatternFill();
@@ -203,6 +224,7 @@ class InfoOutputDev: public OutputDev
     private:
     
     FontInfo* getOrCreateFontInfo(GfxState*state);
+    void usedOnPage(FontInfo*fontinfo);
 };
 
 #endif //__infooutputdev_h__
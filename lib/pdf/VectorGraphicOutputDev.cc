@@ -37,6 +37,7 @@
 #include "../os.h"
 #include "../log.h"
 #include "../mem.h"
+#include "../stats.h"
 #include "../utf8.h"
 #include "../gfxdevice.h"
 #include "../gfxtools.h"
@@ -48,6 +49,7 @@
 #include "../devices/render.h"
 
 #include "../png.h"
+#include "../jpeg.h"
 
 namespace {
 gfxcxform_t CreateAlphaCxform(float alpha) {
@@ -230,6 +232,8 @@ gfxline_t* VectorGraphicOutputDev::gfxPath_to_gfxline(GfxState*state, GfxPath*pa
 	msg("<warning> empty path");
 	return 0;
     }
+    stats_timer_t timer;
+    stats_timer_start(&timer, "pdf.paths");
     gfxdrawer_t draw;
     gfxdrawer_target_gfxline(&draw);
 
@@ -281,6 +285,7 @@ gfxline_t* VectorGraphicOutputDev::gfxPath_to_gfxline(GfxState*state, GfxPath*pa
 
     gfxline_optimize(result);
 
+    stats_timer_stop(&timer);
     return result;
 }
 
@@ -1061,7 +1066,8 @@ static void drawimage(gfxdevice_t*dev, gfxcolor_t* data, int sizex,int sizey,
         double x1,double y1,
         double x2,double y2,
         double x3,double y3,
-        double x4,double y4, int type, int multiply, gfxcxform_t* color_transform)
+        double x4,double y4, int type, int multiply, gfxcxform_t* color_transform,
+	unsigned char*jpeg, int jpeg_size)
 {
     gfxcolor_t*newpic=0;
     
@@ -1098,6 +1104,8 @@ static void drawimage(gfxdevice_t*dev, gfxcolor_t* data, int sizex,int sizey,
     img.data = (gfxcolor_t*)data;
     img.width = sizex;
     img.height = sizey;
+    img.jpeg = jpeg;
+    img.jpeg_size = jpeg_size;
   
     if(type == IMAGE_TYPE_JPEG)
 	/* TODO: pass image_dpi to device instead */
@@ -1108,15 +1116,89 @@ static void drawimage(gfxdevice_t*dev, gfxcolor_t* data, int sizex,int sizey,
 }
 
 void drawimagejpeg(gfxdevice_t*dev, gfxcolor_t*mem, int sizex,int sizey, 
-        double x1,double y1, double x2,double y2, double x3,double y3, double x4,double y4, int multiply, gfxcxform_t* color_transform)
+        double x1,double y1, double x2,double y2, double x3,double y3, double x4,double y4, int multiply, gfxcxform_t* color_transform,
+	unsigned char*jpeg, int jpeg_size)
 {
-    drawimage(dev,mem,sizex,sizey,x1,y1,x2,y2,x3,y3,x4,y4, IMAGE_TYPE_JPEG, multiply, color_transform);
+    drawimage(dev,mem,sizex,sizey,x1,y1,x2,y2,x3,y3,x4,y4, IMAGE_TYPE_JPEG, multiply, color_transform, jpeg, jpeg_size);
 }
 
 void drawimagelossless(gfxdevice_t*dev, gfxcolor_t*mem, int sizex,int sizey, 
         double x1,double y1, double x2,double y2, double x3,double y3, double x4,double y4, int multiply, gfxcxform_t* color_transform)
 {
-    drawimage(dev,mem,sizex,sizey,x1,y1,x2,y2,x3,y3,x4,y4, IMAGE_TYPE_LOSSLESS, multiply, color_transform);
+    drawimage(dev,mem,sizex,sizey,x1,y1,x2,y2,x3,y3,x4,y4, IMAGE_TYPE_LOSSLESS, multiply, color_transform, 0, 0);
+}
+
+/* If str is a JPEG image which is displayed without any color conversion,
+   return the original JPEG data, so that devices can store it instead of
+   compressing the decoded pixels again. */
+static unsigned char* getOriginalJPEG(Stream*str, GfxImageColorMap*colorMap, int width, int height, int*size)
+{
+    if(str->getKind()!=strDCT || colorMap->getBits()!=8)
+	return 0;
+
+    int ncomps = colorMap->getNumPixelComps();
+    GfxColorSpace*cs = colorMap->getColorSpace();
+    if(cs->getMode() == csICCBased)
+	cs = ((GfxICCBasedColorSpace*)cs)->getAlt();
+    switch(cs->getMode()) {
+	case csDeviceGray: case csCalGray:
+	    if(ncomps!=1) return 0;
+	    break;
+	case csDeviceRGB: case csCalRGB:
+	    if(ncomps!=3) return 0;
+	    break;
+	default:
+	    return 0;
+    }
+    int t;
+    for(t=0;t<ncomps;t++) {
+	if(colorMap->getDecodeLow(t)!=0 || colorMap->getDecodeHigh(t)!=1)
+	    return 0;
+    }
+
+    /* /ColorTransform overrides the color space the JPEG data specifies */
+    Dict*dict = str->getDict();
+    if(dict) {
+	Object parms, obj;
+	dict->lookup("DecodeParms", &parms);
+	if(parms.isNull()) {
+	    parms.free();
+	    dict->lookup("DP", &parms);
+	}
+	if(parms.isArray() && parms.arrayGetLength()) {
+	    parms.arrayGet(parms.arrayGetLength()-1, &obj);
+	    parms.free();
+	    parms = obj;
+	}
+	GBool transform = parms.isDict() && !parms.dictLookup("ColorTransform", &obj)->isNull();
+	if(parms.isDict())
+	    obj.free();
+	parms.free();
+	if(transform)
+	    return 0;
+    }
+
+    Stream*raw = str->getNextStream();
+    unsigned char*data = 0;
+    int len = 0, datasize = 0, c;
+    raw->reset();
+    while((c = raw->getChar()) != EOF) {
+	if(len == datasize) {
+	    datasize = datasize?datasize*2:65536;
+	    data = (unsigned char*)realloc(data, datasize);
+	}
+	data[len++] = c;
+    }
+
+    unsigned w=0, h=0;
+    int comps=0;
+    if(!jpeg_is_baseline(data, len, &w, &h, &comps) || 
+       (int)w!=width || (int)h!=height || comps!=ncomps) {
+	free(data);
+	return 0;
+    }
+    *size = len;
+    return data;
 }
 
 
@@ -1179,6 +1261,13 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
       maskStr->close();
   }
   
+  /* this has to happen before the image stream is reset, as
+     that starts reading the data */
+  unsigned char*jpeg = 0;
+  int jpeg_size = 0;
+  if(!mask && !maskColors && !maskStr && !inlineImg && !type3active)
+      jpeg = getOriginalJPEG(str, colorMap, width, height, &jpeg_size);
+
   imgStr = new ImageStream(str, width, ncomps,bits);
   imgStr->reset();
 
@@ -1194,6 +1283,8 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
       delete imgStr;
       if(maskbitmap)
 	  free(maskbitmap);
+      if(jpeg)
+	  free(jpeg);
       return;
   }
 
@@ -1328,12 +1419,13 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
 	}
       }
       if(str->getKind()==strDCT)
-	  drawimagejpeg(device, pic, width, height, x1,y1,x2,y2,x3,y3,x4,y4, config_multiply, &color_transform);
+	  drawimagejpeg(device, pic, width, height, x1,y1,x2,y2,x3,y3,x4,y4, config_multiply, &color_transform, jpeg, jpeg_size);
       else
 	  drawimagelossless(device, pic, width, height, x1,y1,x2,y2,x3,y3,x4,y4, config_multiply, &color_transform);
       delete[] pic;
       delete imgStr;
       if(maskbitmap) free(maskbitmap);
+      if(jpeg) free(jpeg);
       return;
   } else {
       gfxcolor_t*pic=new gfxcolor_t[width*height];
@@ -0,0 +1,407 @@
+/* fontcache.c
+   On-disk cache for converted pdf fonts and pages.
+
+   Converting the glyph outlines of an embedded font into gfxlines (including
+   the cubic->quadratic approximation and the font transformations) is done
+   again for every document that uses the font. For document sets that share
+   the same (subsetted) fonts, the converted fonts are stored in a cache
+   directory, one file per font:
+
+     "gfxfont\1"                 magic
+     U32 keylen, key[keylen]     the key, compared byte-by-byte on load
+     U32 datalen, data[datalen]  the converted font
+
+   The page cache uses the same layout (with magic "gfxpage\1"), and stores
+   the recorded gfxdevice stream of a page (see devices/record.c) as data.
+
+   Entries are written to a temporary file and then renamed into place, so
+   concurrent pdf2swf processes sharing a cache directory only ever see
+   complete entries. If the cache exceeds its maximum size, the least recently
+   used entries are deleted.
+
+   This file is part of swftools.
+
+   Swftools is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   Swftools is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with swftools; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../config.h"
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+#ifdef HAVE_UTIME_H
+#include <utime.h>
+#endif
+#include "../mem.h"
+#include "../log.h"
+#include "../bitio.h"
+#include "../gfxdevice.h"
+#include "fontcache.h"
+
+typedef struct _diskcache {
+    const char*name;
+    const char*magic;
+    const char*ext;
+    char*dir;
+    int max_kbytes;
+} diskcache_t;
+
+static diskcache_t fontcache = {"font", "gfxfont\1", ".gfxfont", 0, 64*1024};
+static diskcache_t pagecache = {"page", "gfxpage\1", ".gfxpage", 0, 256*1024};
+
+static void cache_setdir(diskcache_t*c, const char*dir)
+{
+    if(c->dir)
+	free(c->dir);
+    c->dir = dir && *dir ? strdup(dir) : 0;
+}
+
+static char* entry_filename(diskcache_t*c, const void*key, int keylen)
+{
+    /* 64 bit FNV-1a. Collisions are harmless, as the full key is
+       stored in the entry */
+    unsigned long long h = 0xcbf29ce484222325ull;
+    const unsigned char*k = (const unsigned char*)key;
+    int t;
+    for(t=0;t<keylen;t++) {
+	h ^= k[t];
+	h *= 0x100000001b3ull;
+    }
+    char*filename = (char*)malloc(strlen(c->dir)+32);
+    sprintf(filename, "%s/%08x%08x%s", c->dir, (unsigned int)(h>>32), (unsigned int)h, c->ext);
+    return filename;
+}
+
+static void write_line(writer_t*w, gfxline_t*line)
+{
+    int num = 0;
+    gfxline_t*l;
+    for(l=line;l;l=l->next)
+	num++;
+    writer_writeU32(w, num);
+    for(l=line;l;l=l->next) {
+	writer_writeU8(w, l->type);
+	writer_writeDouble(w, l->x);
+	writer_writeDouble(w, l->y);
+	if(l->type == gfx_splineTo) {
+	    writer_writeDouble(w, l->sx);
+	    writer_writeDouble(w, l->sy);
+	}
+    }
+}
+
+static gfxline_t* read_line(reader_t*r)
+{
+    int num = reader_readU32(r);
+    if(!num)
+	return 0;
+    /* allocate the line in one block, gfxline_free() knows about this layout */
+    gfxline_t*line = (gfxline_t*)rfx_calloc(sizeof(gfxline_t)*num);
+    int t;
+    for(t=0;t<num;t++) {
+	gfxline_t*l = &line[t];
+	l->type = (gfx_linetype)reader_readU8(r);
+	l->x = reader_readDouble(r);
+	l->y = reader_readDouble(r);
+	if(l->type == gfx_splineTo) {
+	    l->sx = reader_readDouble(r);
+	    l->sy = reader_readDouble(r);
+	}
+	l->next = t<num-1 ? &line[t+1] : 0;
+    }
+    return line;
+}
+
+static U32 get_u32(unsigned char*p)
+{
+    return p[0]|p[1]<<8|p[2]<<16|(U32)p[3]<<24;
+}
+static void put_u32(unsigned char*p, U32 v)
+{
+    p[0] = v;p[1] = v>>8;p[2] = v>>16;p[3] = v>>24;
+}
+
+/* returns the entry's data (which starts at *data+*datapos), or 0 */
+static unsigned char* cache_read(diskcache_t*c, const void*key, int keylen, int*datapos, int*datalen)
+{
+    if(!c->dir)
+	return 0;
+    char*filename = entry_filename(c, key, keylen);
+    FILE*fi = fopen(filename, "rb");
+    if(!fi) {
+	free(filename);
+	return 0;
+    }
+    fseek(fi, 0, SEEK_END);
+    long size = ftell(fi);
+    fseek(fi, 0, SEEK_SET);
+    unsigned char*data = 0;
+    int headersize = 8+4+keylen+4;
+    if(size >= headersize) {
+	data = (unsigned char*)malloc(size);
+	if(fread(data, size, 1, fi)!=1) {
+	    free(data);data = 0;
+	}
+    }
+    fclose(fi);
+
+    if(!data ||
+       memcmp(data, c->magic, 8) ||
+       get_u32(data+8) != keylen ||
+       memcmp(data+12, key, keylen) ||
+       get_u32(data+12+keylen) != size - headersize) {
+	msg("<verbose> %s cache entry %s doesn't match", c->name, filename);
+	if(data) free(data);
+	free(filename);
+	return 0;
+    }
+
+#ifdef HAVE_UTIME_H
+    /* mark as recently used */
+    utime(filename, 0);
+#endif
+    msg("<verbose> Loading %s from cache entry %s", c->name, filename);
+    free(filename);
+    *datapos = headersize;
+    *datalen = size - headersize;
+    return data;
+}
+
+static void cache_remove(diskcache_t*c, const void*key, int keylen)
+{
+    if(!c->dir)
+	return;
+    char*filename = entry_filename(c, key, keylen);
+    msg("<verbose> Removing %s cache entry %s", c->name, filename);
+    unlink(filename);
+    free(filename);
+}
+
+gfxfont_t* fontcache_load(const void*key, int keylen, double*scale)
+{
+    int pos = 0, len = 0;
+    unsigned char*data = cache_read(&fontcache, key, keylen, &pos, &len);
+    if(!data)
+	return 0;
+
+    reader_t r;
+    reader_init_memreader(&r, data+pos, len);
+    gfxfont_t*font = (gfxfont_t*)rfx_calloc(sizeof(gfxfont_t));
+    *scale = reader_readDouble(&r);
+    font->ascent = reader_readDouble(&r);
+    font->descent = reader_readDouble(&r);
+    font->num_glyphs = reader_readU32(&r);
+    /* like FontInfo::createGfxFont, reserve space for two extra characters */
+    font->glyphs = (gfxglyph_t*)rfx_calloc(sizeof(gfxglyph_t)*(font->num_glyphs+2));
+    int t;
+    for(t=0;t<font->num_glyphs;t++) {
+	gfxglyph_t*g = &font->glyphs[t];
+	g->unicode = reader_readU32(&r);
+	g->advance = reader_readDouble(&r);
+	g->line = read_line(&r);
+    }
+    r.dealloc(&r);
+    free(data);
+    return font;
+}
+
+typedef struct _cacheentry {
+    char*filename;
+    time_t mtime;
+    int size;
+} cacheentry_t;
+
+static int compare_mtime(const void*_a, const void*_b)
+{
+    const cacheentry_t*a = (const cacheentry_t*)_a;
+    const cacheentry_t*b = (const cacheentry_t*)_b;
+    if(a->mtime < b->mtime) return -1;
+    if(a->mtime > b->mtime) return 1;
+    return 0;
+}
+
+static void evict(diskcache_t*c)
+{
+#ifdef HAVE_DIRENT_H
+    if(c->max_kbytes<=0)
+	return;
+    DIR*dir = opendir(c->dir);
+    if(!dir)
+	return;
+
+    int num = 0, size = 16;
+    cacheentry_t*entries = (cacheentry_t*)malloc(sizeof(cacheentry_t)*size);
+    double total = 0;
+    struct dirent*ent;
+    int extlen = strlen(c->ext);
+    while((ent = readdir(dir))) {
+	int l = strlen(ent->d_name);
+	if(l <= extlen || strcmp(ent->d_name+l-extlen, c->ext))
+	    continue;
+	char*filename = (char*)malloc(strlen(c->dir)+l+2);
+	sprintf(filename, "%s/%s", c->dir, ent->d_name);
+	struct stat st;
+	if(stat(filename, &st)<0) {
+	    /* removed by another process in the meantime */
+	    free(filename);
+	    continue;
+	}
+	if(num == size) {
+	    size *= 2;
+	    entries = (cacheentry_t*)realloc(entries, sizeof(cacheentry_t)*size);
+	}
+	entries[num].filename = filename;
+	entries[num].mtime = st.st_mtime;
+	entries[num].size = st.st_size;
+	total += st.st_size;
+	num++;
+    }
+    closedir(dir);
+
+    double max = c->max_kbytes*1024.0;
+    if(total > max) {
+	qsort(entries, num, sizeof(cacheentry_t), compare_mtime);
+	/* shrink to 3/4 of the maximum, so that we don't have to do
+	   this again for the next entry */
+	int t;
+	for(t=0;t<num && total > max*3/4;t++) {
+	    msg("<verbose> Removing %s cache entry %s", c->name, entries[t].filename);
+	    /* another process might have deleted it already- that's fine */
+	    unlink(entries[t].filename);
+	    total -= entries[t].size;
+	}
+    }
+    int t;
+    for(t=0;t<num;t++) {
+	free(entries[t].filename);
+    }
+    free(entries);
+#endif
+}
+
+static void cache_write(diskcache_t*c, const void*key, int keylen, const void*data, int len)
+{
+    unsigned char header[4];
+    char*filename = entry_filename(c, key, keylen);
+    char*tmpname = (char*)malloc(strlen(filename)+32);
+    sprintf(tmpname, "%s.%d.tmp", filename, (int)getpid());
+    FILE*fi = fopen(tmpname, "wb");
+    if(!fi) {
+	static char warned = 0;
+	if(!warned) {
+	    msg("<warning> Couldn't write to %s cache directory %s", c->name, c->dir);
+	    warned = 1;
+	}
+    } else {
+	int ok = fwrite(c->magic, 8, 1, fi)==1;
+	put_u32(header, keylen);
+	ok &= fwrite(header, 4, 1, fi)==1;
+	ok &= fwrite(key, keylen, 1, fi)==1;
+	put_u32(header, len);
+	ok &= fwrite(header, 4, 1, fi)==1;
+	ok &= fwrite(data, len, 1, fi)==1;
+	ok &= fclose(fi)==0;
+	/* rename() is atomic, so other processes either see the old entry,
+	   no entry, or the complete new one */
+	if(!ok || rename(tmpname, filename)<0) {
+	    unlink(tmpname);
+	} else {
+	    msg("<verbose> Stored %s in cache entry %s (%d bytes)", c->name, filename, len);
+	}
+    }
+    free(tmpname);
+    free(filename);
+
+    evict(c);
+}
+
+void fontcache_setdir(const char*dir)
+{
+    cache_setdir(&fontcache, dir);
+}
+
+void fontcache_setmaxsize(int kbytes)
+{
+    fontcache.max_kbytes = kbytes;
+}
+
+char fontcache_enabled()
+{
+    return fontcache.dir!=0;
+}
+
+void fontcache_store(const void*key, int keylen, gfxfont_t*font, double scale)
+{
+    if(!fontcache.dir)
+	return;
+
+    writer_t w;
+    writer_init_growingmemwriter(&w, 4096);
+    writer_writeDouble(&w, scale);
+    writer_writeDouble(&w, font->ascent);
+    writer_writeDouble(&w, font->descent);
+    writer_writeU32(&w, font->num_glyphs);
+    int t;
+    for(t=0;t<font->num_glyphs;t++) {
+	gfxglyph_t*g = &font->glyphs[t];
+	writer_writeU32(&w, g->unicode);
+	writer_writeDouble(&w, g->advance);
+	write_line(&w, g->line);
+    }
+    int len = 0;
+    void*data = writer_growmemwrite_memptr(&w, &len);
+    cache_write(&fontcache, key, keylen, data, len);
+    w.finish(&w);
+}
+
+void pagecache_setdir(const char*dir)
+{
+    cache_setdir(&pagecache, dir);
+}
+
+void pagecache_setmaxsize(int kbytes)
+{
+    pagecache.max_kbytes = kbytes;
+}
+
+char pagecache_enabled()
+{
+    return pagecache.dir!=0;
+}
+
+void* pagecache_load(const void*key, int keylen, int*pos, int*len)
+{
+    return cache_read(&pagecache, key, keylen, pos, len);
+}
+
+void pagecache_store(const void*key, int keylen, const void*data, int len)
+{
+    if(!pagecache.dir)
+	return;
+    cache_write(&pagecache, key, keylen, data, len);
+}
+
+void pagecache_remove(const void*key, int keylen)
+{
+    cache_remove(&pagecache, key, keylen);
+}
@@ -0,0 +1,56 @@
+/* fontcache.h
+   On-disk cache for converted pdf fonts and pages.
+
+   This file is part of swftools.
+
+   Swftools is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   Swftools is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with swftools; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __fontcache_h__
+#define __fontcache_h__
+
+#include "../gfxdevice.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The cache is disabled until a directory is set. Entries are identified by an
+   arbitrary binary key (the caller serializes everything the conversion depends
+   on into it). The key is stored with the entry and compared on load, so hash
+   collisions result in cache misses, never in wrong fonts. */
+void fontcache_setdir(const char*dir);
+void fontcache_setmaxsize(int kbytes);
+char fontcache_enabled();
+
+gfxfont_t* fontcache_load(const void*key, int keylen, double*scale);
+void fontcache_store(const void*key, int keylen, gfxfont_t*font, double scale);
+
+/* The page cache works the same way, but stores arbitrary data (the recorded
+   output of a page). pagecache_load() returns the whole entry, which has to be
+   free()d, with the data starting at offset *pos. */
+void pagecache_setdir(const char*dir);
+void pagecache_setmaxsize(int kbytes);
+char pagecache_enabled();
+
+void* pagecache_load(const void*key, int keylen, int*pos, int*len);
+void pagecache_store(const void*key, int keylen, const void*data, int len);
+/* delete an entry which turned out to be unusable */
+void pagecache_remove(const void*key, int keylen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__fontcache_h__
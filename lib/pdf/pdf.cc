@@ -3,7 +3,11 @@
 #include "../gfxdevice.h"
 #include "../gfxsource.h"
 #include "../devices/rescale.h"
+#include "../devices/record.h"
 #include "../log.h"
+#include "../stats.h"
+#include "../q.h"
+#include "../bitio.h"
 #include "../../config.h"
 #ifdef HAVE_POPPLER
   #include <poppler-config.h>
@@ -18,6 +22,7 @@
 #include "VectorGraphicOutputDev.h"
 #include "../mem.h"
 #include "pdf.h"
+#include "fontcache.h"
 #define NO_ARGPARSER
 #include "../args.h"
 #include "../utf8.h"
@@ -67,6 +72,9 @@ typedef struct _pdf_doc_internal
     int pagemap_size;
     int pagemap_pos;
 
+    /* page cache */
+    dict_t*stream_digests;
+
     gfxsource_t*parent;
 } pdf_doc_internal_t;
 
@@ -102,13 +110,264 @@ void pdfpage_destroy(gfxpage_t*pdf_page)
     free(pdf_page);pdf_page=0;
 }
 
-static void render2(gfxpage_t*page, gfxdevice_t*dev, int x,int y, int x1,int y1,int x2,int y2)
+/* The page cache stores the recorded output of a page (see devices/record.c),
+   keyed by everything the conversion of the page depends on: the page's
+   objects (content streams, resources, annotations and everything they
+   reference), the fonts as collected by the InfoOutputDev (the glyph numbering
+   of a font depends on all the pages using it), and the conversion settings.
+   Stream data is only stored as a digest in the key, everything else is
+   stored as is. */
+
+typedef struct _streamdigest {
+    int gen;
+    U64 h[2];
+} streamdigest_t;
+
+typedef struct _pagekey {
+    writer_t*w;
+    pdf_doc_internal_t*pi;
+    dict_t*visited;
+    char ok;
+} pagekey_t;
+
+static void key_object(pagekey_t*k, Object*obj, int depth);
+
+static void key_dict(pagekey_t*k, Dict*dict, int depth)
+{
+    int t;
+    writer_writeU8(k->w, 'd');
+    writer_writeU32(k->w, dict->getLength());
+    for(t=0;t<dict->getLength();t++) {
+	char*key = dict->getKey(t);
+	writer_writeString(k->w, key);
+	/* don't walk up the page tree, that would add all other pages */
+	if(!strcmp(key, "Parent"))
+	    continue;
+	Object obj;
+	dict->getValNF(t, &obj);
+	key_object(k, &obj, depth+1);
+	obj.free();
+    }
+}
+
+static void stream_digest(Stream*str, U64*h)
+{
+    unsigned char buf[4096];
+    int len = 0, c;
+    h[0] = 0;
+    h[1] = 0x5bd1e995;
+    str->reset();
+    do {
+	c = str->getChar();
+	if(c != EOF)
+	    buf[len++] = c;
+	if(len == sizeof(buf) || (c == EOF && len)) {
+	    h[0] = memory_hash64(buf, len, h[0]);
+	    h[1] = memory_hash64(buf, len, h[1]);
+	    len = 0;
+	}
+    } while(c != EOF);
+    str->close();
+}
+
+static void key_stream(pagekey_t*k, Object*obj, Ref*ref, int depth)
+{
+    key_dict(k, obj->streamGetDict(), depth);
+    writer_writeU8(k->w, 'S');
+    if(!ref) {
+	U64 h[2];
+	stream_digest(obj->getStream()->getUndecodedStream(), h);
+	k->w->write(k->w, h, sizeof(h));
+	return;
+    }
+    /* fonts and images are usually shared between pages, so we remember
+       the digests of all the streams we have seen in this document */
+    streamdigest_t*d = (streamdigest_t*)dict_lookup(k->pi->stream_digests, (void*)(ptroff_t)ref->num);
+    if(!d) {
+	d = (streamdigest_t*)malloc(sizeof(streamdigest_t));
+	d->gen = -1;
+	dict_put(k->pi->stream_digests, (void*)(ptroff_t)ref->num, d);
+    }
+    if(d->gen != ref->gen) {
+	stream_digest(obj->getStream()->getUndecodedStream(), d->h);
+	d->gen = ref->gen;
+    }
+    k->w->write(k->w, d->h, sizeof(d->h));
+}
+
+static void key_ref(pagekey_t*k, Ref ref, int depth)
+{
+    writer_writeU8(k->w, 'R');
+    writer_writeU32(k->w, ref.num);
+    writer_writeU32(k->w, ref.gen);
+    if(dict_contains(k->visited, (void*)(ptroff_t)ref.num))
+	return;
+    dict_put(k->visited, (void*)(ptroff_t)ref.num, 0);
+
+    Object obj;
+    k->pi->doc->getXRef()->fetch(ref.num, ref.gen, &obj);
+    if(obj.isDict((char*)"Page")) {
+	/* for links, all that matters about another page is its number */
+	writer_writeU8(k->w, 'P');
+	writer_writeU32(k->w, k->pi->doc->getCatalog()->findPage(ref.num, ref.gen));
+    } else if(obj.isStream()) {
+	key_stream(k, &obj, &ref, depth);
+    } else {
+	key_object(k, &obj, depth);
+    }
+    obj.free();
+}
+
+static void key_object(pagekey_t*k, Object*obj, int depth)
+{
+    if(depth > 1000) {
+	/* we can't afford to miss anything, so don't cache this page */
+	k->ok = 0;
+	return;
+    }
+    int t;
+    switch(obj->getType()) {
+	case objBool:
+	    writer_writeU8(k->w, 'b');
+	    writer_writeU8(k->w, obj->getBool());
+	    break;
+	case objInt:
+	    writer_writeU8(k->w, 'i');
+	    writer_writeU32(k->w, obj->getInt());
+	    break;
+	case objReal:
+	    writer_writeU8(k->w, 'f');
+	    writer_writeDouble(k->w, obj->getReal());
+	    break;
+	case objString:
+	    writer_writeU8(k->w, 's');
+	    writer_writeU32(k->w, obj->getString()->getLength());
+	    k->w->write(k->w, obj->getString()->getCString(), obj->getString()->getLength());
+	    break;
+	case objName:
+	    writer_writeU8(k->w, 'n');
+	    writer_writeString(k->w, obj->getName());
+	    break;
+	case objArray:
+	    writer_writeU8(k->w, 'a');
+	    writer_writeU32(k->w, obj->arrayGetLength());
+	    for(t=0;t<obj->arrayGetLength();t++) {
+		Object o;
+		obj->arrayGetNF(t, &o);
+		key_object(k, &o, depth+1);
+		o.free();
+	    }
+	    break;
+	case objDict:
+	    key_dict(k, obj->getDict(), depth);
+	    break;
+	case objStream:
+	    key_stream(k, obj, 0, depth);
+	    break;
+	case objRef:
+	    key_ref(k, obj->getRef(), depth);
+	    break;
+	default:
+	    writer_writeU8(k->w, '0'+obj->getType());
+	    break;
+    }
+}
+
+static void key_rect(writer_t*w, PDFRectangle*r)
+{
+    writer_writeDouble(w, r->x1);
+    writer_writeDouble(w, r->y1);
+    writer_writeDouble(w, r->x2);
+    writer_writeDouble(w, r->y2);
+}
+
+static char page_cachekey(gfxpage_t*page, writer_t*w, int x,int y, int x1,int y1,int x2,int y2)
 {
     pdf_doc_internal_t*pi = (pdf_doc_internal_t*)page->parent->internal;
     gfxsource_internal_t*i = (gfxsource_internal_t*)pi->parent->internal;
+    Catalog*catalog = pi->doc->getCatalog();
+    Page*p = catalog->getPage(page->nr);
+
+    writer_writeU32(w, 2); // key format version
+    /* the output of a given page might change with every release, and
+       the recording format along with it */
+    writer_writeString(w, VERSION);
+    writer_writeU32(w, RECORD_VERSION);
+    writer_writeU8(w, pi->config_bitmap_optimizing);
+    writer_writeU8(w, pi->config_full_bitmap_optimizing);
+    writer_writeU8(w, pi->config_only_text);
+    writer_writeU8(w, pi->config_print);
+    writer_writeDouble(w, zoom);
+    writer_writeDouble(w, multiply);
+    writer_writeU32(w, x);
+    writer_writeU32(w, y);
+    writer_writeU32(w, x1);
+    writer_writeU32(w, y1);
+    writer_writeU32(w, x2);
+    writer_writeU32(w, y2);
+    gfxparam_t*param;
+    for(param=i->parameters->params;param;param=param->next) {
+	writer_writeString(w, param->key);
+	writer_writeString(w, param->value);
+    }
+    writer_writeU8(w, 0);
+    for(param=pi->parameters->params;param;param=param->next) {
+	writer_writeString(w, param->key);
+	writer_writeString(w, param->value);
+    }
+    writer_writeU8(w, 0);
 
-    if(!pi->config_print && pi->nocopy) {msg("<fatal> PDF disallows copying");exit(0);}
-    if(pi->config_print && pi->noprint) {msg("<fatal> PDF disallows printing");exit(0);}
+    pagekey_t k;
+    k.w = w;
+    k.pi = pi;
+    k.ok = 1;
+    k.visited = dict_new2(&int_type);
+
+    /* the page dictionary itself, and its inherited attributes */
+    Ref*ref = catalog->getPageRef(page->nr);
+    Object obj;
+    dict_put(k.visited, (void*)(ptroff_t)ref->num, 0);
+    if(pi->doc->getXRef()->fetch(ref->num, ref->gen, &obj)->isDict()) {
+	key_dict(&k, obj.getDict(), 0);
+    } else {
+	k.ok = 0;
+    }
+    obj.free();
+    Dict*resources = p->getResourceDict();
+    if(resources) {
+	key_dict(&k, resources, 0);
+    } else {
+	writer_writeU8(w, 0);
+    }
+    key_rect(w, p->getMediaBox());
+    key_rect(w, p->getCropBox());
+    writer_writeU32(w, p->getRotate());
+
+    pi->info->writePageKey(page->nr, w);
+
+    /* links depend on the page numbering, and might use named destinations */
+    Object annots;
+    if(!p->getAnnots(&annots)->isNull()) {
+	writer_writeU32(w, page->nr);
+	int t;
+	writer_writeU32(w, pi->pagemap_pos);
+	for(t=0;t<=pi->pagemap_pos && t<pi->pagemap_size;t++) {
+	    writer_writeU32(w, pi->pagemap[t]);
+	}
+	key_object(&k, catalog->getDests(), 0);
+	key_object(&k, catalog->getNameTree(), 0);
+	key_object(&k, catalog->getAcroForm(), 0);
+    }
+    annots.free();
+
+    dict_destroy(k.visited);
+    return k.ok;
+}
+
+static void render_page(gfxpage_t*page, gfxdevice_t*dev, int x,int y, int x1,int y1,int x2,int y2)
+{
+    pdf_doc_internal_t*pi = (pdf_doc_internal_t*)page->parent->internal;
+    gfxsource_internal_t*i = (gfxsource_internal_t*)pi->parent->internal;
 
     CommonOutputDev*outputDev = 0;
     if(pi->config_full_bitmap_optimizing) {
@@ -137,6 +396,81 @@ static void render2(gfxpage_t*page, gfxdevice_t*dev, int x,int y, int x1,int y1,
 	p = p->next;
     }
 
+    outputDev->setDevice(dev);
+    stats_timer_t timer;
+    stats_timer_start(&timer, "pdf.render");
+    pi->doc->processLinks((OutputDev*)outputDev, page->nr);
+    pi->doc->displayPage((OutputDev*)outputDev, page->nr, zoom*multiply, zoom*multiply, /*rotate*/0, true, true, pi->config_print);
+    outputDev->finishPage();
+    stats_timer_stop(&timer);
+    outputDev->setDevice(0);
+    delete outputDev;
+}
+
+static void render_page_cached(gfxpage_t*page, gfxdevice_t*dev, int x,int y, int x1,int y1,int x2,int y2)
+{
+    pdf_doc_internal_t*pi = (pdf_doc_internal_t*)page->parent->internal;
+
+    writer_t w;
+    writer_init_growingmemwriter(&w, 4096);
+    stats_timer_t timer;
+    stats_timer_start(&timer, "pdf.pagekey");
+    char ok = page_cachekey(page, &w, x, y, x1, y1, x2, y2);
+    stats_timer_stop(&timer);
+    if(!ok) {
+	w.finish(&w);
+	render_page(page, dev, x, y, x1, y1, x2, y2);
+	return;
+    }
+    int keylen = 0;
+    void*key = writer_growmemwrite_memptr(&w, &keylen);
+
+    /* the fonts are the same for all pages, so the recording only refers
+       to them by id */
+    gfxfontlist_t*fonts = 0;
+    if(!pi->config_full_bitmap_optimizing) {
+	fontinfolist_t*l;
+	for(l=pi->info->getPageFonts(page->nr);l;l=l->next) {
+	    fonts = gfxfontlist_addfont(fonts, l->font->getGfxFont());
+	}
+    }
+
+    int pos = 0, len = 0;
+    char replayed = 0;
+    unsigned char*data = (unsigned char*)pagecache_load(key, keylen, &pos, &len);
+    if(data) {
+	msg("<verbose> Replaying page %d from the page cache", page->nr);
+	replayed = gfxresult_record_replay_memory(data+pos, len, dev, &fonts);
+	free(data);
+	if(!replayed) {
+	    msg("<warning> Page cache entry for page %d is broken, rendering the page again", page->nr);
+	    pagecache_remove(key, keylen);
+	}
+    }
+    if(!replayed) {
+	gfxdevice_t recorder;
+	gfxdevice_record_init(&recorder, 0);
+	gfxdevice_record_setexternalfonts(&recorder, fonts);
+	render_page(page, &recorder, x, y, x1, y1, x2, y2);
+	gfxresult_t*result = recorder.finish(&recorder);
+	gfxresult_record_replay(result, dev, &fonts);
+	void*recording = result->get(result, "data");
+	int*length = (int*)result->get(result, "length");
+	pagecache_store(key, keylen, recording, *length);
+	result->destroy(result);
+    }
+    /* fonts which weren't known in advance are still used by the output device */
+    gfxfontlist_free(fonts, 0);
+    w.finish(&w);
+}
+
+static void render2(gfxpage_t*page, gfxdevice_t*dev, int x,int y, int x1,int y1,int x2,int y2)
+{
+    pdf_doc_internal_t*pi = (pdf_doc_internal_t*)page->parent->internal;
+
+    if(!pi->config_print && pi->nocopy) {msg("<fatal> PDF disallows copying");exit(0);}
+    if(pi->config_print && pi->noprint) {msg("<fatal> PDF disallows printing");exit(0);}
+
     gfxdevice_t* middev=0;
     if(multiply!=1.0) {
     	middev = (gfxdevice_t*)malloc(sizeof(gfxdevice_t));
@@ -159,12 +493,11 @@ static void render2(gfxpage_t*page, gfxdevice_t*dev, int x,int y, int x1,int y1,
         dev->setparameter(dev, "protect", "1");
     }
 
-    outputDev->setDevice(dev);
-    pi->doc->processLinks((OutputDev*)outputDev, page->nr);
-    pi->doc->displayPage((OutputDev*)outputDev, page->nr, zoom*multiply, zoom*multiply, /*rotate*/0, true, true, pi->config_print);
-    outputDev->finishPage();
-    outputDev->setDevice(0);
-    delete outputDev;
+    if(pagecache_enabled()) {
+	render_page_cached(page, dev, x, y, x1, y1, x2, y2);
+    } else {
+	render_page(page, dev, x, y, x1, y1, x2, y2);
+    }
 
     if(middev) {
 	gfxdevice_rescale_setdevice(middev, 0x00000000);
@@ -212,6 +545,13 @@ void pdf_doc_destroy(gfxdocument_t*gfx)
 	free(i->pagemap);
     }
 
+    if(i->stream_digests) {
+	DICT_ITERATE_DATA(i->stream_digests, streamdigest_t*, d) {
+	    free(d);
+	}
+	dict_destroy(i->stream_digests);i->stream_digests = 0;
+    }
+
     i->docinfo.free();
 
     if(i->filename) {
@@ -442,6 +782,17 @@ static void pdf_setparameter(gfxsource_t*src, const char*name, const char*value)
 	config_bigchar = atoi(value);
     } else if(!strcmp(name, "pages")) {
 	global_page_range = strdup(value);
+    } else if(!strcmp(name, "fontcache")) {
+	fontcache_setdir(value);
+    } else if(!strcmp(name, "fontcachesize")) {
+	fontcache_setmaxsize(atoi(value));
+    } else if(!strcmp(name, "pagecache")) {
+	pagecache_setdir(value);
+    } else if(!strcmp(name, "pagecachesize")) {
+	pagecache_setmaxsize(atoi(value));
+    } else if(!strcmp(name, "preloadfonts")) {
+	if(atoi(value))
+	    ((GFXGlobalParams*)globalParams)->preloadFonts();
     } else if(!strncmp(name, "font", strlen("font")) && name[4]!='q') {
 	addGlobalFont(value);
     } else if(!strncmp(name, "languagedir", strlen("languagedir"))) {
@@ -461,6 +812,11 @@ static void pdf_setparameter(gfxsource_t*src, const char*name, const char*value)
 	printf("\nPDF device global parameters:\n");
 	printf("fontdir=<dir>     a directory with additional fonts\n");
 	printf("font=<filename>   an additional font filename\n");
+	printf("fontcache=<dir>   cache converted fonts in <dir>, for reuse by later runs\n");
+	printf("fontcachesize=<kb> maximum size of the font cache (default: 65536)\n");
+	printf("pagecache=<dir>   cache converted pages in <dir>, only pages which changed are converted again\n");
+	printf("pagecachesize=<kb> maximum size of the page cache (default: 262144)\n");
+	printf("preloadfonts      set up the standard fonts and fontconfig now, instead of on first use\n");
 	printf("pages=<range>     the range of pages to convert (example: pages=1-100,210-)\n");
 	printf("zoom=<dpi>        the resultion (default: 72)\n");
 	printf("languagedir=<dir> Add an xpdf language directory\n");
@@ -485,6 +841,7 @@ static gfxdocument_t*pdf_open(gfxsource_t*src, const char*filename)
     memset(i, 0, sizeof(pdf_doc_internal_t));
     i->parent = src;
     i->parameters = gfxparams_new();
+    i->stream_digests = dict_new2(&int_type);
     pdf_doc->internal = i;
     char*userPassword=0;
     
@@ -504,7 +861,10 @@ static gfxdocument_t*pdf_open(gfxsource_t*src, const char*filename)
     } else {
       i->userPW = NULL;
     }
+    stats_timer_t timer;
+    stats_timer_start(&timer, "pdf.parse");
     i->doc = new PDFDoc(i->fileName, i->userPW);
+    stats_timer_stop(&timer);
     if (!i->doc->isOk()) {
         return 0;
     }
@@ -539,8 +899,10 @@ static gfxdocument_t*pdf_open(gfxsource_t*src, const char*filename)
     memset(i->pages,0,sizeof(pdf_page_info_t)*pdf_doc->num_pages);
     for(t=1;t<=pdf_doc->num_pages;t++) {
 	if(!global_page_range || is_in_range(t, global_page_range)) {
+	    stats_timer_start(&timer, "pdf.info");
 	    i->doc->displayPage((OutputDev*)i->info, t, zoom, zoom, /*rotate*/0, /*usemediabox*/true, /*crop*/true, i->config_print);
 	    i->doc->processLinks((OutputDev*)i->info, t);
+	    stats_timer_stop(&timer);
 	    i->pages[t-1].xMin = i->info->x1;
 	    i->pages[t-1].yMin = i->info->y1;
 	    i->pages[t-1].xMax = i->info->x2;
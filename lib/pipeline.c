@@ -0,0 +1,141 @@
+/* pipeline.c
+   Ordered producer/consumer pipeline, for decoding input files
+   ahead of a serial writer.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include "../config.h"
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#include "mem.h"
+#include "pipeline.h"
+
+struct _pipeline {
+    int num;
+    int window;
+    pipeline_func_t func;
+    void*user;
+
+    void**result;
+    char*done;
+#ifdef HAVE_PTHREAD_H
+    int numthreads;
+    pthread_t*threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready; // an item was finished
+    pthread_cond_t space; // the consumer advanced
+    int next;     // the next item to hand to a worker
+    int consumed; // the number of items fetched by the consumer
+    char stop;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_H
+static void* worker(void*_p)
+{
+    pipeline_t*p = (pipeline_t*)_p;
+    pthread_mutex_lock(&p->mutex);
+    while(1) {
+	while(!p->stop && p->next < p->num && p->next >= p->consumed + p->window)
+	    pthread_cond_wait(&p->space, &p->mutex);
+	if(p->stop || p->next >= p->num)
+	    break;
+	int nr = p->next++;
+	pthread_mutex_unlock(&p->mutex);
+
+	void*result = p->func(nr, p->user);
+
+	pthread_mutex_lock(&p->mutex);
+	p->result[nr] = result;
+	p->done[nr] = 1;
+	pthread_cond_broadcast(&p->ready);
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return 0;
+}
+#endif
+
+pipeline_t* pipeline_new(int num, int numjobs, int window, pipeline_func_t func, void*user)
+{
+    pipeline_t*p = (pipeline_t*)rfx_calloc(sizeof(pipeline_t));
+    p->num = num;
+    p->window = window>numjobs ? window : numjobs;
+    p->func = func;
+    p->user = user;
+#ifdef HAVE_PTHREAD_H
+    if(numjobs > num)
+	numjobs = num;
+    if(numjobs > 1) {
+	p->result = (void**)rfx_calloc(sizeof(void*)*num);
+	p->done = (char*)rfx_calloc(num);
+	pthread_mutex_init(&p->mutex, 0);
+	pthread_cond_init(&p->ready, 0);
+	pthread_cond_init(&p->space, 0);
+	p->threads = (pthread_t*)rfx_calloc(sizeof(pthread_t)*numjobs);
+	int t;
+	for(t=0;t<numjobs;t++) {
+	    if(pthread_create(&p->threads[t], 0, worker, p))
+		break;
+	}
+	p->numthreads = t;
+    }
+#endif
+    return p;
+}
+
+void* pipeline_get(pipeline_t*p, int nr)
+{
+#ifdef HAVE_PTHREAD_H
+    if(p->numthreads) {
+	pthread_mutex_lock(&p->mutex);
+	while(!p->done[nr])
+	    pthread_cond_wait(&p->ready, &p->mutex);
+	void*result = p->result[nr];
+	p->result[nr] = 0;
+	p->consumed = nr+1;
+	pthread_cond_broadcast(&p->space);
+	pthread_mutex_unlock(&p->mutex);
+	return result;
+    }
+#endif
+    return p->func(nr, p->user);
+}
+
+void pipeline_destroy(pipeline_t*p)
+{
+#ifdef HAVE_PTHREAD_H
+    if(p->threads) {
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->space);
+	pthread_mutex_unlock(&p->mutex);
+	int t;
+	for(t=0;t<p->numthreads;t++) {
+	    pthread_join(p->threads[t], 0);
+	}
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->ready);
+	pthread_cond_destroy(&p->space);
+	free(p->threads);
+	free(p->result);
+	free(p->done);
+    }
+#endif
+    free(p);
+}
@@ -0,0 +1,47 @@
+/* pipeline.h
+   Header file for pipeline.c.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __pipeline_h__
+#define __pipeline_h__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Runs a function for the items 0..num-1 on a number of worker threads,
+   while the results are consumed in order by the calling thread.
+   Workers stay at most "window" items ahead of the consumer. */
+typedef struct _pipeline pipeline_t;
+
+typedef void* (*pipeline_func_t)(int nr, void*user);
+
+/* with numjobs<=1 (or without thread support), items are processed
+   on demand in pipeline_get() */
+pipeline_t* pipeline_new(int num, int numjobs, int window, pipeline_func_t func, void*user);
+
+/* wait for item nr and return its result. Items must be fetched in order. */
+void* pipeline_get(pipeline_t*p, int nr);
+
+void pipeline_destroy(pipeline_t*p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__pipeline_h__
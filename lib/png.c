@@ -24,6 +24,8 @@
 #include <fcntl.h>
 #include <zlib.h>
 #include <limits.h>
+#include "../config.h"
+#include "palette.h"
 
 #ifdef EXPORT
 #undef EXPORT
@@ -99,63 +101,64 @@ static int png_read_header(FILE*fi, struct png_header*header)
     unsigned char head[8] = {137,80,78,71,13,10,26,10};
     unsigned char head2[8];
     unsigned char*data;
-    fread(head2,8,1,fi);
+    if(!fread(head2,8,1,fi))
+	return 0;
     if(strncmp((const char*)head,(const char*)head2,4))
 	return 0; // not a png file
-    
-    while(png_read_chunk(&id, &len, &data, fi))
-    {
-	//printf("Chunk: %c%c%c%c (len:%d)\n", id[0],id[1],id[2],id[3], len);
-	if(!strncmp(id, "IHDR", 4)) {
-	    char a,b,c,f,i;
-	    if(len < 8) exit(1);
-	    header->width = data[0]<<24|data[1]<<16|data[2]<<8|data[3];
-	    header->height = data[4]<<24|data[5]<<16|data[6]<<8|data[7];
-	    a = data[8];      // should be 1,2,4,8,16 adapting to Image mode
-	    b = data[9];      // should be 3(indexed) or 2(rgb)
-
-	    c = data[10];     // compression mode (0)
-	    f = data[11];     // filter mode (0)
-	    i = data[12];     // interlace mode (0)
-
-	    if(b!=0 && b!=4 && b!=2 && b!=3 && b!=6) {
-		fprintf(stderr, "Image mode %d not supported!\n", b);
-		return 0;
-	    }
-	    // ColorType  Allowed Bit Depths  Interpretation
-	    //     0          1,2,4,8,16       grayscale            (PNG0)
-	    //     2          8,16             R,G,B triple         (PNG24)
-	    //     3          1,2,4,8          palette              (PNG8)
-	    //     4          8,16             grayscale, alpha (YA)
-	    //     6          8,16             R,G,B triple, alpha  (PNG32)
-	    if(a!=8) {
-		if(((b==2 || b==4 || b==6) && a!=16) ||  // YA, RGB, RGBA
-		   (b==3 && (a!=1 && a!=2 && a!=4)) ||   // palette
-		   (b==0 && (a!=1 && a!=2 && a!=4 && a!=16))) {  // grayscale
-		    fprintf(stderr, "Bpp %d in mode %d not supported!\n", a, b);
-		    return 0;
-		}
-	    }
-	    if(c!=0) {
-		printf("Compression mode %d not supported!\n", c);
-		return 0;
-	    }
-	    if(f!=0) {
-		printf("Filter mode %d not supported!\n", f);
-		return 0;
-	    }
-	    if(i!=0) {
-		printf("Interlace mode %d not supported!\n", i);
-		return 0;
+
+    /* IHDR is always the first chunk. We stop reading there, so that
+       the image data can be streamed from the current file position. */
+    if(!png_read_chunk(&id, &len, &data, fi))
+	return 0;
+    if(!strncmp(id, "IHDR", 4) && len >= 13) {
+	char a,b,c,f,i;
+	header->width = data[0]<<24|data[1]<<16|data[2]<<8|data[3];
+	header->height = data[4]<<24|data[5]<<16|data[6]<<8|data[7];
+	a = data[8];      // should be 1,2,4,8,16 adapting to Image mode
+	b = data[9];      // should be 3(indexed) or 2(rgb)
+
+	c = data[10];     // compression mode (0)
+	f = data[11];     // filter mode (0)
+	i = data[12];     // interlace mode (0)
+
+	ok = 1;
+	if(b!=0 && b!=4 && b!=2 && b!=3 && b!=6) {
+	    fprintf(stderr, "Image mode %d not supported!\n", b);
+	    ok = 0;
+	}
+	// ColorType  Allowed Bit Depths  Interpretation
+	//     0          1,2,4,8,16       grayscale            (PNG0)
+	//     2          8,16             R,G,B triple         (PNG24)
+	//     3          1,2,4,8          palette              (PNG8)
+	//     4          8,16             grayscale, alpha (YA)
+	//     6          8,16             R,G,B triple, alpha  (PNG32)
+	else if(a!=8) {
+	    if(((b==2 || b==4 || b==6) && a!=16) ||  // YA, RGB, RGBA
+	       (b==3 && (a!=1 && a!=2 && a!=4)) ||   // palette
+	       (b==0 && (a!=1 && a!=2 && a!=4 && a!=16))) {  // grayscale
+		fprintf(stderr, "Bpp %d in mode %d not supported!\n", a, b);
+		ok = 0;
 	    }
-	    //printf("%dx%d bpp:%d mode:%d comp:%d filter:%d interlace:%d\n",header->width, header->height, a,b,c,f,i);
-	    header->bpp = a;
-	    header->mode = b;
-	    ok = 1;
-	} 
-	
-	free(data);
+	}
+	if(c!=0) {
+	    printf("Compression mode %d not supported!\n", c);
+	    ok = 0;
+	}
+	if(f!=0) {
+	    printf("Filter mode %d not supported!\n", f);
+	    ok = 0;
+	}
+	if(i!=0) {
+	    printf("Interlace mode %d not supported!\n", i);
+	    ok = 0;
+	}
+	if(!header->width || !header->height)
+	    ok = 0;
+	//printf("%dx%d bpp:%d mode:%d comp:%d filter:%d interlace:%d\n",header->width, header->height, a,b,c,f,i);
+	header->bpp = a;
+	header->mode = b;
     }
+    free(data);
     return ok;
 }
 
@@ -177,197 +180,6 @@ static inline byte PaethPredictor (byte a,byte b,byte c)
         else return c;
 }
 
-static void applyfilter1(int mode, unsigned char*src, unsigned char*old, unsigned char*dest, unsigned width)
-{
-    int x;
-    unsigned char last=0;
-    unsigned char upperlast=0;
-
-    if(mode==0) {
-	for(x=0;x<width;x++) {
-	    *dest = *src;
-	    dest++;
-	    src++;
-	}
-    }
-    else if(mode==1) {
-	for(x=0;x<width;x++) {
-	    *dest = *src+last;
-	    last = *dest;
-	    dest++;
-	    src++;
-	}
-    }
-    else if(mode==2) {
-	for(x=0;x<width;x++) {
-	    *dest = *src+*old;
-	    dest++;
-	    old++;
-	    src++;
-	}
-    }
-    else if(mode==3) {
-	for(x=0;x<width;x++) {
-	    *dest = *src+(*old+last)/2;
-	    last = *dest;
-	    dest++;
-	    old++;
-	    src++;
-	}
-    }
-    else if(mode==4) {
-	for(x=0;x<width;x++) {
-	    *dest = *src+PaethPredictor(last,*old,upperlast);
-	    last = *dest;
-	    upperlast = *old;
-	    dest++;
-	    old++;
-	    src++;
-	}
-    }    
-
-}
-
-static void applyfilter2(int mode, unsigned char*src, unsigned char*old, unsigned char*dest, unsigned width)
-{
-    int x;
-    unsigned char lasta=0;
-    unsigned char lastb=0;
-    unsigned char upperlasta=0;
-    unsigned char upperlastb=0;
-
-    if(mode==0) {
-	for(x=0;x<width;x++) {
-	    dest[0] = src[0];
-	    dest[1] = src[1];
-	    dest+=2;
-	    src+=2;
-	}
-    }
-    else if(mode==1) {
-	for(x=0;x<width;x++) {
-	    dest[0] = src[0]+lasta;
-	    dest[1] = src[1]+lastb;
-	    lasta = dest[0];
-	    lastb = dest[1];
-	    dest+=2;
-	    src+=2;
-	}
-    }
-    else if(mode==2) {
-	for(x=0;x<width;x++) {
-	    dest[0] = src[0]+old[0];
-	    dest[1] = src[1]+old[1];
-	    dest+=2;
-	    old+=2;
-	    src+=2;
-	}
-    }
-    else if(mode==3) {
-	for(x=0;x<width;x++) {
-	    dest[0] = src[0]+(old[0]+lasta)/2;
-	    dest[1] = src[1]+(old[1]+lastb)/2;
-	    lasta = dest[0];
-	    lastb = dest[1];
-	    dest+=2;
-	    old+=2;
-	    src+=2;
-	}
-    }
-    else if(mode==4) {
-	for(x=0;x<width;x++) {
-	    dest[0] = src[0]+PaethPredictor(lasta,old[0],upperlasta);
-	    dest[1] = src[1]+PaethPredictor(lastb,old[1],upperlastb);
-	    lasta = dest[0];
-	    lastb = dest[1];
-	    upperlasta = old[0];
-	    upperlastb = old[1];
-	    dest+=2;
-	    old+=2;
-	    src+=2;
-	}
-    }    
-}
-
-
-/* also performs 24 bit conversion! */
-static void applyfilter3(int mode, unsigned char*src, unsigned char*old, unsigned char*dest, unsigned width)
-{
-    int x;
-    unsigned char lastr=0;
-    unsigned char lastg=0;
-    unsigned char lastb=0;
-    unsigned char upperlastr=0;
-    unsigned char upperlastg=0;
-    unsigned char upperlastb=0;
-
-    if(mode==0) {
-	for(x=0;x<width;x++) {
-	    dest[0] = 255;
-	    dest[1] = src[0];
-	    dest[2] = src[1];
-	    dest[3] = src[2];
-	    dest+=4;
-	    src+=3;
-	}
-    }
-    else if(mode==1) {
-	for(x=0;x<width;x++) {
-	    dest[0] = 255;
-	    dest[1] = src[0]+lastr;
-	    dest[2] = src[1]+lastg;
-	    dest[3] = src[2]+lastb;
-	    lastr = dest[1];
-	    lastg = dest[2];
-	    lastb = dest[3];
-	    dest+=4;
-	    src+=3;
-	}
-    }
-    else if(mode==2) {
-	for(x=0;x<width;x++) {
-	    dest[0] = 255;
-	    dest[1] = src[0]+old[1];
-	    dest[2] = src[1]+old[2];
-	    dest[3] = src[2]+old[3];
-	    dest+=4;
-	    old+=4;
-	    src+=3;
-	}
-    }
-    else if(mode==3) {
-	for(x=0;x<width;x++) {
-	    dest[0] = 255;
-	    dest[1] = src[0]+(old[1]+lastr)/2;
-	    dest[2] = src[1]+(old[2]+lastg)/2;
-	    dest[3] = src[2]+(old[3]+lastb)/2;
-	    lastr = dest[1];
-	    lastg = dest[2];
-	    lastb = dest[3];
-	    dest+=4;
-	    old+=4;
-	    src+=3;
-	}
-    }
-    else if(mode==4) {
-	for(x=0;x<width;x++) {
-	    dest[0] = 255;
-	    dest[1] = src[0]+PaethPredictor(lastr,old[1],upperlastr);
-	    dest[2] = src[1]+PaethPredictor(lastg,old[2],upperlastg);
-	    dest[3] = src[2]+PaethPredictor(lastb,old[3],upperlastb);
-	    lastr = dest[1];
-	    lastg = dest[2];
-	    lastb = dest[3];
-	    upperlastr = old[1];
-	    upperlastg = old[2];
-	    upperlastb = old[3];
-	    dest+=4;
-	    old+=4;
-	    src+=3;
-	}
-    }    
-}
-
 void png_inverse_filter_32(int mode, unsigned char*src, unsigned char*old, unsigned char*dest, unsigned width)
 {
     int x;
@@ -460,6 +272,7 @@ EXPORT int png_getdimensions(const char*sname, unsigned*destwidth, unsigned*dest
 	return 0;
     }
     if(!png_read_header(fi, &header)) {
+	fclose(fi);
 	return 0;
     }
 
@@ -469,581 +282,439 @@ EXPORT int png_getdimensions(const char*sname, unsigned*destwidth, unsigned*dest
     return 1;
 }
 
-EXPORT int png_load(const char*sname, unsigned*destwidth, unsigned*destheight, unsigned char**destdata)
+/* The image data is inflated from the IDAT chunks in blocks of 32k (small
+   enough to stay in the cache, but large enough for zlib's fast path), and
+   handed out one scanline at a time. We never keep more than two lines of
+   the uncompressed image in memory. */
+typedef struct _pngreader {
+    FILE*fi;
+    z_stream zs;
+    unsigned chunk_left; // bytes of the current IDAT chunk not read yet
+    char eof;
+    unsigned char*pos;   // unconsumed part of out[]
+    unsigned left;
+    unsigned char in[16384];
+    unsigned char out[32768];
+} pngreader_t;
+
+static int png_read_idat(pngreader_t*r)
 {
-    char tagid[4];
-    int len;
-    unsigned char*data;
-    unsigned char*imagedata;
-    unsigned char*zimagedata=0;
-    unsigned long int zimagedatalen=0;
-    unsigned char*palette = 0;
-    int palettelen = 0;
-    unsigned char*alphapalette = 0;
-    int alphapalettelen = 0;
-    struct png_header header;
-    int bypp;
-    unsigned char*data2 = 0;
-    unsigned char alphacolor[3];
-    int hasalphacolor=0;
-
-    FILE *fi;
-    unsigned char *scanline;
-
-    if ((fi = fopen(sname, "rb")) == NULL) {
-	fprintf(stderr, "Couldn't open %s\n", sname);
-	return 0;
+    while(!r->chunk_left) {
+	/* skip the crc of the previous chunk. (Not using fseek, that would
+	   discard the stdio buffer) */
+	unsigned char head[12];
+	if(!fread(head, 12, 1, r->fi) || strncmp((const char*)&head[8], "IDAT", 4))
+	    return 0;
+	r->chunk_left = head[4]<<24|head[5]<<16|head[6]<<8|head[7];
     }
-
-    if(!png_read_header(fi, &header)) {
-	fprintf(stderr, "Couldn't png read header %s\n", sname);
-	fclose(fi);
+    unsigned len = r->chunk_left < sizeof(r->in) ? r->chunk_left : sizeof(r->in);
+    if(!fread(r->in, len, 1, r->fi))
 	return 0;
-    }
+    r->chunk_left -= len;
+    r->zs.next_in = r->in;
+    r->zs.avail_in = len;
+    return 1;
+}
 
-    if(header.mode == 3 || header.mode == 0) bypp = 1;
-    else if(header.mode == 4) bypp = 2;
-    else if(header.mode == 2) bypp = 3;
-    else if(header.mode == 6) bypp = 4;
-    else {
-	fprintf(stderr, "ERROR: mode:%d\n", header.mode);
-	return 0;
+static int png_inflate_block(pngreader_t*r)
+{
+    r->zs.next_out = r->out;
+    r->zs.avail_out = sizeof(r->out);
+    while(r->zs.avail_out) {
+	if(!r->zs.avail_in && !r->eof && !png_read_idat(r))
+	    r->eof = 1;
+	int ret = inflate(&r->zs, Z_NO_FLUSH);
+	if(ret == Z_STREAM_END)
+	    break;
+	if(ret != Z_OK) {
+	    if(r->zs.avail_out < sizeof(r->out))
+		break; // return what we have, fail on the next call
+	    return 0;
+	}
     }
+    r->pos = r->out;
+    r->left = sizeof(r->out) - r->zs.avail_out;
+    return r->left > 0;
+}
 
-    unsigned long long imagedatalen_64 = ((unsigned long long)header.width + 1) * header.height * bypp + 1;
-    if(imagedatalen_64 > 0xffffffff)
-	return 0;
-    unsigned long imagedatalen = (unsigned long)imagedatalen_64;
-    imagedata = (unsigned char*)malloc(imagedatalen);
-    if (!imagedata) {
-	fprintf(stderr, "ERROR: malloc imagedatalen:%lu\n", imagedatalen);
-	return 0;
+static int png_read_line(pngreader_t*r, unsigned char*line, unsigned len)
+{
+    while(len) {
+	if(!r->left && !png_inflate_block(r))
+	    return 0;
+	unsigned l = len < r->left ? len : r->left;
+	memcpy(line, r->pos, l);
+	line += l;
+	len -= l;
+	r->pos += l;
+	r->left -= l;
     }
+    return 1;
+}
 
-    fseek(fi,8,SEEK_SET);
-    while(!feof(fi))
-    {
-	if(!png_read_chunk(&tagid, &len, &data, fi))
+static inline unsigned char png_paeth(int a, int b, int c)
+{
+    /* same as PaethPredictor(), but written so that the compiler can
+       use conditional moves instead of branches */
+    int pa = abs(b - c);
+    int pb = abs(a - c);
+    int pc = abs(a + b - c - c);
+    int min = pa, p = a;
+    if(pb < min) {min = pb; p = b;}
+    if(pc < min) p = c;
+    return p;
+}
+
+/* undo the filtering of one scanline, in place. bpp is the number of bytes
+   per pixel (at least 1), len is always a multiple of it. */
+static void png_unfilter_line_generic(int mode, unsigned char*cur, const unsigned char*prev, unsigned len, unsigned bpp)
+{
+    unsigned x;
+    switch(mode) {
+	case 1: // sub
+	    for(x=bpp;x<len;x++)
+		cur[x] += cur[x-bpp];
 	    break;
-	if(!strncmp(tagid, "IEND", 4)) {
+	case 3: // average
+	    for(x=0;x<bpp;x++)
+		cur[x] += prev[x]>>1;
+	    for(;x<len;x++)
+		cur[x] += (cur[x-bpp]+prev[x])>>1;
+	    break;
+	case 4: // paeth
+	    for(x=0;x<bpp;x++)
+		cur[x] += prev[x];
+	    for(;x<len;x++)
+		cur[x] += png_paeth(cur[x-bpp], prev[x], prev[x-bpp]);
 	    break;
-	}
-	if(!strncmp(tagid, "PLTE", 4)) {
-	    palette = data;
-	    palettelen = len/3;
-	    data = 0; //don't free data
-	    //printf("%d colors in palette\n", palettelen);
-	}
-	if(!strncmp(tagid, "tRNS", 4)) {
-	    if(header.mode == 3) {
-		if(!alphapalette) { // guard from redundant tRNS
-		    alphapalette = data;
-		    alphapalettelen = len;
-		    data = 0; //don't free data
-		}
-		//printf("found %d alpha colors\n", alphapalettelen);
-	    } else if(header.mode == 0 || header.mode == 2) {
-		int t;
-		if(header.mode == 2) {
-		    if(len > 5) {
-			alphacolor[0] = data[1];
-			alphacolor[1] = data[3];
-			alphacolor[2] = data[5];
-		    }
-		} else {
-		    if(len > 1) {
-			alphacolor[0] = alphacolor[1] = alphacolor[2] = data[1];
-		    }
-		}
-		hasalphacolor = 1;
-	    }
-	}
-	if(!strncmp(tagid, "IDAT", 4)) {
-	    if(!zimagedata) {
-		zimagedatalen = len;
-		zimagedata = (unsigned char*)malloc(len);
-		if(!zimagedata) {
-		    fprintf(stderr, "ERROR: malloc zimagedata len:%d\n", len);
-		    free(imagedata);
-		    free(alphapalette);
-		    return 0;
-		}
-		memcpy(zimagedata,data,len);
-	    } else {
-		zimagedata = (unsigned char*)realloc(zimagedata, zimagedatalen+len);
-		memcpy(&zimagedata[zimagedatalen], data, len);
-		zimagedatalen += len;
-	    }
-	}
-	if(!strncmp(tagid, "tEXt", 4)) {
-	    /*int t;
-	    printf("Image Text: ");
-	    for(t=0;t<len;t++) {
-		if(data[t]>=32 && data[t]<128)
-		    printf("%c", data[t]);
-		else
-		    printf("?");
-	    }
-	    printf("\n");*/
-	}
-	if(data) {
-	    free(data); data=0;
-        }
-    }
-    
-    fclose(fi);
-    if(!zimagedata || uncompress(imagedata, &imagedatalen, zimagedata, zimagedatalen) != Z_OK) {
-	fprintf(stderr, "Couldn't uncompress sname:%s!\n", sname);
-	free(imagedata);
-	free(zimagedata);
-	free(alphapalette);
-	return 0;
     }
-    free(zimagedata); zimagedata = 0;
-
-    *destwidth = header.width;
-    *destheight = header.height;
+}
 
-    unsigned long long alloclen_64 = (unsigned long long)header.width * header.height * 4;
-    if (alloclen_64 > 0xffffffffl) {
-	fprintf(stderr, "ERROR: alloclen_64:%llu > 0xffffffff\n", alloclen_64);
-	free(imagedata);
-	free(alphapalette);
-	return 0;
+/* undo the filtering of a scanline, in place */
+static void png_unfilter_line(int mode, unsigned char*cur, const unsigned char*prev, unsigned len, unsigned bpp)
+{
+    unsigned x;
+    if(mode == 2) { // up
+	/* add eight bytes at once, without carrying from one byte into the next */
+	for(x=0;x+8<=len;x+=8) {
+	    unsigned long long a,b;
+	    memcpy(&a, &cur[x], 8);
+	    memcpy(&b, &prev[x], 8);
+	    a = ((a&0x7f7f7f7f7f7f7f7full) + (b&0x7f7f7f7f7f7f7f7full)) ^ ((a^b)&0x8080808080808080ull);
+	    memcpy(&cur[x], &a, 8);
+	}
+	for(;x<len;x++)
+	    cur[x] += prev[x];
+    } else {
+	png_unfilter_line_generic(mode, cur, prev, len, bpp);
     }
-    data2 = (unsigned char*)malloc((size_t)alloclen_64);
-    if(!data2) {
-	fprintf(stderr, "ERROR: malloc alloclen_64:%d\n", len);
-	free(imagedata);
-	free(alphapalette);
-	return 0;
+}
+
+/* For 8 bit RGB and RGBA, unfiltering and the conversion to a,r,g,b are
+   done in one pass, with the already converted previous line as reference.
+   The left and upper left pixels are kept in registers, and the channels
+   of one pixel are independent of each other, so they can be computed in
+   parallel. */
+#define UNFILTER_PIXELS(f) \
+    for(x=0;x<width;x++,src+=bpp) { \
+	unsigned char b0 = prev[x].r, b1 = prev[x].g, b2 = prev[x].b, b3 = prev[x].a; \
+	l0 = src[0] + f(l0, b0, u0); \
+	l1 = src[1] + f(l1, b1, u1); \
+	l2 = src[2] + f(l2, b2, u2); \
+	if(bpp==4) \
+	l3 = src[3] + f(l3, b3, u3); \
+	u0 = b0; u1 = b1; u2 = b2; u3 = b3; \
+	dest[x].a = l3; dest[x].r = l0; dest[x].g = l1; dest[x].b = l2; \
+    }
+#define NONE(a,b,c) 0
+#define SUB(a,b,c) (a)
+#define UP(a,b,c) (b)
+#define AVERAGE(a,b,c) (((a)+(b))>>1)
+#define PAETH(a,b,c) png_paeth(a,b,c)
+
+static inline void png_unfilter_rgb_bpp(int mode, const unsigned char*src, const COL*prev, COL*dest, unsigned width, const unsigned bpp)
+{
+    unsigned x;
+    unsigned char l0=0,l1=0,l2=0,l3=bpp==4?0:255; // left (RGB is opaque)
+    unsigned char u0=0,u1=0,u2=0,u3=0; // upper left
+    switch(mode) {
+	case 1: UNFILTER_PIXELS(SUB);break;
+	case 2: UNFILTER_PIXELS(UP);break;
+	case 3: UNFILTER_PIXELS(AVERAGE);break;
+	case 4: UNFILTER_PIXELS(PAETH);break;
+	default: UNFILTER_PIXELS(NONE);break;
     }
+}
+#undef UNFILTER_PIXELS
+#undef NONE
+#undef SUB
+#undef UP
+#undef AVERAGE
+#undef PAETH
+
+static void png_unfilter_rgb(int mode, const unsigned char*src, const COL*prev, COL*dest, unsigned width, unsigned bpp)
+{
+    if(bpp == 4)
+	png_unfilter_rgb_bpp(mode, src, prev, dest, width, 4);
+    else
+	png_unfilter_rgb_bpp(mode, src, prev, dest, width, 3);
+}
 
-    if(header.mode == 4)
-    {
-	int i,s=0;
-	int x,y;
-	int pos=0;
-	unsigned char* old= (unsigned char*)malloc(header.width*2);
-	memset(old, 0, header.width*2);
-	*destdata = data2;
-	for(y=0;y<header.height;y++) {
-	    int mode = imagedata[pos++]; //filter mode
-	    unsigned char*src;
-	    unsigned char*dest;
-	    int x;
-	    dest = &data2[(y*header.width)*4];
-
-	    if(header.bpp == 8) {
-		/* one byte per pixel */
-		src = &imagedata[pos];
-		pos+=header.width*2;
-	    } else {
-		/* not implemented yet */
-		fprintf(stderr, "ERROR: mode=4 bpp:%d\n", header.bpp);
-		free(imagedata);
-		free(alphapalette);
-		free(data2);
-		*destdata = 0;
-		return 0;
+/* convert an unfiltered scanline into the a,r,g,b layout used by rfxswf */
+static void png_convert_line(struct png_header*header, const unsigned char*src, COL*dest, COL*palette, int hastrns, unsigned*trns)
+{
+    unsigned width = header->width;
+    unsigned x;
+    if(header->mode == 0 || header->mode == 3) {
+	if(header->bpp == 16) {
+	    for(x=0;x<width;x++) {
+		unsigned char gray = src[x*2];
+		dest[x].a = (hastrns && (src[x*2]<<8|src[x*2+1]) == trns[0]) ? 0 : 255;
+		dest[x].r = dest[x].g = dest[x].b = gray;
 	    }
-
-	    applyfilter2(mode, src, old, dest, header.width);
-	    memcpy(old, dest, header.width*2);
-
-	    for(x=header.width-1;x>=0;x--) {
-		unsigned char gray = dest[x*2+0];
-		unsigned char alpha = dest[x*2+1];
-		dest[x*4+0] = alpha;
-		dest[x*4+1] = gray;
-		dest[x*4+2] = gray;
-		dest[x*4+3] = gray;
+	} else if(header->bpp == 8) {
+	    for(x=0;x<width;x++) {
+		dest[x] = palette[src[x]];
 	    }
-	}
-	free(old);
-    } else if(header.mode == 6 || header.mode == 2) {
-	int i,s=0;
-	int x,y;
-	int pos=0;
-	*destdata = data2;
-	
-	unsigned char* firstline = malloc(header.width*4);
-	if(!firstline) {
-		fprintf(stderr, "ERROR: malloc firstline width*4:%d\n", header.width*4);
-		free(imagedata);
-		free(data2);
-		free(alphapalette);
-		free(firstline);
-		*destdata = 0;
-		return 0;
-	}
-	memset(firstline,0,header.width*4);
-	for(y=0;y<header.height;y++) {
-	    int mode = imagedata[pos++]; //filter mode
-	    unsigned char*src;
-	    unsigned char*dest;
-	    unsigned char*old;
-	    dest = &data2[(y*header.width)*4];
-
-	    if(header.bpp == 8)
-	    {
-		/* one byte per pixel */
-		src = &imagedata[pos];
-		pos+=header.width*(header.mode==6?4:3);
-	    } else {
-		/* not implemented yet */
-		fprintf(stderr, "ERROR: bpp:%d\n", header.bpp);
-		free(imagedata);
-		free(data2);
-		free(alphapalette);
-		free(firstline);
-		*destdata = 0;
-		return 0;
+	} else {
+	    int bits = header->bpp;
+	    int mask = (1<<bits)-1;
+	    unsigned s = 0;
+	    for(x=0;x<width;x++) {
+		dest[x] = palette[(src[s>>3] >> (8-bits-(s&7))) & mask];
+		s += bits;
 	    }
-
-	    if(!y) {
-		old = firstline;
+	}
+    } else if(header->mode == 2 && header->bpp == 8 && !hastrns) {
+	for(x=0;x<width;x++) {
+	    const unsigned char*p = &src[x*3];
+	    dest[x].a = 255;
+	    dest[x].r = p[0];
+	    dest[x].g = p[1];
+	    dest[x].b = p[2];
+	}
+    } else if(header->mode == 2) {
+	int step = header->bpp == 16 ? 2 : 1;
+	for(x=0;x<width;x++) {
+	    const unsigned char*p = &src[x*3*step];
+	    if(hastrns && (step==1 ?
+	       (p[0] == trns[0] && p[1] == trns[1] && p[2] == trns[2]) :
+	       ((p[0]<<8|p[1]) == trns[0] && (p[2]<<8|p[3]) == trns[1] && (p[4]<<8|p[5]) == trns[2]))) {
+		*(u32*)&dest[x] = 0;
 	    } else {
-		old = &data2[(y-1)*header.width*4];
-	    }
-	    if(header.mode == 6) { 
-		png_inverse_filter_32(mode, src, old, dest, header.width);
-	    } else { // header.mode = 2
-		applyfilter3(mode, src, old, dest, header.width);
-		/* replace alpha color */
-		if(hasalphacolor) {
-		    int x;
-		    for(x=0;x<header.width;x++) {
-			if(dest[x*4+1] == alphacolor[0] &&
-			   dest[x*4+2] == alphacolor[1] &&
-			   dest[x*4+3] == alphacolor[2]) {
-			    *(u32*)&dest[x*4] = 0;
-			}
-		    }
-		}
+		dest[x].a = 255;
+		dest[x].r = p[0];
+		dest[x].g = p[step];
+		dest[x].b = p[step*2];
 	    }
 	}
-	free(firstline);
-    } else if(header.mode == 0 || header.mode == 3) {
-	COL*rgba = 0;
-	unsigned char*tmpline = (unsigned char*)malloc(header.width+1);
-	unsigned char*destline = (unsigned char*)malloc(header.width+1);
-	int i,x,y;
-	int pos=0;
-	if(!tmpline || !destline) {
-	    free(imagedata);
-	    free(alphapalette);
-	    free(data2);
-	    free(tmpline);
-	    free(destline);
-	    return 0;
-	}
-	*destdata = data2;
-	
-	if(header.mode == 0) { // grayscale palette
-            int mult = (0x1ff>>header.bpp);
-	    palettelen = 1<<header.bpp;
-	    rgba = (COL*)malloc(palettelen*sizeof(COL));
-	    for(i=0;i<palettelen;i++) {
-		rgba[i].a = 255;
-		rgba[i].r = i*mult;
-		rgba[i].g = i*mult;
-		rgba[i].b = i*mult;
-		if(hasalphacolor) {
-		    if(rgba[i].r == alphacolor[0])
-			rgba[i].a = 0;
-		}
+    } else if(header->mode == 4) {
+	int step = header->bpp == 16 ? 2 : 1;
+	for(x=0;x<width;x++) {
+	    const unsigned char*p = &src[x*2*step];
+	    dest[x].a = p[step];
+	    dest[x].r = dest[x].g = dest[x].b = p[0];
+	}
+    } else if(header->mode == 6) {
+	if(header->bpp == 16) {
+	    for(x=0;x<width;x++) {
+		const unsigned char*p = &src[x*8];
+		dest[x].a = p[6];
+		dest[x].r = p[0];
+		dest[x].g = p[2];
+		dest[x].b = p[4];
 	    }
 	} else {
-	    if(!palette) {
-		fprintf(stderr, "Error: No palette found!\n");
-		free(imagedata);
-		free(alphapalette);
-		free(data2);
-		free(tmpline);
-		free(destline);
-		*destdata = 0;
-		return 0;
-	    }
-	    rgba = (COL*)malloc(palettelen*4);
-	    if(!rgba) {
-		free(imagedata);
-		free(alphapalette);
-		free(data2);
-		free(tmpline);
-		free(destline);
-		*destdata = 0;
-		return 0;
+#ifndef WORDS_BIGENDIAN
+	    /* r,g,b,a -> a,r,g,b is a rotation by one byte */
+	    for(x=0;x<width;x++) {
+		u32 v;
+		memcpy(&v, &src[x*4], 4);
+		v = v<<8 | v>>24;
+		memcpy(&dest[x], &v, 4);
 	    }
-	    /* 24->32 bit conversion */
-	    for(i=0;i<palettelen;i++) {
-		rgba[i].r = palette[i*3+0];
-		rgba[i].g = palette[i*3+1];
-		rgba[i].b = palette[i*3+2];
-		if(alphapalette && i<alphapalettelen) {
-		    rgba[i].a = alphapalette[i];
-		    /*rgba[i].r = ((int)rgba[i].r*rgba[i].a)/255;
-		    rgba[i].g = ((int)rgba[i].g*rgba[i].a)/255;
-		    rgba[i].b = ((int)rgba[i].b*rgba[i].a)/255;*/
-		} else {
-		    rgba[i].a = 255;
-		}
-		if(hasalphacolor) {
-		    if(rgba[i].r == alphacolor[0] &&
-		       rgba[i].g == alphacolor[1] &&
-		       rgba[i].b == alphacolor[2])
-			rgba[i].a = 0;
-		}
-	    }
-	}
-
-	for(y=0;y<header.height;y++) {
-	    int mode = imagedata[pos++]; //filter mode
-	    int x;
-	    unsigned char*old;
-	    unsigned char*src;
-	    src = &imagedata[pos];
-	    if(header.bpp == 8) {
-		pos+=header.width;
-	    } else {
-		int x,s=0;
-		int bitpos = 0;
-		u32 v = (1<<header.bpp)-1;
-		for(x=0;x<header.width;x++) {
-		    u32 r = src[s/8]<<8 | 
-			    src[s/8+1];
-		    int t;
-		    tmpline[x] = (r>>(16-header.bpp-(s&7)))&v;
-		    s+=header.bpp;
-		}
-		src = tmpline;
-		pos+=(header.width*header.bpp+7)/8;
-	    }
-
-	    if(!y) {
-		memset(destline,0,header.width);
-		old = &destline[y*header.width];
-	    } else {
-		old = tmpline;
-	    }
-	    applyfilter1(mode, src, old, destline, header.width);
-	    memcpy(tmpline,destline,header.width);
-	    for(x=0;x<header.width;x++) {
-		*(COL*)&data2[y*header.width*4+x*4+0] = rgba[destline[x]];
+#else
+	    for(x=0;x<width;x++) {
+		const unsigned char*p = &src[x*4];
+		dest[x].a = p[3];
+		dest[x].r = p[0];
+		dest[x].g = p[1];
+		dest[x].b = p[2];
 	    }
+#endif
 	}
-	free(tmpline);
-	free(destline);
-	free(rgba);
-    } else {
-	fprintf(stderr, "expected PNG mode to be 2, 3 or 6 (is:%d)\n", header.mode);
-	free(imagedata);
-	free(alphapalette);
-	free(data2);
-	*destdata = 0;
-	return 0;
     }
-
-    free(imagedata);
-    free(alphapalette);
-    return 1;
 }
 
-static char hasAlpha(unsigned char*_image, int size)
+EXPORT int png_load(const char*sname, unsigned*destwidth, unsigned*destheight, unsigned char**destdata)
 {
-    COL*image = (COL*)_image;
+    struct png_header header;
+    COL palette[256];
+    int palettelen = 0;
+    unsigned trns[3] = {0,0,0};
+    int hastrns = 0;
+    pngreader_t*r = 0;
+    unsigned char*lines = 0;
+    COL*empty = 0;
+    unsigned char*data2 = 0;
+    int channels;
+    int ok = 0;
     int t;
-    for(t=0;t<size;t++) {
-        if(image[t].a!=255)
-            return 1;
-    }
-    return 0;
-}
-
-typedef struct {
-    u32 num;
-    u32 color;
-} colornum_t;
+    unsigned y;
 
-static int compare_colors(const void*_c1, const void*_c2) {
-    colornum_t*c1 = (colornum_t*)_c1;
-    colornum_t*c2 = (colornum_t*)_c2;
-    return c2->num - c1->num;
-}
+    FILE *fi;
 
-static colornum_t* getColors(COL*image, int size, int*num)
-{
-    unsigned char*colexists = malloc((256*256*256)/8);
-    memset(colexists, 0, (256*256*256)/8);
-    int t;
-    int count=0;
-
-    /* find all different colors in the image */
-    for(t=0;t<size;t++) {
-        int index = (image[t].r)|(image[t].g)<<8|(image[t].b)<<16;
-        if(!(colexists[index/8]&(1<<(index&7)))) {
-            count++;
-            colexists[index/8]|=(1<<(index&7));
-        }
-    }
-    
-    /* now store them in an array */
-    colornum_t*colors=(colornum_t*)malloc(sizeof(colornum_t)*count);
-    int pos=0;
-    for(t=0;t<256*256*256;t++) {
-        if(colexists[t/8]&(1<<(t&7))) {
-            colors[pos].color = t;
-            colors[pos].num = 0;
-            pos++;
-        }
+    if ((fi = fopen(sname, "rb")) == NULL) {
+	fprintf(stderr, "Couldn't open %s\n", sname);
+	return 0;
     }
 
-    /* next, count how often each color occurs */
-    for(t=0;t<size;t++) {
-        int col = (image[t].r)|(image[t].g)<<8|(image[t].b)<<16;
-        int min,max,i,l;
-        for(min=0, max=count, i=count/2, l=count; i != l; l=i,i=(min+max)/2) {
-	    // binary search
-            if(colors[i].color >= col) max=i;
-            else min=i+1;
-        }
-        assert(colors[i].color==col);
-        colors[i].num++;
+    if(!png_read_header(fi, &header)) {
+	fprintf(stderr, "Couldn't png read header %s\n", sname);
+	fclose(fi);
+	return 0;
     }
-    free(colexists);
-    *num = count;
-    return colors;
-}
 
-static void getOptimalPalette(COL*image, int size, int palettesize, COL*palette)
-{
-    int num;
-    memset(palette, 0, sizeof(COL)*256);
-    colornum_t*colors = getColors(image, size, &num);
-
-    assert(palettesize<=256);
-
-    qsort(colors, num, sizeof(colornum_t), compare_colors);
-
-    if(num<=palettesize) {
-        /* if there are not more than palettesize different colors in 
-           the image anyway, we are done */
-        int t;
-        for(t=0;t<num;t++) {
-            palette[t].r = colors[t].color;
-            palette[t].g = colors[t].color>>8;
-            palette[t].b = colors[t].color>>16;
-            palette[t].a = 255;
-        }
-        return;
-    }
+    if(header.mode == 3 || header.mode == 0) channels = 1;
+    else if(header.mode == 4) channels = 2;
+    else if(header.mode == 2) channels = 3;
+    else channels = 4;
 
-    if(num>2048) {
-	/* if there are too many different colors, pick the ones that
-	   occur most often */
-	num = 2048;
+    unsigned bpp = (channels*header.bpp+7)/8;
+    unsigned long long linelen_64 = ((unsigned long long)header.width*channels*header.bpp+7)/8;
+    unsigned long long alloclen_64 = (unsigned long long)header.width * header.height * 4;
+    if(linelen_64 >= 0x7fffffff || alloclen_64 > 0xffffffffl) {
+	fprintf(stderr, "ERROR: image too large: %ux%u\n", header.width, header.height);
+	fclose(fi);
+	return 0;
     }
+    unsigned linelen = (unsigned)linelen_64;
 
-    colornum_t*centers = malloc(sizeof(colornum_t)*palettesize);
-    int t;
-    for(t=0;t<palettesize;t++) {
-        centers[t].color = colors[t].color;
+    memset(palette, 0, sizeof(palette));
+
+    /* read the chunks up to the first IDAT */
+    while(1) {
+	unsigned char head[8];
+	if(!fread(head, 8, 1, fi)) {
+	    fprintf(stderr, "Couldn't find image data in %s\n", sname);
+	    goto cleanup;
+	}
+	unsigned len = head[0]<<24|head[1]<<16|head[2]<<8|head[3];
+	char*tagid = (char*)&head[4];
+	if(!strncmp(tagid, "IDAT", 4)) {
+	    r = (pngreader_t*)calloc(1, sizeof(pngreader_t));
+	    r->fi = fi;
+	    r->chunk_left = len;
+	    break;
+	}
+	if(!strncmp(tagid, "IEND", 4)) {
+	    fprintf(stderr, "Couldn't find image data in %s\n", sname);
+	    goto cleanup;
+	}
+	if(strncmp(tagid, "PLTE", 4) && strncmp(tagid, "tRNS", 4)) {
+	    fseek(fi, len+4, SEEK_CUR);
+	    continue;
+	}
+	unsigned char*data = (unsigned char*)malloc(len+1);
+	if(!data || (len && !fread(data, len, 1, fi))) {
+	    fprintf(stderr, "ERROR: couldn't read chunk (len:%u) from %s\n", len, sname);
+	    free(data);
+	    goto cleanup;
+	}
+	fseek(fi, 4, SEEK_CUR);
+	if(!strncmp(tagid, "PLTE", 4)) {
+	    palettelen = len/3;
+	    if(palettelen > 256)
+		palettelen = 256;
+	    for(t=0;t<palettelen;t++) {
+		palette[t].a = 255;
+		palette[t].r = data[t*3+0];
+		palette[t].g = data[t*3+1];
+		palette[t].b = data[t*3+2];
+	    }
+	} else if(!hastrns) { // guard from redundant tRNS
+	    if(header.mode == 3) {
+		for(t=0;t<len && t<256;t++) {
+		    palette[t].a = data[t];
+		}
+	    } else if(header.mode == 2 && len >= 6) {
+		trns[0] = data[0]<<8|data[1];
+		trns[1] = data[2]<<8|data[3];
+		trns[2] = data[4]<<8|data[5];
+	    } else if(header.mode == 0 && len >= 2) {
+		trns[0] = data[0]<<8|data[1];
+	    }
+	    hastrns = 1;
+	}
+	free(data);
     }
-    unsigned char*belongsto = (unsigned char*)malloc(num);
-    memset(belongsto, 0, num);
-    /* do a k-means clustering on the colors */
-    char change = 1;
-    int tries = 0;
-    while(change) {
-        if(tries++ >= (palettesize+num)*2) {
-            fprintf(stderr, "Warning: didn't find optimal palette\n");
-            break;
-        }
-        change = 0;
-        int s,t;
-        for(s=0;s<palettesize;s++) {
-            centers[s].num = 0;
-        }
-        for(t=0;t<num;t++) {
-            int best=0x7fffffff;
-            int bestpos=0;
-            for(s=0;s<palettesize;s++) {
-                int distance = 0;
-                distance += abs((centers[s].color>>0&0xff) - (colors[t].color>>0&0xff));
-                distance += abs((centers[s].color>>8&0xff) - (colors[t].color>>8&0xff));
-                distance += abs((centers[s].color>>16&0xff) - (colors[t].color>>16&0xff));
-                distance *= colors[t].num;
-                if(distance<best) {
-                    best = distance;
-                    bestpos = s;
-                }
-            }
-            if(bestpos!=belongsto[t])
-                change = 1;
-            belongsto[t] = bestpos;
-        }
-        for(s=0;s<palettesize;s++) {
-            int r=0;
-            int g=0;
-            int b=0;
-            int count=0;
-            for(t=0;t<num;t++) {
-                if(belongsto[t]==s) {
-                    r += ((colors[t].color>>0)&0xff)*colors[t].num;
-                    g += ((colors[t].color>>8)&0xff)*colors[t].num;
-                    b += ((colors[t].color>>16)&0xff)*colors[t].num;
-                    count+=colors[t].num;
-                }
-            }
-            if(!count) {
-                int random = rand()%num;
-                centers[s].color = colors[random].color;
-                centers[s].num = 0;
-                change = 1;
-            } else {
-                r /= count;
-                g /= count;
-                b /= count;
-                centers[s].color = r|g<<8|b<<16;
-                centers[s].num = count;
-            }
-        }
+
+    if(header.mode == 3 && !palettelen) {
+	fprintf(stderr, "Error: No palette found!\n");
+	goto cleanup;
     }
-    free(belongsto);
-    free(colors);
-    for(t=0;t<palettesize;t++) {
-        palette[t].r = centers[t].color;
-        palette[t].g = centers[t].color>>8;
-        palette[t].b = centers[t].color>>16;
-        palette[t].a = 255;
+    if(header.mode == 0 && header.bpp <= 8) {
+	/* grayscale palette */
+	int num = 1<<header.bpp;
+	for(t=0;t<num;t++) {
+	    palette[t].a = (hastrns && t == trns[0]) ? 0 : 255;
+	    palette[t].r = palette[t].g = palette[t].b = t*255/(num-1);
+	}
     }
-    free(centers);
-}
 
-static int sqr(const int x) {return x*x;}
+    if(inflateInit(&r->zs) != Z_OK) {
+	free(r); r = 0;
+	goto cleanup;
+    }
 
-static void png_quantize_image(unsigned char*_image, int size, int numcolors, unsigned char**newimage, COL*palette) 
-{
-    COL*image = (COL*)_image;
-    getOptimalPalette(image, size, numcolors, palette);
-    *newimage = (unsigned char*)malloc(size);
-    int t;
-    for(t=0;t<size;t++) {
-        int best=0x7fffffff;
-        int bestcol = 0;
-        int s;
-        for(s=0;s<numcolors;s++) {
-            int distance = 0;
-            distance += sqr((palette[s].r) - (image[t].r))*5;
-            distance += sqr((palette[s].g) - (image[t].g))*6;
-            distance += sqr((palette[s].b) - (image[t].b))*4;
-            if(distance<best) {
-                best = distance;
-                bestcol = s;
-            }
-        }
-        (*newimage)[t] = bestcol;
+    data2 = (unsigned char*)malloc((size_t)alloclen_64);
+    /* two lines (the current and the previous one), each prefixed
+       with the filter byte */
+    lines = (unsigned char*)calloc(2, linelen+1);
+    if(!data2 || !lines) {
+	fprintf(stderr, "ERROR: malloc alloclen_64:%llu\n", alloclen_64);
+	goto cleanup;
+    }
+
+    /* for 8 bit RGB(A), the previous line is taken from the output image */
+    char rgb = header.bpp == 8 && (header.mode == 6 || (header.mode == 2 && !hastrns));
+    if(rgb) {
+	empty = (COL*)calloc(header.width, sizeof(COL));
+	if(!empty)
+	    goto cleanup;
+    }
+    for(y=0;y<header.height;y++) {
+	unsigned char*line = &lines[(y&1)*(linelen+1)];
+	unsigned char*prev = &lines[((y&1)^1)*(linelen+1)+1];
+	if(!png_read_line(r, line, linelen+1)) {
+	    fprintf(stderr, "Couldn't uncompress sname:%s!\n", sname);
+	    goto cleanup;
+	}
+	COL*dest = (COL*)&data2[(size_t)y*header.width*4];
+	if(rgb) {
+	    png_unfilter_rgb(line[0], &line[1], y ? dest - header.width : empty, dest, header.width, bpp);
+	} else {
+	    png_unfilter_line(line[0], &line[1], prev, linelen, bpp);
+	    png_convert_line(&header, &line[1], dest, palette, hastrns, trns);
+	}
     }
+
+    *destwidth = header.width;
+    *destheight = header.height;
+    *destdata = data2;
+    data2 = 0;
+    ok = 1;
+
+cleanup:
+    if(r) {
+	inflateEnd(&r->zs);
+	free(r);
+    }
+    free(lines);
+    free(empty);
+    free(data2);
+    fclose(fi);
+    return ok;
 }
 
 static u32 mycrc32;
@@ -1103,9 +774,8 @@ static void png_patch_len(FILE*fi, int pos, int len)
 }
 static void png_write_bytes(FILE*fi, unsigned char*bytes, int len)
 {
-    int t;
-    for(t=0;t<len;t++)
-	png_write_byte(fi,bytes[t]);
+    fwrite(bytes,len,1,fi);
+    mycrc32 = crc32(mycrc32^0xffffffff, bytes, len)^0xffffffff;
 }
 static void png_write_dword(FILE*fi, u32 dword)
 {
@@ -1227,129 +897,6 @@ static int finishzlib(z_stream*zs, FILE*fi)
     return size;
 }
 
-static inline u32 color_hash(COL*col)
-{
-    u32 col32 = *(u32*)col;
-    u32 hash = (col32 >> 17) ^ col32;
-    hash ^= ((hash>>8) + 1) ^ hash;
-    return hash;
-}
-
-static int png_get_number_of_palette_entries(COL*img, unsigned width, unsigned height, COL*palette, char*has_alpha)
-{
-    int len = width*height;
-    int t;
-    int palsize = 0;
-    int size[256];
-    int palette_overflow = 0;
-    u32 lastcol32 = 0;
-    
-    memset(size, 0, sizeof(size));
-
-    u32*pal = (u32*)malloc(65536*sizeof(u32));
-    int*count = (int*)malloc(65536*sizeof(int));
-
-    assert(sizeof(COL)==sizeof(u32));
-    assert(width && height);
-
-    lastcol32 = (*(u32*)&img[0])^0xffffffff; // don't match
-
-    for(t=0;t<len;t++) {
-	u32 col32 = *(u32*)&img[t];
-	if(col32 == lastcol32)
-	    continue;
-	
-	if(img[t].a!=255)
-	    *has_alpha=1;
-	int i;
-	
-	u32 hash = color_hash(&img[t])&255;
-
-	int csize = size[hash];
-	u32*cpal = &pal[hash*256];
-	int*ccount = &count[hash*256];
-	for(i=0;i<csize;i++) {
-	    if(col32 == cpal[i]) {
-		ccount[i]++;
-		break;
-	    }
-	}
-	if(i==csize) {
-	    if(palsize==256) {
-		palette_overflow = 1;
-		break;
-	    }
-	    count[size[hash]] = 1;
-	    cpal[size[hash]++] = col32;
-	    palsize++;
-	}
-	lastcol32 = col32;
-    }
-    if(palette_overflow) {
-	free(pal);
-	*has_alpha=1;
-	return width*height;
-    }
-    if(palette) {
-	int i = 0;
-	int occurences[256];
-	for(t=0;t<256;t++) {
-	    int s;
-	    int csize = size[t];
-	    u32* cpal = &pal[t*256];
-	    int* ccount = &count[t*256];
-	    for(s=0;s<csize;s++) {
-		occurences[i] = ccount[s];
-		palette[i++] = *(COL*)(&cpal[s]);
-	    }
-	}
-	assert(i==palsize);
-	int j;
-	for(i=0;i<palsize-1;i++) {
-	    for(j=i+1;j<palsize;j++) {
-		if(occurences[j] < occurences[i]) {
-		    int o = occurences[i];
-		    COL c = palette[i];
-		    occurences[i] = occurences[j];
-		    palette[i] = palette[j];
-		    occurences[j] = o;
-		    palette[j] = c;
-		}
-	    }
-	}
-    }
-    free(pal);
-    free(count);
-    return palsize;
-}
-
-static void png_map_to_palette(COL*src, unsigned char*dest, int size, COL*palette, int palette_size)
-{
-    int t;
-    int palette_hash[1024];
-    memset(palette_hash, 0, sizeof(int)*1024);
-    
-    for(t=0;t<palette_size;t++) {
-	u32 hash = color_hash(&palette[t])&1023;
-	while(palette_hash[hash])
-	    hash = (hash+1)&1023;
-	palette_hash[hash] = t;
-    }
-
-    for(t=0;t<size;t++) {
-	u32 hash = color_hash(&src[t]);
-	int index = 0;
-	while(1) {
-	    hash&=1023;
-	    index = palette_hash[hash];
-	    if(!memcmp(&palette[index], &src[t], sizeof(COL)))
-		break;
-	    hash++;
-	}
-	dest[t] = palette_hash[hash];
-    }
-}
-
 static int png_apply_specific_filter_8(int filtermode, unsigned char*dest, unsigned char*src, unsigned width)
 {
     int pos2 = 0;
@@ -1605,7 +1152,122 @@ int png_apply_filter_32(unsigned char*dest, unsigned char*src, unsigned width, i
     return png_apply_filter(dest, src, width, y, 32);
 }
 
-static void png_write_palette_based2(const char*filename, unsigned char*data, unsigned width, unsigned height, int numcolors, int compression)
+/* The functions below filter rows for the encoder. They work on rows of
+   bytes in PNG order (r,g,b,a or palette indices), with bpp bytes per
+   pixel. The previous row of the first line is all zeros. */
+
+#define LO7 0x7f7f7f7f7f7f7f7full
+#define HI1 0x8080808080808080ull
+
+/* byte-wise a-b and (a+b)>>1 of eight bytes, without carries
+   from one byte into the next */
+static inline unsigned long long png_sub8(unsigned long long a, unsigned long long b)
+{
+    return ((a|HI1) - (b&LO7)) ^ ((a^~b)&HI1);
+}
+static inline unsigned long long png_avg8(unsigned long long a, unsigned long long b)
+{
+    return (a&b) + (((a^b)>>1)&LO7);
+}
+static inline unsigned long long png_load8(const unsigned char*p)
+{
+    unsigned long long v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+/* apply one filter to a row. dest receives len bytes. */
+static void png_filter_line(int mode, unsigned char*dest, const unsigned char*cur, const unsigned char*prev, unsigned len, unsigned bpp)
+{
+    unsigned x = 0;
+    if(mode == 0) {
+	memcpy(dest, cur, len);
+	return;
+    }
+    /* the first pixel has no left neighbor */
+    for(;x<bpp && x<len;x++) {
+	switch(mode) {
+	    case 1: dest[x] = cur[x]; break;
+	    case 2: dest[x] = cur[x] - prev[x]; break;
+	    case 3: dest[x] = cur[x] - (prev[x]>>1); break;
+	    case 4: dest[x] = cur[x] - prev[x]; break;
+	}
+    }
+    if(mode != 4) {
+	for(;x+8<=len;x+=8) {
+	    unsigned long long c = png_load8(&cur[x]), p;
+	    if(mode == 1)
+		p = png_load8(&cur[x-bpp]);
+	    else if(mode == 2)
+		p = png_load8(&prev[x]);
+	    else
+		p = png_avg8(png_load8(&cur[x-bpp]), png_load8(&prev[x]));
+	    c = png_sub8(c, p);
+	    memcpy(&dest[x], &c, 8);
+	}
+    }
+    for(;x<len;x++) {
+	switch(mode) {
+	    case 1: dest[x] = cur[x] - cur[x-bpp]; break;
+	    case 2: dest[x] = cur[x] - prev[x]; break;
+	    case 3: dest[x] = cur[x] - ((cur[x-bpp] + prev[x])>>1); break;
+	    case 4: dest[x] = cur[x] - png_paeth(cur[x-bpp], prev[x], prev[x-bpp]); break;
+	}
+    }
+}
+
+/* Pick the filter which produces the fewest different (byte1,byte2)
+   pairs, as an approximation for zlib compressibility. Only pairs whose
+   first byte is a multiple of 8 are counted. This tends to favor
+   filters which produce many zero bytes, and in practice gives smaller
+   files than counting all pairs, or than the sum of absolute residuals
+   recommended by the PNG spec. */
+static int png_choose_filter(const unsigned char*cur, const unsigned char*prev, unsigned len, unsigned bpp, unsigned char*tmp)
+{
+    unsigned char seen[1024];
+    int f, best = 0, best_energy = INT_MAX;
+    for(f=0;f<5;f++) {
+	png_filter_line(f, tmp, cur, prev, len, bpp);
+	memset(seen, 0, sizeof(seen));
+	int energy = 0;
+	unsigned x;
+	for(x=1;x<len;x++) {
+	    if(tmp[x-1]&7)
+		continue;
+	    int v = tmp[x]<<5|tmp[x-1]>>3;
+	    int b = 1<<(v&7);
+	    if(!(seen[v>>3]&b)) {
+		seen[v>>3] |= b;
+		energy++;
+	    }
+	}
+	if(energy < best_energy) {
+	    best = f;
+	    best_energy = energy;
+	}
+    }
+    return best;
+}
+#undef LO7
+#undef HI1
+
+/* convert a line of a,r,g,b pixels to r,g,b,a bytes */
+static void png_col_to_rgba(const COL*src, unsigned char*dest, unsigned width)
+{
+    unsigned x;
+    for(x=0;x<width;x++) {
+	dest[x*4+0] = src[x].r;
+	dest[x*4+1] = src[x].g;
+	dest[x*4+2] = src[x].b;
+	dest[x*4+3] = src[x].a;
+    }
+}
+
+#define FILTER_NONE 0    // always use filter type 0
+#define FILTER_SAMPLED 1 // choose a filter on every 8th line, and keep it in between
+#define FILTER_PAIRS 2   // choose a filter on every line
+
+static void png_write_palette_based2(const char*filename, unsigned char*data, unsigned width, unsigned height, int numcolors, int compression, int filtering)
 {
     FILE*fi;
     int crc;
@@ -1632,25 +1294,35 @@ static void png_write_palette_based2(const char*filename, unsigned char*data, un
 	cols = 0;
 	format = 5;
     } else if(!numcolors) {
-	int num = png_get_number_of_palette_entries((COL*)data, width, height, palette, &has_alpha);
-	if(num<=255) {
-	    //printf("image has %d different colors (alpha=%d)\n", num, has_alpha);
-	    data2 = malloc(width*height);
-	    png_map_to_palette((COL*)data, data2, width*height, palette, num);
+	/* count the colors and map the pixels to the palette in one go */
+	palette_t pal;
+	data2 = malloc(width*height);
+	palette_analyze(data, width, height, 256, &pal, data2, width);
+	if(pal.num<=256) {
+	    //printf("image has %d different colors (alpha=%d)\n", pal.num, pal.transparent);
+	    memcpy(palette, pal.colors, pal.num*sizeof(COL));
+	    has_alpha = pal.transparent;
 	    data = data2;
 	    bpp = 8;
-	    cols = num;
+	    cols = pal.num;
 	    format = 3;
 	} else {
+	    free(data2);
+	    data2 = 0;
 	    bpp = 32;
 	    cols = 0;
 	    format = 5;
 	}
     } else {
-        bpp = 8;
-        cols = numcolors;
-        format = 3;
-        png_quantize_image(data, width*height, numcolors, &data, palette);
+	data2 = malloc(width*height);
+	cols = palette_quantize(data, width, height, numcolors, (U32*)palette, data2, width);
+	for(t=0;t<cols;t++) {
+	    if(palette[t].a!=255)
+		has_alpha = 1;
+	}
+	data = data2;
+	bpp = 8;
+	format = 3;
     }
 
     fi = fopen(filename, "wb");
@@ -1712,54 +1384,34 @@ static void png_write_palette_based2(const char*filename, unsigned char*data, un
 
     long idatsize = 0;
     {
-	int x,y;
-        int bypp = bpp/8;
+	int y;
+	int bypp = bpp/8;
 	unsigned srcwidth = width * bypp;
 	unsigned linelen = 1 + srcwidth;
-        if(bypp==2) 
-            linelen = 1 + ((srcwidth+1)&~1);
-        else if(bypp==3) 
-            linelen = 1 + ((srcwidth+2)/3)*3;
-        else if(bypp==4) 
-            linelen = 1 + ((srcwidth+3)&~3);
 	unsigned char* line = (unsigned char*)malloc(linelen);
-	memset(line, 0, linelen);
-#if 0
-	unsigned char* bestline = (unsigned char*)malloc(linelen);
-	memset(bestline, 0, linelen);
-	for(y=0;y<height;y++)
-	{
-	    int filtermode;
-	    int bestsize = 0x7fffffff;
-	    for(filtermode=0;filtermode<=4;filtermode++) {
-		if(!y && filtermode>=2)
-		    continue; // don't do y direction filters in the first row
-		
-		line[0]=filtermode; //filter type
-                if(bpp==8)
-		    png_apply_specific_filter_8(filtermode, line+1, &data[y*srcwidth], width);
-                else
-		    png_apply_specific_filter_32(filtermode, line+1, &data[y*srcwidth], width);
-
-		int size = test_line(&zs, line, linelen);
-		if(size < bestsize) {
-		    memcpy(bestline, line, linelen);
-		    bestsize = size;
-		}
-	    }
-	    idatsize += compress_line(&zs, bestline, linelen, fi);
-	}
-	free(bestline);
-#else
+	unsigned char* tmp = (unsigned char*)malloc(srcwidth);
+	/* the current and the previous line, in png byte order */
+	unsigned char* rows = (unsigned char*)calloc(3, srcwidth);
+	const unsigned char* prev = &rows[2*srcwidth];
+	int filter = 0;
 	for(y=0;y<height;y++) {
-            if(bpp==8)
-		line[0] = png_apply_filter_8(line+1, &data[y*srcwidth], width, y);
-            else
-		line[0] = png_apply_filter_32(line+1, &data[y*srcwidth], width, y);
-
+	    const unsigned char* cur;
+	    if(bpp==8) {
+		cur = &data[y*srcwidth];
+	    } else {
+		unsigned char* row = &rows[(y&1)*srcwidth];
+		png_col_to_rgba((COL*)&data[y*srcwidth], row, width);
+		cur = row;
+	    }
+	    if(filtering == FILTER_PAIRS || (filtering == FILTER_SAMPLED && !(y&7)))
+		filter = png_choose_filter(cur, prev, srcwidth, bypp, tmp);
+	    line[0] = filter;
+	    png_filter_line(filter, line+1, cur, prev, srcwidth, bypp);
 	    idatsize += compress_line(&zs, line, linelen, fi);
+	    prev = cur;
 	}
-#endif
+	free(rows);
+	free(tmp);
 	free(line);
     }
     idatsize += finishzlib(&zs, fi);
@@ -1777,17 +1429,68 @@ static void png_write_palette_based2(const char*filename, unsigned char*data, un
 
 EXPORT void png_write_palette_based(const char*filename, unsigned char*data, unsigned width, unsigned height, int numcolors)
 {
-    png_write_palette_based2(filename, data, width, height, numcolors, Z_BEST_COMPRESSION);
+    png_write_palette_based2(filename, data, width, height, numcolors, Z_BEST_COMPRESSION, FILTER_PAIRS);
 }
 EXPORT void png_write(const char*filename, unsigned char*data, unsigned width, unsigned height)
 {
-    png_write_palette_based2(filename, data, width, height, 0, Z_BEST_COMPRESSION);
+    png_write_palette_based2(filename, data, width, height, 0, Z_BEST_COMPRESSION, FILTER_PAIRS);
+}
+EXPORT int png_parse_preset(const char*name, png_preset_t*preset)
+{
+    if(!strcmp(name, "fast")) *preset = png_fast;
+    else if(!strcmp(name, "normal")) *preset = png_normal;
+    else if(!strcmp(name, "best")) *preset = png_best;
+    else return 0;
+    return 1;
+}
+EXPORT void png_write_preset(const char*filename, unsigned char*data, unsigned width, unsigned height, png_preset_t preset)
+{
+    switch(preset) {
+	case png_fast:
+	    png_write_palette_based2(filename, data, width, height, 0, Z_BEST_SPEED, FILTER_SAMPLED);
+	    break;
+	case png_normal:
+	    png_write_palette_based2(filename, data, width, height, 0, Z_DEFAULT_COMPRESSION, FILTER_PAIRS);
+	    break;
+	default:
+	    png_write_palette_based2(filename, data, width, height, 0, Z_BEST_COMPRESSION, FILTER_PAIRS);
+	    break;
+    }
 }
 EXPORT void png_write_quick(const char*filename, unsigned char*data, unsigned width, unsigned height)
 {
-    png_write_palette_based2(filename, data, width, height, 257, Z_NO_COMPRESSION);
+    png_write_palette_based2(filename, data, width, height, 257, Z_NO_COMPRESSION, FILTER_NONE);
 }
 EXPORT void png_write_palette_based_2(const char*filename, unsigned char*data, unsigned width, unsigned height)
 {
-    png_write_palette_based2(filename, data, width, height, 256, Z_BEST_COMPRESSION);
+    png_write_palette_based2(filename, data, width, height, 256, Z_BEST_COMPRESSION, FILTER_PAIRS);
+}
+
+#ifdef MAIN
+#include <time.h>
+/* decoding benchmark: compile with -DMAIN, and run with a list of png files */
+int main(int argn, char*argv[])
+{
+    int iterations = 20;
+    int t;
+    for(t=1;t<argn;t++) {
+	unsigned width=0, height=0;
+	unsigned char*data = 0;
+	int i;
+	clock_t start = clock();
+	for(i=0;i<iterations;i++) {
+	    if(!png_load(argv[t], &width, &height, &data))
+		break;
+	    free(data);
+	}
+	if(i<iterations) {
+	    fprintf(stderr, "Couldn't load %s\n", argv[t]);
+	    continue;
+	}
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC / iterations;
+	printf("%s: %dx%d, %.3f ms, %.1f MPixel/s\n", argv[t], width, height,
+		seconds*1000, seconds>0 ? width*(double)height/seconds/1000000 : 0);
+    }
+    return 0;
 }
+#endif
@@ -32,6 +32,12 @@ int png_getdimensions(const char*sname, unsigned*destwidth, unsigned*destheight)
 void png_write_palette_based(const char*filename, unsigned char*data, unsigned width, unsigned height, int numcolors);
 
 void png_write(const char*filename, unsigned char*data, unsigned width, unsigned height);
+
+/* speed/size tradeoff for png_write_preset(). png_write() is png_best. */
+typedef enum {png_fast, png_normal, png_best} png_preset_t;
+void png_write_preset(const char*filename, unsigned char*data, unsigned width, unsigned height, png_preset_t preset);
+/* parse "fast", "normal" or "best". Returns 0 for unknown names. */
+int png_parse_preset(const char*name, png_preset_t*preset);
 void png_write_quick(const char*filename, unsigned char*data, unsigned width, unsigned height);
 void png_write_palette_based_2(const char*filename, unsigned char*data, unsigned width, unsigned height);
 
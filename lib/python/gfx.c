@@ -51,16 +51,25 @@
 #define M_FLAGS (METH_KEYWORDS)
 #endif
 
+/* a lock which the thread holding it can acquire again, e.g. from a
+   PassThrough callback. owner and count are only touched with the GIL held. */
+typedef struct _gfxlock {
+    PyThread_type_lock lock;
+    unsigned long owner;
+    int count;
+} gfxlock_t;
+
 typedef struct _state {
     gfxsource_t*pdfdriver;
     gfxsource_t*swfdriver;
     gfxsource_t*imagedriver;
+    gfxlock_t*pdflock;
 } state_t;
 
 #ifdef PYTHON3
 #define STATE(m) ((state_t*)PyModule_GetState(m))
 #else
-static state_t global_state = {0,0,0};
+static state_t global_state = {0,0,0,0};
 #define STATE(m) &global_state;
 #endif
  
@@ -78,6 +87,7 @@ typedef struct {
     PyObject_HEAD
     gfxdevice_t*output_device;
     PyObject*pyobj; //only for passthrough
+    gfxlock_t*lock;
 } OutputObject;
 
 typedef struct {
@@ -92,6 +102,8 @@ typedef struct {
     gfxdocument_t*doc;
     char*filename;
     int page_pos;
+    gfxlock_t*lock;
+    char ownlock; // pdf documents share the lock of the pdf driver
 } DocObject;
 
 typedef struct {
@@ -122,6 +134,8 @@ typedef struct {
 typedef struct {
     PyObject_HEAD
     gfximage_t*image;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
 } BitmapObject;
 
 static char* strf(char*format, ...)
@@ -177,6 +191,57 @@ PyObject*forward_getattr(PyObject*self, char *a)
 #define PY_ERROR(s,args...) (PyErr_SetString(PyExc_Exception, strf(s, ## args)),(void*)NULL)
 #define PY_NONE Py_BuildValue("s", 0)
 
+/* Documents and output devices are not thread-safe, so each of them has a
+   lock which is held while native code works on it. (For pdf documents,
+   that's one lock for all of them, as xpdf has global state.) Long-running
+   calls release the GIL while holding the lock. The locks are reentrant:
+   a PassThrough device is called back with the locks of the document and
+   the output held, and may call into the module again. */
+static gfxlock_t* lock_new()
+{
+    gfxlock_t*l = (gfxlock_t*)malloc(sizeof(gfxlock_t));
+    l->lock = PyThread_allocate_lock();
+    l->owner = 0;
+    l->count = 0;
+    return l;
+}
+static void lock_free(gfxlock_t*l)
+{
+    PyThread_free_lock(l->lock);
+    free(l);
+}
+static void lock_acquire(gfxlock_t*l)
+{
+    unsigned long me = PyThread_get_thread_ident();
+    if(l->count && l->owner == me) {
+	l->count++;
+	return;
+    }
+    /* never wait for a lock while holding the GIL- the thread holding the
+       lock might need the GIL to call into a PassThrough device */
+    if(!PyThread_acquire_lock(l->lock, NOWAIT_LOCK)) {
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(l->lock, WAIT_LOCK);
+	Py_END_ALLOW_THREADS
+    }
+    l->owner = me;
+    l->count = 1;
+}
+static void lock_release(gfxlock_t*l)
+{
+    if(--l->count)
+	return;
+    l->owner = 0;
+    PyThread_release_lock(l->lock);
+}
+#define BEGIN_NATIVE(lock, allow_threads) \
+    lock_acquire(lock); \
+    { PyThreadState*_save = 0; \
+      if(allow_threads) {Py_UNBLOCK_THREADS}
+#define END_NATIVE(lock) \
+      if(_save) {Py_BLOCK_THREADS} } \
+    lock_release(lock);
+
 //---------------------------------------------------------------------
 PyDoc_STRVAR(output_save_doc, \
 "save(filename)\n\n"
@@ -195,13 +260,15 @@ static PyObject* output_save(PyObject* _self, PyObject* args, PyObject* kwargs)
     int ret;
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &filename))
 	return NULL;
+    if(!self->output_device)
+	return PY_ERROR("Output device was already saved");
 
-    Py_BEGIN_ALLOW_THREADS
+    BEGIN_NATIVE(self->lock, !self->pyobj);
     gfxresult_t*result = self->output_device->finish(self->output_device);
     self->output_device = 0;
     ret = result->save(result, filename);
     result->destroy(result);
-    Py_END_ALLOW_THREADS
+    END_NATIVE(self->lock);
     if(ret < 0) {
 	return PY_ERROR("Couldn't write to %s", filename);
     }
@@ -229,9 +296,9 @@ static PyObject* output_startpage(PyObject* _self, PyObject* args, PyObject* kwa
     int width=0, height=0;
     if (!PyArg_ParseTuple(args, "ii", &width, &height))
 	return NULL;
-    Py_BEGIN_ALLOW_THREADS
+    BEGIN_NATIVE(self->lock, !self->pyobj);
     self->output_device->startpage(self->output_device, width, height);
-    Py_END_ALLOW_THREADS
+    END_NATIVE(self->lock);
     return PY_NONE;
 }
 
@@ -334,7 +401,9 @@ static PyObject* output_fillbitmap(PyObject* _self, PyObject* args, PyObject* kw
     memset(&m, 0, sizeof(gfxmatrix_t));
     m.m00 = m.m11 = 1.0;
 
+    lock_acquire(self->lock);
     self->output_device->fillbitmap(self->output_device, line, image, &m, 0);
+    lock_release(self->lock);
     gfxline_free(line);
     return PY_NONE;
 }
@@ -372,7 +441,9 @@ static PyObject* output_fill(PyObject* _self, PyObject* args, PyObject* kwargs)
     memset(&m, 0, sizeof(gfxmatrix_t));
     m.m00 = m.m11 = 1.0;
 
+    lock_acquire(self->lock);
     self->output_device->fill(self->output_device, line, &c);
+    lock_release(self->lock);
     gfxline_free(line);
     return PY_NONE;
 }
@@ -406,8 +477,10 @@ static PyObject* output_stroke(PyObject* _self, PyObject* args, PyObject* kwargs
     if(!line) 
         return 0;
 
+    lock_acquire(self->lock);
     self->output_device->stroke(self->output_device, line, width, &c, 
             /*TODO*/ gfx_capRound, gfx_joinRound, 0.0);
+    lock_release(self->lock);
     gfxline_free(line);
     return PY_NONE;
 }
@@ -422,9 +495,9 @@ static PyObject* output_endpage(PyObject* _self, PyObject* args, PyObject* kwarg
     OutputObject* self = (OutputObject*)_self;
     if (!PyArg_ParseTuple(args, ""))
 	return NULL;
-    Py_BEGIN_ALLOW_THREADS
+    BEGIN_NATIVE(self->lock, !self->pyobj);
     self->output_device->endpage(self->output_device);
-    Py_END_ALLOW_THREADS
+    END_NATIVE(self->lock);
     return PY_NONE;
 }
 PyDoc_STRVAR(output_setparameter_doc, \
@@ -438,9 +511,21 @@ static PyObject* output_setparameter(PyObject* _self, PyObject* args, PyObject*
     char*key=0,*value=0;
     if (args && !PyArg_ParseTupleAndKeywords(args, kwargs, "ss", kwlist, &key, &value))
 	return NULL;
+    lock_acquire(self->lock);
     self->output_device->setparameter(self->output_device, key, value);
+    lock_release(self->lock);
     return PY_NONE;
 }
+static OutputObject* output_new()
+{
+    OutputObject*self = PyObject_New(OutputObject, &OutputClass);
+    self->output_device = (gfxdevice_t*)malloc(sizeof(gfxdevice_t));
+    memset(self->output_device, 0, sizeof(gfxdevice_t));
+    self->pyobj = 0;
+    self->lock = lock_new();
+    return self;
+}
+
 PyDoc_STRVAR(f_createSWF_doc, \
 "SWF()\n\n"
 "Creates a device which renders documents to SWF (Flash) files.\n"
@@ -453,9 +538,7 @@ static PyObject* f_createSWF(PyObject* module, PyObject* args, PyObject* kwargs)
     static char *kwlist[] = {NULL};
     if (args && !PyArg_ParseTupleAndKeywords(args, kwargs, "", kwlist))
 	return NULL;
-    OutputObject*self = PyObject_New(OutputObject, &OutputClass);
-    
-    self->output_device = (gfxdevice_t*)malloc(sizeof(gfxdevice_t));
+    OutputObject*self = output_new();
     gfxdevice_swf_init(self->output_device);
     return (PyObject*)self;
 }
@@ -472,9 +555,7 @@ static PyObject* f_createImageList(PyObject* module, PyObject* args, PyObject* k
     static char *kwlist[] = {NULL};
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "", kwlist))
 	return NULL;
-    OutputObject*self = PyObject_New(OutputObject, &OutputClass);
-    
-    self->output_device = (gfxdevice_t*)malloc(sizeof(gfxdevice_t));
+    OutputObject*self = output_new();
     gfxdevice_render_init(self->output_device);
     return (PyObject*)self;
 }
@@ -490,9 +571,7 @@ static PyObject* f_createPlainText(PyObject* module, PyObject* args, PyObject* k
     static char *kwlist[] = {NULL};
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "", kwlist))
 	return NULL;
-    OutputObject*self = PyObject_New(OutputObject, &OutputClass);
-    
-    self->output_device = (gfxdevice_t*)malloc(sizeof(gfxdevice_t));
+    OutputObject*self = output_new();
     gfxdevice_text_init(self->output_device);
     return (PyObject*)self;
 }
@@ -509,9 +588,7 @@ static PyObject* f_createOpenGL(PyObject* module, PyObject* args, PyObject* kwar
     static char *kwlist[] = {NULL};
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "", kwlist))
 	return NULL;
-    OutputObject*self = PyObject_New(OutputObject, &OutputClass);
-    
-    self->output_device = (gfxdevice_t*)malloc(sizeof(gfxdevice_t));
+    OutputObject*self = output_new();
     gfxdevice_opengl_init(self->output_device);
     return (PyObject*)self;
 }
@@ -586,6 +663,7 @@ static PyObject* convert_color(gfxcolor_t*col)
 static PyObject* lookup_font(gfxfont_t*font);
 static PyObject* char_new(gfxfont_t*font, int glyphnr, gfxcolor_t*color, gfxmatrix_t*matrix);
 static PyObject* create_bitmap(gfximage_t*img);
+static PyObject* bitmap_wrap(gfximage_t*img);
 
 static gfxfontlist_t* global_fonts;
 static char callback_python(char*function, gfxdevice_t*dev, const char*format, ...)
@@ -772,11 +850,9 @@ static gfxresult_t* my_finish(gfxdevice_t*dev)
 
 PyObject* passthrough_create(PyObject*obj)
 {
-    OutputObject*self = PyObject_New(OutputObject, &OutputClass);
+    OutputObject*self = output_new();
     self->pyobj = obj;
     Py_INCREF(obj);
-    self->output_device = (gfxdevice_t*)malloc(sizeof(gfxdevice_t));
-    memset(self->output_device, 0, sizeof(gfxdevice_t));
     self->output_device->name = strdup("passthrough");
 
     self->output_device->setparameter = my_setparameter;
@@ -847,6 +923,11 @@ static void output_dealloc(PyObject* _self) {
         }
         self->output_device = 0;
     }
+    if(self->pyobj) {
+	Py_DECREF(self->pyobj);
+	self->pyobj = 0;
+    }
+    lock_free(self->lock);
     
     PyObject_Del(self);
 }
@@ -872,7 +953,9 @@ static int output_setattr(PyObject * _self, char* a, PyObject * o)
     if(!pystring_check(o))
         return -1;
     const char*value = pystring_asstring(o);
+    lock_acquire(self->lock);
     self->output_device->setparameter(self->output_device, a, value);
+    lock_release(self->lock);
     return -1;
 }
 static int output_print(PyObject * _self, FILE *fi, int flags)
@@ -950,6 +1033,18 @@ static PyObject* lookup_font(gfxfont_t*font)
     Py_INCREF(fontobj);
     return fontobj;
 }
+/* the cached fonts belong to documents, and are freed together with them.
+   Called (with the GIL held) before a document is destroyed. */
+static void flush_fonts()
+{
+    gfxfontlist_t*l = global_fonts;
+    while(l) {
+	Py_DECREF((PyObject*)l->user);
+	l = l->next;
+    }
+    gfxfontlist_free(global_fonts, 0);
+    global_fonts = 0;
+}
 static PyObject* font_getattr(PyObject * _self, char* a)
 {
     FontObject*self = (FontObject*)_self;
@@ -1111,12 +1206,15 @@ static PyObject* page_render(PyObject* _self, PyObject* args, PyObject* kwargs)
 	    return NULL;
     }
 
-    Py_BEGIN_ALLOW_THREADS
+    DocObject*doc = (DocObject*)self->parent;
+    lock_acquire(doc->lock);
+    BEGIN_NATIVE(output->lock, !output->pyobj);
     if(x|y|cx1|cx2|cy1|cy2)
         self->page->rendersection(self->page, output->output_device,x,y,cx1,cy1,cx2,cy2);
     else
         self->page->render(self->page, output->output_device);
-    Py_END_ALLOW_THREADS
+    END_NATIVE(output->lock);
+    lock_release(doc->lock);
     return PY_NONE;
 }
 
@@ -1138,11 +1236,25 @@ static PyObject* page_draw(PyObject* _self, PyObject* args, PyObject* kwargs)
 	passthrough = passthrough_create(output);
 	output = passthrough;
     }
-    gfxdevice_t*device = ((OutputObject*)passthrough)->output_device;
+    OutputObject*out = (OutputObject*)output;
+    gfxdevice_t*device = out->output_device;
+    DocObject*doc = (DocObject*)self->parent;
+
+    lock_acquire(doc->lock);
+    if(!out->pyobj) {
+	BEGIN_NATIVE(out->lock, 1);
+	device->startpage(device, self->page->width, self->page->height);
+	self->page->render(self->page, device);
+	device->endpage(device);
+	END_NATIVE(out->lock);
+	lock_release(doc->lock);
+	return PY_NONE;
+    }
 
     if(setjmp(backjump)) {
 	/* exception in the code below*/
 	has_backjump = 0;
+	lock_release(doc->lock);
 	//FIXME: this clear the exception, for some reason
 	//if(passthrough) {
 	//    Py_DECREF(passthrough);
@@ -1154,6 +1266,7 @@ static PyObject* page_draw(PyObject* _self, PyObject* args, PyObject* kwargs)
     self->page->render(self->page, device);
     device->endpage(device);
     has_backjump = 0;
+    lock_release(doc->lock);
 
     if(passthrough) {
 	Py_DECREF(passthrough);
@@ -1161,12 +1274,38 @@ static PyObject* page_draw(PyObject* _self, PyObject* args, PyObject* kwargs)
     return PY_NONE;
 }
 
+/* render a page to a bitmap, with the GIL released */
+static gfximage_t* page_to_image(PageObject*self, int width, int height)
+{
+    DocObject*doc = (DocObject*)self->parent;
+    gfximage_t*img = 0;
+    BEGIN_NATIVE(doc->lock, 1);
+    gfxdevice_t dev1,dev2;
+    gfxdevice_render_init(&dev1);
+    dev1.setparameter(&dev1, "antialise", "2");
+    dev1.setparameter(&dev1, "fillwhite", "1");
+    gfxdevice_rescale_init(&dev2, &dev1, width, height, 0);
+    dev2.startpage(&dev2, self->page->width, self->page->height);
+    self->page->render(self->page, &dev2);
+    dev2.endpage(&dev2);
+    gfxresult_t*result = dev2.finish(&dev2);
+    gfximage_t*page0 = (gfximage_t*)result->get(result,"page0");
+    /* take the pixels out of the result, so that they survive destroy() */
+    img = (gfximage_t*)malloc(sizeof(gfximage_t));
+    *img = *page0;
+    page0->data = 0;
+    result->destroy(result); result=0;
+    END_NATIVE(doc->lock);
+    return img;
+}
+
 PyDoc_STRVAR(page_asImage_doc, \
 "asImage(width, height)\n\n"
 "Creates a bitmap from a page. The bitmap will be returned as a string\n"
 "containing RGB triplets. The bitmap will be rescaled to the specified width and\n"
 "height. The aspect ratio of width and height doesn't need to be the same\n"
 "as the page.\n"
+"Other threads keep running while the page is rendered.\n"
 );
 static PyObject* page_asImage(PyObject* _self, PyObject* args, PyObject* kwargs)
 {
@@ -1174,7 +1313,7 @@ static PyObject* page_asImage(PyObject* _self, PyObject* args, PyObject* kwargs)
     
     static char *kwlist[] = {"width", "height", "allow_threads", NULL};
     int width=0,height=0;
-    int allow_threads=0;
+    int allow_threads=1; // ignored, the GIL is always released
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|i", kwlist, &width, &height, &allow_threads))
 	return NULL;
 
@@ -1182,58 +1321,70 @@ static PyObject* page_asImage(PyObject* _self, PyObject* args, PyObject* kwargs)
 	return PY_ERROR("invalid dimensions: %dx%d", width,height);
     }
 
-    PyThreadState *_save=0;
-    if (allow_threads) {
-        Py_UNBLOCK_THREADS
-    }
-    gfxdevice_t dev1,dev2;
-    gfxdevice_render_init(&dev1);
-    dev1.setparameter(&dev1, "antialise", "2");
-    dev1.setparameter(&dev1, "fillwhite", "1");
-    gfxdevice_rescale_init(&dev2, &dev1, width, height, 0);
-    dev2.startpage(&dev2, self->page->width, self->page->height);
-    self->page->render(self->page, &dev2);
-    dev2.endpage(&dev2);
-    gfxresult_t*result = dev2.finish(&dev2);
-    gfximage_t*img = (gfximage_t*)result->get(result,"page0");
+    gfximage_t*img = page_to_image(self, width, height);
     int l = img->width*img->height;
     int ll = l*3;
-    unsigned char*data = (unsigned char*)malloc(ll);
-    int s,t;
-    for(t=0,s=0;t<l;s+=3,t++) {
-	data[s+0] = img->data[t].r;
-	data[s+1] = img->data[t].g;
-	data[s+2] = img->data[t].b;
-    }
-    result->destroy(result); result=0;
-    free(img->data); free(img);
 
+    /* convert directly into the string object */
     PyObject *ret;
 #ifdef PYTHON3
-    ret = PyByteArray_FromStringAndSize((char*)data,ll);
+    ret = PyByteArray_FromStringAndSize(0,ll);
+    unsigned char*data = ret?(unsigned char*)PyByteArray_AS_STRING(ret):0;
 #else
-    ret = PyString_FromStringAndSize((char*)data,ll);
+    ret = PyString_FromStringAndSize(0,ll);
+    unsigned char*data = ret?(unsigned char*)PyString_AS_STRING(ret):0;
 #endif
-    free(data);
-
-    if (allow_threads) {
-        Py_BLOCK_THREADS
+    if(data) {
+	Py_BEGIN_ALLOW_THREADS
+	int s,t;
+	for(t=0,s=0;t<l;s+=3,t++) {
+	    data[s+0] = img->data[t].r;
+	    data[s+1] = img->data[t].g;
+	    data[s+2] = img->data[t].b;
+	}
+	Py_END_ALLOW_THREADS
     }
+    free(img->data); free(img);
     return ret;
 }
 
+PyDoc_STRVAR(page_asBitmap_doc, \
+"asBitmap(width, height)\n\n"
+"Like asImage(), but returns a Bitmap object. Bitmaps support the\n"
+"buffer protocol, so the pixels can be accessed without copying them,\n"
+"e.g. via memoryview(bitmap).\n"
+);
+static PyObject* page_asBitmap(PyObject* _self, PyObject* args, PyObject* kwargs)
+{
+    PageObject* self = (PageObject*)_self; 
+    
+    static char *kwlist[] = {"width", "height", NULL};
+    int width=0,height=0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii", kwlist, &width, &height))
+	return NULL;
+
+    if(!width || !height) {
+	return PY_ERROR("invalid dimensions: %dx%d", width,height);
+    }
+    return bitmap_wrap(page_to_image(self, width, height));
+}
+
 static PyMethodDef page_methods[] =
 {
     /* Page functions */
     {"render", (PyCFunction)page_render, M_FLAGS, page_render_doc},
     {"draw", (PyCFunction)page_draw, M_FLAGS, page_draw_doc},
     {"asImage", (PyCFunction)page_asImage, M_FLAGS, page_asImage_doc},
+    {"asBitmap", (PyCFunction)page_asBitmap, M_FLAGS, page_asBitmap_doc},
     {0,0,0,0}
 };
 static void page_dealloc(PyObject* _self) {
     PageObject* self = (PageObject*)_self; 
     if(self->page) {
+	DocObject*doc = (DocObject*)self->parent;
+	lock_acquire(doc->lock);
         self->page->destroy(self->page);
+	lock_release(doc->lock);
         self->page=0;
     }
     if(self->parent) {
@@ -1288,11 +1439,14 @@ PyDoc_STRVAR(doc_getPage_doc,
 static PyObject*page_new(DocObject*doc, int pagenr)
 {
     PageObject*page = PyObject_New(PageObject, &PageClass);
+    BEGIN_NATIVE(doc->lock, 1);
     page->page = doc->doc->getpage(doc->doc, pagenr);
+    END_NATIVE(doc->lock);
     page->nr = pagenr;
     page->parent = (PyObject*)doc;
     Py_INCREF(page->parent);
     if(!page->page) {
+        Py_DECREF(page->parent);
         PyObject_Del(page);
         return PY_ERROR("Couldn't extract page %d", pagenr);
     }
@@ -1346,7 +1500,9 @@ static PyObject* doc_getInfo(PyObject* _self, PyObject* args, PyObject* kwargs)
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &key))
 	return NULL;
 
+    lock_acquire(self->lock);
     char*s = self->doc->getinfo(self->doc, key);
+    lock_release(self->lock);
     return pystring_fromstring(s);
 }
 
@@ -1366,7 +1522,9 @@ static PyObject* doc_setparameter(PyObject* _self, PyObject* args, PyObject* kwa
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss", kwlist, &key,&value))
 	return NULL;
 
+    lock_acquire(self->lock);
     self->doc->setparameter(self->doc, key, value);
+    lock_release(self->lock);
     return PY_NONE;
 }
 
@@ -1424,25 +1582,31 @@ static PyObject* f_open(PyObject* module, PyObject* args, PyObject* kwargs)
     }
    
     state_t*state = STATE(module);
+    gfxsource_t*driver = 0;
     if(!strcmp(type,"pdf")) {
-        Py_BEGIN_ALLOW_THREADS
-        self->doc = state->pdfdriver->open(state->pdfdriver,filename);
-        Py_END_ALLOW_THREADS
-    }
-    else if(!strcmp(type, "image") || !strcmp(type, "img")) {
-        Py_BEGIN_ALLOW_THREADS
-        self->doc = state->imagedriver->open(state->imagedriver, filename);
-        Py_END_ALLOW_THREADS
+	driver = state->pdfdriver;
+	self->lock = state->pdflock;
+	self->ownlock = 0;
+    } else if(!strcmp(type, "image") || !strcmp(type, "img")) {
+	driver = state->imagedriver;
+    } else if(!strcmp(type, "swf") || !strcmp(type, "SWF")) {
+	driver = state->swfdriver;
+    } else {
+        PyObject_Del(self);
+	return PY_ERROR("Unknown type %s", type);
     }
-    else if(!strcmp(type, "swf") || !strcmp(type, "SWF")) {
-        Py_BEGIN_ALLOW_THREADS
-        self->doc = state->swfdriver->open(state->imagedriver, filename);
-        Py_END_ALLOW_THREADS
+    if(driver != state->pdfdriver) {
+	self->lock = lock_new();
+	self->ownlock = 1;
     }
-    else
-	return PY_ERROR("Unknown type %s", type);
+
+    BEGIN_NATIVE(self->lock, 1);
+    self->doc = driver->open(driver, filename);
+    END_NATIVE(self->lock);
 
     if(!self->doc) {
+	if(self->ownlock)
+	    lock_free(self->lock);
         PyObject_Del(self);
         return PY_ERROR("Couldn't open %s", filename);
     }
@@ -1453,18 +1617,24 @@ static PyObject* f_open(PyObject* module, PyObject* args, PyObject* kwargs)
 static PyMethodDef doc_methods[] =
 {
     /* PDF functions */
-    {"getPage", (PyCFunction)doc_getPage, METH_KEYWORDS, doc_getPage_doc},
-    {"getInfo", (PyCFunction)doc_getInfo, METH_KEYWORDS, doc_getInfo_doc},
-    {"setparameter", (PyCFunction)doc_setparameter, METH_KEYWORDS, doc_setparameter_doc},
+    {"getPage", (PyCFunction)doc_getPage, M_FLAGS, doc_getPage_doc},
+    {"getInfo", (PyCFunction)doc_getInfo, M_FLAGS, doc_getInfo_doc},
+    {"setparameter", (PyCFunction)doc_setparameter, M_FLAGS, doc_setparameter_doc},
     {0,0,0,0}
 };
 
 static void doc_dealloc(PyObject* _self) {
     DocObject* self = (DocObject*)_self;
     if(self->doc) {
+	flush_fonts();
+	lock_acquire(self->lock);
         self->doc->destroy(self->doc);
+	lock_release(self->lock);
         self->doc=0;
     }
+    if(self->ownlock) {
+	lock_free(self->lock);
+    }
     if(self->filename) {
 	free(self->filename);self->filename=0;
     }
@@ -1569,8 +1739,8 @@ static PyObject* gfx_kdtree_find(PyObject* _self, PyObject* args, PyObject* kwar
 
 static PyMethodDef gfx_kdtree_methods[] =
 {
-    {"add_box", (PyCFunction)gfx_kdtree_add_box, METH_KEYWORDS, gfx_kdtree_add_box_doc},
-    {"find", (PyCFunction)gfx_kdtree_find, METH_KEYWORDS, gfx_kdtree_find_doc},
+    {"add_box", (PyCFunction)gfx_kdtree_add_box, M_FLAGS, gfx_kdtree_add_box_doc},
+    {"find", (PyCFunction)gfx_kdtree_find, M_FLAGS, gfx_kdtree_find_doc},
     {0,0,0,0}
 };
 
@@ -1580,13 +1750,27 @@ PyDoc_STRVAR(f_createBitmap_doc, \
 "Creates a Bitmap, which can be used to store bounding boxes\n"
 );
 static PyObject* create_bitmap(gfximage_t*img)
+{
+    gfximage_t*copy = malloc(sizeof(gfximage_t));
+    copy->data = malloc(sizeof(gfxcolor_t)*img->width*img->height);
+    memcpy(copy->data, img->data, sizeof(gfxcolor_t)*img->width*img->height);
+    copy->width = img->width;
+    copy->height = img->height;
+    copy->jpeg = 0;
+    copy->jpeg_size = 0;
+    return bitmap_wrap(copy);
+}
+/* create a bitmap object which takes ownership of img */
+static PyObject* bitmap_wrap(gfximage_t*img)
 {
     BitmapObject*self = PyObject_New(BitmapObject, &BitmapClass);
-    self->image = malloc(sizeof(gfximage_t));
-    self->image->data = malloc(sizeof(gfxcolor_t)*img->width*img->height);
-    memcpy(self->image->data, img->data, sizeof(gfxcolor_t)*img->width*img->height);
-    self->image->width = img->width;
-    self->image->height = img->height;
+    self->image = img;
+    self->shape[0] = img->height;
+    self->shape[1] = img->width;
+    self->shape[2] = sizeof(gfxcolor_t);
+    self->strides[0] = img->width*sizeof(gfxcolor_t);
+    self->strides[1] = sizeof(gfxcolor_t);
+    self->strides[2] = 1;
     return (PyObject*)self;
 }
 static void gfx_bitmap_dealloc(PyObject* _self) {
@@ -1614,12 +1798,14 @@ PyDoc_STRVAR(gfx_bitmap_save_png_doc,
 );
 static PyObject* gfx_bitmap_save_png(PyObject* _self, PyObject* args, PyObject* kwargs)
 {
-    ImageObject* self = (ImageObject*)_self;
+    BitmapObject* self = (BitmapObject*)_self;
     static char *kwlist[] = {"filename", NULL};
     char*filename=0;
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &filename))
 	return NULL;
+    Py_BEGIN_ALLOW_THREADS
     gfximage_save_png_quick(self->image, filename);
+    Py_END_ALLOW_THREADS
     return PY_NONE;
 }
 PyDoc_STRVAR(gfx_bitmap_save_jpeg_doc,
@@ -1628,13 +1814,15 @@ PyDoc_STRVAR(gfx_bitmap_save_jpeg_doc,
 );
 static PyObject* gfx_bitmap_save_jpeg(PyObject* _self, PyObject* args, PyObject* kwargs)
 {
-    ImageObject* self = (ImageObject*)_self;
+    BitmapObject* self = (BitmapObject*)_self;
     static char *kwlist[] = {"filename", "quality", NULL};
     char*filename=0;
     int quality=95;
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|i", kwlist, &filename, &quality))
 	return NULL;
+    Py_BEGIN_ALLOW_THREADS
     gfximage_save_jpeg(self->image, filename, quality);
+    Py_END_ALLOW_THREADS
     return PY_NONE;
 }
 static int gfx_bitmap_print(PyObject * _self, FILE *fi, int flags)
@@ -1643,10 +1831,30 @@ static int gfx_bitmap_print(PyObject * _self, FILE *fi, int flags)
     fprintf(fi, "<bitmap object at %p(%d)>", _self, _self?_self->ob_refcnt:0);
     return 0;
 }
+/* the buffer is the image data itself, as a height x width x 4 array
+   of bytes (alpha, red, green, blue) */
+static int gfx_bitmap_getbuffer(PyObject*_self, Py_buffer*view, int flags)
+{
+    BitmapObject*self = (BitmapObject*)_self;
+    gfximage_t*img = self->image;
+    if(PyBuffer_FillInfo(view, _self, img->data, sizeof(gfxcolor_t)*img->width*img->height, 0, flags) < 0)
+	return -1;
+    if(flags & PyBUF_ND) {
+	view->ndim = 3;
+	view->shape = self->shape;
+    }
+    if(flags & PyBUF_STRIDES) {
+	view->strides = self->strides;
+    }
+    return 0;
+}
+static PyBufferProcs gfx_bitmap_as_buffer = {
+    bf_getbuffer: gfx_bitmap_getbuffer,
+};
 static PyMethodDef gfx_bitmap_methods[] =
 {
-    {"save_png", (PyCFunction)gfx_bitmap_save_png, METH_KEYWORDS, gfx_bitmap_save_png_doc},
-    {"save_jpeg", (PyCFunction)gfx_bitmap_save_jpeg, METH_KEYWORDS, gfx_bitmap_save_jpeg_doc},
+    {"save_png", (PyCFunction)gfx_bitmap_save_png, M_FLAGS, gfx_bitmap_save_png_doc},
+    {"save_jpeg", (PyCFunction)gfx_bitmap_save_jpeg, M_FLAGS, gfx_bitmap_save_jpeg_doc},
     {0,0,0,0}
 };
 
@@ -1780,6 +1988,9 @@ static PyTypeObject CharClass =
 
 PyDoc_STRVAR(gfx_bitmap_doc,
 "A bitmap.\n"
+"Bitmaps support the buffer protocol: memoryview(bitmap) gives\n"
+"access to the pixels (a height x width x 4 array of alpha, red,\n"
+"green and blue bytes) without copying them.\n"
 );
 static PyTypeObject BitmapClass =
 {
@@ -1793,6 +2004,10 @@ static PyTypeObject BitmapClass =
     tp_setattr: gfx_bitmap_setattr,
     tp_doc: gfx_bitmap_doc,
     tp_methods: gfx_bitmap_methods,
+    tp_as_buffer: &gfx_bitmap_as_buffer,
+#ifndef PYTHON3
+    tp_flags: Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_NEWBUFFER,
+#endif
 };
 
 
@@ -1834,7 +2049,9 @@ static PyObject* f_setparameter(PyObject* module, PyObject* args, PyObject* kwar
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss", kwlist, &key, &value))
 	return NULL;
     state_t*state = STATE(module);
+    lock_acquire(state->pdflock);
     state->pdfdriver->setparameter(state->pdfdriver,key,value);
+    lock_release(state->pdflock);
     return PY_NONE;
 }
 
@@ -1875,7 +2092,9 @@ static PyObject* f_addfont(PyObject* module, PyObject* args, PyObject* kwargs)
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &filename))
 	return NULL;
     state_t*state = STATE(module);
+    lock_acquire(state->pdflock);
     state->pdfdriver->setparameter(state->pdfdriver,"font", filename);
+    lock_release(state->pdflock);
     return PY_NONE;
 }
 
@@ -1892,7 +2111,9 @@ static PyObject* f_addfontdir(PyObject* module, PyObject* args, PyObject* kwargs
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &filename))
 	return NULL;
     state_t*state = STATE(module);
+    lock_acquire(state->pdflock);
     state->pdfdriver->setparameter(state->pdfdriver,"fontdir", filename);
+    lock_release(state->pdflock);
     return PY_NONE;
 }
 
@@ -1938,6 +2159,8 @@ void gfx_free(void*module)
 	state->swfdriver->destroy(state->swfdriver);
     if(state->imagedriver && state->imagedriver->destroy)
 	state->imagedriver->destroy(state->imagedriver);
+    if(state->pdflock)
+	lock_free(state->pdflock);
     memset(state, 0, sizeof(state_t));
 }
 
@@ -1976,6 +2199,7 @@ PyObject * PyInit_gfx(void)
     state->pdfdriver = gfxsource_pdf_create();
     state->swfdriver = gfxsource_swf_create();
     state->imagedriver = gfxsource_image_create();
+    state->pdflock = lock_new();
 
     PyObject*module_dict = PyModule_GetDict(module);
     PyDict_SetItemString(module_dict, "Doc", (PyObject*)&DocClass);
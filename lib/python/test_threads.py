@@ -0,0 +1,182 @@
+#!/usr/bin/python
+#
+# test_threads.py
+#
+# Render pages from several threads at once- pages of one shared
+# document, pages of documents each thread opened itself, and into
+# shared and private outputs- and compare every bitmap with the one
+# rendered single-threaded beforehand. Also checks that rendering
+# releases the GIL, and that a PassThrough device can call back into
+# the module.
+#
+# Part of the swftools package.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+import sys
+import os
+import glob
+import hashlib
+import tempfile
+import threading
+import time
+from optparse import OptionParser
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gfx
+
+parser = OptionParser()
+parser.add_option("-t", "--threads", dest="threads", help="Number of threads", type="int", default=8)
+parser.add_option("-n", "--iterations", dest="iterations", help="Iterations per thread", type="int", default=4)
+parser.add_option("-d", "--dir", dest="dir", help="Directory with pdf files", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "../../spec"))
+parser.add_option("-v", "--verbose", dest="verbose", help="Print timings", action="store_true")
+(options, args) = parser.parse_args()
+
+WIDTH,HEIGHT = 120,90
+
+pdfs = sorted(glob.glob(os.path.join(options.dir, "*.pdf")))[:8]
+if not pdfs:
+    sys.stdout.write("no pdf files in %s\n" % options.dir)
+    sys.exit(1)
+
+def digest(bitmap):
+    return hashlib.md5(memoryview(bitmap).tobytes()).hexdigest()
+
+# an swf with a frame for every pdf page, for the swf reader (which
+# doesn't know buttons)
+swf = os.path.join(tempfile.mkdtemp(prefix="test_threads"), "pages.swf")
+output = gfx.SWF()
+output.setparameter("disablelinks", "1")
+for filename in pdfs:
+    doc = gfx.open("pdf", filename)
+    for nr in range(1, doc.pages+1):
+        page = doc.getPage(nr)
+        output.startpage(page.width, page.height)
+        page.render(output)
+        output.endpage()
+output.save(swf)
+
+# the reference bitmaps, rendered in one thread
+reference = {}
+for filename,type in [(f,"pdf") for f in pdfs] + [(swf,"swf")]:
+    doc = gfx.open(type, filename)
+    for nr in range(1, doc.pages+1):
+        reference[(filename,nr)] = digest(doc.getPage(nr).asBitmap(WIDTH,HEIGHT))
+
+shared = {"pdf": gfx.open("pdf", pdfs[0]), "swf": gfx.open("swf", swf)}
+shared_output = gfx.ImageList()
+
+class Counter:
+    def __init__(self):
+        self.count = 0
+    def fill(self, *args):
+        self.count += 1
+    def stroke(self, *args):
+        self.count += 1
+    def drawchar(self, *args):
+        self.count += 1
+
+errors = []
+
+# calls into the module while the pdf lock is held by the render call
+class Reentrant(Counter):
+    def fill(self, *args):
+        if self.count == 0:
+            gfx.setparameter("zoom", "72")
+            page = gfx.open("pdf", pdfs[-1]).getPage(1)
+            page.render(gfx.PassThrough(Counter()))
+            page.asImage(20,20)
+        self.count += 1
+
+def check(filename, doc, nr, what):
+    if digest(doc.getPage(nr).asBitmap(WIDTH,HEIGHT)) != reference[(filename,nr)]:
+        errors.append("%s: %s page %d differs" % (what, os.path.basename(filename), nr))
+
+def worker(k):
+    try:
+        for i in range(options.iterations):
+            # a document of our own
+            filename = pdfs[(k+i) % len(pdfs)]
+            doc = gfx.open("pdf", filename)
+            for nr in range(1, doc.pages+1):
+                check(filename, doc, nr, "own pdf")
+            doc2 = gfx.open("swf", swf)
+            for nr in range(1+(k+i)%doc2.pages, doc2.pages+1, 3):
+                check(swf, doc2, nr, "own swf")
+
+            # one document, all threads
+            pages = shared["pdf"].pages
+            check(pdfs[0], shared["pdf"], 1+(k+i)%pages, "shared pdf")
+            pages = shared["swf"].pages
+            check(swf, shared["swf"], 1+(k*7+i)%pages, "shared swf")
+
+            # native outputs, shared and private, and one calling back into python.
+            # A pdf document sends every font to the first output only, so
+            # the swf output gets a document of its own.
+            shared["swf"].getPage(1+k%pages).draw(shared_output)
+            page = gfx.open("pdf", filename).getPage(1)
+            out = gfx.SWF()
+            out.startpage(page.width, page.height)
+            page.render(out)
+            out.endpage()
+            page.render(gfx.PassThrough(Counter()))
+            page.render(gfx.PassThrough(Reentrant()))
+            if len(page.asImage(60,40)) != 60*40*3:
+                errors.append("asImage returned the wrong size")
+    except Exception as e:
+        errors.append("thread %d: %r" % (k, e))
+
+threads = [threading.Thread(target=worker, args=(k,)) for k in range(options.threads)]
+t = time.time()
+for thread in threads:
+    thread.start()
+for thread in threads:
+    thread.join()
+if options.verbose:
+    sys.stdout.write("%d threads: %.2fs\n" % (options.threads, time.time()-t))
+
+# One long render in the background. With the GIL released while it
+# runs, this thread keeps ticking; otherwise it would stall until the
+# render is done.
+page = gfx.open("pdf", pdfs[0]).getPage(1)
+duration = []
+def render():
+    t = time.time()
+    page.asBitmap(2400,1800)
+    duration.append(time.time()-t)
+thread = threading.Thread(target=render)
+ticks,gap = 0,0.0
+last = time.time()
+thread.start()
+while thread.is_alive():
+    time.sleep(0.001)
+    now = time.time()
+    gap = max(gap, now-last)
+    last = now
+    ticks += 1
+thread.join()
+if options.verbose:
+    sys.stdout.write("render: %.3fs, %d ticks in the main thread, longest gap %.3fs\n" % (duration[0], ticks, gap))
+if gap > duration[0]/2:
+    errors.append("main thread stalled for %.3fs during a %.3fs render" % (gap, duration[0]))
+
+os.unlink(swf)
+os.rmdir(os.path.dirname(swf))
+
+for e in sorted(set(errors)):
+    sys.stdout.write("error: %s\n" % e)
+if not errors:
+    sys.stdout.write("ok, %d threads\n" % options.threads)
+sys.exit(errors and 1 or 0)
@@ -750,6 +750,35 @@ uint64_t string_hash64(const char*str)
     }
     return checksum;
 }
+/* A fast, well mixed 64 bit hash of a memory block (not cryptographic,
+   and not portable between little and big endian machines). */
+static inline uint64_t hash64_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+uint64_t memory_hash64(const void*data, int len, uint64_t seed)
+{
+    const unsigned char*p = (const unsigned char*)data;
+    uint64_t h = seed ^ ((uint64_t)len * 0x9e3779b97f4a7c15ull);
+    uint64_t w;
+    while(len >= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ hash64_mix(w)) * 0x9e3779b97f4a7c15ull;
+        p += 8;
+        len -= 8;
+    }
+    if(len) {
+        w = 0;
+        memcpy(&w, p, len);
+        h = (h ^ hash64_mix(w)) * 0x9e3779b97f4a7c15ull;
+    }
+    return hash64_mix(h);
+}
 unsigned int string_hash3(const char*str, int len)
 {
     string_t s;
@@ -184,6 +184,7 @@ unsigned int string_hash(const string_t*str);
 unsigned int string_hash2(const char*str);
 unsigned int string_hash3(const char*str, int len);
 uint64_t string_hash64(const char*str);
+uint64_t memory_hash64(const void*data, int len, uint64_t seed);
 void string_set(string_t*str, const char*text);
 void string_set2(string_t*str, const char*text, int len);
 string_t*string_dup3(string_t*s);
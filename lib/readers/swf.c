@@ -19,9 +19,12 @@ typedef struct _swf_page_internal
     int frame;
 } swf_page_internal_t;
 
+typedef struct _displaylist displaylist_t;
+
 typedef struct _swf_doc_internal
 {
     map16_t*id2char;
+    displaylist_t*timeline;
     SWF swf;
     int width,height;
     MATRIX m;
@@ -46,6 +49,7 @@ typedef struct _placement
     SWFPLACEOBJECT po;
     int age;
     int startFrame;
+    displaylist_t*sprite; // the state of the sprite's timeline, if any
 } placement_t;
 
 typedef struct _sprite
@@ -53,6 +57,24 @@ typedef struct _sprite
     int frameCount;
 } sprite_t;
 
+typedef struct _shape
+{
+    SHAPE2 shape;        // only the styles, the lines are in outlines/fills
+    gfxline_t**outlines; // one for every line style
+    gfxline_t**fills;    // one for every fill style
+} shape_t;
+
+/* The depths of a timeline, at a given frame. Going from one frame to
+   the next only processes the tags in between. */
+struct _displaylist
+{
+    TAG*start;
+    TAG*tag;    // the tag we stopped at, or 0
+    int frame;
+    char done;
+    map16_t*depths;
+};
+
 typedef struct _render
 {
     map16_t*id2char;
@@ -71,7 +93,7 @@ map16_t* map16_new()
 {
     map16_t*map = rfx_calloc(sizeof(map16_t));
     /* TODO: replace this by a more sophisticated data structure */
-    map->ids = (void**)rfx_calloc(sizeof(character_t)*65536);
+    map->ids = (void**)rfx_calloc(sizeof(void*)*65536);
     return map;
 }
 character_t*map16_get_id(map16_t*map, int id)
@@ -83,6 +105,7 @@ character_t*map16_get_id(map16_t*map, int id)
 void map16_free(map16_t*map)
 {
     free(map->ids);
+    free(map);
 }
 void map16_add_id(map16_t*map, int nr, void*id)
 {
@@ -120,9 +143,13 @@ placement_t* placement_join(placement_t*p1, placement_t*p2)
     return placement;
 }
 
+static void displaylist_free(displaylist_t*dl);
+
 static void placement_free(placement_t*p)
 {
     swf_PlaceObjectFree(&p->po);
+    if(p->sprite)
+	displaylist_free(p->sprite);
     free(p);
 }
 
@@ -199,6 +226,56 @@ gfxline_t* swfline_to_gfxline(SHAPELINE*line, int linestyle, int fillstyle0)
 }
 
 
+//---- shape handling ----
+
+static shape_t* getshape(character_t*c)
+{
+    if(c->data)
+	return (shape_t*)c->data;
+
+    /* convert the shape only once, and transform it for every placement */
+    shape_t*shape = (shape_t*)rfx_calloc(sizeof(shape_t));
+    swf_ParseDefineShape(c->tag, &shape->shape);
+    int t;
+    shape->outlines = (gfxline_t**)rfx_calloc(sizeof(gfxline_t*)*(shape->shape.numlinestyles+1));
+    for(t=1;t<=shape->shape.numlinestyles;t++) {
+	shape->outlines[t-1] = swfline_to_gfxline(shape->shape.lines, t, -1);
+    }
+    shape->fills = (gfxline_t**)rfx_calloc(sizeof(gfxline_t*)*(shape->shape.numfillstyles+1));
+    for(t=1;t<=shape->shape.numfillstyles;t++) {
+	shape->fills[t-1] = swfline_to_gfxline(shape->shape.lines, -1, t);
+    }
+    SHAPELINE*line = shape->shape.lines;
+    while(line) {
+	SHAPELINE*next = line->next;
+	rfx_free(line);
+	line = next;
+    }
+    shape->shape.lines = 0;
+    c->data = shape;
+    return shape;
+}
+
+static void shape_free(shape_t*shape)
+{
+    int t;
+    for(t=0;t<shape->shape.numlinestyles;t++)
+	gfxline_free(shape->outlines[t]);
+    for(t=0;t<shape->shape.numfillstyles;t++)
+	gfxline_free(shape->fills[t]);
+    rfx_free(shape->outlines);
+    rfx_free(shape->fills);
+    swf_Shape2Free(&shape->shape);
+    rfx_free(shape);
+}
+
+static gfxline_t* transformLine(gfxline_t*line, gfxmatrix_t*m)
+{
+    gfxline_t*l = gfxline_clone(line);
+    gfxline_transform(l, m);
+    return l;
+}
+
 //---- bitmap handling ----
 
 static gfximage_t* gfximage_new(RGBA*data, int width, int height)
@@ -223,7 +300,8 @@ static gfximage_t* findimage(render_t*r, U16 id)
 
     return c->data;
 }
-//---- shape handling ----
+
+//---- fill handling ----
 
 static void renderFilled(render_t*r, gfxline_t*line, FILLSTYLE*f, CXFORM*cx, MATRIX*po_m)
 {
@@ -434,12 +512,62 @@ static void increaseAge(void*self, int id, void*data)
     p->age++;
 }
 
-static map16_t* extractFrame(TAG*startTag, int frame_to_extract)
+static displaylist_t* displaylist_new(TAG*start)
 {
-    map16_t*depthmap = map16_new();
-    TAG*tag = startTag;
-    int frame = 1;
-    int insprite = 0;
+    displaylist_t*dl = (displaylist_t*)rfx_calloc(sizeof(displaylist_t));
+    dl->start = start;
+    dl->frame = 1;
+    dl->depths = map16_new();
+    return dl;
+}
+
+static void freePlacement(void*self, int depth, void*data)
+{
+    placement_free((placement_t*)data);
+}
+
+static void displaylist_clear(displaylist_t*dl)
+{
+    map16_enumerate(dl->depths, freePlacement, 0);
+    memset(dl->depths->ids, 0, sizeof(void*)*65536);
+    dl->tag = 0;
+    dl->frame = 1;
+    dl->done = 0;
+}
+
+static void displaylist_free(displaylist_t*dl)
+{
+    map16_enumerate(dl->depths, freePlacement, 0);
+    map16_free(dl->depths);
+    free(dl);
+}
+
+/* Advance the display list to frame_to_extract (0 = the end of the timeline).
+   Consecutive frames only process the tags in between, going back in time
+   starts over at the first frame. */
+static map16_t* displaylist_seek(displaylist_t*dl, int frame_to_extract)
+{
+    TAG*tag;
+
+    if(frame_to_extract && frame_to_extract < dl->frame)
+	displaylist_clear(dl);
+    if(dl->done || (dl->tag && dl->frame == frame_to_extract))
+	return dl->depths;
+
+    if(!dl->tag) {
+	tag = dl->start;
+    } else {
+	/* finish the frame we stopped at */
+	if(dl->tag->id == ST_END) {
+	    dl->done = 1;
+	    return dl->depths;
+	}
+	if(dl->tag->id == ST_SHOWFRAME) {
+	    dl->frame++;
+	    map16_enumerate(dl->depths, increaseAge, 0);
+	}
+	tag = dl->tag->next;
+    }
 
     for(;tag;tag = tag->next) {
 	if(tag->id == ST_DEFINESPRITE) {
@@ -451,39 +579,46 @@ static map16_t* extractFrame(TAG*startTag, int frame_to_extract)
 	   tag->id == ST_PLACEOBJECT2) {
             placement_t* p = rfx_calloc(sizeof(placement_t));
 	    p->age = 1;
-	    p->startFrame = frame;
+	    p->startFrame = dl->frame;
             swf_GetPlaceObject(tag, &p->po);
 	    if(p->po.move) {
-		placement_t*old = (placement_t*)map16_get_id(depthmap, p->po.depth);
-	
-		if(!(p->po.flags&PF_CHAR)) p->po.id = old->po.id;
-		if(!(p->po.flags&PF_MATRIX)) p->po.matrix = old->po.matrix;
-		if(!(p->po.flags&PF_CXFORM)) p->po.cxform = old->po.cxform;
-		if(!(p->po.flags&PF_RATIO)) p->po.ratio = old->po.ratio;
-
-		map16_remove_id(depthmap, old->po.depth);
-		placement_free(old);
+		placement_t*old = (placement_t*)map16_get_id(dl->depths, p->po.depth);
+		if(old) {
+		    if(!(p->po.flags&PF_CHAR)) p->po.id = old->po.id;
+		    if(!(p->po.flags&PF_MATRIX)) p->po.matrix = old->po.matrix;
+		    if(!(p->po.flags&PF_CXFORM)) p->po.cxform = old->po.cxform;
+		    if(!(p->po.flags&PF_RATIO)) p->po.ratio = old->po.ratio;
+
+		    map16_remove_id(dl->depths, old->po.depth);
+		    placement_free(old);
+		}
 	    }
-	    map16_add_id(depthmap, p->po.depth, p);
+	    map16_add_id(dl->depths, p->po.depth, p);
 	}
 	if(tag->id == ST_REMOVEOBJECT ||
 	   tag->id == ST_REMOVEOBJECT2) {
 	    U16 depth = swf_GetDepth(tag);
-	    map16_remove_id(depthmap, depth);
+	    placement_t*old = (placement_t*)map16_get_id(dl->depths, depth);
+	    if(old) {
+		map16_remove_id(dl->depths, depth);
+		placement_free(old);
+	    }
 	}
 	if(tag->id == ST_SHOWFRAME || tag->id == ST_END || !tag->next) {
-	    if(frame == frame_to_extract) {
-		return depthmap;
+	    if(dl->frame == frame_to_extract) {
+		dl->tag = tag;
+		return dl->depths;
 	    }
 	    if(tag->id == ST_SHOWFRAME) {
-		frame++;
-		map16_enumerate(depthmap, increaseAge, 0);
+		dl->frame++;
+		map16_enumerate(dl->depths, increaseAge, 0);
 	    }
 	}
 	if(tag->id == ST_END) 
 	    break;
     }
-    return depthmap;
+    dl->done = 1;
+    return dl->depths;
 }
 
 // ---- rendering ----
@@ -530,39 +665,32 @@ void swf_ApplyMatrixToShape(SHAPE2*shape, MATRIX*m)
 static void renderCharacter(render_t*r, placement_t*p, character_t*c)
 {
     if(c->type == TYPE_SHAPE) {
-	SHAPE2 shape;
-	swf_ParseDefineShape(c->tag, &shape);
+	shape_t*shape = getshape(c);
 
 	MATRIX m,m2;
 	swf_MatrixJoin(&m2, &r->m, &r->current_placement->po.matrix);
 	swf_MatrixJoin(&m, &m2, &p->po.matrix);
+	gfxmatrix_t gm;
+	convertMatrix(&m, &gm);
 
-	swf_ApplyMatrixToShape(&shape, &m);
-
-	SHAPELINE*line = shape.lines;
 	int t;
-	
-	for(t=1;t<=shape.numlinestyles;t++) {
-	   gfxline_t*line = swfline_to_gfxline(shape.lines, t, -1);
-	   if(line) renderOutline(r, line, &shape.linestyles[t-1], &p->po.cxform);
+	for(t=1;t<=shape->shape.numlinestyles;t++) {
+	   gfxline_t*line = transformLine(shape->outlines[t-1], &gm);
+	   if(line) renderOutline(r, line, &shape->shape.linestyles[t-1], &p->po.cxform);
 	   gfxline_free(line);
 	}
 
-	for(t=1;t<=shape.numfillstyles;t++) {
-	   gfxline_t*line;
-	   line = swfline_to_gfxline(shape.lines, -1, t);
+	for(t=1;t<=shape->shape.numfillstyles;t++) {
+	   gfxline_t*line = transformLine(shape->fills[t-1], &gm);
 	   if(line) {
 	       if(!p->po.clipdepth) {
-		   renderFilled(r, line, &shape.fillstyles[t-1], &p->po.cxform, &p->po.matrix);
+		   renderFilled(r, line, &shape->shape.fillstyles[t-1], &p->po.cxform, &p->po.matrix);
 	       } else { 
 		   r->device->startclip(r->device, line);
                    r->clips_waiting[p->po.clipdepth]++;
 	       }
 	   }
 	   gfxline_free(line);
-	   /*line = swfline_to_gfxline(shape.lines, -1, -1, t);
-	   if(line) renderFilled(r, line, &shape.fillstyles[t-1], &p->po.cxform);
-	   gfxline_free(line);*/
 	}
 	
     } else if(c->type == TYPE_TEXT) {
@@ -603,8 +731,9 @@ static void placeObject(void*self, int id, void*data)
 
         sprite_t* s = (sprite_t*)c->data;
 
-	TAG*spritetags = c->tag->next;
-        map16_t* depths = extractFrame(spritetags, s->frameCount>0? p->age % s->frameCount : 0);
+	if(!p->sprite)
+	    p->sprite = displaylist_new(c->tag->next);
+        map16_t* depths = displaylist_seek(p->sprite, s->frameCount>0? p->age % s->frameCount : 0);
         map16_enumerate(depths, placeObject, r);
        
         int t;
@@ -635,7 +764,7 @@ void swfpage_render(gfxpage_t*page, gfxdevice_t*output)
 {
     swf_page_internal_t*i = (swf_page_internal_t*)page->internal;
     swf_doc_internal_t*pi = (swf_doc_internal_t*)page->parent->internal;
-    map16_t* depths = extractFrame(pi->swf.firstTag, i->frame);
+    map16_t* depths = displaylist_seek(pi->timeline, i->frame);
     render_t r;
     r.id2char = pi->id2char;
     r.clips = 0;
@@ -656,6 +785,7 @@ void swfpage_render(gfxpage_t*page, gfxdevice_t*output)
         }
     }
     free(r.clips_waiting);
+    placement_free(r.current_placement);
 }
 
 void swfpage_rendersection(gfxpage_t*page, gfxdevice_t*output, gfxcoord_t x, gfxcoord_t y, gfxcoord_t _x1, gfxcoord_t _y1, gfxcoord_t _x2, gfxcoord_t _y2)
@@ -665,9 +795,34 @@ void swfpage_rendersection(gfxpage_t*page, gfxdevice_t*output, gfxcoord_t x, gfx
     swfpage_render(page,output);
 }
 
+static void freeCharacter(void*self, int id, void*data)
+{
+    character_t*c = (character_t*)data;
+    if(c->type == TYPE_SHAPE && c->data) {
+	shape_free((shape_t*)c->data);
+    } else if(c->type == TYPE_FONT) {
+	font_t*font = (font_t*)c->data;
+	int t;
+	for(t=0;t<font->numchars;t++)
+	    gfxline_free(font->glyphs[t]);
+	free(font->glyphs);
+	free(font);
+    } else if(c->type == TYPE_BITMAP) {
+	gfximage_t*img = (gfximage_t*)c->data;
+	free(img->data);
+	free(img);
+    } else {
+	free(c->data);
+    }
+    free(c);
+}
+
 void swf_doc_destroy(gfxdocument_t*gfx)
 {
     swf_doc_internal_t*i= (swf_doc_internal_t*)gfx->internal;
+    displaylist_free(i->timeline);
+    map16_enumerate(i->id2char, freeCharacter, 0);
+    map16_free(i->id2char);
     swf_FreeTags(&i->swf);
     free(gfx->internal);gfx->internal=0;
     free(gfx);gfx=0;
@@ -735,6 +890,7 @@ gfxdocument_t*swf_open(gfxsource_t*src, const char*filename)
     swf_UnFoldAll(&i->swf);
     
     i->id2char = extractDefinitions(&i->swf);
+    i->timeline = displaylist_new(i->swf.firstTag);
     i->width = (i->swf.movieSize.xmax - i->swf.movieSize.xmin) / 20;
     i->height = (i->swf.movieSize.ymax - i->swf.movieSize.ymin) / 20;
     
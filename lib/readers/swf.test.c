@@ -0,0 +1,324 @@
+/* swf.test.c
+
+   Renders the frames of a generated SWF with nested sprites through the
+   swf reader, in order, backwards and in random order, and compares the
+   results with what the frames have to look like.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../rfxswf.h"
+#include "../gfxdevice.h"
+#include "../gfxsource.h"
+#include "../devices/render.h"
+#include "swf.h"
+
+/* All rectangles are on whole pixels, so there's nothing to anti-alias
+   and the frames should match the expected images exactly. Shapes are
+   transformed in floating point, so a channel may be off by MAX_DIFF.
+   Frames rendered from a document that has already rendered other frames
+   have to be identical to those rendered from a freshly opened one. */
+#define MAX_DIFF 1
+
+#define WIDTH 200
+#define HEIGHT 100
+#define FRAMES 12
+
+static RGBA red = {255,255,0,0};
+static RGBA green = {255,0,255,0};
+static RGBA blue = {255,0,0,255};
+static RGBA yellow = {255,255,255,0};
+
+static MATRIX at(int x, int y)
+{
+    MATRIX m;
+    swf_GetMatrix(0, &m);
+    m.tx = x*20;
+    m.ty = y*20;
+    return m;
+}
+
+static TAG* place(TAG*tag, int id, int depth, int x, int y)
+{
+    MATRIX m = at(x,y);
+    tag = swf_InsertTag(tag, ST_PLACEOBJECT2);
+    swf_ObjectPlace(tag, id, depth, &m, 0, 0);
+    return tag;
+}
+
+static TAG* move(TAG*tag, int depth, int x, int y)
+{
+    MATRIX m = at(x,y);
+    tag = swf_InsertTag(tag, ST_PLACEOBJECT2);
+    swf_ObjectMove(tag, depth, &m, 0);
+    return tag;
+}
+
+static TAG* removeobject(TAG*tag, int depth)
+{
+    tag = swf_InsertTag(tag, ST_REMOVEOBJECT2);
+    swf_SetU16(tag, depth);
+    return tag;
+}
+
+static TAG* rectangle(TAG*tag, int id, int size, RGBA*color)
+{
+    tag = swf_InsertTag(tag, ST_DEFINESHAPE3);
+    swf_ShapeSetRectangle(tag, id, size*20, size*20, color);
+    return tag;
+}
+
+/* The main timeline places sprite 11 once, at (10,10), and a yellow
+   square in frames 5-8.
+   Sprite 11 has four frames: it places sprite 10 at (0,0), and moves
+   a red square along y=40 in frames 1-3. Frame 4 removes it again.
+   Sprite 10 has three frames: a green square at (0,0), then a blue one
+   at (20,0) which then moves to (40,0).
+   A sprite's frame is the number of frames since it was placed, so
+   sprite 10 follows the frames of sprite 11, not those of the movie. */
+static void write_swf(const char*filename)
+{
+    SWF swf;
+    memset(&swf, 0, sizeof(swf));
+    swf.fileVersion = 8;
+    swf.frameRate = 25*256;
+    swf.movieSize.xmax = WIDTH*20;
+    swf.movieSize.ymax = HEIGHT*20;
+
+    TAG*tag = swf.firstTag = swf_InsertTag(0, ST_SETBACKGROUNDCOLOR);
+    swf_SetU8(tag, 255);swf_SetU8(tag, 255);swf_SetU8(tag, 255);
+
+    tag = rectangle(tag, 1, 20, &red);
+    tag = rectangle(tag, 2, 10, &green);
+    tag = rectangle(tag, 3, 10, &blue);
+    tag = rectangle(tag, 4, 20, &yellow);
+
+    tag = swf_InsertTag(tag, ST_DEFINESPRITE);
+    swf_SetU16(tag, 10);
+    swf_SetU16(tag, 3);
+    tag = place(tag, 2, 1, 0, 0);
+    tag = swf_InsertTag(tag, ST_SHOWFRAME);
+    tag = removeobject(tag, 1);
+    tag = place(tag, 3, 1, 20, 0);
+    tag = swf_InsertTag(tag, ST_SHOWFRAME);
+    tag = move(tag, 1, 40, 0);
+    tag = swf_InsertTag(tag, ST_SHOWFRAME);
+    tag = swf_InsertTag(tag, ST_END);
+
+    tag = swf_InsertTag(tag, ST_DEFINESPRITE);
+    swf_SetU16(tag, 11);
+    swf_SetU16(tag, 4);
+    tag = place(tag, 10, 1, 0, 0);
+    tag = place(tag, 1, 2, 0, 40);
+    tag = swf_InsertTag(tag, ST_SHOWFRAME);
+    tag = move(tag, 2, 20, 40);
+    tag = swf_InsertTag(tag, ST_SHOWFRAME);
+    tag = move(tag, 2, 40, 40);
+    tag = swf_InsertTag(tag, ST_SHOWFRAME);
+    tag = removeobject(tag, 2);
+    tag = swf_InsertTag(tag, ST_SHOWFRAME);
+    tag = swf_InsertTag(tag, ST_END);
+
+    int frame;
+    for(frame=1;frame<=FRAMES;frame++) {
+	if(frame==1)
+	    tag = place(tag, 11, 1, 10, 10);
+	if(frame==5)
+	    tag = place(tag, 4, 2, 150, 60);
+	if(frame==9)
+	    tag = removeobject(tag, 2);
+	tag = swf_InsertTag(tag, ST_SHOWFRAME);
+    }
+    tag = swf_InsertTag(tag, ST_END);
+
+    swf_FoldAll(&swf);
+    if(swf_SaveSWF(&swf, (char*)filename) < 0) {
+	fprintf(stderr, "Couldn't write %s\n", filename);
+	exit(1);
+    }
+    swf_FreeTags(&swf);
+}
+
+static void fill(gfximage_t*img, int x, int y, int size, RGBA*c)
+{
+    int xx,yy;
+    for(yy=y;yy<y+size;yy++)
+    for(xx=x;xx<x+size;xx++) {
+	gfxcolor_t*p = &img->data[yy*img->width+xx];
+	p->a = c->a;p->r = c->r;p->g = c->g;p->b = c->b;
+    }
+}
+
+static gfximage_t* expected_frame(int frame)
+{
+    gfximage_t*img = (gfximage_t*)rfx_calloc(sizeof(gfximage_t));
+    img->width = WIDTH;
+    img->height = HEIGHT;
+    img->data = (gfxcolor_t*)rfx_calloc(WIDTH*HEIGHT*sizeof(gfxcolor_t));
+
+    int frame11 = (frame-1)%4+1;
+    int frame10 = (frame11-1)%3+1;
+    /* the reader shows the last frame of a sprite by running to the end
+       of its timeline, which ages the sprites inside by one more frame */
+    if(frame11 == 4)
+	frame10 = frame11%3+1;
+    if(frame10 == 1) fill(img, 10, 10, 10, &green);
+    if(frame10 == 2) fill(img, 30, 10, 10, &blue);
+    if(frame10 == 3) fill(img, 50, 10, 10, &blue);
+    if(frame11 <= 3) fill(img, 10+(frame11-1)*20, 50, 20, &red);
+    if(frame >= 5 && frame <= 8) fill(img, 150, 60, 20, &yellow);
+    return img;
+}
+
+static void image_free(gfximage_t*img)
+{
+    free(img->data);
+    free(img);
+}
+
+static gfximage_t* render_frame(gfxdocument_t*doc, int frame)
+{
+    gfxdevice_t dev;
+    gfxdevice_render_init(&dev);
+    gfxpage_t*page = doc->getpage(doc, frame);
+    dev.startpage(&dev, page->width, page->height);
+    page->render(page, &dev);
+    dev.endpage(&dev);
+    page->destroy(page);
+    gfxresult_t*result = dev.finish(&dev);
+
+    gfximage_t*img = (gfximage_t*)result->get(result, "page0");
+    gfximage_t*copy = (gfximage_t*)rfx_calloc(sizeof(gfximage_t));
+    copy->width = img->width;
+    copy->height = img->height;
+    copy->data = (gfxcolor_t*)rfx_alloc(img->width*img->height*sizeof(gfxcolor_t));
+    memcpy(copy->data, img->data, img->width*img->height*sizeof(gfxcolor_t));
+    result->destroy(result);
+    return copy;
+}
+
+static int errors = 0;
+
+static void compare_expected(const char*what, int frame, gfximage_t*img)
+{
+    if(img->width != WIDTH || img->height != HEIGHT) {
+	printf("%s, frame %d: size is %dx%d\n", what, frame, img->width, img->height);
+	errors++;
+	return;
+    }
+    gfximage_t*expected = expected_frame(frame);
+    int t, max = 0, bad = 0;
+    for(t=0;t<WIDTH*HEIGHT;t++) {
+	unsigned char*p1 = (unsigned char*)&img->data[t];
+	unsigned char*p2 = (unsigned char*)&expected->data[t];
+	int i, d = 0;
+	for(i=0;i<4;i++) {
+	    int dd = abs(p1[i]-p2[i]);
+	    if(dd > d) d = dd;
+	}
+	if(d > max) max = d;
+	if(d > MAX_DIFF) bad++;
+    }
+    if(bad) {
+	printf("%s, frame %d: %d pixels differ from the expected image, by up to %d\n", what, frame, bad, max);
+	errors++;
+    }
+    image_free(expected);
+}
+
+static void compare_exact(const char*what, int frame, gfximage_t*img, gfximage_t*reference)
+{
+    if(img->width != reference->width || img->height != reference->height ||
+       memcmp(img->data, reference->data, img->width*img->height*sizeof(gfxcolor_t))) {
+	printf("%s, frame %d: differs from the frame rendered by a new document\n", what, frame);
+	errors++;
+    }
+}
+
+static void render_sequence(gfxsource_t*src, const char*filename, const char*what,
+	                    int*frames, int num, gfximage_t**reference)
+{
+    gfxdocument_t*doc = src->open(src, filename);
+    int t;
+    for(t=0;t<num;t++) {
+	gfximage_t*img = render_frame(doc, frames[t]);
+	compare_expected(what, frames[t], img);
+	compare_exact(what, frames[t], img, reference[frames[t]-1]);
+	image_free(img);
+    }
+    doc->destroy(doc);
+}
+
+int main()
+{
+    char filename[] = "/tmp/swftestXXXXXX";
+    int fi = mkstemp(filename);
+    if(fi<0) {
+	perror(filename);
+	return 1;
+    }
+    close(fi);
+    write_swf(filename);
+
+    gfxsource_t*src = gfxsource_swf_create();
+
+    /* every frame from a document of its own */
+    gfximage_t*reference[FRAMES];
+    int t;
+    for(t=0;t<FRAMES;t++) {
+	gfxdocument_t*doc = src->open(src, filename);
+	if(!doc || doc->num_pages != FRAMES) {
+	    printf("couldn't read the generated file\n");
+	    unlink(filename);
+	    return 1;
+	}
+	reference[t] = render_frame(doc, t+1);
+	compare_expected("new document", t+1, reference[t]);
+	doc->destroy(doc);
+    }
+
+    int frames[64];
+    for(t=0;t<FRAMES;t++)
+	frames[t] = t+1;
+    render_sequence(src, filename, "in order", frames, FRAMES, reference);
+
+    for(t=0;t<FRAMES;t++)
+	frames[t] = FRAMES-t;
+    render_sequence(src, filename, "backwards", frames, FRAMES, reference);
+
+    /* includes rendering the same frame twice in a row, and jumping
+       into the middle of the sprites' timelines */
+    srand48(1);
+    for(t=0;t<64;t++)
+	frames[t] = lrand48()%FRAMES+1;
+    render_sequence(src, filename, "random order", frames, 64, reference);
+
+    for(t=0;t<FRAMES;t++)
+	image_free(reference[t]);
+    src->destroy(src);
+    unlink(filename);
+
+    if(errors) {
+	printf("%d errors\n", errors);
+	return 1;
+    }
+    printf("ok, %d frames in and out of order, max pixel difference %d\n", FRAMES, MAX_DIFF);
+    return 0;
+}
@@ -46,6 +46,7 @@
 
 #include "./bitio.h"
 #include "./os.h"
+#include "./stats.h"
 
 // internal constants
 
@@ -1712,7 +1713,7 @@ int WriteExtraTags(SWF*swf, writer_t*writer)
     return len;
 }
 
-int  swf_WriteSWF2(writer_t*writer, SWF * swf)     // Writes SWF to file, returns length or <0 if fails
+static int write_swf(writer_t*writer, SWF * swf)
 { U32 len;
   TAG * t;
   int frameCount=0;
@@ -1842,6 +1843,17 @@ int  swf_WriteSWF2(writer_t*writer, SWF * swf)     // Writes SWF to file, return
   }
 }
 
+int  swf_WriteSWF2(writer_t*writer, SWF * swf)     // Writes SWF to file, returns length or <0 if fails
+{
+  stats_timer_t timer;
+  stats_timer_start(&timer, "swf.write");
+  int len = write_swf(writer, swf);
+  stats_timer_stop(&timer);
+  if(len>0)
+    stats_count("swf.write", 0, 0, len);
+  return len;
+}
+
 int swf_SaveSWF(SWF * swf, char*filename)
 {
     int fi = open(filename, O_BINARY|O_RDWR|O_TRUNC|O_CREAT, 0777);
@@ -1945,6 +1957,7 @@ void swf_FreeTags(SWF * swf)                 // Frees all malloc'ed memory for t
 //#include "modules/swfobject.c"
 //#include "modules/swfbutton.c"
 //#include "modules/swftools.c"
+//#include "modules/swfcombine.c"
 //#include "modules/swfcgi.c"
 //#include "modules/swfbits.c"
 //#include "modules/swfaction.c"
@@ -500,6 +500,9 @@ void swf_SetShape2(TAG*tag, SHAPE2*shape2);
 
 void swf_RecodeShapeData(U8*data, int bitlen, int in_bits_fill, int in_bits_line,
                          U8**destdata, U32*destbitlen, int out_bits_fill, int out_bits_line);
+int swf_TranscodeShapeRecords(TAG*tag, U8*data, int bitlen, int version,
+			      int in_bits_fill, int in_bits_line, int out_bits_fill, int out_bits_line,
+			      S32 dx, S32 dy, U16*idmap);
 
 // swfdraw.c
 
@@ -742,11 +745,13 @@ int swf_SetLosslessBits(TAG * t,U16 width,U16 height,void * bitmap,U8 bitmap_fla
 int swf_SetLosslessBitsIndexed(TAG * t,U16 width,U16 height,U8 * bitmap,RGBA * palette,U16 ncolors);
 int swf_SetLosslessBitsGrayscale(TAG * t,U16 width,U16 height,U8 * bitmap);
 void swf_SetLosslessImage(TAG*tag, RGBA*data, int width, int height); //WARNING: will change tag->id
+void swf_SetLosslessImageQuantized(TAG*tag, RGBA*data, int width, int height, int numcolors); //WARNING: will change tag->id
 
 RGBA* swf_DefineLosslessBitsTagToImage(TAG*tag, int*width, int*height);
 
 RGBA* swf_ExtractImage(TAG*tag, int*dwidth, int*dheight);
 TAG* swf_AddImage(TAG*tag, int bitid, RGBA*mem, int width, int height, int quality);
+TAG* swf_AddImageQuantized(TAG*tag, int bitid, RGBA*mem, int width, int height, int quality, int numcolors);
 
 // swfsound.c
 void swf_SetSoundStreamHead(TAG*tag, int avgnumsamples);
@@ -790,6 +795,33 @@ TAG* swf_Concatenate (TAG*list1,TAG*list2); // warning: both list1 and list2 are
 
 RGBA swf_GetSWFBackgroundColor(SWF*swf);
 
+// swfcombine.c
+
+typedef struct _COMBINEOPTIONS
+{
+    char overlay;   // don't remove any master objects, only overlay the slave
+    char clip;      // clip the slave by the object it replaces
+    char merge;     // don't store the slave in a sprite
+    char cat;       // concatenate master and slave
+    char isframe;   // slavename is a frame (number or label), not an object
+    char antistream;
+    int movex, movey;          // slave position adjustment (twips)
+    float scalex, scaley;
+    int mastermovex, mastermovey;
+    float masterscalex, masterscaley;
+    int sizex, sizey;          // force movie size (twips)
+    char hassizex, hassizey;
+    int framerate;             // 8.8 fixed point, 0 = keep
+    int flashversion;          // 0 = keep
+} COMBINEOPTIONS;
+
+void swf_CombineOptionsInit(COMBINEOPTIONS*options);
+void swf_CombinePrepare(SWF*swf); // removes jpegtables and header tags. Call on every input.
+/* Replaces the object named slavename ("name" or "#id") of master by slave.
+   master and slave are modified, and can be freed afterwards.
+   Returns <0 if the options can't be applied. */
+int swf_Combine(SWF*master, const char*slavename, SWF*slave, SWF*newswf, COMBINEOPTIONS*options);
+
 // swfcgi.c
 
 void swf_uncgi();  // same behaviour as Steven Grimm's uncgi-library
@@ -0,0 +1,166 @@
+/* stats.c
+   Named timers and counters for finding out where conversion time is spent.
+
+   Library stages wrap their work in stats_timer_start()/stats_timer_stop();
+   the gfxdevice in devices/stats.c does the same for every device callback.
+   At the end, the tools write all entries as a JSON object:
+
+     {"stages": {"<name>": {"calls": 1, "wall": 0.5, "cpu": 0.4,
+                            "points": 0, "pixels": 0, "bytes": 0}, ...}}
+
+   Times nest: a stage which calls into another stage includes its time.
+   The entries aren't locked, so only one thread should use them.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../config.h"
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include "stats.h"
+
+char stats_enabled = 0;
+
+static stats_entry_t*entries = 0;
+static stats_entry_t*last = 0;
+
+void stats_enable(char enable)
+{
+    stats_enabled = enable;
+}
+
+stats_entry_t* stats_get(const char*name)
+{
+    stats_entry_t*e;
+    for(e=entries;e;e=e->next) {
+	if(!strcmp(e->name, name))
+	    return e;
+    }
+    e = (stats_entry_t*)calloc(1, sizeof(stats_entry_t));
+    e->name = strdup(name);
+    /* keep the entries in the order they were created in */
+    if(last)
+	last->next = e;
+    else
+	entries = e;
+    last = e;
+    return e;
+}
+
+void stats_now(double*wall, double*cpu)
+{
+#ifdef HAVE_SYS_TIME_H
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    *wall = tv.tv_sec + tv.tv_usec/1000000.0;
+#else
+    *wall = time(0);
+#endif
+    *cpu = clock()/(double)CLOCKS_PER_SEC;
+}
+
+void stats_timer_start(stats_timer_t*t, const char*name)
+{
+    if(!stats_enabled) {
+	t->entry = 0;
+	return;
+    }
+    t->entry = stats_get(name);
+    stats_now(&t->wall, &t->cpu);
+}
+
+void stats_timer_stop(stats_timer_t*t)
+{
+    if(!t->entry)
+	return;
+    double wall, cpu;
+    stats_now(&wall, &cpu);
+    t->entry->calls++;
+    t->entry->wall += wall - t->wall;
+    t->entry->cpu += cpu - t->cpu;
+    t->entry = 0;
+}
+
+void stats_count(const char*name, double points, double pixels, double bytes)
+{
+    if(!stats_enabled)
+	return;
+    stats_entry_t*e = stats_get(name);
+    e->points += points;
+    e->pixels += pixels;
+    e->bytes += bytes;
+}
+
+static void write_string(FILE*fi, const char*s)
+{
+    fputc('"', fi);
+    for(;*s;s++) {
+	if(*s=='"' || *s=='\\')
+	    fprintf(fi, "\\%c", *s);
+	else if((unsigned char)*s < 32)
+	    fprintf(fi, "\\u%04x", *s);
+	else
+	    fputc(*s, fi);
+    }
+    fputc('"', fi);
+}
+
+void stats_write_json(FILE*fi)
+{
+    stats_entry_t*e;
+    fprintf(fi, "{\"stages\": {");
+    for(e=entries;e;e=e->next) {
+	fprintf(fi, "%s\n  ", e==entries?"":",");
+	write_string(fi, e->name);
+	fprintf(fi, ": {\"calls\": %d, \"wall\": %.6f, \"cpu\": %.6f, \"points\": %.0f, \"pixels\": %.0f, \"bytes\": %.0f}",
+		e->calls, e->wall, e->cpu, e->points, e->pixels, e->bytes);
+    }
+    fprintf(fi, "\n}}\n");
+}
+
+int stats_save(const char*filename)
+{
+    if(!strcmp(filename, "-")) {
+	stats_write_json(stdout);
+	fflush(stdout);
+	return 1;
+    }
+    FILE*fi = fopen(filename, "wb");
+    if(!fi) {
+	fprintf(stderr, "Couldn't write statistics to %s\n", filename);
+	return 0;
+    }
+    stats_write_json(fi);
+    fclose(fi);
+    return 1;
+}
+
+void stats_clear()
+{
+    stats_entry_t*e = entries;
+    while(e) {
+	stats_entry_t*next = e->next;
+	free(e->name);
+	free(e);
+	e = next;
+    }
+    entries = last = 0;
+}
@@ -0,0 +1,76 @@
+/* stats.h
+   Header file for stats.c.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __stats_h__
+#define __stats_h__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* an entry in the statistics: how often a stage was run, how much
+   time was spent in it, and how much data it processed */
+typedef struct _stats_entry {
+    char*name;
+    int calls;
+    double wall; // seconds
+    double cpu;  // seconds
+    double points;
+    double pixels;
+    double bytes;
+    struct _stats_entry*next;
+} stats_entry_t;
+
+typedef struct _stats_timer {
+    stats_entry_t*entry;
+    double wall;
+    double cpu;
+} stats_timer_t;
+
+/* nothing is measured unless this is set */
+extern char stats_enabled;
+
+void stats_enable(char enable);
+
+/* find (or create) the entry with the given name */
+stats_entry_t* stats_get(const char*name);
+
+void stats_now(double*wall, double*cpu);
+
+/* measure the time until stats_timer_stop(), and add it to the entry
+   "name". Does nothing if statistics are disabled. */
+void stats_timer_start(stats_timer_t*t, const char*name);
+void stats_timer_stop(stats_timer_t*t);
+
+/* add data volume to an entry */
+void stats_count(const char*name, double points, double pixels, double bytes);
+
+/* write all entries, as JSON */
+void stats_write_json(FILE*fi);
+int stats_save(const char*filename);
+
+void stats_clear();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__stats_h__
@@ -49,6 +49,8 @@ static struct options_t options[] = {
 {"q", "quiet"},
 {"C", "cgi"},
 {"R", "resolve"},
+{"O", "optimize"},
+{"c", "cache"},
 {"D", "define"},
 {"X", "width"},
 {"Y", "height"},
@@ -118,6 +120,14 @@ int args_callback_option(char*name,char*val)
         as3_set_option("recurse","1");
 	return 0;
     }
+    else if(!strcmp(name, "O")) {
+        as3_set_option("optimize","1");
+	return 0;
+    }
+    else if(!strcmp(name, "c")) {
+        as3_set_option("cachedir",val);
+	return 1;
+    }
     else if(!strcmp(name, "D")) {
         if(!strstr(val, "::")) {
             fprintf(stderr, "Error: compile definition must contain \"::\"\n");
@@ -157,6 +167,8 @@ void args_callback_usage(char *name)
     printf("-q , --quiet                   Decrease verbosity\n");
     printf("-C , --cgi                     Output to stdout (for use in CGI environments)\n");
     printf("-R , --resolve                 Try to resolve undefined classes automatically.\n");
+    printf("-O , --optimize                Run a peephole optimizer over the generated bytecode\n");
+    printf("-c , --cache <dir>             Keep compiled source files in directory <dir>, and reuse them\n");
     printf("-D , --define <namespace::variable>    Set a compile time variable (for doing conditional compilation)\n");
     printf("-X , --width                   Set target SWF width\n");
     printf("-Y , --height                  Set target SWF width\n");
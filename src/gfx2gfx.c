@@ -41,10 +41,12 @@
 #endif
 #include "../../swftools/lib/devices/rescale.h"
 #include "../../swftools/lib/devices/record.h"
+#include "../../swftools/lib/devices/stats.h"
 #include "../../swftools/lib/readers/image.h"
 #include "../../swftools/lib/readers/swf.h"
 #include "../../swftools/lib/pdf/pdf.h"
 #include "../../swftools/lib/log.h"
+#include "../../swftools/lib/stats.h"
 
 static gfxsource_t*driver = 0;
 
@@ -54,6 +56,7 @@ static char * maxdpi = "72";
 static char * pagerange = 0;
 static char * filename = 0;
 static const char * format = 0;
+static char * statsfile = 0;
 
 int args_callback_option(char*name,char*val) {
     if (!strcmp(name, "o"))
@@ -114,6 +117,12 @@ int args_callback_option(char*name,char*val) {
         free(s);
 	return 1;
     }
+    else if (!strcmp(name, "T"))
+    {
+	statsfile = val;
+	stats_enable(1);
+	return 1;
+    }
     else if (!strcmp(name, "V"))
     {	
 	printf("gfx2gfx - part of %s %s\n", PACKAGE, VERSION);
@@ -134,6 +143,7 @@ struct options_t options[] =
  {"s","set"},
  {"r","resolution"},
  {"p","pages"},
+ {"T","stats"},
  {0,0}
 };
 
@@ -227,6 +237,11 @@ int main(int argn, char *argv[])
         gfxdevice_rescale_init(&rescale, &lrf, 592, 732, 0);
 
         gfxdevice_t*out = &rescale;
+        gfxdevice_t stats;
+        if(statsfile) {
+            gfxdevice_stats_init(&stats, out, "lrf");
+            out = &stats;
+        }
         out->setparameter(out, "keepratio", "1");
         out->setparameter(out, "pagepattern", outputname);
 
@@ -272,6 +287,12 @@ int main(int argn, char *argv[])
 	    msg("<error> Invalid output format: %s", format);
 	    exit(1);
 	}
+
+        gfxdevice_t stats;
+        if(statsfile) {
+            gfxdevice_stats_init(&stats, out, format);
+            out = &stats;
+        }
 	    
 	out->setparameter(out, "maxdpi", maxdpi);
 
@@ -290,15 +311,23 @@ int main(int argn, char *argv[])
     }
 
     if(result) {
+	stats_timer_t timer;
+	stats_timer_start(&timer, "result.save");
 	if(result->save(result, outputname) < 0) {
 	    exit(1);
 	}
+	stats_timer_stop(&timer);
 	result->destroy(result);
     }
 
     doc->destroy(doc);
 
     driver->destroy(driver);
+
+    if(statsfile) {
+	stats_save(statsfile);
+	stats_clear();
+    }
     return 0;
 }
 
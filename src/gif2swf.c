@@ -28,6 +28,7 @@
 #include <gif_lib.h>
 #include "../lib/rfxswf.h"
 #include "../lib/args.h"
+#include "../lib/pipeline.h"
 
 #define MAX_INPUT_FILES 1024
 #define VERBOSE(x) (global.verbose>=x)
@@ -47,6 +48,7 @@ static struct {
     char *outfile;
     int imagecount;
     int loopcount;
+    int jobs;
 } global;
 
 struct {
@@ -194,12 +196,21 @@ int MovieFinish(SWF * swf, TAG * t, char *sname)
     return 0;
 }
 
-TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int id, int imgidx)
+typedef struct _imagetag {
+    TAG *tag;                   // the bitmap tag (not yet linked)
+    GifFileType *gft;
+    struct gif_header header;
+} imagetag_t;
+
+/* Decode one frame of a GIF file into a bitmap tag. This runs on the
+   worker threads if -J is given. */
+static void *MovieLoadImage(int nr, void *user)
 {
-    SHAPE *s;
-    SRECT r;
-    MATRIX m;
-    int fs;
+    int numframes = global.imagecount > 1 ? global.imagecount : 1;
+    char *sname = image[nr / numframes].filename;
+    int imgidx = nr % numframes;
+    int id = imgidx ? (imgidx * 2) + 1 : ((nr / numframes) * 2) + 1;
+    imagetag_t *it = (imagetag_t *) calloc(1, sizeof(imagetag_t));
 
     U8 *imagedata, *from, *to;
     GifImageDesc *img;
@@ -216,9 +227,6 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int id, int imgidx)
     GifColorType c;
     int interlacedOffset[] = { 0, 4, 2, 1 };    // The way Interlaced image should
     int interlacedJumps[] = { 8, 8, 4, 2 };     // be read - offsets and jumps...
-    U16 delay, depth;
-    int disposal;
-    char *as_lastframe;
 
     GifFileType *gft;
     FILE *fi;
@@ -227,7 +235,7 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int id, int imgidx)
     if ((fi = fopen(sname, "rb")) == NULL) {
         if (VERBOSE(1))
             fprintf(stderr, "Read access failed: %s\n", sname);
-        return t;
+        return it;
     }
     fclose(fi);
 
@@ -238,7 +246,7 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int id, int imgidx)
 #endif
     if (gft == NULL) {
         fprintf(stderr, "%s is not a GIF file!\n", sname);
-        return t;
+        return it;
     }
 
     if ((ret = DGifSlurp(gft)) != GIF_OK) {
@@ -249,7 +257,7 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int id, int imgidx)
 #else
         fprintf(stderr, "GIF-LIB: %s\n", GifErrorString(ret));
 #endif
-        return t;
+        return it;
     }
 
     header.width = gft->SWidth;
@@ -300,8 +308,8 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int id, int imgidx)
         }
     }
 
-    t = swf_InsertTag(t, bpp == 4 ? ST_DEFINEBITSLOSSLESS2 : ST_DEFINEBITSLOSSLESS);
-    swf_SetU16(t, id);          // id
+    it->tag = swf_InsertTag(0, bpp == 4 ? ST_DEFINEBITSLOSSLESS2 : ST_DEFINEBITSLOSSLESS);
+    swf_SetU16(it->tag, id);    // id
 
     // Ah! The Flash specs says scanlines must be DWORD ALIGNED!
     // (but image width is the correct number of pixels)
@@ -364,7 +372,36 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int id, int imgidx)
                 }
         }
     }
-    swf_SetLosslessBitsIndexed(t, header.width, header.height, imagedata, pal, 256);
+    swf_SetLosslessBitsIndexed(it->tag, header.width, header.height, imagedata, pal, 256);
+
+    free(pal);
+    free(imagedata);
+
+    it->gft = gft;
+    it->header = header;
+    return it;
+}
+
+TAG *MovieAddFrame(SWF * swf, TAG * t, imagetag_t * it, int id, int imgidx)
+{
+    SHAPE *s;
+    SRECT r;
+    MATRIX m;
+    int fs;
+    GifFileType *gft = it->gft;
+    struct gif_header header = it->header;
+    U16 delay, depth;
+    int disposal;
+    char *as_lastframe;
+
+    if (!it->tag) {
+        free(it);
+        return t;
+    }
+    it->tag->prev = t;
+    t->next = it->tag;
+    t = it->tag;
+    free(it);
 
     t = swf_InsertTag(t, ST_DEFINESHAPE);
 
@@ -468,9 +505,6 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int id, int imgidx)
         }
     }
 
-    free(pal);
-    free(imagedata);
-
 #if GIFLIB_MAJOR == 5 && GIFLIB_MINOR >= 1 || GIFLIB_MAJOR > 5
     DGifCloseFile(gft, D_GIF_SUCCEEDED);
 #else
@@ -617,6 +651,11 @@ int args_callback_option(char *arg, char *val)
             res = 1;
             break;
 
+        case 'J':
+            global.jobs = atoi(val);
+            res = 1;
+            break;
+
         case 'V':
             printf("gif2swf - part of %s %s\n", PACKAGE, VERSION);
             exit(0);
@@ -645,6 +684,7 @@ static struct options_t options[] = {
 {"v", "verbose"},
 {"C", "cgi"},
 {"V", "version"},
+{"J", "jobs"},
 {0,0}
 };
 
@@ -688,6 +728,7 @@ void args_callback_usage(char *name)
     printf("-v , --verbose <level>         Set verbose level (0=quiet, 1=default, 2=debug)\n");
     printf("-C , --cgi                     For use as CGI- prepend http header, write to stdout\n");
     printf("-V , --version                 Print version information and exit\n");
+    printf("-J , --jobs <num>              Decode images on <num> threads\n");
     printf("\n");
 }
 
@@ -722,14 +763,19 @@ int main(int argc, char **argv)
                    global.force_height ? global.force_height : global.max_image_height);
     {
         int i, j;
+        int numframes = global.imagecount > 1 ? global.imagecount : 1;
+        /* the frames are decoded in parallel, but the movie itself is
+           assembled in input order, so the output doesn't depend on -J */
+        pipeline_t *p = pipeline_new(global.nfiles * numframes, global.jobs, global.jobs * 2, MovieLoadImage, 0);
         for (i = 0; i < global.nfiles; i++) {
             if (VERBOSE(3))
                 fprintf(stderr, "[%03i] %s\n", i, image[i].filename);
-            t = MovieAddFrame(&swf, t, image[i].filename, (i * 2) + 1, 0);
+            t = MovieAddFrame(&swf, t, (imagetag_t *) pipeline_get(p, i * numframes), (i * 2) + 1, 0);
             for (j = 2; j <= global.imagecount; j++)
-                t = MovieAddFrame(&swf, t, image[i].filename, (j * 2) - 1, j - 1);
+                t = MovieAddFrame(&swf, t, (imagetag_t *) pipeline_get(p, i * numframes + j - 1), (j * 2) - 1, j - 1);
             free(image[i].filename);
         }
+        pipeline_destroy(p);
     }
 
     MovieFinish(&swf, t, global.outfile);
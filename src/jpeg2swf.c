@@ -27,6 +27,7 @@
 #include <jpeglib.h>
 #include "../lib/rfxswf.h"
 #include "../lib/args.h"	// not really a header ;-)
+#include "../lib/pipeline.h"
 
 #define MAX_INPUT_FILES 1024
 #define VERBOSE(x) (global.verbose>=x)
@@ -47,6 +48,7 @@ static struct {
     int version;
     int fit_to_movie;
     float scale;
+    int jobs;
 } global;
 
 static int custom_move=0;
@@ -228,8 +230,31 @@ int getJPEG(char*filename, int* width, int* height, RGBA**pic2)
 }
 
 
+typedef struct _imagetag {
+    TAG*tag;     // the bitmap tag (not yet linked)
+    RGBA*pic;    // the decoded image, for -M
+    int width, height;
+} imagetag_t;
+
+/* Decode an image (-M) or recompress it into a bitmap tag. This runs
+   on the worker threads if -J is given. The bitmap id is filled in by
+   MovieAddFrame, which hands out all the ids. */
+static void* MovieLoadImage(int nr, void*user)
+{
+    image_t*img = &image[nr];
+    imagetag_t*i = (imagetag_t*)calloc(1, sizeof(imagetag_t));
+    if(global.mx) {
+	getJPEG(img->filename, &i->width, &i->height, &i->pic);
+    } else {
+	i->tag = swf_InsertTag(0, ST_DEFINEBITSJPEG2);
+	swf_SetU16(i->tag, 0);		// id
+	swf_SetJPEGBits(i->tag, img->filename, img->quality);
+    }
+    return i;
+}
+
 int frame = 0;
-TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int quality, 
+TAG *MovieAddFrame(SWF * swf, TAG * t, imagetag_t*i, int quality, 
 		   int width, int height)
 {
     SHAPE *s;
@@ -240,11 +265,10 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int quality,
     int movie_height = swf->movieSize.ymax - swf->movieSize.ymin;
 
     if(global.mx) {
-	int sizex, sizey;
-	RGBA * pic2;
+	int sizex = i->width, sizey = i->height;
+	RGBA * pic2 = i->pic;
 	SWFPLACEOBJECT obj;
 	int quant=0;
-	getJPEG(sname, &sizex, &sizey, &pic2);
 	if(sizex != stream.owidth || sizey != stream.oheight) {
 	    fprintf(stderr, "All images must have the same dimensions if using -m!");
 	    exit(1);
@@ -258,6 +282,7 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int quality,
 	} else {
 	    swf_SetVideoStreamPFrame(t, &stream, pic2, quant);
 	}
+	free(pic2);
 
 	t = swf_InsertTag(t, ST_PLACEOBJECT2);
 	swf_GetPlaceObject(0, &obj);
@@ -273,9 +298,10 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int quality,
 
 	t = swf_InsertTag(t, ST_SHOWFRAME);
     } else {
-	t = swf_InsertTag(t, ST_DEFINEBITSJPEG2);
-	swf_SetU16(t, global.next_id);		// id
-	swf_SetJPEGBits(t,sname,quality);
+	PUT16(i->tag->data, global.next_id);
+	i->tag->prev = t;
+	t->next = i->tag;
+	t = i->tag;
 
 	t = swf_InsertTag(t, ST_DEFINESHAPE);
 	swf_ShapeNew(&s);
@@ -329,6 +355,7 @@ TAG *MovieAddFrame(SWF * swf, TAG * t, char *sname, int quality,
 	t = swf_InsertTag(t, ST_SHOWFRAME);
     }
     frame++;
+    free(i);
 
     return t;
 }
@@ -522,6 +549,12 @@ int args_callback_option(char *arg, char *val)
 	    break;
 	}
 
+	case 'J': {
+	    global.jobs = atoi(val);
+	    res = 1;
+	    break;
+	}
+
 	default:
 	    res = -1;
 	    break;
@@ -551,6 +584,7 @@ static struct options_t options[] = {
 {"V", "version"},
 {"f", "fit-to-movie"},
 {"e", "export"},
+{"J", "jobs"},
 {0,0}
 };
 
@@ -599,6 +633,7 @@ void args_callback_usage(char *name)
     printf("-V , --version                 Print version information and exit\n");
     printf("-f , --fit-to-movie            Fit images to movie size\n");
     printf("-e , --export <assetname>          Make importable as asset with <assetname>\n");
+    printf("-J , --jobs <num>              Decode and compress images on <num> threads\n");
     printf("\n");
 }
 
@@ -630,14 +665,18 @@ int main(int argc, char **argv)
 
     {
 	int i;
+	/* the images are decoded in parallel, but the movie itself is
+	   assembled in input order, so the output doesn't depend on -J */
+	pipeline_t*p = pipeline_new(global.nfiles, global.jobs, global.jobs*2, MovieLoadImage, 0);
 	for (i = 0; i < global.nfiles; i++) {
 	    if (VERBOSE(3))
 		fprintf(stderr, "[%03i] %s (%i%%)\n", i,
 			image[i].filename, image[i].quality);
-	    t = MovieAddFrame(&swf, t, image[i].filename, image[i].quality,
+	    t = MovieAddFrame(&swf, t, (imagetag_t*)pipeline_get(p, i), image[i].quality,
 			      image[i].width, image[i].height);
 	    free(image[i].filename);
 	}
+	pipeline_destroy(p);
     }
 
     MovieFinish(&swf, t, global.outfile);
@@ -36,6 +36,16 @@
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
 #endif
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
 
 #include "../lib/args.h"
 #include "../lib/os.h"
@@ -44,9 +54,12 @@
 #include "../lib/devices/polyops.h"
 #include "../lib/devices/record.h"
 #include "../lib/devices/rescale.h"
+#include "../lib/devices/stats.h"
 #include "../lib/gfxfilter.h"
 #include "../lib/pdf/pdf.h"
 #include "../lib/log.h"
+#include "../lib/stats.h"
+#include "../lib/utf8.h"
 
 #define SWFDIR concatPaths(getInstallationPath(), "swfs")
 
@@ -74,6 +87,9 @@ static int max_time = 0;
 static int flatten = 0;
 
 static char* filters = 0;
+static char* statsfile = 0;
+
+static char* daemon_socket = 0;
 
 char* fontpaths[256];
 int fontpathpos = 0;
@@ -266,7 +282,13 @@ int args_callback_option(char*name,char*val) {
 	if(c && *c && c[1])  {
 	    *c = 0;
 	    c++;
-	    store_parameter(s,c);
+	    if(!strcmp(s, "filtermemory")) {
+		gfxdevice_record_setmaxmemory(atoi(c)*1024);
+	    } else if(!strcmp(s, "logbuffer")) {
+		setLogBuffer(atoi(c));
+	    } else {
+		store_parameter(s,c);
+	    }
 	} else if(!strcmp(s,"help")) {
 	    printf("PDF Parameters:\n");
 	    gfxsource_t*pdf = gfxsource_pdf_create();
@@ -275,6 +297,10 @@ int args_callback_option(char*name,char*val) {
 	    gfxdevice_swf_init(&swf);
 	    printf("SWF Parameters:\n");
 	    swf.setparameter(&swf, "help", "");
+	    printf("Filter Parameters:\n");
+	    printf("filtermemory=<kb>  memory two-pass filters may use before buffering to disk (default: 32768)\n");
+	    printf("Logging Parameters:\n");
+	    printf("logbuffer=<kb>     write log messages from a separate thread, using a buffer of this size\n");
 	    exit(0);
 	} else {
 	    store_parameter(s,"1");
@@ -301,6 +327,11 @@ int args_callback_option(char*name,char*val) {
 # endif
 	return 1;
     }
+    else if (!strcmp(name, "D"))
+    {
+	daemon_socket = val;
+	return 1;
+    }
 #endif
     else if (!strcmp(name, "z"))
     {
@@ -449,6 +480,12 @@ int args_callback_option(char*name,char*val) {
 	printf("pdf2swf - part of %s %s\n", PACKAGE, VERSION);
 	exit(0);
     }
+    else if (!strcmp(name, "stats"))
+    {
+	statsfile = val;
+	stats_enable(1);
+	return 1;
+    }
     else 
     {
 	fprintf(stderr, "Unknown option: -%s\n", name);
@@ -485,6 +522,8 @@ static struct options_t options[] = {
 {"Q", "maxtime"},
 {"X", "width"},
 {"Y", "height"},
+{"stats", "stats"},
+{"D", "daemon"},
 {0,0}
 };
 
@@ -536,31 +575,74 @@ void args_callback_usage(char *name)
     printf("-G , --flatten                 Remove as many clip layers from file as possible. \n");
     printf("-I , --info                    Don't do actual conversion, just display a list of all pages in the PDF.\n");
     printf("-Q , --maxtime n               Abort conversion after n seconds. Only available on Unix.\n");
+    printf("     --stats file              Write timings and counters for each conversion stage to file (as JSON, - for stdout).\n");
+    printf("-D , --daemon socket           Convert the jobs read from the UNIX domain socket (or stdin, for -). Only available on Unix.\n");
+    printf("\n");
+    printf("In daemon mode, every line is one job, like\n");
+    printf("    {\"input\": \"file.pdf\", \"output\": \"file.swf\", \"args\": [\"-z\", \"-j\", \"50\"], \"maxmemory\": 512}\n");
+    printf("args are added to the options given on the command line, and maxmemory (megabytes)\n");
+    printf("limits the memory of the job. For every job, a line with its exit status, the time it\n");
+    printf("took and its peak memory use (maxrss, in kilobytes) is written back.\n");
     printf("\n");
 }
 
-float getRate(char*filename)
+static SWF* read_swf(const char*filename)
 {
-    int fi;
-    SWF swf;
-    fi = open(filename,O_RDONLY|O_BINARY);
+    SWF*swf = (SWF*)rfx_calloc(sizeof(SWF));
+    int fi = open(filename,O_RDONLY|O_BINARY);
     if(fi<0) { 
 	char buffer[256];
 	sprintf(buffer, "Couldn't open %s", filename);
         perror(buffer);
         exit(1);
     }
-    if(swf_ReadSWF(fi,&swf) < 0)
+    if(swf_ReadSWF(fi,swf) < 0)
     { 
         fprintf(stderr, "%s is not a valid SWF file or contains errors.\n",filename);
         close(fi);
         exit(1);
     }
-    swf_FreeTags(&swf);
-    return swf.frameRate / 256.0;
+    close(fi);
+    swf_CombinePrepare(swf);
+    return swf;
 }
 
-void show_info(gfxsource_t*driver, char*filename)
+/* swf->frameCount is only set by swf_ReadSWF()/swf_WriteSWF(), but the
+   combiner needs it for SWFs which are still in memory, too */
+static int count_frames(SWF*swf)
+{
+    TAG*tag = swf->firstTag;
+    int frames = 0, insprite = 0;
+    while(tag) {
+	if(tag->id == ST_DEFINESPRITE && !swf_IsFolded(tag)) insprite++;
+	else if(tag->id == ST_END && insprite) insprite--;
+	else if(tag->id == ST_END && !insprite) {
+	    if(tag->prev && tag->prev->id!=ST_SHOWFRAME)
+		frames++;
+	}
+	else if(tag->id == ST_SHOWFRAME && !insprite) frames++;
+	tag = tag->next;
+    }
+    return frames;
+}
+
+/* replace the object named slavename in master by slave, like swfcombine(1) does.
+   master and slave are freed. */
+static SWF* combine_swf(SWF*master, const char*slavename, SWF*slave, COMBINEOPTIONS*options)
+{
+    SWF*newswf = (SWF*)rfx_calloc(sizeof(SWF));
+    if(swf_Combine(master, slavename, slave, newswf, options)<0) {
+	msg("<fatal> Couldn't combine the pages with the viewer");
+	exit(1);
+    }
+    swf_FreeTags(master);free(master);
+    swf_FreeTags(slave);free(slave);
+    if(!newswf->fileVersion)
+	newswf->fileVersion = 4;
+    return newswf;
+}
+
+void show_info(gfxsource_t*driver, const char*filename)
 {
     gfxdocument_t* pdf = driver->open(driver, filename);
     int pagenr;
@@ -589,7 +671,7 @@ void show_info(gfxsource_t*driver, char*filename)
 }
 
 
-static gfxdevice_t swf,wrap,rescale;
+static gfxdevice_t swf,wrap,rescale,swfstats,outstats;
 gfxdevice_t*create_output_device()
 {
     gfxdevice_swf_init(&swf);
@@ -597,6 +679,11 @@ gfxdevice_t*create_output_device()
     /* set up filter chain */
 	
     out = &swf;
+    if(statsfile) {
+	gfxdevice_stats_init(&swfstats, out, "swf");
+	out = &swfstats;
+    }
+    gfxdevice_t*last = out;
     if(flatten) {
         gfxdevice_removeclippings_init(&wrap, &swf);
         out = &wrap;
@@ -617,6 +704,12 @@ gfxdevice_t*create_output_device()
 	gfxfilterchain_destroy(chain);
     }
 
+    if(statsfile && out != last) {
+	/* measure the filters, too */
+	gfxdevice_stats_init(&outstats, out, "output");
+	out = &outstats;
+    }
+
     /* pass global parameters to output device */
     parameter_t*p = device_config;
     while(p) {
@@ -626,42 +719,10 @@ gfxdevice_t*create_output_device()
     return out;
 }
 
-int main(int argn, char *argv[])
+/* convert filename to outputname, using the current options */
+static int convert()
 {
-    int ret;
-    char buf[256];
-    int numfonts = 0;
-    int t;
-    char t1searchpath[1024];
-    int nup_pos = 0;
-    int x,y;
     int one_file_per_page = 0;
-    
-    initLog(0,-1,0,0,-1,loglevel);
-
-    /* not needed anymore since fonts are embedded
-       if(installPath) {
-	fontpaths[fontpathpos++] = concatPaths(installPath, "fonts");
-    }*/
-
-#ifdef HAVE_SRAND48
-    srand48(time(0)*getpid());
-#else
-#ifdef HAVE_SRAND
-    srand(time(0)*getpid());
-#endif
-#endif
-
-    processargs(argn, argv);
-    
-    driver = gfxsource_pdf_create();
-    
-    /* pass global parameters to PDF driver*/
-    parameter_t*p = device_config;
-    while(p) {
-	driver->setparameter(driver, p->name, p->value);
-	p = p->next;
-    }
 
     if(!filename)
     {
@@ -688,27 +749,22 @@ int main(int argn, char *argv[])
     // test if the page range is o.k.
     is_in_range(0x7fffffff, pagerange);
 
-    if (!filename) {
-	args_callback_usage(argv[0]);
-	exit(0);
-    }
-    
-    char fullname[256];
+    /* the pdf reader takes the password appended to the filename */
+    char*fullname = 0;
+    const char*openname = filename;
     if(password && *password) {
-	sprintf(fullname, "%s|%s", filename, password);
-	filename = fullname;
+	int len = strlen(filename)+strlen(password)+2;
+	fullname = (char*)malloc(len);
+	snprintf(fullname, len, "%s|%s", filename, password);
+	openname = fullname;
     }
     
     if(pagerange)
 	driver->setparameter(driver, "pages", pagerange);
 
-    /* add fonts */
-    for(t=0;t<fontpathpos;t++) {
-	driver->setparameter(driver, "fontdir", fontpaths[t]);
-    }
-
     if(info_only) {
-	show_info(driver, filename);
+	show_info(driver, openname);
+	free(fullname);
 	return 0;
     }
     if(!strchr(outputname, '\\')){
@@ -717,10 +773,12 @@ int main(int argn, char *argv[])
 		if(strchr(u+1, '%') || 
 		   strchr(outputname, '%')!=u)  {
 		    msg("<error> only one %% allowed in filename\n");
+		    free(fullname);
 		    return 1;
 		}
 		if(preloader || viewer) {
 		    msg("<error> -b/-l/-B/-L not supported together with %% in filename\n");
+		    free(fullname);
 		    return 1;
 		}
 		msg("<notice> outputting one file per page");
@@ -735,13 +793,14 @@ int main(int argn, char *argv[])
 	    }
     }
 
-    gfxdocument_t* pdf = driver->open(driver, filename);
+    gfxdocument_t* pdf = driver->open(driver, openname);
+    free(fullname);fullname = 0;
     if(!pdf) {
         msg("<error> Couldn't open %s", filename);
         exit(1);
     }
     /* pass global parameters document */
-    p = device_config;
+    parameter_t*p = device_config;
     while(p) {
 	pdf->setparameter(pdf, p->name, p->value);
 	p = p->next;
@@ -863,49 +922,526 @@ int main(int argn, char *argv[])
 	result->destroy(result);result=0;
     } else {
 	gfxresult_t*result = out->finish(out);
-	msg("<notice> Writing SWF file %s", outputname);
-	if(result->save(result, outputname) < 0) {
-	    exit(1);
-	}
-	int width = (int)(ptroff_t)result->get(result, "width");
-	int height = (int)(ptroff_t)result->get(result, "height");
-	result->destroy(result);result=0;
-
-	if(preloader || viewer) {
-	    const char*zip = "";
-	    if(zlib) {
-		zip = "-z";
+	if(!preloader && !viewer) {
+	    msg("<notice> Writing SWF file %s", outputname);
+	    if(result->save(result, outputname) < 0) {
+		exit(1);
 	    }
-	    if(!preloader && viewer) {
-		systemf("swfcombine %s -X %d -Y %d \"%s\" viewport=\"%s\" -o \"%s\"",zip,width,height,
-			viewer, outputname, outputname);
-		if(!system_quiet)
-		    printf("\n");
+	    result->destroy(result);result=0;
+	} else {
+	    /* link viewer and/or preloader directly to the SWF in memory, instead
+	       of writing it out and running swfcombine on it */
+	    int width = (int)(ptroff_t)result->get(result, "width");
+	    int height = (int)(ptroff_t)result->get(result, "height");
+	    SWF*swf = (SWF*)result->get(result, "swf");
+	    result->destroy(result);result=0;
+	    swf->frameCount = count_frames(swf);
+	    swf_CombinePrepare(swf);
+
+	    COMBINEOPTIONS options;
+	    swf_CombineOptionsInit(&options);
+	    if(viewer) {
+		msg("<notice> Adding viewer %s", viewer);
+		if(!preloader) {
+		    options.sizex = width*20;options.hassizex = 1;
+		    options.sizey = height*20;options.hassizey = 1;
+		}
+		swf = combine_swf(read_swf(viewer), "viewport", swf, &options);
 	    }
-	    if(preloader && !viewer) {
-		msg("<warning> --preloader option without --viewer option doesn't make very much sense.");
-		ret = systemf("swfcombine %s -Y %d -X %d %s/PreLoaderTemplate.swf loader=\"%s\" movie=\"%s\" -o \"%s\"",zip,width,height,
-			SWFDIR, preloader, outputname, outputname);
-		if(!system_quiet)
-		    printf("\n");
+	    if(preloader) {
+		if(!viewer) {
+		    msg("<warning> --preloader option without --viewer option doesn't make very much sense.");
+		}
+		msg("<notice> Adding preloader %s", preloader);
+		char buf[256];
+		sprintf(buf, "%s/PreLoaderTemplate.swf", SWFDIR);
+		SWF*loader = read_swf(preloader);
+		options.sizex = width*20;options.hassizex = 1;
+		options.sizey = height*20;options.hassizey = 1;
+		if(viewer)
+		    options.framerate = loader->frameRate;
+		SWF*loadertemplate = combine_swf(read_swf(buf), "loader", loader, &options);
+		swf = combine_swf(loadertemplate, "movie", swf, &options);
 	    }
-	    if(preloader && viewer) {
-#ifdef HAVE_MKSTEMP
-		char tmpname[] = "__swf__XXXXXX";
-		mkstemp(tmpname);
-#else 
-		char*tmpname = "__tmp__.swf";
-#endif
-		systemf("swfcombine \"%s\" viewport=%s -o %s",
-			viewer, outputname, tmpname);
-		systemf("swfcombine %s -X %d -Y %d -r %f %s/PreLoaderTemplate.swf loader=%s movie=%s -o \"%s\"",zip,width,height,
-			getRate(preloader), SWFDIR, preloader, tmpname, outputname);
-		systemf("rm %s", tmpname);
+	    if(zlib) {
+		if(swf->fileVersion < 6)
+		    swf->fileVersion = 6;
+		swf->compressed = 1;
+	    } else {
+		swf->compressed = -1; // don't compress
 	    }
+	    msg("<notice> Writing SWF file %s", outputname);
+	    int fi = open(outputname, O_BINARY|O_CREAT|O_TRUNC|O_WRONLY, 0777);
+	    if(fi<0) {
+		msg("<fatal> Could not create \"%s\". ", outputname);
+		exit(1);
+	    }
+	    swf_WriteSWF(fi, swf);
+	    close(fi);
+	    swf_FreeTags(swf);free(swf);
 	}
     }
 
     pdf->destroy(pdf);
+
+    if(statsfile) {
+	stats_save(statsfile);
+	stats_clear();
+    }
+    return 0;
+}
+
+#ifndef WIN32
+/* Daemon mode: The global state (xpdf's GlobalParams, the standard fonts,
+   fontconfig) is set up once, and every job then runs in a child process
+   forked off from that state. Per-document state is thus discarded by
+   simply exiting, and a failing (or crashing) document can't take the
+   daemon down with it. */
+
+typedef struct _job {
+    char*input;
+    char*output;
+    char**args;
+    int num_args;
+    int maxmemory; // in megabytes
+} job_t;
+
+static volatile int daemon_stop = 0;
+static int daemon_listen = -1;
+
+static void daemon_sigterm(int signal)
+{
+    daemon_stop = 1;
+}
+
+static const char* json_space(const char*s)
+{
+    while(*s==' ' || *s=='\t' || *s=='\r' || *s=='\n')
+	s++;
+    return s;
+}
+
+static int json_hex4(const char*s)
+{
+    int t, c = 0;
+    for(t=0;t<4;t++) {
+	if(s[t]>='0' && s[t]<='9') c = c*16 + s[t]-'0';
+	else if(s[t]>='a' && s[t]<='f') c = c*16 + s[t]-'a'+10;
+	else if(s[t]>='A' && s[t]<='F') c = c*16 + s[t]-'A'+10;
+	else return -1;
+    }
+    return c;
+}
+
+/* parse a string, and store it (as utf-8) in *str. Returns the position
+   after the string, or 0 if there is no valid string at s */
+static const char* json_string(const char*s, char**str)
+{
+    char*d;
+    *str = 0;
+    if(*s!='"')
+	return 0;
+    s++;
+    /* escape sequences never get longer when decoded */
+    d = *str = (char*)malloc(strlen(s)+1);
+    while(*s!='"') {
+	if(!*s)
+	    goto error;
+	if(*s!='\\') {
+	    *d++ = *s++;
+	    continue;
+	}
+	s++;
+	switch(*s) {
+	    case 'b': *d++ = '\b';break;
+	    case 'f': *d++ = '\f';break;
+	    case 'n': *d++ = '\n';break;
+	    case 'r': *d++ = '\r';break;
+	    case 't': *d++ = '\t';break;
+	    case '"': case '\\': case '/': *d++ = *s;break;
+	    case 'u': {
+		int c = json_hex4(s+1);
+		if(c<0)
+		    goto error;
+		s+=4;
+		if(c>=0xd800 && c<0xdc00 && s[1]=='\\' && s[2]=='u') {
+		    int c2 = json_hex4(s+3);
+		    if(c2>=0xdc00 && c2<0xe000) {
+			c = 0x10000 + ((c-0xd800)<<10) + (c2-0xdc00);
+			s+=6;
+		    }
+		}
+		d += writeUTF8(c, d);
+		break;
+	    }
+	    default:
+		goto error;
+	}
+	s++;
+    }
+    *d = 0;
+    return s+1;
+error:
+    free(*str);*str = 0;
+    return 0;
+}
+
+/* skip a value we're not interested in */
+static const char* json_skip(const char*s)
+{
+    int depth = 0;
+    do {
+	if(*s=='"') {
+	    char*str;
+	    if(!(s = json_string(s, &str)))
+		return 0;
+	    free(str);
+	    continue;
+	}
+	if(*s=='{' || *s=='[') {
+	    depth++;
+	} else if(*s=='}' || *s==']') {
+	    depth--;
+	} else if(!*s || (!depth && strchr(", \t\r\n", *s))) {
+	    break;
+	}
+	s++;
+    } while(depth>0 || (*s && !strchr(",}] \t\r\n", *s)));
+    return depth?0:s;
+}
+
+static const char* json_args(const char*s, job_t*job)
+{
+    if(*s!='[')
+	return 0;
+    s = json_space(s+1);
+    while(*s!=']') {
+	char*arg;
+	if(!(s = json_string(s, &arg)))
+	    return 0;
+	job->args = (char**)realloc(job->args, sizeof(char*)*(job->num_args+1));
+	job->args[job->num_args++] = arg;
+	s = json_space(s);
+	if(*s==',')
+	    s = json_space(s+1);
+	else if(*s!=']')
+	    return 0;
+    }
+    return s+1;
+}
+
+static void job_free(job_t*job)
+{
+    int t;
+    free(job->input);
+    free(job->output);
+    for(t=0;t<job->num_args;t++)
+	free(job->args[t]);
+    free(job->args);
+    memset(job, 0, sizeof(job_t));
+}
+
+static int job_parse(const char*line, job_t*job)
+{
+    const char*s = json_space(line);
+    memset(job, 0, sizeof(job_t));
+    if(*s!='{')
+	return 0;
+    s = json_space(s+1);
+    while(*s!='}') {
+	char*key;
+	if(!(s = json_string(s, &key)))
+	    return 0;
+	s = json_space(s);
+	if(*s!=':') {
+	    free(key);
+	    return 0;
+	}
+	s = json_space(s+1);
+	if(!strcmp(key, "input")) {
+	    free(job->input);
+	    s = json_string(s, &job->input);
+	} else if(!strcmp(key, "output")) {
+	    free(job->output);
+	    s = json_string(s, &job->output);
+	} else if(!strcmp(key, "args")) {
+	    s = json_args(s, job);
+	} else if(!strcmp(key, "maxmemory")) {
+	    char*end;
+	    job->maxmemory = (int)strtod(s, &end);
+	    s = end!=s ? end : 0;
+	} else {
+	    s = json_skip(s);
+	}
+	free(key);
+	if(!s)
+	    return 0;
+	s = json_space(s);
+	if(*s==',')
+	    s = json_space(s+1);
+	else if(*s!='}')
+	    return 0;
+    }
+    return job->input!=0;
+}
+
+static void json_write_string(FILE*fo, const char*s)
+{
+    fputc('"', fo);
+    for(;*s;s++) {
+	if(*s=='"' || *s=='\\')
+	    fprintf(fo, "\\%c", *s);
+	else if((unsigned char)*s < 32)
+	    fprintf(fo, "\\u%04x", *s);
+	else
+	    fputc(*s, fo);
+    }
+    fputc('"', fo);
+}
+
+/* runs in the forked child. Never returns. */
+static void job_run(job_t*job, int jobfd, int logbuffer)
+{
+    int old_fontpathpos = fontpathpos;
+    int null = open("/dev/null", O_RDONLY);
+    int t;
+
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    /* temporary filenames are random, so don't inherit the daemon's seed */
+#ifdef HAVE_SRAND48
+    srand48(time(0)*getpid());
+#else
+#ifdef HAVE_SRAND
+    srand(time(0)*getpid());
+#endif
+#endif
+
+    /* the daemon keeps reading jobs from this stream, so make sure exit()
+       can't reposition it. Log messages go to stderr, so that they don't
+       end up between the job results on stdout. */
+    dup2(null, jobfd);
+    close(null);
+    if(daemon_listen>=0)
+	close(daemon_listen);
+    dup2(2, 1);
+    if(logbuffer)
+	setLogBuffer(logbuffer);
+
+    if(job->maxmemory>0) {
+	struct rlimit limit;
+	limit.rlim_cur = limit.rlim_max = (rlim_t)job->maxmemory*1048576;
+	if(setrlimit(RLIMIT_AS, &limit) < 0)
+	    msg("<warning> Couldn't limit memory to %d Mb", job->maxmemory);
+    }
+
+    if(job->num_args) {
+	char**argv = (char**)malloc(sizeof(char*)*(job->num_args+1));
+	argv[0] = "pdf2swf";
+	memcpy(&argv[1], job->args, sizeof(char*)*job->num_args);
+	processargs(job->num_args+1, argv);
+    }
+    filename = job->input;
+    if(job->output)
+	outputname = job->output;
+    if(max_time)
+	alarm(max_time);
+
+    /* pass the parameters of this job to the PDF driver */
+    parameter_t*p = device_config;
+    while(p) {
+	driver->setparameter(driver, p->name, p->value);
+	p = p->next;
+    }
+    for(t=old_fontpathpos;t<fontpathpos;t++) {
+	driver->setparameter(driver, "fontdir", fontpaths[t]);
+    }
+
+    /* don't destroy the driver- that would delete the standard fonts
+       the daemon wrote out */
+    exit(convert());
+}
+
+static void daemon_job(const char*line, FILE*fi, FILE*fo)
+{
+    job_t job;
+    double wall1, wall2, cpu;
+    struct rusage usage;
+    int status = 0;
+    int logbuffer = getLogBuffer();
+    pid_t pid;
+
+    if(!job_parse(line, &job)) {
+	fprintf(fo, "{\"status\": \"error\", \"message\": \"invalid job\"}\n");
+	fflush(fo);
+	job_free(&job);
+	return;
+    }
+
+    /* the logging thread doesn't survive fork() */
+    setLogBuffer(0);
+    fflush(stdout);
+    fflush(stderr);
+    stats_now(&wall1, &cpu);
+    pid = fork();
+    if(!pid)
+	job_run(&job, fileno(fi), logbuffer);
+    if(pid<0) {
+	fprintf(fo, "{\"input\": ");
+	json_write_string(fo, job.input);
+	fprintf(fo, ", \"status\": \"error\", \"message\": \"fork failed\"}\n");
+	fflush(fo);
+	setLogBuffer(logbuffer);
+	job_free(&job);
+	return;
+    }
+    memset(&usage, 0, sizeof(usage));
+    while(wait4(pid, &status, 0, &usage)<0 && errno==EINTR);
+    stats_now(&wall2, &cpu);
+    setLogBuffer(logbuffer);
+
+    fprintf(fo, "{\"input\": ");
+    json_write_string(fo, job.input);
+    if(job.output) {
+	fprintf(fo, ", \"output\": ");
+	json_write_string(fo, job.output);
+    }
+    if(WIFEXITED(status)) {
+	fprintf(fo, ", \"status\": \"%s\", \"exitcode\": %d",
+		WEXITSTATUS(status)?"failed":"ok", WEXITSTATUS(status));
+    } else {
+	fprintf(fo, ", \"status\": \"killed\", \"signal\": %d",
+		WIFSIGNALED(status)?WTERMSIG(status):0);
+    }
+    fprintf(fo, ", \"wall\": %.6f, \"cpu\": %.6f, \"maxrss\": %ld}\n",
+	    wall2-wall1,
+	    usage.ru_utime.tv_sec + usage.ru_utime.tv_usec/1000000.0 +
+	    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec/1000000.0,
+	    (long)usage.ru_maxrss);
+    fflush(fo);
+    job_free(&job);
+}
+
+static void daemon_serve(FILE*fi, FILE*fo)
+{
+    char*line = 0;
+    size_t size = 0;
+    while(!daemon_stop && getline(&line, &size, fi) >= 0) {
+	if(!*json_space(line))
+	    continue;
+	daemon_job(line, fi, fo);
+    }
+    free(line);
+}
+
+static int run_daemon(const char*socketname)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = daemon_sigterm; // no SA_RESTART, so that accept() returns
+    sigaction(SIGTERM, &action, 0);
+    sigaction(SIGINT, &action, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* -Q applies to the jobs, not to the daemon */
+    alarm(0);
+
+    driver->setparameter(driver, "preloadfonts", "1");
+
+    if(!strcmp(socketname, "-")) {
+	daemon_serve(stdin, stdout);
+	return 0;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(socketname) >= sizeof(addr.sun_path)) {
+	msg("<fatal> Socket name too long: %s", socketname);
+	return 1;
+    }
+    strcpy(addr.sun_path, socketname);
+
+    /* remove the socket of a previous run */
+    struct stat st;
+    if(!stat(socketname, &st) && S_ISSOCK(st.st_mode))
+	unlink(socketname);
+
+    daemon_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(daemon_listen<0 ||
+       bind(daemon_listen, (struct sockaddr*)&addr, sizeof(addr))<0 ||
+       listen(daemon_listen, 16)<0) {
+	perror(socketname);
+	return 1;
+    }
+    msg("<notice> Waiting for jobs on %s", socketname);
+
+    while(!daemon_stop) {
+	int c = accept(daemon_listen, 0, 0);
+	if(c<0) {
+	    if(errno==EINTR)
+		continue;
+	    perror("accept");
+	    break;
+	}
+	FILE*fi = fdopen(c, "rb");
+	FILE*fo = fdopen(dup(c), "wb");
+	daemon_serve(fi, fo);
+	fclose(fi);
+	fclose(fo);
+    }
+    close(daemon_listen);
+    daemon_listen = -1;
+    unlink(socketname);
+    return 0;
+}
+#endif
+
+int main(int argn, char *argv[])
+{
+    int ret;
+    int t;
+    
+    initLog(0,-1,0,0,-1,loglevel);
+
+    /* not needed anymore since fonts are embedded
+       if(installPath) {
+	fontpaths[fontpathpos++] = concatPaths(installPath, "fonts");
+    }*/
+
+#ifdef HAVE_SRAND48
+    srand48(time(0)*getpid());
+#else
+#ifdef HAVE_SRAND
+    srand(time(0)*getpid());
+#endif
+#endif
+
+    processargs(argn, argv);
+    
+    driver = gfxsource_pdf_create();
+    
+    /* pass global parameters to PDF driver*/
+    parameter_t*p = device_config;
+    while(p) {
+	driver->setparameter(driver, p->name, p->value);
+	p = p->next;
+    }
+
+    /* add fonts */
+    for(t=0;t<fontpathpos;t++) {
+	driver->setparameter(driver, "fontdir", fontpaths[t]);
+    }
+
+#ifndef WIN32
+    if(daemon_socket)
+	ret = run_daemon(daemon_socket);
+    else
+#endif
+	ret = convert();
+
     driver->destroy(driver);
 
    
@@ -922,6 +1458,6 @@ int main(int argn, char *argv[])
 	free(filters);
     }
 
-    return 0;
+    return ret;
 }
 
@@ -27,6 +27,9 @@
 #include "../lib/log.h"
 #include "../lib/jpeg.h"
 #include "../lib/png.h"
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #ifdef HAVE_ZLIB_H
 #ifdef HAVE_LIBZ
 #include "zlib.h"
@@ -48,6 +51,9 @@ char* extractmp3ids = 0;
 char* extractbinaryids = 0;
 char* extractanyids = 0;
 char extractmp3 = 0;
+char extractall = 0;
+int numjobs = 1;
+png_preset_t pngpreset = png_normal;
 
 char* extractname = 0;
 
@@ -78,6 +84,9 @@ struct options_t options[] =
  {"V","version"},
  {"b","binary"},
  {"O","outputformat"},
+ {"A","all"},
+ {"J","jobs"},
+ {"c","compression"},
  {0,0}
 };
 
@@ -181,6 +190,24 @@ int args_callback_option(char*name,char*val)
 	extractanyids = val;
 	return 1;
     }
+    else if(!strcmp(name, "A")) {
+	numextracts++;
+	extractall = 1;
+	return 0;
+    }
+    else if(!strcmp(name, "J")) {
+	numjobs = atoi(val);
+	if(numjobs<1)
+	    numjobs = 1;
+	return 1;
+    }
+    else if(!strcmp(name, "c")) {
+	if(!png_parse_preset(val, &pngpreset)) {
+	    fprintf(stderr, "Unknown compression preset: %s (use fast, normal or best)\n", val);
+	    exit(1);
+	}
+	return 1;
+    }
     else if(!strcmp(name, "f")) {
 	numextracts++;
 	extractframes = val;
@@ -234,11 +261,16 @@ void args_callback_usage(char*name)
 #ifdef _ZLIB_INCLUDED_
     printf("\t-p , --pngs ID\t\t\t Extract PNG picture(s)\n");
 #endif
+    printf("\t-c , --compression preset\t PNG compression: fast, normal or best (default: normal)\n");
     printf("\n");
     printf("Sound extraction:\n");
     printf("\t-m , --mp3\t\t\t Extract main mp3 stream\n");
     printf("\t-M , --embeddedmp3\t\t\t Extract embedded mp3 stream(s)\n");
     printf("\t-s , --sound ID\t\t\t Extract Sound(s)\n");
+    printf("\n");
+    printf("Bulk extraction:\n");
+    printf("\t-A , --all\t\t\t Extract all fonts, pictures, sounds and binaries, and list them\n");
+    printf("\t-J , --jobs N\t\t\t Use N threads for writing pictures, sounds and binaries\n");
 }
 int args_callback_command(char*name,char*val)
 {
@@ -267,6 +299,102 @@ void prepare_name(char *buf, size_t len, const char *prefix,
   }
 }
 
+/* names of the files written for each id (for the -A summary) */
+static char*extracted[65536];
+
+static void extracted_file(int id, const char*filename)
+{
+    if(extractall)
+	extracted[id&0xffff] = strdup(filename);
+}
+
+/* with -J, pictures, sounds and binaries are collected while walking
+   through the file, and then written by a pool of threads. Each job
+   only touches its own tag. */
+typedef struct _job {
+    TAG*tag;
+    int (*handler)(TAG*tag);
+} job_t;
+
+static job_t*jobs = 0;
+static int jobs_len = 0;
+static int jobs_size = 0;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* lib/jpeg.c and lib/png.c keep their state in static variables */
+static pthread_mutex_t codec_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int next_job = 0;
+#define lockCodecs() pthread_mutex_lock(&codec_mutex)
+#define unlockCodecs() pthread_mutex_unlock(&codec_mutex)
+#else
+#define lockCodecs()
+#define unlockCodecs()
+#endif
+
+static void dispatch(TAG*tag, int(*handler)(TAG*tag))
+{
+    /* only one output file? Then every object overwrites it, so keep
+       the order, and the last object wins, like it always did. With -O
+       or several kinds of objects, each object has a file of its own. */
+    if(numjobs<=1 || numextracts==1) {
+	handler(tag);
+	return;
+    }
+    if(jobs_len == jobs_size) {
+	jobs_size = jobs_size ? jobs_size*2 : 256;
+	jobs = (job_t*)realloc(jobs, sizeof(job_t)*jobs_size);
+    }
+    jobs[jobs_len].tag = tag;
+    jobs[jobs_len].handler = handler;
+    jobs_len++;
+}
+
+#ifdef HAVE_PTHREAD_H
+static void* worker(void*arg)
+{
+    while(1) {
+	pthread_mutex_lock(&jobs_mutex);
+	int j = next_job++;
+	pthread_mutex_unlock(&jobs_mutex);
+	if(j >= jobs_len)
+	    break;
+	jobs[j].handler(jobs[j].tag);
+    }
+    return 0;
+}
+#endif
+
+static void runjobs()
+{
+    int t;
+    if(!jobs_len)
+	return;
+    msg("<verbose> Writing %d objects using %d threads", jobs_len, numjobs);
+#ifdef HAVE_PTHREAD_H
+    pthread_t*threads = (pthread_t*)malloc(sizeof(pthread_t)*numjobs);
+    int started = 0;
+    for(t=0;t<numjobs;t++) {
+	if(pthread_create(&threads[started], 0, worker, 0))
+	    break;
+	started++;
+    }
+    if(!started) {
+	worker(0);
+    }
+    for(t=0;t<started;t++) {
+	pthread_join(threads[t], 0);
+    }
+    free(threads);
+#else
+    for(t=0;t<jobs_len;t++) {
+	jobs[t].handler(jobs[t].tag);
+    }
+#endif
+    free(jobs);jobs = 0;
+    jobs_len = jobs_size = 0;
+}
+
 U8 mainr,maing,mainb;
 /* 1 = used, not expanded,
    3 = used, expanded
@@ -668,6 +796,7 @@ int handlefont(SWF*swf, TAG*tag)
 
     swf_WriteFont(f, filename);
     swf_FontFree(f);
+    extracted_file(id, filename);
     return 1;
 }
 
@@ -784,7 +913,9 @@ int handlejpeg(TAG*tag)
 	}
 	unsigned char*image;
 	unsigned width=0, height=0;
+	lockCodecs();
 	jpeg_load_from_mem(&tag->data[6], end-6, &image, &width, &height);
+	unlockCodecs();
 
 	uLongf datalen = width*height;
 	Bytef *data = malloc(datalen);
@@ -799,7 +930,9 @@ int handlejpeg(TAG*tag)
 	    image[t*4+0] = data[t];
 	}
 	free(data);
-	png_write(filename, image, width, height);
+	lockCodecs();
+	png_write_preset(filename, image, width, height, pngpreset);
+	unlockCodecs();
 	free(image);
     }
     else {
@@ -810,12 +943,11 @@ int handlejpeg(TAG*tag)
         }
 	return 0;
     }
+    extracted_file(GET16(tag->data), filename);
     return 1;
 }
 
 #ifdef _ZLIB_INCLUDED_
-static U32 mycrc32;
-
 static U32*crc32_table = 0;
 static void make_crc32_table(void)
 {
@@ -833,39 +965,41 @@ static void make_crc32_table(void)
     crc32_table[t] = c;
   }
 }
-static inline void png_write_byte(FILE*fi, U8 byte)
+/* the checksum of the current chunk is passed around, so that
+   several pngs can be written at the same time */
+static inline void png_write_byte(FILE*fi, U32*crc, U8 byte)
 {
     fwrite(&byte,1,1,fi);
-    mycrc32 = crc32_table[(mycrc32 ^ byte) & 0xff] ^ (mycrc32 >> 8);
+    *crc = crc32_table[(*crc ^ byte) & 0xff] ^ (*crc >> 8);
 }
-static void png_start_chunk(FILE*fi, char*type, int len)
+static void png_start_chunk(FILE*fi, U32*crc, char*type, int len)
 {
     U8 mytype[4]={0,0,0,0};
     U32 mylen = BE_32_TO_NATIVE(len);
     memcpy(mytype,type,strlen(type));
     fwrite(&mylen, 4, 1, fi);
-    mycrc32=0xffffffff;
-    png_write_byte(fi,mytype[0]);
-    png_write_byte(fi,mytype[1]);
-    png_write_byte(fi,mytype[2]);
-    png_write_byte(fi,mytype[3]);
+    *crc=0xffffffff;
+    png_write_byte(fi,crc,mytype[0]);
+    png_write_byte(fi,crc,mytype[1]);
+    png_write_byte(fi,crc,mytype[2]);
+    png_write_byte(fi,crc,mytype[3]);
 }
-static void png_write_bytes(FILE*fi, U8*bytes, int len)
+static void png_write_bytes(FILE*fi, U32*crc, U8*bytes, int len)
 {
     int t;
     for(t=0;t<len;t++)
-	png_write_byte(fi,bytes[t]);
+	png_write_byte(fi,crc,bytes[t]);
 }
-static void png_write_dword(FILE*fi, U32 dword)
+static void png_write_dword(FILE*fi, U32*crc, U32 dword)
 {
-    png_write_byte(fi,dword>>24);
-    png_write_byte(fi,dword>>16);
-    png_write_byte(fi,dword>>8);
-    png_write_byte(fi,dword);
+    png_write_byte(fi,crc,dword>>24);
+    png_write_byte(fi,crc,dword>>16);
+    png_write_byte(fi,crc,dword>>8);
+    png_write_byte(fi,crc,dword);
 }
-static void png_end_chunk(FILE*fi)
+static void png_end_chunk(FILE*fi, U32*crc)
 {
-    U32 tmp = BE_32_TO_NATIVE((mycrc32^0xffffffff));
+    U32 tmp = BE_32_TO_NATIVE((*crc^0xffffffff));
     fwrite(&tmp,4,1,fi);
 }
 
@@ -880,7 +1014,7 @@ int handlelossless(TAG*tag)
     char*filename = name;
     FILE*fi;
     int width, height;
-    int crc;
+    U32 crc;
     int id;
     int t;
     U8 bpp = 1;
@@ -975,40 +1109,40 @@ int handlelossless(TAG*tag)
     fi = save_fopen(filename, "wb");
     fwrite(head,sizeof(head),1,fi);     
 
-    png_start_chunk(fi, "IHDR", 13);
-     png_write_dword(fi,width);
-     png_write_dword(fi,height);
-     png_write_byte(fi,8);
+    png_start_chunk(fi,&crc, "IHDR", 13);
+     png_write_dword(fi,&crc,width);
+     png_write_dword(fi,&crc,height);
+     png_write_byte(fi,&crc,8);
      if(format == 3)
-     png_write_byte(fi,3); //indexed
+     png_write_byte(fi,&crc,3); //indexed
      else if(format == 5 && alpha==0)
-     png_write_byte(fi,2); //rgb
+     png_write_byte(fi,&crc,2); //rgb
      else if(format == 5 && alpha==1)
-     png_write_byte(fi,6); //rgba
+     png_write_byte(fi,&crc,6); //rgba
      else return 0;
 
-     png_write_byte(fi,0); //compression mode
-     png_write_byte(fi,0); //filter mode
-     png_write_byte(fi,0); //interlace mode
-    png_end_chunk(fi);
+     png_write_byte(fi,&crc,0); //compression mode
+     png_write_byte(fi,&crc,0); //filter mode
+     png_write_byte(fi,&crc,0); //interlace mode
+    png_end_chunk(fi,&crc);
    
     if(format == 3) {
-	png_start_chunk(fi, "PLTE", 768);
+	png_start_chunk(fi,&crc, "PLTE", 768);
 	 
 	 for(t=0;t<256;t++) {
-	     png_write_byte(fi,palette[t].r);
-	     png_write_byte(fi,palette[t].g);
-	     png_write_byte(fi,palette[t].b);
+	     png_write_byte(fi,&crc,palette[t].r);
+	     png_write_byte(fi,&crc,palette[t].g);
+	     png_write_byte(fi,&crc,palette[t].b);
 	 }
-	png_end_chunk(fi);
+	png_end_chunk(fi,&crc);
 
 	if(alpha) {
 	    /* write alpha palette */
-	    png_start_chunk(fi, "tRNS", 256);
+	    png_start_chunk(fi,&crc, "tRNS", 256);
 	    for(t=0;t<256;t++) {
-		png_write_byte(fi,palette[t].a);
+		png_write_byte(fi,&crc,palette[t].a);
 	    }
-	    png_end_chunk(fi);
+	    png_end_chunk(fi,&crc);
 	}
     }
     {
@@ -1049,16 +1183,24 @@ int handlelossless(TAG*tag)
 	datalen3=pos2;
     }
 
-    if(compress (data2, &datalen2, data3, datalen3) != Z_OK) {
+    int level = Z_DEFAULT_COMPRESSION;
+    if(pngpreset == png_fast)
+	level = Z_BEST_SPEED;
+    else if(pngpreset == png_best)
+	level = Z_BEST_COMPRESSION;
+    if(compress2 (data2, &datalen2, data3, datalen3, level) != Z_OK) {
 	fprintf(stderr, "zlib error in pic %d\n", id);
 	return 0;
     }
     msg("<verbose> Compressed data is %d bytes", datalen2);
-    png_start_chunk(fi, "IDAT", datalen2);
-    png_write_bytes(fi,data2,datalen2);
-    png_end_chunk(fi);
-    png_start_chunk(fi, "IEND", 0);
-    png_end_chunk(fi);
+    png_start_chunk(fi,&crc, "IDAT", datalen2);
+    png_write_bytes(fi,&crc,data2,datalen2);
+    png_end_chunk(fi,&crc);
+    png_start_chunk(fi,&crc, "IEND", 0);
+    png_end_chunk(fi,&crc);
+
+    fclose(fi);
+    extracted_file(id, filename);
 
     free(data);
     free(data2);
@@ -1149,6 +1291,7 @@ int handledefinesound(TAG*tag)
     fi = save_fopen(filename, "wb");
     fwrite(&tag->data[tag->pos], tag->len - tag->pos, 1, fi);
     fclose(fi);
+    extracted_file(id, filename);
     return 1;
 }
 
@@ -1173,9 +1316,10 @@ int handlebinary(TAG*tag) {
 	    filename = buf;
 	}
     }
-    fout = fopen(filename, "wb");
+    fout = save_fopen(filename, "wb");
     fwrite(tag->data+dx,len-dx,1,fout);
     fclose(fout);
+    extracted_file(GET16(tag->data), filename);
     return 1;
 }
 
@@ -1212,6 +1356,37 @@ int handleembeddedmp3(TAG*tag) {
     return 1;
 }
 
+/* the chain of handlers used for -a, minus the fonts (which
+   are extracted while walking through the file) */
+int handleany(TAG*tag)
+{
+    if (handlejpeg(tag)) {
+	// pass
+    } else if (handlebinary(tag)) {
+	// pass
+#ifdef _ZLIB_INCLUDED_
+    } else if (handlelossless(tag)) {
+	// pass
+#endif
+    } else if (handledefinesound(tag)) {
+	// Not sure if sound code checks carefully for type.
+	// pass
+    } else if (handleembeddedmp3(tag)) {
+	// pass
+    } else {
+	printf("#%d not processed\n", swf_GetDefineID(tag));
+	return 0;
+    }
+    return 1;
+}
+
+/* tags handleany() writes out without touching anything but the tag
+   itself (unlike sprites, which handleembeddedmp3 unfolds) */
+static char is_standalone_object(TAG*tag)
+{
+    return swf_isImageTag(tag) || tag->id == ST_DEFINESOUND || tag->id == ST_DEFINEBINARY;
+}
+
 int main (int argc,char ** argv)
 { 
     TAG*tag;
@@ -1226,8 +1401,15 @@ int main (int argc,char ** argv)
 
     if(!extractframes && !extractids && ! extractname && !extractjpegids && !extractpngids
 	&& !extractmp3 && !extractsoundids && !extractfontids && !extractbinaryids 
-        && !extractanyids && !extractmp3ids)
+        && !extractanyids && !extractmp3ids && !extractall)
 	listavailable = 1;
+    if(extractall || outputformat) {
+	/* always write one file per object */
+	numextracts = -1;
+    }
+    if(numjobs>1 && numextracts==1) {
+	fprintf(stderr, "Warning: all objects go into one output file, so -J is ignored. Use -O to write one file per object.\n");
+    }
 
     if(!originalplaceobjects && movetozero) {
 	fprintf(stderr, "Error: -0 (--movetozero) can only be used in conjunction with -P (--placeobject)\n");
@@ -1326,40 +1508,44 @@ int main (int argc,char ** argv)
 		handlefont(&swf, tag);
 	    }
 	    if(extractjpegids && is_in_range(id, extractjpegids)) {
-		handlejpeg(tag);
+		dispatch(tag, handlejpeg);
 	    }
 	    if(extractsoundids && is_in_range(id, extractsoundids)) {
-		handledefinesound(tag);
+		dispatch(tag, handledefinesound);
 	    }
 	    if(extractmp3ids && is_in_range(id, extractmp3ids)) {
 		handleembeddedmp3(tag);
 	    }
 	    if(extractbinaryids && is_in_range(id, extractbinaryids)) {
-		handlebinary(tag);
+		dispatch(tag, handlebinary);
 	    }
 #ifdef _ZLIB_INCLUDED_
 	    if(extractpngids && is_in_range(id, extractpngids)) {
-		handlelossless(tag);
+		dispatch(tag, handlelossless);
 	    }
 #endif
-	    if(extractanyids && is_in_range(id, extractanyids)) {
-	        if (handlefont(&swf,tag)) {
-		    // pass
-		} else if (handlejpeg(tag)) {
-		    // pass
-		} else if (handlebinary(tag)) {
-		    // pass
+	    if(extractall) {
+		if(swf_isFontTag(tag)) {
+		    handlefont(&swf, tag);
 #ifdef _ZLIB_INCLUDED_
-		} else if (handlelossless(tag)) {
-		    // pass
+		} else if(tag->id == ST_DEFINEBITSLOSSLESS || tag->id == ST_DEFINEBITSLOSSLESS2) {
+		    dispatch(tag, handlelossless);
 #endif
-		} else if (handledefinesound(tag)) {
-		    // Not sure if sound code checks carefully for type.
-		    // pass
-		} else if (handleembeddedmp3(tag)) {
+		} else if(swf_isImageTag(tag)) {
+		    dispatch(tag, handlejpeg);
+		} else if(tag->id == ST_DEFINESOUND) {
+		    dispatch(tag, handledefinesound);
+		} else if(tag->id == ST_DEFINEBINARY) {
+		    dispatch(tag, handlebinary);
+		}
+	    }
+	    if(extractanyids && is_in_range(id, extractanyids)) {
+	        if (handlefont(&swf,tag)) {
 		    // pass
+		} else if (is_standalone_object(tag)) {
+		    dispatch(tag, handleany);
 		} else {
-		    printf("#%d not processed\n", id);
+		    handleany(tag);
 		}
 	    }
 	}
@@ -1398,6 +1584,22 @@ int main (int argc,char ** argv)
 	tag = tag->next;
 	tagnum ++;
     }
+#ifdef _ZLIB_INCLUDED_
+    /* the png writers on the worker threads all share this table */
+    make_crc32_table();
+#endif
+    runjobs();
+
+    if(extractall) {
+	int t;
+	for(t=0;t<65536;t++) {
+	    if(extracted[t]) {
+		printf("%5d %s\n", t, extracted[t]);
+		free(extracted[t]);
+	    }
+	}
+    }
+
     if (found)
 	extractTag(&swf, destfilename);
 
@@ -11,6 +11,8 @@
 #include "../lib/readers/swf.h"
 #include "../lib/devices/render.h"
 #include "../lib/devices/rescale.h"
+#include "../lib/devices/stats.h"
+#include "../lib/stats.h"
 
 static struct options_t options[] = {
 {"h", "help"},
@@ -21,6 +23,8 @@ static struct options_t options[] = {
 {"V", "version"},
 {"X", "width"},
 {"Y", "height"},
+{"T", "stats"},
+{"c", "compression"},
 {0,0}
 };
 
@@ -33,6 +37,8 @@ static char*pagerange = 0;
 static int width = 0;
 static int height = 0;
 static int resolution = 0;
+static char*statsfile = 0;
+static char*pngpreset = "best";
 
 typedef struct _parameter {
     const char*name;
@@ -88,6 +94,18 @@ int args_callback_option(char*name,char*val)
     } else if(!strcmp(name, "Y")) {
 	height = atoi(val);
 	return 1;
+    } else if(!strcmp(name, "T")) {
+	statsfile = val;
+	stats_enable(1);
+	return 1;
+    } else if(!strcmp(name, "c")) {
+	png_preset_t preset;
+	if(!png_parse_preset(val, &preset)) {
+	    fprintf(stderr, "Unknown compression preset: %s (use fast, normal or best)\n", val);
+	    exit(1);
+	}
+	pngpreset = val;
+	return 1;
     } else {
         printf("Unknown option: -%s\n", name);
 	exit(1);
@@ -111,6 +129,8 @@ void args_callback_usage(char *name)
     printf("-r , --resolution dpi          Scale width and height to a specific DPI resolution, assuming input is 1px per pt (default: 72)\n");
     printf("-X , --width width             Scale output to specific width (proportional unless height specified)\n");
     printf("-Y , --height height           Scale output to specific height (proportional unless width specified)\n");
+    printf("-T , --stats file              Write timings and counters for each rendering stage to file (as JSON, - for stdout)\n");
+    printf("-c , --compression preset      PNG compression: fast, normal or best (default: best)\n");
     printf("\n");
 }
 int args_callback_command(char*name,char*val)
@@ -161,8 +181,11 @@ int main(int argn, char*argv[])
         RGBA* img = swf_Render(&buf);
             if(quantize)
             png_write_palette_based_2(outputname, (unsigned char*)img, buf.width, buf.height);
-            else
-            png_write(outputname, (unsigned char*)img, buf.width, buf.height);
+            else {
+            png_preset_t preset = png_best;
+            png_parse_preset(pngpreset, &preset);
+            png_write_preset(outputname, (unsigned char*)img, buf.width, buf.height, preset);
+            }
         swf_Render_Delete(&buf);
     } else {
         parameter_t*p;
@@ -196,11 +219,17 @@ int main(int argn, char*argv[])
         for(t=1;t<=sizeof(to_output);t++) {
             if (to_output[t-1]) {
                 gfxdevice_t dev2,*dev=&dev2;
+                gfxdevice_t stats1,stats2;
                 gfxdevice_render_init(dev);
+                if(statsfile) {
+                    gfxdevice_stats_init(&stats1, dev, "render");
+                    dev = &stats1;
+                }
                     dev->setparameter(dev, "antialise", "4");
                     if(quantize) {
                         dev->setparameter(dev, "palette", "1");
                     }
+                    dev->setparameter(dev, "pngpreset", pngpreset);
                 if(width || height || resolution) {
                     double scale = 0.0;
                     if (resolution) {
@@ -208,16 +237,23 @@ int main(int argn, char*argv[])
                         scale = resolution / 72.0;
                     }
                     dev = gfxdevice_rescale_new(dev, width, height, scale);
+                    if(statsfile) {
+                        gfxdevice_stats_init(&stats2, dev, "output");
+                        dev = &stats2;
+                    }
                 }
                 for(p=params;p;p=p->next) {
                     dev->setparameter(dev, p->name, p->value);
                 }
 
+                stats_timer_t timer;
+                stats_timer_start(&timer, "page.render");
                 gfxpage_t* page = doc->getpage(doc, t);
                 dev->startpage(dev, page->width, page->height);
                 page->render(page, dev);
                 dev->endpage(dev);
                 page->destroy(page);
+                stats_timer_stop(&timer);
                 
                 gfxresult_t* result = dev->finish(dev);
                 if(result) {
@@ -233,10 +269,12 @@ int main(int argn, char*argv[])
                             sprintf(suffixed_outputname, "%s-%d", outputname, t);
                         }
                     }
+                    stats_timer_start(&timer, "page.save");
                     if(result->save(result, effective_outputname) < 0) {
                         fprintf(stderr,"Error writing page %d to %s\n", t, outputname);
                         exit(1);
                     }
+                    stats_timer_stop(&timer);
                     free(suffixed_outputname);
                     result->destroy(result);
                 }
@@ -244,6 +282,10 @@ int main(int argn, char*argv[])
         }
         doc->destroy(doc);
     }
+    if(statsfile) {
+        stats_save(statsfile);
+        stats_clear();
+    }
     return 0;
 }
 